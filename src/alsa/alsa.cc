@@ -21,20 +21,28 @@
  * Because ALSA is not thread-safe (despite claims to the contrary) we use non-
  * blocking output in the pump thread with the mutex locked, then unlock the
  * mutex and wait for more room in the buffer with poll() while other threads
- * lock the mutex and read the output time.  We poll a pipe of our own as well
- * as the ALSA file descriptors so that we can wake up the pump thread when
+ * lock the mutex and read the output time.  We poll an eventfd of our own as
+ * well as the ALSA file descriptors so that we can wake up the pump thread when
  * needed.
  *
- * When paused, or when it comes to the end of the data given it, the pump will
- * wait on alsa_cond for the signal to continue.  When it has more data waiting,
- * however, it will be sitting in poll() waiting for ALSA's signal that more
- * data can be written.
+ * Audio data is passed from the writing thread to the pump through a single-
+ * producer, single-consumer ring buffer.  The read and write positions are
+ * free-running byte counts kept on separate cache lines; only the writer
+ * advances write_pos and only the pump (or a control function, while the pump
+ * is stopped) advances read_pos.  Writing audio therefore never touches
+ * alsa_mutex, which now guards only the ALSA handle and the control state
+ * (prebuffer, pause, flush, drain).
  *
- * * After adding more data to the buffer, and after resuming from pause,
- *   signal on alsa_cond to wake the pump.  (There is no need to signal when
- *   entering pause.)
- * * After setting the pump_quit flag, signal on alsa_cond AND the poll_pipe
- *   before joining the thread.
+ * When paused, or when it comes to the end of the data given it, the pump sets
+ * pump_idle and sleeps on wake_fd alone.  When it has more data waiting, it
+ * sleeps in poll() on wake_fd and the ALSA descriptors.  The writing thread
+ * waits for room by sleeping on room_fd with writer_waiting set.
+ *
+ * * After adding more data to the buffer, signal wake_fd if pump_idle is set.
+ * * After resuming from pause or starting playback, signal wake_fd.
+ * * After consuming data, signal room_fd if writer_waiting is set.
+ * * After discarding the buffer, signal room_fd to interrupt a waiting writer.
+ * * After setting the pump_quit flag, signal wake_fd before joining the thread.
  */
 
 #include <assert.h>
@@ -44,6 +52,9 @@
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
 
 #include <glib.h>
 
@@ -77,14 +88,21 @@ static snd_pcm_format_t alsa_format;
 static int alsa_channels, alsa_rate;
 
 static void * alsa_buffer;
-static int alsa_buffer_length, alsa_buffer_data_start, alsa_buffer_data_length;
+static int alsa_buffer_length;
 static int alsa_period; /* milliseconds */
 
-static int64_t alsa_written; /* frames */
+static struct {
+    alignas (64) std::atomic<int64_t> read_pos; /* bytes, advanced by pump */
+    alignas (64) std::atomic<int64_t> write_pos; /* bytes, advanced by writer */
+    alignas (64) std::atomic<bool> pump_idle, writer_waiting;
+} ring;
+
+/* the frame count corresponding to read_pos == alsa_base_pos */
+static int64_t alsa_base_frames, alsa_base_pos;
 static char alsa_prebuffer, alsa_paused;
 static int alsa_paused_delay; /* frames */
 
-static int poll_pipe[2];
+static int wake_fd, room_fd;
 static int poll_count;
 static struct pollfd * poll_handles;
 
@@ -94,25 +112,29 @@ static pthread_t pump_thread;
 static snd_mixer_t * alsa_mixer;
 static snd_mixer_elem_t * alsa_mixer_element;
 
+static int ring_used (void)
+{
+    return ring.write_pos.load () - ring.read_pos.load ();
+}
+
 static char poll_setup (void)
 {
-    if (pipe (poll_pipe))
+    if ((wake_fd = eventfd (0, EFD_NONBLOCK)) < 0)
     {
-        ERROR ("Failed to create pipe: %s.\n", strerror (errno));
+        ERROR ("Failed to create eventfd: %s.\n", strerror (errno));
         return 0;
     }
 
-    if (fcntl (poll_pipe[0], F_SETFL, O_NONBLOCK))
+    if ((room_fd = eventfd (0, EFD_NONBLOCK)) < 0)
     {
-        ERROR ("Failed to set O_NONBLOCK on pipe: %s.\n", strerror (errno));
-        close (poll_pipe[0]);
-        close (poll_pipe[1]);
+        ERROR ("Failed to create eventfd: %s.\n", strerror (errno));
+        close (wake_fd);
         return 0;
     }
 
     poll_count = 1 + snd_pcm_poll_descriptors_count (alsa_handle);
     poll_handles = g_new (struct pollfd, poll_count);
-    poll_handles[0].fd = poll_pipe[0];
+    poll_handles[0].fd = wake_fd;
     poll_handles[0].events = POLLIN;
     poll_count = 1 + snd_pcm_poll_descriptors (alsa_handle, poll_handles + 1,
      poll_count - 1);
@@ -120,33 +142,64 @@ static char poll_setup (void)
     return 1;
 }
 
-static void poll_sleep (void)
+static void event_clear (int fd)
+{
+    eventfd_t value;
+    eventfd_read (fd, & value);
+}
+
+static void event_signal (int fd)
 {
-    if (poll (poll_handles, poll_count, -1) < 0)
+    if (eventfd_write (fd, 1) < 0)
+        ERROR ("Failed to write to eventfd: %s.\n", strerror (errno));
+}
+
+/* with_pcm = 0 sleeps until poll_wake() is called; otherwise we also wake up
+ * when ALSA has room for more data */
+static void poll_sleep (char with_pcm)
+{
+    if (poll (poll_handles, with_pcm ? poll_count : 1, -1) < 0)
     {
         ERROR ("Failed to poll: %s.\n", strerror (errno));
         return;
     }
 
     if (poll_handles[0].revents & POLLIN)
+        event_clear (wake_fd);
+}
+
+static void poll_wake (void)
+{
+    event_signal (wake_fd);
+}
+
+/* Called from the writing thread.  Sleeps until the pump has consumed data
+ * past read_pos or until the buffer is discarded. */
+static void room_wait (int64_t read_pos)
+{
+    ring.writer_waiting.store (true);
+
+    if (ring.read_pos.load () == read_pos)
     {
-        char c;
-        while (read (poll_pipe[0], & c, 1) == 1)
-            ;
+        struct pollfd handle = {room_fd, POLLIN, 0};
+
+        if (poll (& handle, 1, -1) < 0)
+            ERROR ("Failed to poll: %s.\n", strerror (errno));
     }
+
+    event_clear (room_fd);
+    ring.writer_waiting.store (false);
 }
 
-static void poll_wake (void)
+static void room_wake (void)
 {
-    const char c = 0;
-    if (write (poll_pipe[1], & c, 1) < 0)
-        ERROR ("Failed to write to pipe: %s.\n", strerror (errno));
+    event_signal (room_fd);
 }
 
 static void poll_cleanup (void)
 {
-    close (poll_pipe[0]);
-    close (poll_pipe[1]);
+    close (wake_fd);
+    close (room_fd);
     g_free (poll_handles);
 }
 
@@ -162,9 +215,20 @@ static void * pump (void * unused)
     while (! pump_quit)
     {
         if (alsa_prebuffer || alsa_paused || ! snd_pcm_bytes_to_frames
-         (alsa_handle, alsa_buffer_data_length))
+         (alsa_handle, ring_used ()))
         {
-            pthread_cond_wait (& alsa_cond, & alsa_mutex);
+            /* either we see new data here or the writer sees pump_idle */
+            ring.pump_idle.store (true);
+
+            if (alsa_prebuffer || alsa_paused || ! snd_pcm_bytes_to_frames
+             (alsa_handle, ring_used ()))
+            {
+                pthread_mutex_unlock (& alsa_mutex);
+                poll_sleep (0);
+                pthread_mutex_lock (& alsa_mutex);
+            }
+
+            ring.pump_idle.store (false);
             continue;
         }
 
@@ -176,30 +240,32 @@ static void * pump (void * unused)
 
         slept = 0;
 
-        length = snd_pcm_frames_to_bytes (alsa_handle, length);
-        length = MIN (length, alsa_buffer_data_length);
-        length = MIN (length, alsa_buffer_length - alsa_buffer_data_start);
-        length = snd_pcm_bytes_to_frames (alsa_handle, length);
+        {
+            int64_t read_pos = ring.read_pos.load (std::memory_order_relaxed);
+            int start = read_pos % alsa_buffer_length;
 
-        int written;
-        CHECK_VAL_RECOVER (written, snd_pcm_writei, alsa_handle, (char *)
-         alsa_buffer + alsa_buffer_data_start, length);
+            length = snd_pcm_frames_to_bytes (alsa_handle, length);
+            length = MIN (length, ring_used ());
+            length = MIN (length, alsa_buffer_length - start);
+            length = snd_pcm_bytes_to_frames (alsa_handle, length);
 
-        failed = 0;
+            int written;
+            CHECK_VAL_RECOVER (written, snd_pcm_writei, alsa_handle, (char *)
+             alsa_buffer + start, length);
 
-        written = snd_pcm_frames_to_bytes (alsa_handle, written);
-        alsa_buffer_data_start += written;
-        alsa_buffer_data_length -= written;
+            failed = 0;
 
-        pthread_cond_broadcast (& alsa_cond); /* signal write complete */
+            written = snd_pcm_frames_to_bytes (alsa_handle, written);
+            ring.read_pos.store (read_pos + written);
 
-        if (alsa_buffer_data_start == alsa_buffer_length)
-        {
-            alsa_buffer_data_start = 0;
-            continue;
+            if (ring.writer_waiting.load ())
+                room_wake ();
+
+            if (start + written == alsa_buffer_length)
+                continue;
         }
 
-        if (! snd_pcm_bytes_to_frames (alsa_handle, alsa_buffer_data_length))
+        if (! snd_pcm_bytes_to_frames (alsa_handle, ring_used ()))
             continue;
 
     WAIT:
@@ -218,7 +284,7 @@ static void * pump (void * unused)
         }
         else
         {
-            poll_sleep ();
+            poll_sleep (1);
             slept ++;
         }
 
@@ -248,7 +314,6 @@ static void pump_stop (void)
 {
     AUDDBG ("Stopping pump.\n");
     pump_quit = 1;
-    pthread_cond_broadcast (& alsa_cond);
     poll_wake ();
     pthread_mutex_unlock (& alsa_mutex);
     pthread_join (pump_thread, NULL);
@@ -256,6 +321,18 @@ static void pump_stop (void)
     pump_quit = 0;
 }
 
+/* call only with the pump stopped */
+static void discard_buffer (int64_t frames)
+{
+    int64_t pos = ring.write_pos.load ();
+
+    ring.read_pos.store (pos);
+    alsa_base_frames = frames;
+    alsa_base_pos = pos;
+
+    room_wake (); /* interrupt period wait */
+}
+
 static void start_playback (void)
 {
     AUDDBG ("Starting playback.\n");
@@ -263,7 +340,7 @@ static void start_playback (void)
 
 FAILED:
     alsa_prebuffer = 0;
-    pthread_cond_broadcast (& alsa_cond);
+    poll_wake ();
 }
 
 static int get_delay (void)
@@ -378,10 +455,13 @@ int alsa_open_audio (int aud_format, int rate, int channels)
     alsa_buffer_length = snd_pcm_frames_to_bytes (alsa_handle, (int64_t)
      soft_buffer * rate / 1000);
     alsa_buffer = g_malloc (alsa_buffer_length);
-    alsa_buffer_data_start = 0;
-    alsa_buffer_data_length = 0;
+    ring.read_pos.store (0);
+    ring.write_pos.store (0);
+    ring.pump_idle.store (false);
+    ring.writer_waiting.store (false);
 
-    alsa_written = 0;
+    alsa_base_frames = 0;
+    alsa_base_pos = 0;
     alsa_prebuffer = 1;
     alsa_paused = 0;
     alsa_paused_delay = 0;
@@ -426,20 +506,15 @@ FAILED:
 
 int alsa_buffer_free (void)
 {
-    pthread_mutex_lock (& alsa_mutex);
-    int avail = alsa_buffer_length - alsa_buffer_data_length;
-    pthread_mutex_unlock (& alsa_mutex);
-    return avail;
+    return alsa_buffer_length - ring_used ();
 }
 
 void alsa_write_audio (void * data, int length)
 {
-    pthread_mutex_lock (& alsa_mutex);
-
-    int start = (alsa_buffer_data_start + alsa_buffer_data_length) %
-     alsa_buffer_length;
+    int64_t write_pos = ring.write_pos.load (std::memory_order_relaxed);
+    int start = write_pos % alsa_buffer_length;
 
-    assert (length <= alsa_buffer_length - alsa_buffer_data_length);
+    assert (length <= alsa_buffer_length - ring_used ());
 
     if (length > alsa_buffer_length - start)
     {
@@ -451,33 +526,31 @@ void alsa_write_audio (void * data, int length)
     else
         memcpy ((char *) alsa_buffer + start, data, length);
 
-    alsa_buffer_data_length += length;
-    alsa_written += snd_pcm_bytes_to_frames (alsa_handle, length);
+    /* either the pump sees the new data or we see that it is idle */
+    ring.write_pos.store (write_pos + length);
 
-    if (! alsa_paused)
-        pthread_cond_broadcast (& alsa_cond);
-
-    pthread_mutex_unlock (& alsa_mutex);
+    if (ring.pump_idle.load ())
+        poll_wake ();
 }
 
 void alsa_period_wait (void)
 {
-    pthread_mutex_lock (& alsa_mutex);
-
-    while (alsa_buffer_data_length == alsa_buffer_length)
+    while (1)
     {
-        if (! alsa_paused)
-        {
-            if (alsa_prebuffer)
-                start_playback ();
-            else
-                pthread_cond_broadcast (& alsa_cond);
-        }
+        int64_t read_pos = ring.read_pos.load ();
 
-        pthread_cond_wait (& alsa_cond, & alsa_mutex);
-    }
+        if (ring.write_pos.load () - read_pos < alsa_buffer_length)
+            break;
 
-    pthread_mutex_unlock (& alsa_mutex);
+        pthread_mutex_lock (& alsa_mutex);
+
+        if (! alsa_paused && alsa_prebuffer)
+            start_playback ();
+
+        pthread_mutex_unlock (& alsa_mutex);
+
+        room_wait (read_pos);
+    }
 }
 
 void alsa_drain (void)
@@ -490,8 +563,19 @@ void alsa_drain (void)
     if (alsa_prebuffer)
         start_playback ();
 
-    while (snd_pcm_bytes_to_frames (alsa_handle, alsa_buffer_data_length))
-        pthread_cond_wait (& alsa_cond, & alsa_mutex);
+    pthread_mutex_unlock (& alsa_mutex);
+
+    while (1)
+    {
+        int64_t read_pos = ring.read_pos.load ();
+
+        if (! snd_pcm_bytes_to_frames (alsa_handle, ring.write_pos.load () - read_pos))
+            break;
+
+        room_wait (read_pos);
+    }
+
+    pthread_mutex_lock (& alsa_mutex);
 
     pump_stop ();
 
@@ -516,7 +600,7 @@ void alsa_drain (void)
                 break;
 
             pthread_mutex_unlock (& alsa_mutex);
-            poll_sleep ();
+            poll_sleep (1);
             pthread_mutex_lock (& alsa_mutex);
         }
     }
@@ -532,8 +616,8 @@ int alsa_output_time (void)
 {
     pthread_mutex_lock (& alsa_mutex);
 
-    int64_t frames = alsa_written - snd_pcm_bytes_to_frames (alsa_handle,
-     alsa_buffer_data_length);
+    int64_t frames = alsa_base_frames + snd_pcm_bytes_to_frames (alsa_handle,
+     ring.read_pos.load () - alsa_base_pos);
 
     if (alsa_prebuffer || alsa_paused)
         frames -= alsa_paused_delay;
@@ -555,15 +639,11 @@ void alsa_flush (int time)
     CHECK (snd_pcm_drop, alsa_handle);
 
 FAILED:
-    alsa_buffer_data_start = 0;
-    alsa_buffer_data_length = 0;
+    discard_buffer ((int64_t) time * alsa_rate / 1000);
 
-    alsa_written = (int64_t) time * alsa_rate / 1000;
     alsa_prebuffer = 1;
     alsa_paused_delay = 0;
 
-    pthread_cond_broadcast (& alsa_cond); /* interrupt period wait */
-
     pump_start ();
 
     pthread_mutex_unlock (& alsa_mutex);
@@ -586,7 +666,7 @@ void alsa_pause (int pause)
 
 DONE:
     if (! pause)
-        pthread_cond_broadcast (& alsa_cond);
+        poll_wake ();
 
     pthread_mutex_unlock (& alsa_mutex);
     return;
@@ -0,0 +1,190 @@
+/*
+ * Dynamic Range Compression Plugin for Audacious
+ * Copyright 2010-2012 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Benchmark for the compressor and limiter modes.  A stereo tone whose level
+ * jumps every 100 ms, often above the ceiling, is run through each mode in a
+ * few block sizes.  Each run prints the throughput, the highest output peak,
+ * and the number of heap allocations made while processing after the first
+ * block.
+ *
+ * usage: compressor-bench [seconds] */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include <libaudcore/runtime.h>
+
+#include "../compressor.h"
+
+#define RATE 44100
+#define CHANNELS 2
+
+static const int block_sizes[] = {512, 2048, 8192}; /* frames */
+
+/* allocations are counted by wrapping the C library allocator */
+#ifdef __GLIBC__
+extern "C" {
+void * __libc_malloc (size_t size);
+void * __libc_calloc (size_t n, size_t size);
+void * __libc_realloc (void * ptr, size_t size);
+}
+
+static int allocations;
+
+extern "C" void * malloc (size_t size)
+{
+    __atomic_add_fetch (& allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc (size);
+}
+
+extern "C" void * calloc (size_t n, size_t size)
+{
+    __atomic_add_fetch (& allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc (n, size);
+}
+
+extern "C" void * realloc (void * ptr, size_t size)
+{
+    __atomic_add_fetch (& allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc (ptr, size);
+}
+
+static int get_allocations (void)
+{
+    return __atomic_load_n (& allocations, __ATOMIC_RELAXED);
+}
+#else
+static int get_allocations (void)
+{
+    return -1;
+}
+#endif
+
+/* stands in for the one in plugin.cc, which needs the rest of the plugin */
+void compressor_config_load (void)
+{
+    aud_set_double ("compressor", "center", 0.5);
+    aud_set_double ("compressor", "range", 0.5);
+    aud_set_double ("compressor", "limit", 1.0);
+}
+
+static double now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static float * make_signal (int frames)
+{
+    static const float levels[] = {0.1, 0.4, 0.9, 1.5, 3.0};
+
+    float * signal = g_new (float, CHANNELS * frames);
+    float level = levels[0];
+
+    for (int f = 0; f < frames; f ++)
+    {
+        if (! (f % (RATE / 10)))
+            level = levels[rand () % G_N_ELEMENTS (levels)];
+
+        float value = level * sinf (2 * G_PI * 440 * f / RATE);
+
+        for (int c = 0; c < CHANNELS; c ++)
+            signal[CHANNELS * f + c] = value;
+    }
+
+    return signal;
+}
+
+static void run (const char * name, int mode, int block, const float * signal, int frames)
+{
+    int channels = CHANNELS, rate = RATE;
+    float * buffer = g_new (float, CHANNELS * block);
+    float peak = 0;
+    int allocs = 0;
+    double elapsed = 0;
+
+    aud_set_int ("compressor", "mode", mode);
+    compressor_start (& channels, & rate);
+
+    for (int pos = 0; pos < frames; pos += block)
+    {
+        int samples = CHANNELS * MIN (block, frames - pos);
+        float * data = buffer;
+
+        memcpy (buffer, signal + CHANNELS * pos, sizeof (float) * samples);
+
+        int before = get_allocations ();
+        double start = now ();
+
+        if (pos + block < frames)
+            compressor_process (& data, & samples);
+        else
+            compressor_finish (& data, & samples);
+
+        elapsed += now () - start;
+
+        /* the first block sets up the buffers, and the last drains them */
+        if (pos && pos + block < frames)
+            allocs += get_allocations () - before;
+
+        for (int i = 0; i < samples; i ++)
+            peak = MAX (peak, fabsf (data[i]));
+    }
+
+    printf ("%-10s %4d-frame blocks  %7.1f Mframes/s  %6.0fx realtime  "
+     "peak %.3f  %d allocations\n", name, block, frames / elapsed / 1e6,
+     frames / elapsed / RATE, peak, allocs);
+
+    g_free (buffer);
+}
+
+int main (int argc, char * * argv)
+{
+    double seconds = (argc > 1) ? atof (argv[1]) : 300;
+
+    if (seconds <= 0)
+    {
+        fprintf (stderr, "usage: %s [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    compressor_init ();
+
+    int frames = (int) (seconds * RATE);
+    float * signal = make_signal (frames);
+
+    printf ("%g seconds of %d Hz stereo\n\n", seconds, RATE);
+
+    for (int block : block_sizes)
+    {
+        run ("compressor", MODE_COMPRESSOR, block, signal, frames);
+        run ("limiter", MODE_LIMITER, block, signal, frames);
+    }
+
+    compressor_cleanup ();
+    g_free (signal);
+
+    return 0;
+}
@@ -43,6 +43,8 @@ static int ring_at, buffer_filled, peaks_filled;
 static float current_peak;
 static int output_filled;
 static int current_channels, current_rate;
+static int current_mode;
+static float center, exponent;
 
 static void buffer_append (float * * data, int * length)
 {
@@ -55,8 +57,8 @@ static void buffer_append (float * * data, int * length)
     {
         int part = buffer_size - offset;
 
-        memcpy (buffer + offset, * data, part);
-        memcpy (buffer, (* data) + part, writable - part);
+        memcpy (buffer + offset, * data, sizeof (float) * part);
+        memcpy (buffer, (* data) + part, sizeof (float) * (writable - part));
     }
 
     buffer_filled += writable;
@@ -86,10 +88,8 @@ static float calc_peak (float * data, int length)
 
 static void do_ramp (float * data, int length, float peak_a, float peak_b)
 {
-    float center = aud_get_double ("compressor", "center");
-    float range = aud_get_double ("compressor", "range");
-    float a = powf (peak_a / center, range - 1);
-    float b = powf (peak_b / center, range - 1);
+    float a = powf (peak_a / center, exponent);
+    float b = powf (peak_b / center, exponent);
 
     for (int count = 0; count < length; count ++)
     {
@@ -132,6 +132,9 @@ static void do_compress (float * * data, int * samples, char finish)
 
     output_filled = 0;
 
+    center = aud_get_double ("compressor", "center");
+    exponent = aud_get_double ("compressor", "range") - 1;
+
     while (1)
     {
         buffer_append (data, samples);
@@ -206,6 +209,8 @@ void compressor_cleanup (void)
     g_free (buffer);
     g_free (output);
     g_free (peaks);
+
+    limiter_cleanup ();
 }
 
 void compressor_start (int * channels, int * rate)
@@ -217,26 +222,42 @@ void compressor_start (int * channels, int * rate)
 
     current_channels = * channels;
     current_rate = * rate;
+    current_mode = aud_get_int ("compressor", "mode");
+
+    if (current_mode == MODE_LIMITER)
+        limiter_start (current_channels, current_rate);
 
     reset ();
 }
 
 void compressor_process (float * * data, int * samples)
 {
-    do_compress (data, samples, 0);
+    if (current_mode == MODE_LIMITER)
+        limiter_process (data, samples);
+    else
+        do_compress (data, samples, 0);
 }
 
 void compressor_flush (void)
 {
-    reset ();
+    if (current_mode == MODE_LIMITER)
+        limiter_flush ();
+    else
+        reset ();
 }
 
 void compressor_finish (float * * data, int * samples)
 {
-    do_compress (data, samples, 1);
+    if (current_mode == MODE_LIMITER)
+        limiter_finish (data, samples);
+    else
+        do_compress (data, samples, 1);
 }
 
 int compressor_adjust_delay (int delay)
 {
+    if (current_mode == MODE_LIMITER)
+        return limiter_adjust_delay (delay);
+
     return delay + (int64_t) (buffer_filled / current_channels) * 1000 / current_rate;
 }
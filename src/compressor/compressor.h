@@ -17,6 +17,11 @@
  * the use of this software.
  */
 
+enum {
+    MODE_COMPRESSOR,
+    MODE_LIMITER
+};
+
 void compressor_config_load (void);
 
 int compressor_init (void);
@@ -26,3 +31,12 @@ void compressor_process (float * * data, int * samples);
 void compressor_flush (void);
 void compressor_finish (float * * data, int * samples);
 int compressor_adjust_delay (int delay);
+
+/* limiter.cc */
+
+void limiter_start (int channels, int rate);
+void limiter_cleanup (void);
+void limiter_process (float * * data, int * samples);
+void limiter_flush (void);
+void limiter_finish (float * * data, int * samples);
+int limiter_adjust_delay (int delay);
@@ -0,0 +1,267 @@
+/*
+ * Dynamic Range Compression Plugin for Audacious
+ * Copyright 2010-2012 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Look-ahead peak limiter.  The input is delayed by LOOKAHEAD_TIME, and the
+ * largest sample in the delay line (found with a monotonic deque, so each frame
+ * costs O(1) amortized) determines the gain.  The gain ramps down linearly so
+ * that it has reached the required level by the time the peak is output, and
+ * recovers exponentially afterwards.  Like the compressor, nothing is output
+ * after a start or flush until the delay line has filled, so that consecutive
+ * songs are joined without a gap. */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glib.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include <libaudcore/runtime.h>
+
+#include "compressor.h"
+
+#define LOOKAHEAD_TIME 0.005 /* seconds */
+#define RELEASE_TIME 0.1 /* seconds */
+#define BLOCK 256 /* frames */
+
+static int channels, rate;
+static int lookahead; /* frames */
+static float release;
+
+/* the last (up to) lookahead frames of input, followed by the current block */
+static float * history;
+static int history_filled; /* frames */
+static float * gains;
+static float * output;
+static int output_size;
+
+/* frames not yet dropped from the window, in order of decreasing peak */
+static int64_t * deque_pos;
+static float * deque_peak;
+static int deque_size, deque_head, deque_len;
+static int64_t frame_pos;
+
+static float gain, gain_step, gain_target;
+
+void limiter_start (int new_channels, int new_rate)
+{
+    limiter_cleanup ();
+
+    channels = new_channels;
+    rate = new_rate;
+    lookahead = MAX ((int) (rate * LOOKAHEAD_TIME), 1);
+    release = 1 - expf (-1 / (rate * (float) RELEASE_TIME));
+
+    history = g_new (float, channels * (lookahead + BLOCK));
+    gains = g_new (float, BLOCK);
+
+    /* the window holds lookahead + 1 frames, plus one about to drop out */
+    deque_size = lookahead + 2;
+    deque_pos = g_new (int64_t, deque_size);
+    deque_peak = g_new (float, deque_size);
+
+    limiter_flush ();
+}
+
+void limiter_cleanup (void)
+{
+    g_free (history);
+    g_free (gains);
+    g_free (output);
+    g_free (deque_pos);
+    g_free (deque_peak);
+
+    history = gains = output = deque_peak = NULL;
+    deque_pos = NULL;
+    output_size = 0;
+}
+
+void limiter_flush (void)
+{
+    history_filled = 0;
+
+    deque_head = deque_len = 0;
+    frame_pos = 0;
+
+    gain = 1;
+    gain_step = 0;
+    gain_target = 1;
+}
+
+static float frame_peak (const float * frame)
+{
+    float peak = 0;
+
+    for (int c = 0; c < channels; c ++)
+        peak = MAX (peak, fabsf (frame[c]));
+
+    return peak;
+}
+
+/* adds a frame to the window and returns the largest peak in the window */
+static float window_push (float peak)
+{
+    /* frames with smaller peaks can never be the maximum again */
+    while (deque_len && deque_peak[(deque_head + deque_len - 1) % deque_size] <= peak)
+        deque_len --;
+
+    int back = (deque_head + deque_len) % deque_size;
+    deque_pos[back] = frame_pos;
+    deque_peak[back] = peak;
+    deque_len ++;
+
+    if (deque_pos[deque_head] < frame_pos - lookahead)
+    {
+        deque_head = (deque_head + 1) % deque_size;
+        deque_len --;
+    }
+
+    frame_pos ++;
+
+    return deque_peak[deque_head];
+}
+
+static void update_gain (float needed)
+{
+    if (needed < (gain_step < 0 ? gain_target : gain))
+    {
+        /* steep enough to reach the new target by the time its peak is
+         * output, and still steep enough for any earlier peak */
+        gain_step = MIN (gain_step, (needed - gain) / (lookahead + 1));
+        gain_target = needed;
+    }
+
+    if (gain_step < 0)
+    {
+        gain += gain_step;
+
+        if (gain <= gain_target)
+        {
+            gain = gain_target;
+            gain_step = 0;
+        }
+    }
+    else if (needed > gain)
+        gain += (needed - gain) * release;
+}
+
+static void apply_gains (float * data, const float * src, int frames)
+{
+    int f = 0;
+
+#ifdef __SSE__
+    if (channels == 2)
+    {
+        for (; f + 2 <= frames; f += 2)
+        {
+            __m128 g = _mm_setr_ps (gains[f], gains[f], gains[f + 1], gains[f + 1]);
+            _mm_storeu_ps (data + 2 * f, _mm_mul_ps (_mm_loadu_ps (src + 2 * f), g));
+        }
+    }
+#endif
+
+    for (; f < frames; f ++)
+    {
+        for (int c = 0; c < channels; c ++)
+            data[channels * f + c] = src[channels * f + c] * gains[f];
+    }
+}
+
+/* Limits a block of audio; the output is delayed by the look-ahead, so it
+ * starts with the frames held back from earlier blocks.  It is written to out,
+ * which may be the same as in, and the number of frames output is returned. */
+static int limit_block (const float * in, float * out, int frames, float ceiling)
+{
+    float * block = history + channels * history_filled;
+    int skip = lookahead - history_filled; /* frames not yet output */
+    int out_frames = MAX (frames - skip, 0);
+
+    memcpy (block, in, sizeof (float) * channels * frames);
+
+    for (int f = 0; f < frames; f ++)
+    {
+        float peak = window_push (frame_peak (block + channels * f));
+        update_gain ((peak > ceiling) ? ceiling / peak : 1);
+
+        /* frame f completes the window of the frame lookahead earlier */
+        if (f >= skip)
+            gains[f - skip] = gain;
+    }
+
+    apply_gains (out, history, out_frames);
+
+    history_filled += frames - out_frames;
+    memmove (history, history + channels * out_frames,
+     sizeof (float) * channels * history_filled);
+
+    return out_frames;
+}
+
+/* returns the number of samples output */
+static int limit (float * data, int samples)
+{
+    float ceiling = aud_get_double ("compressor", "limit");
+    int frames = samples / channels;
+    int read = 0, written = 0;
+
+    while (read < frames)
+    {
+        int block = MIN (frames - read, BLOCK);
+
+        written += limit_block (data + channels * read, data + channels * written,
+         block, ceiling);
+        read += block;
+    }
+
+    return channels * written;
+}
+
+void limiter_process (float * * data, int * samples)
+{
+    * samples = limit (* data, * samples);
+}
+
+void limiter_finish (float * * data, int * samples)
+{
+    int total = * samples + channels * lookahead;
+
+    if (output_size < total)
+    {
+        output_size = total;
+        output = g_renew (float, output, output_size);
+    }
+
+    /* push silence through to drain the delay line; only the frames that were
+     * held back come out of it, not the silence itself */
+    memcpy (output, * data, sizeof (float) * (* samples));
+    memset (output + * samples, 0, sizeof (float) * channels * lookahead);
+
+    * samples = limit (output, total);
+    limiter_flush ();
+
+    * data = output;
+}
+
+int limiter_adjust_delay (int delay)
+{
+    return delay + (int64_t) history_filled * 1000 / rate;
+}
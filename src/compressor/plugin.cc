@@ -27,18 +27,31 @@
 /* What is a "normal" volume?  Replay Gain stuff claims to use 89 dB, but what
  * does that translate to in our PCM range?  Does anybody even know? */
 static const char * const compressor_defaults[] = {
+ "mode", "0", /* MODE_COMPRESSOR */
  "center", "0.5",
  "range", "0.5",
+ "limit", "1.0",
  NULL};
 
+static const ComboBoxElements mode_list[] = {
+ {"0", N_("Compressor")}, /* MODE_COMPRESSOR */
+ {"1", N_("Look-ahead limiter")}}; /* MODE_LIMITER */
+
 static const PreferencesWidget compressor_widgets[] = {
+    WidgetCombo (N_("Mode:"),
+        {VALUE_STRING, 0, "compressor", "mode"},
+        {mode_list, ARRAY_LEN (mode_list)}),
     WidgetLabel (N_("<b>Compression</b>")),
     WidgetSpin (N_("Center volume:"),
         {VALUE_FLOAT, 0, "compressor", "center"},
         {0.1, 1, 0.1}),
     WidgetSpin (N_("Dynamic range:"),
         {VALUE_FLOAT, 0, "compressor", "range"},
-        {0.0, 3.0, 0.1})
+        {0.0, 3.0, 0.1}),
+    WidgetLabel (N_("<b>Limiting</b>")),
+    WidgetSpin (N_("Peak limit:"),
+        {VALUE_FLOAT, 0, "compressor", "limit"},
+        {0.1, 1, 0.05})
 };
 
 static const PluginPreferences compressor_prefs = {
@@ -11,6 +11,7 @@
 #include <string.h>
 
 #include <libaudcore/audstrings.h>
+#include <libaudcore/index.h>
 #include <libaudcore/input.h>
 #include <libaudcore/plugin.h>
 
@@ -20,6 +21,7 @@
 
 static const int fade_threshold = 10 * 1000;
 static const int fade_length    = 8 * 1000;
+static const int snapshot_interval = 5 * 1000;
 
 static blargg_err_t log_err(blargg_err_t err)
 {
@@ -35,6 +37,107 @@ static void log_warning(Music_Emu * emu)
         fprintf (stderr, "console: %s\n", str);
 }
 
+/* Emulator states recorded during playback, so that a seek can resume from the
+ * closest earlier state instead of restarting the track and emulating all the
+ * way up to the target.  When the memory limit is reached, every other state
+ * is dropped and the interval between states doubles, so the states always
+ * cover the part of the track played so far. */
+class SnapshotList {
+public:
+    SnapshotList(Music_Emu* emu, int memory_mb);
+
+    // Records a state if one is due; call after each play()
+    void update();
+
+    // Seeks to msec, starting from a recorded state if that is faster
+    blargg_err_t seek(long msec);
+
+private:
+    Music_Emu* m_emu;
+    long m_size;              // bytes per state (0 = not supported)
+    int m_max_count;
+    long m_interval;          // msec between states
+    Index<long> m_times;      // in msec, ascending
+    Index<char> m_states;     // m_size bytes per entry in m_times
+
+    void thin_out();
+};
+
+SnapshotList::SnapshotList(Music_Emu* emu, int memory_mb) :
+    m_emu(emu),
+    m_size(emu->state_size()),
+    m_max_count(0),
+    m_interval(snapshot_interval)
+{
+    if (m_size > 0)
+        m_max_count = (int64_t) memory_mb * 1048576 / m_size;
+
+    /* need at least two states for thinning out to make room */
+    if (m_max_count < 2)
+        m_max_count = 0;
+}
+
+void SnapshotList::thin_out()
+{
+    int keep = (m_times.len() + 1) / 2;
+
+    for (int i = 1; i < keep; i ++)
+    {
+        m_times[i] = m_times[2 * i];
+        memcpy(& m_states[i * m_size], & m_states[2 * i * m_size], m_size);
+    }
+
+    m_times.remove(keep, m_times.len() - keep);
+    m_states.remove(keep * m_size, m_states.len() - keep * m_size);
+    m_interval *= 2;
+}
+
+void SnapshotList::update()
+{
+    if (!m_max_count)
+        return;
+
+    long time = m_emu->tell();
+    int count = m_times.len();
+    long next = count ? m_times[count - 1] + m_interval : m_interval;
+
+    if (time < next)
+        return;
+
+    if (count == m_max_count)
+    {
+        thin_out();
+        count = m_times.len();
+    }
+
+    m_states.insert(count * m_size, m_size);
+
+    if (log_err(m_emu->save_state(& m_states[count * m_size])))
+    {
+        m_states.remove(count * m_size, m_size);
+        m_max_count = 0;
+        return;
+    }
+
+    m_times.append(time);
+}
+
+blargg_err_t SnapshotList::seek(long msec)
+{
+    long now = m_emu->tell();
+
+    /* latest state at or before the target */
+    int i = m_times.len();
+    while (i > 0 && m_times[i - 1] > msec)
+        i --;
+
+    /* loading is only worth it if it saves emulating some part of the track */
+    if (i > 0 && (msec < now || m_times[i - 1] > now))
+        log_err(m_emu->load_state(& m_states[(i - 1) * m_size]));
+
+    return m_emu->seek(msec);
+}
+
 /* Handles URL parsing, file opening and identification, and file
  * loading. Keeps file header around when loading rest of file to
  * avoid seeking and re-reading.
@@ -273,18 +376,21 @@ bool_t console_play(const char *filename, VFSFile *file)
         length -= fade_length / 2;
     fh.m_emu->set_fade(length, fade_length);
 
+    SnapshotList snapshots(fh.m_emu, audcfg.snapshot_memory);
+
     while (!aud_input_check_stop())
     {
         /* Perform seek, if requested */
         int seek_value = aud_input_check_seek();
         if (seek_value >= 0)
-            fh.m_emu->seek(seek_value);
+            log_err(snapshots.seek(seek_value));
 
         /* Fill and play buffer of audio */
         int const buf_size = 1024;
         Music_Emu::sample_t buf[buf_size];
 
         fh.m_emu->play(buf_size, buf);
+        snapshots.update();
 
         aud_input_write_audio(buf, sizeof(buf));
 
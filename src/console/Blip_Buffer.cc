@@ -187,6 +187,36 @@ void Blip_Buffer::remove_samples( long count )
 	}
 }
 
+long Blip_Buffer::state_size() const
+{
+	return sizeof offset_ + sizeof reader_accum_ + sizeof modified_ +
+			(buffer_size_ + blip_buffer_extra_) * sizeof (buf_t_);
+}
+
+void Blip_Buffer::save_state( void* out ) const
+{
+	char* p = (char*) out;
+	memcpy( p, &offset_, sizeof offset_ );
+	p += sizeof offset_;
+	memcpy( p, &reader_accum_, sizeof reader_accum_ );
+	p += sizeof reader_accum_;
+	memcpy( p, &modified_, sizeof modified_ );
+	p += sizeof modified_;
+	memcpy( p, buffer_, (buffer_size_ + blip_buffer_extra_) * sizeof (buf_t_) );
+}
+
+void Blip_Buffer::load_state( void const* in )
+{
+	char const* p = (char const*) in;
+	memcpy( &offset_, p, sizeof offset_ );
+	p += sizeof offset_;
+	memcpy( &reader_accum_, p, sizeof reader_accum_ );
+	p += sizeof reader_accum_;
+	memcpy( &modified_, p, sizeof modified_ );
+	p += sizeof modified_;
+	memcpy( buffer_, p, (buffer_size_ + blip_buffer_extra_) * sizeof (buf_t_) );
+}
+
 // Blip_Synth_
 
 Blip_Synth_Fast_::Blip_Synth_Fast_()
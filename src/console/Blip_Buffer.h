@@ -83,6 +83,13 @@ public:
 	// Mix 'count' samples from 'buf' into buffer.
 	void mix_samples( blip_sample_t const* buf, long count );
 
+	// Save/load samples waiting to be read and those being synthesized in the
+	// current frame; state_size() bytes. Sample rate and length must not change
+	// in between.
+	long state_size() const;
+	void save_state( void* out ) const;
+	void load_state( void const* in );
+
 	// not documented yet
 	void set_modified() { modified_ = 1; }
 	int clear_modified() { int b = modified_; modified_ = 0; return b; }
@@ -79,6 +79,21 @@ void Classic_Emu::change_clock_rate( long rate )
 	buf->clock_rate( rate );
 }
 
+long Classic_Emu::buffer_state_size() const
+{
+	return buf->state_size();
+}
+
+void Classic_Emu::save_buffer_state( void* out ) const
+{
+	buf->save_state( out );
+}
+
+void Classic_Emu::load_buffer_state( void const* in )
+{
+	buf->load_state( in );
+}
+
 blargg_err_t Classic_Emu::setup_buffer( long rate )
 {
 	change_clock_rate( rate );
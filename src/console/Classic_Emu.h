@@ -21,6 +21,11 @@ protected:
 	long clock_rate() const { return clock_rate_; }
 	void change_clock_rate( long ); // experimental
 
+	// State of the output buffer, for derived emulators that support snapshots
+	long buffer_state_size() const;
+	void save_buffer_state( void* out ) const;
+	void load_buffer_state( void const* in );
+
 	// Overridable
 	virtual void set_voice( int index, Blip_Buffer* center,
 			Blip_Buffer* left, Blip_Buffer* right ) = 0;
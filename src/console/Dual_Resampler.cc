@@ -100,6 +100,31 @@ void Dual_Resampler::dual_play( long count, dsample_t* out, Blip_Buffer& blip_bu
 	}
 }
 
+long Dual_Resampler::dual_state_size() const
+{
+	return sizeof buf_pos + sample_buf.size() * sizeof (dsample_t) + resampler.state_size();
+}
+
+void Dual_Resampler::save_dual_state( void* out ) const
+{
+	char* p = (char*) out;
+	memcpy( p, &buf_pos, sizeof buf_pos );
+	p += sizeof buf_pos;
+	memcpy( p, sample_buf.begin(), sample_buf.size() * sizeof (dsample_t) );
+	p += sample_buf.size() * sizeof (dsample_t);
+	resampler.save_state( p );
+}
+
+void Dual_Resampler::load_dual_state( void const* in )
+{
+	char const* p = (char const*) in;
+	memcpy( &buf_pos, p, sizeof buf_pos );
+	p += sizeof buf_pos;
+	memcpy( sample_buf.begin(), p, sample_buf.size() * sizeof (dsample_t) );
+	p += sample_buf.size() * sizeof (dsample_t);
+	resampler.load_state( p );
+}
+
 void Dual_Resampler::mix_samples( Blip_Buffer& blip_buf, dsample_t* out )
 {
 	Blip_Reader sn;
@@ -21,6 +21,11 @@ public:
 
 	void dual_play( long count, dsample_t* out, Blip_Buffer& );
 
+	// Save/load samples buffered between frames; dual_state_size() bytes
+	long dual_state_size() const;
+	void save_dual_state( void* out ) const;
+	void load_dual_state( void const* in );
+
 protected:
 	virtual int play_frame( blip_time_t, int pcm_count, dsample_t* pcm_out ) = 0;
 private:
@@ -246,6 +246,78 @@ long Effects_Buffer::samples_avail() const
 	return bufs [0].samples_avail() * 2;
 }
 
+// State
+
+// Echo and reverb only carry over when effects are enabled
+struct effects_state_t
+{
+	long stereo_remain;
+	long effect_remain;
+	int reverb_pos;
+	int echo_pos;
+	bool effects_enabled;
+};
+
+long Effects_Buffer::state_size() const
+{
+	long size = sizeof (effects_state_t) + buf_count * bufs [0].state_size();
+	if ( config_.effects_enabled )
+		size += (echo_size + reverb_size) * sizeof (blip_sample_t);
+	return size;
+}
+
+void Effects_Buffer::save_state( void* out ) const
+{
+	effects_state_t s;
+	s.stereo_remain   = stereo_remain;
+	s.effect_remain   = effect_remain;
+	s.reverb_pos      = reverb_pos;
+	s.echo_pos        = echo_pos;
+	s.effects_enabled = effects_enabled;
+
+	char* p = (char*) out;
+	memcpy( p, &s, sizeof s );
+	p += sizeof s;
+	for ( int i = 0; i < buf_count; i++ )
+	{
+		bufs [i].save_state( p );
+		p += bufs [i].state_size();
+	}
+
+	if ( config_.effects_enabled )
+	{
+		memcpy( p, echo_buf.begin(), echo_size * sizeof (blip_sample_t) );
+		p += echo_size * sizeof (blip_sample_t);
+		memcpy( p, reverb_buf.begin(), reverb_size * sizeof (blip_sample_t) );
+	}
+}
+
+void Effects_Buffer::load_state( void const* in )
+{
+	char const* p = (char const*) in;
+	effects_state_t s;
+	memcpy( &s, p, sizeof s );
+	p += sizeof s;
+	stereo_remain   = s.stereo_remain;
+	effect_remain   = s.effect_remain;
+	reverb_pos      = s.reverb_pos;
+	echo_pos        = s.echo_pos;
+	effects_enabled = s.effects_enabled;
+
+	for ( int i = 0; i < buf_count; i++ )
+	{
+		bufs [i].load_state( p );
+		p += bufs [i].state_size();
+	}
+
+	if ( config_.effects_enabled )
+	{
+		memcpy( echo_buf.begin(), p, echo_size * sizeof (blip_sample_t) );
+		p += echo_size * sizeof (blip_sample_t);
+		memcpy( reverb_buf.begin(), p, reverb_size * sizeof (blip_sample_t) );
+	}
+}
+
 long Effects_Buffer::read_samples( blip_sample_t* out, long total_samples )
 {
 	require( total_samples % 2 == 0 ); // count must be even
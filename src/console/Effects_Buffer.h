@@ -48,6 +48,9 @@ public:
 	void end_frame( blip_time_t );
 	long read_samples( blip_sample_t*, long );
 	long samples_avail() const;
+	long state_size() const;
+	void save_state( void* ) const;
+	void load_state( void const* );
 private:
 	typedef long fixed_t;
 
@@ -197,3 +197,26 @@ int Fir_Resampler_::skip_input( long count )
 
 	return count;
 }
+
+long Fir_Resampler_::state_size() const
+{
+	return 2 * sizeof (int) + buf.size() * sizeof (sample_t);
+}
+
+void Fir_Resampler_::save_state( void* out ) const
+{
+	char* p = (char*) out;
+	int info [2] = { (int) (write_pos - buf.begin()), imp_phase };
+	memcpy( p, info, sizeof info );
+	memcpy( p + sizeof info, buf.begin(), buf.size() * sizeof (sample_t) );
+}
+
+void Fir_Resampler_::load_state( void const* in )
+{
+	char const* p = (char const*) in;
+	int info [2];
+	memcpy( info, p, sizeof info );
+	write_pos = buf.begin() + info [0];
+	imp_phase = info [1];
+	memcpy( buf.begin(), p + sizeof info, buf.size() * sizeof (sample_t) );
+}
@@ -45,6 +45,11 @@ public:
 	// Skip 'count' input samples. Returns number of samples actually skipped.
 	int skip_input( long count );
 
+	// Save/load buffered input and phase; state_size() bytes
+	long state_size() const;
+	void save_state( void* out ) const;
+	void load_state( void const* in );
+
 // Output
 
 	// Number of extra input samples needed until 'count' output samples are available
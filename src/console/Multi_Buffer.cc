@@ -2,6 +2,8 @@
 
 #include "Multi_Buffer.h"
 
+#include <string.h>
+
 /* Copyright (C) 2003-2006 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -93,6 +95,39 @@ void Stereo_Buffer::clear()
 		bufs [i].clear();
 }
 
+long Stereo_Buffer::state_size() const
+{
+	return sizeof stereo_added + sizeof was_stereo + buf_count * bufs [0].state_size();
+}
+
+void Stereo_Buffer::save_state( void* out ) const
+{
+	char* p = (char*) out;
+	memcpy( p, &stereo_added, sizeof stereo_added );
+	p += sizeof stereo_added;
+	memcpy( p, &was_stereo, sizeof was_stereo );
+	p += sizeof was_stereo;
+	for ( int i = 0; i < buf_count; i++ )
+	{
+		bufs [i].save_state( p );
+		p += bufs [i].state_size();
+	}
+}
+
+void Stereo_Buffer::load_state( void const* in )
+{
+	char const* p = (char const*) in;
+	memcpy( &stereo_added, p, sizeof stereo_added );
+	p += sizeof stereo_added;
+	memcpy( &was_stereo, p, sizeof was_stereo );
+	p += sizeof was_stereo;
+	for ( int i = 0; i < buf_count; i++ )
+	{
+		bufs [i].load_state( p );
+		p += bufs [i].state_size();
+	}
+}
+
 void Stereo_Buffer::end_frame( blip_time_t clock_count )
 {
 	stereo_added = 0;
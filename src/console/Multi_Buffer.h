@@ -51,6 +51,12 @@ public:
 	virtual long read_samples( blip_sample_t*, long ) = 0;
 	virtual long samples_avail() const = 0;
 
+	// Save/load samples waiting in the buffers; state_size() bytes. Sample
+	// rate, length and channel setup must not change in between.
+	virtual long state_size() const = 0;
+	virtual void save_state( void* out ) const = 0;
+	virtual void load_state( void const* in ) = 0;
+
 protected:
 	void channels_changed() { channels_changed_count_++; }
 private:
@@ -83,6 +89,9 @@ public:
 	long read_samples( blip_sample_t* p, long s ) { return buf.read_samples( p, s ); }
 	channel_t channel( int, int ) { return chan; }
 	void end_frame( blip_time_t t ) { buf.end_frame( t ); }
+	long state_size() const { return buf.state_size(); }
+	void save_state( void* out ) const { buf.save_state( out ); }
+	void load_state( void const* in ) { buf.load_state( in ); }
 };
 
 // Uses three buffers (one for center) and outputs stereo sample pairs.
@@ -106,6 +115,9 @@ public:
 
 	long samples_avail() const { return bufs [0].samples_avail() * 2; }
 	long read_samples( blip_sample_t*, long );
+	long state_size() const;
+	void save_state( void* ) const;
+	void load_state( void const* );
 
 private:
 	enum { buf_count = 3 };
@@ -132,6 +144,9 @@ public:
 	void end_frame( blip_time_t ) { }
 	long samples_avail() const { return 0; }
 	long read_samples( blip_sample_t*, long ) { return 0; }
+	long state_size() const { return 0; }
+	void save_state( void* ) const { }
+	void load_state( void const* ) { }
 };
 
 
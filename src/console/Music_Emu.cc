@@ -220,6 +220,86 @@ blargg_err_t Music_Emu::skip( long count )
 	return 0;
 }
 
+// State snapshots
+
+// Track position, saved ahead of the silence buffer and the emulator's own state
+struct music_emu_state_t
+{
+	blargg_long out_time;
+	blargg_long emu_time;
+	long silence_time;
+	long silence_count;
+	long buf_remain;
+	int track;
+	bool emu_track_ended;
+	bool track_ended;
+};
+
+static const char state_unsupported [] = "State snapshots not supported by this emulator";
+
+long Music_Emu::state_size() const
+{
+	long size = state_size_();
+	if ( !size )
+		return 0;
+	return sizeof (music_emu_state_t) + buf_size * sizeof (sample_t) + size;
+}
+
+blargg_err_t Music_Emu::save_state( void* out ) const
+{
+	require( current_track() >= 0 ); // start_track() must have been called already
+	if ( !state_size_() )
+		return state_unsupported;
+
+	music_emu_state_t s;
+	s.out_time        = out_time;
+	s.emu_time        = emu_time;
+	s.silence_time    = silence_time;
+	s.silence_count   = silence_count;
+	s.buf_remain      = buf_remain;
+	s.track           = current_track_;
+	s.emu_track_ended = emu_track_ended_;
+	s.track_ended     = track_ended_;
+
+	byte* p = (byte*) out;
+	memcpy( p, &s, sizeof s );
+	p += sizeof s;
+	memcpy( p, buf.begin(), buf_size * sizeof (sample_t) );
+	p += buf_size * sizeof (sample_t);
+	save_state_( p );
+	return 0;
+}
+
+blargg_err_t Music_Emu::load_state( void const* in )
+{
+	require( current_track() >= 0 ); // start_track() must have been called already
+	if ( !state_size_() )
+		return state_unsupported;
+
+	byte const* p = (byte const*) in;
+	music_emu_state_t s;
+	memcpy( &s, p, sizeof s );
+	if ( s.track != current_track_ )
+		return "State belongs to a different track";
+	p += sizeof s;
+
+	out_time         = s.out_time;
+	emu_time         = s.emu_time;
+	silence_time     = s.silence_time;
+	silence_count    = s.silence_count;
+	buf_remain       = s.buf_remain;
+	emu_track_ended_ = s.emu_track_ended;
+	track_ended_     = s.track_ended;
+
+	memcpy( buf.begin(), p, buf_size * sizeof (sample_t) );
+	p += buf_size * sizeof (sample_t);
+	load_state_( p );
+
+	// chip snapshots include their output assignments
+	remute_voices();
+	return 0;
+}
+
 blargg_err_t Music_Emu::skip_( long count )
 {
 	// for long skip, mute sound
@@ -47,6 +47,17 @@ public:
 	// Skip n samples
 	blargg_err_t skip( long n );
 
+	// Number of bytes needed to save the state of the current track, or 0 if
+	// this emulator doesn't support state snapshots
+	long state_size() const;
+
+	// Save state of the current track to out, which must hold state_size() bytes.
+	// A state can only be loaded back into the same emulator object while the
+	// same file and track are playing, with the same sample rate, tempo and
+	// equalizer. Loading is much faster than seeking backwards.
+	blargg_err_t save_state( void* out ) const;
+	blargg_err_t load_state( void const* in );
+
 	// True if a track has reached its end
 	bool track_ended() const;
 
@@ -122,6 +133,9 @@ protected:
 	virtual blargg_err_t start_track_( int ) = 0; // tempo is set before this
 	virtual blargg_err_t play_( long count, sample_t* out ) = 0;
 	virtual blargg_err_t skip_( long count );
+	virtual long state_size_() const { return 0; }
+	virtual void save_state_( void* out ) const { }
+	virtual void load_state_( void const* in ) { }
 protected:
 	virtual void unload();
 	virtual void pre_load();
@@ -2,6 +2,8 @@
 
 #include "Nes_Apu.h"
 
+#include <string.h>
+
 /* Copyright (C) 2003-2006 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -389,3 +391,13 @@ int Nes_Apu::read_status( nes_time_t time )
 
 	return result;
 }
+
+void Nes_Apu::save_snapshot( void* out ) const
+{
+	memcpy( out, this, sizeof *this );
+}
+
+void Nes_Apu::load_snapshot( void const* in )
+{
+	memcpy( (void*) this, in, sizeof *this );
+}
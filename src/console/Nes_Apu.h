@@ -57,6 +57,13 @@ public:
 	void save_state( apu_state_t* out ) const;
 	void load_state( apu_state_t const& );
 
+	// Raw snapshot of the complete chip state, including output assignments.
+	// It can only be loaded back into the same object, since it includes
+	// pointers into the object itself.
+	static long snapshot_size() { return sizeof (Nes_Apu); }
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
+
 	// Set overall volume (default is 1.0)
 	void volume( double );
 
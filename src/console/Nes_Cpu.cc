@@ -4,6 +4,7 @@
 
 #include "blargg_endian.h"
 #include <limits.h>
+#include <string.h>
 
 #define BLARGG_CPU_X86 1
 
@@ -1080,3 +1081,12 @@ stop:
 	return s_time < 0;
 }
 
+void Nes_Cpu::save_snapshot( void* out ) const
+{
+	memcpy( out, this, sizeof *this );
+}
+
+void Nes_Cpu::load_snapshot( void const* in )
+{
+	memcpy( (void*) this, in, sizeof *this );
+}
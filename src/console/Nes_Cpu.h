@@ -61,6 +61,13 @@ public:
 	// CPU invokes bad opcode handler if it encounters this
 	enum { bad_opcode = 0xF2 };
 
+	// Raw snapshot of registers, low memory and the code map. It can only be
+	// loaded back into the same object with the same memory mapped, and not
+	// during run().
+	static long snapshot_size() { return sizeof (Nes_Cpu); }
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
+
 public:
 	Nes_Cpu() { state = &state_; }
 	enum { page_bits = 11 };
@@ -119,3 +119,12 @@ void Nes_Fme7_Apu::run_until( blip_time_t end_time )
 	last_time = end_time;
 }
 
+void Nes_Fme7_Apu::save_snapshot( void* out ) const
+{
+	memcpy( out, this, sizeof *this );
+}
+
+void Nes_Fme7_Apu::load_snapshot( void const* in )
+{
+	memcpy( (void*) this, in, sizeof *this );
+}
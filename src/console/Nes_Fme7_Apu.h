@@ -28,6 +28,9 @@ public:
 	void end_frame( blip_time_t );
 	void save_state( fme7_apu_state_t* ) const;
 	void load_state( fme7_apu_state_t const& );
+	static long snapshot_size() { return sizeof (Nes_Fme7_Apu); }
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
 
 	// Mask and addresses of registers
 	enum { addr_mask = 0xE000 };
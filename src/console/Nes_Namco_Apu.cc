@@ -2,6 +2,8 @@
 
 #include "Nes_Namco_Apu.h"
 
+#include <string.h>
+
 /* Copyright (C) 2003-2006 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -143,3 +145,12 @@ void Nes_Namco_Apu::run_until( blip_time_t nes_end_time )
 	last_time = nes_end_time;
 }
 
+void Nes_Namco_Apu::save_snapshot( void* out ) const
+{
+	memcpy( out, this, sizeof *this );
+}
+
+void Nes_Namco_Apu::load_snapshot( void const* in )
+{
+	memcpy( (void*) this, in, sizeof *this );
+}
@@ -32,6 +32,9 @@ public:
 	// to do: implement save/restore
 	void save_state( namco_state_t* out ) const;
 	void load_state( namco_state_t const& );
+	static long snapshot_size() { return sizeof (Nes_Namco_Apu); }
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
 
 	Nes_Namco_Apu();
 
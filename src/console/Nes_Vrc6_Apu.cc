@@ -2,6 +2,8 @@
 
 #include "Nes_Vrc6_Apu.h"
 
+#include <string.h>
+
 /* Copyright (C) 2003-2006 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -213,3 +215,12 @@ void Nes_Vrc6_Apu::run_saw( blip_time_t end_time )
 	osc.last_amp = last_amp;
 }
 
+void Nes_Vrc6_Apu::save_snapshot( void* out ) const
+{
+	memcpy( out, this, sizeof *this );
+}
+
+void Nes_Vrc6_Apu::load_snapshot( void const* in )
+{
+	memcpy( (void*) this, in, sizeof *this );
+}
@@ -21,6 +21,9 @@ public:
 	void end_frame( blip_time_t );
 	void save_state( vrc6_apu_state_t* ) const;
 	void load_state( vrc6_apu_state_t const& );
+	static long snapshot_size() { return sizeof (Nes_Vrc6_Apu); }
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
 
 	// Oscillator 0 write-only registers are at $9000-$9002
 	// Oscillator 1 write-only registers are at $A000-$A002
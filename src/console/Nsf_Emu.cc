@@ -557,3 +557,107 @@ blargg_err_t Nsf_Emu::run_clocks( blip_time_t& duration, int )
 
 	return 0;
 }
+
+// State snapshots
+
+// Bank switching is captured by the CPU's code map, and play_period only
+// depends on the tempo
+struct nsf_state_t
+{
+	Nes_Cpu::registers_t saved_state;
+	nes_time_t next_play;
+	int play_extra;
+	int play_ready;
+};
+
+long Nsf_Emu::state_size_() const
+{
+	long size = sizeof (nsf_state_t) + sizeof sram + Nes_Cpu::snapshot_size() +
+			Nes_Apu::snapshot_size() + buffer_state_size();
+	#if !NSF_EMU_APU_ONLY
+	{
+		if ( namco ) size += Nes_Namco_Apu::snapshot_size();
+		if ( vrc6  ) size += Nes_Vrc6_Apu::snapshot_size();
+		if ( fme7  ) size += Nes_Fme7_Apu::snapshot_size();
+	}
+	#endif
+	return size;
+}
+
+void Nsf_Emu::save_state_( void* out ) const
+{
+	nsf_state_t s;
+	s.saved_state = saved_state;
+	s.next_play   = next_play;
+	s.play_extra  = play_extra;
+	s.play_ready  = play_ready;
+
+	byte* p = (byte*) out;
+	memcpy( p, &s, sizeof s );
+	p += sizeof s;
+	memcpy( p, sram, sizeof sram );
+	p += sizeof sram;
+	cpu::save_snapshot( p );
+	p += Nes_Cpu::snapshot_size();
+	apu.save_snapshot( p );
+	p += Nes_Apu::snapshot_size();
+	#if !NSF_EMU_APU_ONLY
+	{
+		if ( namco )
+		{
+			namco->save_snapshot( p );
+			p += Nes_Namco_Apu::snapshot_size();
+		}
+		if ( vrc6 )
+		{
+			vrc6->save_snapshot( p );
+			p += Nes_Vrc6_Apu::snapshot_size();
+		}
+		if ( fme7 )
+		{
+			fme7->save_snapshot( p );
+			p += Nes_Fme7_Apu::snapshot_size();
+		}
+	}
+	#endif
+	save_buffer_state( p );
+}
+
+void Nsf_Emu::load_state_( void const* in )
+{
+	byte const* p = (byte const*) in;
+	nsf_state_t s;
+	memcpy( &s, p, sizeof s );
+	p += sizeof s;
+	saved_state = s.saved_state;
+	next_play   = s.next_play;
+	play_extra  = s.play_extra;
+	play_ready  = s.play_ready;
+
+	memcpy( sram, p, sizeof sram );
+	p += sizeof sram;
+	cpu::load_snapshot( p );
+	p += Nes_Cpu::snapshot_size();
+	apu.load_snapshot( p );
+	p += Nes_Apu::snapshot_size();
+	#if !NSF_EMU_APU_ONLY
+	{
+		if ( namco )
+		{
+			namco->load_snapshot( p );
+			p += Nes_Namco_Apu::snapshot_size();
+		}
+		if ( vrc6 )
+		{
+			vrc6->load_snapshot( p );
+			p += Nes_Vrc6_Apu::snapshot_size();
+		}
+		if ( fme7 )
+		{
+			fme7->load_snapshot( p );
+			p += Nes_Fme7_Apu::snapshot_size();
+		}
+	}
+	#endif
+	load_buffer_state( p );
+}
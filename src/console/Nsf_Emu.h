@@ -57,6 +57,9 @@ protected:
 	blargg_err_t load_( Data_Reader& );
 	blargg_err_t start_track_( int );
 	blargg_err_t run_clocks( blip_time_t&, int );
+	long state_size_() const;
+	void save_state_( void* ) const;
+	void load_state_( void const* );
 	void set_tempo_( double );
 	void set_voice( int, Blip_Buffer*, Blip_Buffer*, Blip_Buffer* );
 	void update_eq( blip_eq_t const& );
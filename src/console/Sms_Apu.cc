@@ -2,6 +2,8 @@
 
 #include "Sms_Apu.h"
 
+#include <string.h>
+
 /* Copyright (C) 2003-2006 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -328,3 +330,13 @@ void Sms_Apu::write_data( blip_time_t time, int data )
 		noise.shifter = 0x8000;
 	}
 }
+
+void Sms_Apu::save_snapshot( void* out ) const
+{
+	memcpy( out, this, sizeof *this );
+}
+
+void Sms_Apu::load_snapshot( void const* in )
+{
+	memcpy( (void*) this, in, sizeof *this );
+}
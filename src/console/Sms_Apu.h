@@ -42,6 +42,12 @@ public:
 	// start a new frame at time 0.
 	void end_frame( blip_time_t );
 
+	// Save/load raw copy of the chip state, including output assignments.
+	// Only valid for the same object.
+	static long snapshot_size() { return sizeof (Sms_Apu); }
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
+
 public:
 	Sms_Apu();
 	~Sms_Apu();
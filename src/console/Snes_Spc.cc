@@ -348,6 +348,18 @@ blargg_err_t Snes_Spc::play( int count, sample_t* out )
 	return err;
 }
 
+void Snes_Spc::save_snapshot( void* out ) const
+{
+	memcpy( out, this, sizeof *this );
+}
+
+void Snes_Spc::load_snapshot( void const* in )
+{
+	// Output buffer pointers are stale, but play() and skip() always set
+	// them up again before running
+	memcpy( this, in, sizeof *this );
+}
+
 blargg_err_t Snes_Spc::skip( int count )
 {
 	#if SPC_LESS_ACCURATE
@@ -102,6 +102,13 @@ public:
 	bool check_kon();
 #endif
 
+	// Raw snapshot of the complete emulator state, usable with either DSP. A
+	// snapshot can only be loaded back into the same Snes_Spc object, since it
+	// includes pointers into the object itself.
+	static long snapshot_size() { return sizeof (Snes_Spc); }
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
+
 public:
 	// TODO: document
 	struct regs_t
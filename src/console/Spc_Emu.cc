@@ -350,3 +350,30 @@ blargg_err_t Spc_Emu::play_( long count, sample_t* out )
 	check( remain == 0 );
 	return 0;
 }
+
+// State snapshots
+
+long Spc_Emu::state_size_() const
+{
+	return Snes_Spc::snapshot_size() + resampler.state_size() + sizeof filter;
+}
+
+void Spc_Emu::save_state_( void* out ) const
+{
+	byte* p = (byte*) out;
+	apu.save_snapshot( p );
+	p += Snes_Spc::snapshot_size();
+	resampler.save_state( p );
+	p += resampler.state_size();
+	memcpy( p, &filter, sizeof filter );
+}
+
+void Spc_Emu::load_state_( void const* in )
+{
+	byte const* p = (byte const*) in;
+	apu.load_snapshot( p );
+	p += Snes_Spc::snapshot_size();
+	resampler.load_state( p );
+	p += resampler.state_size();
+	memcpy( &filter, p, sizeof filter );
+}
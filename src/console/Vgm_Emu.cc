@@ -414,3 +414,103 @@ blargg_err_t Vgm_Emu::play_( long count, sample_t* out )
 	Dual_Resampler::dual_play( count, out, blip_buf );
 	return 0;
 }
+
+// State snapshots
+
+// Stream positions are saved as offsets from the start of the file data
+struct vgm_state_t
+{
+	long fm_time_offset;
+	int vgm_time;
+	long pos;
+	long pcm_data;
+	long pcm_pos;
+	int dac_amp;
+	int dac_disabled;
+};
+
+long Vgm_Emu::state_size_() const
+{
+	long size = sizeof (vgm_state_t) + Sms_Apu::snapshot_size();
+	if ( !uses_fm )
+		return size + buffer_state_size();
+
+	size += blip_buf.state_size() + dual_state_size();
+	if ( ym2612.enabled() )
+		size += ym2612.snapshot_size();
+	if ( ym2413.enabled() )
+		size += ym2413.snapshot_size();
+	return size;
+}
+
+void Vgm_Emu::save_state_( void* out ) const
+{
+	vgm_state_t s;
+	s.fm_time_offset = fm_time_offset;
+	s.vgm_time       = vgm_time;
+	s.pos            = pos - data;
+	s.pcm_data       = pcm_data - data;
+	s.pcm_pos        = pcm_pos - data;
+	s.dac_amp        = dac_amp;
+	s.dac_disabled   = dac_disabled;
+
+	byte* p = (byte*) out;
+	memcpy( p, &s, sizeof s );
+	p += sizeof s;
+	psg.save_snapshot( p );
+	p += Sms_Apu::snapshot_size();
+
+	if ( !uses_fm )
+	{
+		save_buffer_state( p );
+		return;
+	}
+
+	blip_buf.save_state( p );
+	p += blip_buf.state_size();
+	save_dual_state( p );
+	p += dual_state_size();
+	if ( ym2612.enabled() )
+	{
+		ym2612.save_snapshot( p );
+		p += ym2612.snapshot_size();
+	}
+	if ( ym2413.enabled() )
+		ym2413.save_snapshot( p );
+}
+
+void Vgm_Emu::load_state_( void const* in )
+{
+	byte const* p = (byte const*) in;
+	vgm_state_t s;
+	memcpy( &s, p, sizeof s );
+	p += sizeof s;
+	fm_time_offset = s.fm_time_offset;
+	vgm_time       = s.vgm_time;
+	pos            = data + s.pos;
+	pcm_data       = data + s.pcm_data;
+	pcm_pos        = data + s.pcm_pos;
+	dac_amp        = s.dac_amp;
+	dac_disabled   = s.dac_disabled;
+
+	psg.load_snapshot( p );
+	p += Sms_Apu::snapshot_size();
+
+	if ( !uses_fm )
+	{
+		load_buffer_state( p );
+		return;
+	}
+
+	blip_buf.load_state( p );
+	p += blip_buf.state_size();
+	load_dual_state( p );
+	p += dual_state_size();
+	if ( ym2612.enabled() )
+	{
+		ym2612.load_snapshot( p );
+		p += ym2612.snapshot_size();
+	}
+	if ( ym2413.enabled() )
+		ym2413.load_snapshot( p );
+}
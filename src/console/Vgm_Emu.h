@@ -66,6 +66,9 @@ protected:
 	blargg_err_t start_track_( int );
 	blargg_err_t play_( long count, sample_t* );
 	blargg_err_t run_clocks( blip_time_t&, int );
+	long state_size_() const;
+	void save_state_( void* ) const;
+	void load_state_( void const* );
 	void set_tempo_( double );
 	void mute_voices_( int mask );
 	void set_voice( int, Blip_Buffer*, Blip_Buffer*, Blip_Buffer* );
@@ -9,6 +9,7 @@
 #include "Ym2413_Emu.h"
 #include "Ym2612_Emu.h"
 #include "Sms_Apu.h"
+#include <string.h>
 
 template<class Emu>
 class Ym_Emu : public Emu {
@@ -22,8 +23,27 @@ public:
 	bool enabled() const            { return last_time != disabled_time; }
 	void begin_frame( short* p );
 	int run_until( int time );
+	long snapshot_size() const      { return sizeof last_time + Emu::snapshot_size(); }
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
 };
 
+template<class Emu>
+inline void Ym_Emu<Emu>::save_snapshot( void* out ) const
+{
+	char* p = (char*) out;
+	memcpy( p, &last_time, sizeof last_time );
+	Emu::save_snapshot( p + sizeof last_time );
+}
+
+template<class Emu>
+inline void Ym_Emu<Emu>::load_snapshot( void const* in )
+{
+	char const* p = (char const*) in;
+	memcpy( &last_time, p, sizeof last_time );
+	Emu::load_snapshot( p + sizeof last_time );
+}
+
 class Vgm_Emu_Impl : public Classic_Emu, private Dual_Resampler {
 public:
 	typedef Classic_Emu::sample_t sample_t;
@@ -2203,6 +2203,22 @@ void Ym2413_Emu::mute_voices( int mask )
 	OPLL_setMask( opll, mask );
 }
 
+// OPLL only points into itself and the global tables
+long Ym2413_Emu::snapshot_size()
+{
+	return sizeof (OPLL);
+}
+
+void Ym2413_Emu::save_snapshot( void* out ) const
+{
+	memcpy( out, opll, sizeof *opll );
+}
+
+void Ym2413_Emu::load_snapshot( void const* in )
+{
+	memcpy( opll, in, sizeof *opll );
+}
+
 void Ym2413_Emu::run( int pair_count, sample_t* out )
 {
 	while ( pair_count-- )
@@ -28,6 +28,11 @@ public:
 	typedef short sample_t;
 	enum { out_chan_count = 2 }; // stereo
 	void run( int pair_count, sample_t* out );
+
+	// See Ym2612_Emu.h
+	static long snapshot_size();
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
 };
 
 #endif
@@ -961,6 +961,26 @@ void Ym2612_Emu::write1( int addr, int data )
 
 void Ym2612_Emu::mute_voices( int mask ) { impl->mute_mask = mask; }
 
+// Everything else in tables_t is fixed by set_rate()
+long Ym2612_Emu::snapshot_size()
+{
+	return sizeof (state_t) + sizeof (int);
+}
+
+void Ym2612_Emu::save_snapshot( void* out ) const
+{
+	char* p = (char*) out;
+	memcpy( p, &impl->YM2612, sizeof impl->YM2612 );
+	memcpy( p + sizeof impl->YM2612, &impl->g.LFOcnt, sizeof impl->g.LFOcnt );
+}
+
+void Ym2612_Emu::load_snapshot( void const* in )
+{
+	char const* p = (char const*) in;
+	memcpy( &impl->YM2612, p, sizeof impl->YM2612 );
+	memcpy( &impl->g.LFOcnt, p + sizeof impl->YM2612, sizeof impl->g.LFOcnt );
+}
+
 static void update_envelope_( slot_t* sl )
 {
 	switch ( sl->Ecurp )
@@ -33,6 +33,12 @@ public:
 	typedef short sample_t;
 	enum { out_chan_count = 2 }; // stereo
 	void run( int pair_count, sample_t* out );
+
+	// Save/load chip state. A snapshot can only be loaded back into the same
+	// object, after the same set_rate().
+	static long snapshot_size();
+	void save_snapshot( void* out ) const;
+	void load_snapshot( void const* in );
 };
 
 #endif
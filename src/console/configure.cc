@@ -25,6 +25,7 @@ static const char * const console_defaults[] = {
  "ignore_spc_length", "FALSE",
  "echo", "0",
  "inc_spc_reverb", "FALSE",
+ "snapshot_memory", "16",
  NULL};
 
 bool_t console_cfg_load (void)
@@ -39,6 +40,7 @@ bool_t console_cfg_load (void)
     audcfg.ignore_spc_length = aud_get_bool (CON_CFGID, "ignore_spc_length");
     audcfg.echo = aud_get_int (CON_CFGID, "echo");
     audcfg.inc_spc_reverb = aud_get_bool (CON_CFGID, "inc_spc_reverb");
+    audcfg.snapshot_memory = aud_get_int (CON_CFGID, "snapshot_memory");
 
     return TRUE;
 }
@@ -53,4 +55,5 @@ void console_cfg_save (void)
     aud_set_bool (CON_CFGID, "ignore_spc_length", audcfg.ignore_spc_length);
     aud_set_int (CON_CFGID, "echo", audcfg.echo);
     aud_set_bool (CON_CFGID, "inc_spc_reverb", audcfg.inc_spc_reverb);
+    aud_set_int (CON_CFGID, "snapshot_memory", audcfg.snapshot_memory);
 }
@@ -20,6 +20,7 @@ typedef struct {
 	bool_t ignore_spc_length; /* if true, ignore length from SPC tags */
 	int echo;                  /* 0 to +100 */
 	bool_t inc_spc_reverb;    /* if true, increases the default reverb */
+	int snapshot_memory;       /* MiB of emulator states kept for seeking */
 } AudaciousConsoleConfig;
 
 extern AudaciousConsoleConfig audcfg;
@@ -54,7 +54,10 @@ static const PreferencesWidget console_widgets[] = {
     WidgetCheck (N_("Ignore length from SPC tags"),
         {VALUE_BOOLEAN, & audcfg.ignore_spc_length}),
     WidgetCheck (N_("Increase reverb"),
-        {VALUE_BOOLEAN, & audcfg.inc_spc_reverb})
+        {VALUE_BOOLEAN, & audcfg.inc_spc_reverb}),
+    WidgetSpin (N_("Memory for fast seeking:"),
+        {VALUE_INT, & audcfg.snapshot_memory},
+        {0, 256, 1, N_("MiB")})
 };
 
 static const PluginPreferences console_prefs = {
@@ -17,17 +17,25 @@
  * the use of this software.
  */
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <glib.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include <libaudcore/i18n.h>
 #include <libaudcore/interface.h>
 #include <libaudcore/plugin.h>
 #include <libaudcore/preferences.h>
 #include <libaudcore/runtime.h>
 
+/* the fade curve is approximated by this many linear pieces */
+#define CURVE_STEPS 256
+
 enum
 {
     STATE_OFF,
@@ -37,14 +45,26 @@ enum
     STATE_STOPPING,
 };
 
+enum
+{
+    CURVE_LINEAR,
+    CURVE_EQUAL_POWER,
+    CURVE_SMOOTH
+};
+
 static const char * const crossfade_defaults[] = {
  "length", "3",
+ "curve", "0", /* CURVE_LINEAR */
  NULL};
 
 static char state = STATE_OFF;
 static int current_channels = 0, current_rate = 0;
+static int fade_length = 0;
+static float fade_curve[CURVE_STEPS + 1];
+
+/* circular buffer; buffer_start is the position of the oldest sample */
 static float * buffer = NULL;
-static int buffer_size = 0, buffer_filled = 0;
+static int buffer_size = 0, buffer_start = 0, buffer_filled = 0;
 static int prebuffer_filled = 0;
 static float * output = NULL;
 static int output_size = 0;
@@ -54,9 +74,11 @@ static void reset (void)
     state = STATE_OFF;
     current_channels = 0;
     current_rate = 0;
+    fade_length = 0;
     g_free (buffer);
     buffer = NULL;
     buffer_size = 0;
+    buffer_start = 0;
     buffer_filled = 0;
     prebuffer_filled = 0;
     g_free (output);
@@ -75,6 +97,73 @@ static void crossfade_cleanup (void)
     reset ();
 }
 
+/* Returns a pointer to the sample at pos (counted from the oldest sample) and
+ * the number of samples that follow it contiguously in memory. */
+static float * buffer_at (int pos, int * avail)
+{
+    int i = buffer_start + pos;
+
+    if (i >= buffer_size)
+        i -= buffer_size;
+
+    * avail = buffer_size - i;
+    return buffer + i;
+}
+
+/* copies samples out of the buffer, handling wraparound */
+static void buffer_read (float * data, int pos, int length)
+{
+    while (length > 0)
+    {
+        int avail;
+        float * src = buffer_at (pos, & avail);
+        int copy = MIN (length, avail);
+
+        memcpy (data, src, sizeof (float) * copy);
+        data += copy;
+        pos += copy;
+        length -= copy;
+    }
+}
+
+static void enlarge_buffer (int length)
+{
+    if (length <= buffer_size)
+        return;
+
+    /* unwrap the contents into the new buffer */
+    float * new_buffer = g_new (float, length);
+
+    if (buffer_filled)
+        buffer_read (new_buffer, 0, buffer_filled);
+
+    g_free (buffer);
+    buffer = new_buffer;
+    buffer_size = length;
+    buffer_start = 0;
+}
+
+static void make_curve (int curve)
+{
+    for (int i = 0; i <= CURVE_STEPS; i ++)
+    {
+        float x = (float) i / CURVE_STEPS;
+
+        switch (curve)
+        {
+        case CURVE_EQUAL_POWER:
+            fade_curve[i] = sinf (x * (float) M_PI_2);
+            break;
+        case CURVE_SMOOTH:
+            fade_curve[i] = 0.5f - 0.5f * cosf (x * (float) M_PI);
+            break;
+        default:
+            fade_curve[i] = x;
+            break;
+        }
+    }
+}
+
 static void crossfade_start (int * channels, int * rate)
 {
     if (state != STATE_BETWEEN)
@@ -98,31 +187,121 @@ static void crossfade_start (int * channels, int * rate)
     current_channels = * channels;
     current_rate = * rate;
     prebuffer_filled = 0;
+
+    fade_length = current_channels * current_rate * aud_get_int ("crossfade", "length");
+    make_curve (aud_get_int ("crossfade", "curve"));
+
+    /* room for the overlap plus the second that return_data may hold back */
+    enlarge_buffer (fade_length + current_channels * current_rate);
+}
+
+/* data[i] *= gain, where the gain goes linearly from a to b */
+static void ramp (float * data, int length, float a, float b)
+{
+    float step = (b - a) / length;
+    int i = 0;
+
+#ifdef __SSE__
+    __m128 offsets = _mm_setr_ps (0, step, 2 * step, 3 * step);
+
+    for (; i + 4 <= length; i += 4)
+    {
+        __m128 gain = _mm_add_ps (_mm_set1_ps (a + step * i), offsets);
+        _mm_storeu_ps (data + i, _mm_mul_ps (_mm_loadu_ps (data + i), gain));
+    }
+#endif
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
 }
 
-static void do_ramp (float * data, int length, float a, float b)
+/* data[i] += add[i] * gain, where the gain goes linearly from a to b */
+static void ramp_mix (float * data, const float * add, int length, float a, float b)
 {
-    int count;
+    float step = (b - a) / length;
+    int i = 0;
+
+#ifdef __SSE__
+    __m128 offsets = _mm_setr_ps (0, step, 2 * step, 3 * step);
 
-    for (count = 0; count < length; count ++)
+    for (; i + 4 <= length; i += 4)
     {
-        * data = (* data) * (a * (length - count) + b * count) / length;
-        data ++;
+        __m128 gain = _mm_add_ps (_mm_set1_ps (a + step * i), offsets);
+        __m128 sum = _mm_add_ps (_mm_loadu_ps (data + i),
+         _mm_mul_ps (_mm_loadu_ps (add + i), gain));
+        _mm_storeu_ps (data + i, sum);
     }
+#endif
+
+    for (; i < length; i ++)
+        data[i] += add[i] * (a + step * i);
 }
 
-static void mix (float * data, float * add, int length)
+static void mix (float * data, const float * add, int length)
 {
-    while (length --)
-        (* data ++) += (* add ++);
+    int i = 0;
+
+#ifdef __SSE__
+    for (; i + 4 <= length; i += 4)
+        _mm_storeu_ps (data + i, _mm_add_ps (_mm_loadu_ps (data + i), _mm_loadu_ps (add + i)));
+#endif
+
+    for (; i < length; i ++)
+        data[i] += add[i];
 }
 
-static void enlarge_buffer (int length)
+/* fade-in gain at position pos of a fade lasting total samples */
+static float curve_gain (int64_t pos, int total)
+{
+    float x = (float) pos * CURVE_STEPS / total;
+    int i = (int) x;
+
+    if (i >= CURVE_STEPS)
+        return fade_curve[CURVE_STEPS];
+
+    return fade_curve[i] + (fade_curve[i + 1] - fade_curve[i]) * (x - i);
+}
+
+/* Mixes data, faded in, into the buffer starting at prebuffer_filled.  The
+ * samples must already be allocated in the buffer. */
+static void fade_in (const float * data, int length)
 {
-    if (length > buffer_size)
+    int piece = MAX (fade_length / CURVE_STEPS, 1);
+
+    while (length > 0)
     {
-        buffer = g_renew (float, buffer, length);
-        buffer_size = length;
+        int avail;
+        float * dest = buffer_at (prebuffer_filled, & avail);
+        int copy = MIN (MIN (length, avail), piece);
+
+        float a = curve_gain (prebuffer_filled, fade_length);
+        float b = curve_gain (prebuffer_filled + copy, fade_length);
+
+        ramp_mix (dest, data, copy, a, b);
+        prebuffer_filled += copy;
+        data += copy;
+        length -= copy;
+    }
+}
+
+/* fades out the whole contents of the buffer, using the fade-in curve played
+ * backwards */
+static void fade_out (void)
+{
+    int total = buffer_filled;
+    int piece = MAX (total / CURVE_STEPS, 1);
+
+    for (int pos = 0; pos < total; )
+    {
+        int avail;
+        float * data = buffer_at (pos, & avail);
+        int copy = MIN (MIN (total - pos, avail), piece);
+
+        float a = curve_gain (total - pos, total);
+        float b = curve_gain (total - pos - copy, total);
+
+        ramp (data, copy, a, b);
+        pos += copy;
     }
 }
 
@@ -130,37 +309,43 @@ static void add_data (float * data, int length)
 {
     if (state == STATE_PREBUFFER)
     {
-        int full = current_channels * current_rate * aud_get_int ("crossfade", "length");
-
-        if (prebuffer_filled < full)
+        if (prebuffer_filled < fade_length)
         {
-            int copy = MIN (length, full - prebuffer_filled);
-            float a = (float) prebuffer_filled / full;
-            float b = (float) (prebuffer_filled + copy) / full;
+            int copy = MIN (length, fade_length - prebuffer_filled);
 
             if (prebuffer_filled + copy > buffer_filled)
             {
+                int old_filled = buffer_filled;
+
                 enlarge_buffer (prebuffer_filled + copy);
-                memset (buffer + buffer_filled, 0, sizeof (float) *
-                 (prebuffer_filled + copy - buffer_filled));
                 buffer_filled = prebuffer_filled + copy;
+
+                for (int pos = old_filled; pos < buffer_filled; )
+                {
+                    int avail;
+                    float * dest = buffer_at (pos, & avail);
+                    int zero = MIN (buffer_filled - pos, avail);
+
+                    memset (dest, 0, sizeof (float) * zero);
+                    pos += zero;
+                }
             }
 
-            do_ramp (data, copy, a, b);
-            mix (buffer + prebuffer_filled, data, copy);
-            prebuffer_filled += copy;
+            fade_in (data, copy);
             data += copy;
             length -= copy;
         }
 
-        if (prebuffer_filled < full)
+        if (prebuffer_filled < fade_length)
             return;
 
-        if (prebuffer_filled < buffer_filled)
+        while (prebuffer_filled < buffer_filled && length > 0)
         {
-            int copy = MIN (length, buffer_filled - prebuffer_filled);
+            int avail;
+            float * dest = buffer_at (prebuffer_filled, & avail);
+            int copy = MIN (MIN (length, buffer_filled - prebuffer_filled), avail);
 
-            mix (buffer + prebuffer_filled, data, copy);
+            mix (dest, data, copy);
             prebuffer_filled += copy;
             data += copy;
             length -= copy;
@@ -176,8 +361,18 @@ static void add_data (float * data, int length)
         return;
 
     enlarge_buffer (buffer_filled + length);
-    memcpy (buffer + buffer_filled, data, sizeof (float) * length);
-    buffer_filled += length;
+
+    while (length > 0)
+    {
+        int avail;
+        float * dest = buffer_at (buffer_filled, & avail);
+        int copy = MIN (length, avail);
+
+        memcpy (dest, data, sizeof (float) * copy);
+        buffer_filled += copy;
+        data += copy;
+        length -= copy;
+    }
 }
 
 static void enlarge_output (int length)
@@ -189,12 +384,25 @@ static void enlarge_output (int length)
     }
 }
 
+/* moves the oldest samples out of the buffer into the output */
+static void take_data (int copy)
+{
+    enlarge_output (copy);
+    buffer_read (output, 0, copy);
+
+    buffer_start += copy;
+    if (buffer_start >= buffer_size)
+        buffer_start -= buffer_size;
+
+    buffer_filled -= copy;
+}
+
 static void return_data (float * * data, int * length)
 {
-    int full = current_channels * current_rate * aud_get_int ("crossfade", "length");
-    int copy = buffer_filled - full;
+    int copy = buffer_filled - fade_length;
 
-    /* only return if we have at least 1/2 second -- this reduces memmove's */
+    /* only return if we have at least 1/2 second -- this keeps the number of
+     * calls down */
     if (state != STATE_RUNNING || copy < current_channels * (current_rate / 2))
     {
         * data = NULL;
@@ -202,10 +410,7 @@ static void return_data (float * * data, int * length)
         return;
     }
 
-    enlarge_output (copy);
-    memcpy (output, buffer, sizeof (float) * copy);
-    buffer_filled -= copy;
-    memmove (buffer, buffer + copy, sizeof (float) * buffer_filled);
+    take_data (copy);
     * data = output;
     * length = copy;
 }
@@ -221,6 +426,7 @@ static void crossfade_flush (void)
     if (state == STATE_PREBUFFER || state == STATE_RUNNING)
     {
         state = STATE_RUNNING;
+        buffer_start = 0;
         buffer_filled = 0;
     }
 }
@@ -229,11 +435,11 @@ static void crossfade_finish (float * * data, int * samples)
 {
     if (state == STATE_BETWEEN) /* second call, end of last song */
     {
-        enlarge_output (buffer_filled);
-        memcpy (output, buffer, sizeof (float) * buffer_filled);
+        int copy = buffer_filled;
+
+        take_data (copy);
         * data = output;
-        * samples = buffer_filled;
-        buffer_filled = 0;
+        * samples = copy;
         state = STATE_OFF;
         return;
     }
@@ -243,7 +449,7 @@ static void crossfade_finish (float * * data, int * samples)
 
     if (state == STATE_PREBUFFER || state == STATE_RUNNING)
     {
-        do_ramp (buffer, buffer_filled, 1.0, 0.0);
+        fade_out ();
         state = STATE_BETWEEN;
     }
 }
@@ -257,11 +463,19 @@ static const char crossfade_about[] =
  N_("Crossfade Plugin for Audacious\n"
     "Copyright 2010-2012 John Lindgren");
 
+static const ComboBoxElements curve_list[] = {
+ {"0", N_("Linear")}, /* CURVE_LINEAR */
+ {"1", N_("Equal power")}, /* CURVE_EQUAL_POWER */
+ {"2", N_("Smooth")}}; /* CURVE_SMOOTH */
+
 static const PreferencesWidget crossfade_widgets[] = {
     WidgetLabel (N_("<b>Crossfade</b>")),
     WidgetSpin (N_("Overlap:"),
         {VALUE_INT, 0, "crossfade", "length"},
-        {1, 10, 1, N_("seconds")})
+        {1, 10, 1, N_("seconds")}),
+    WidgetCombo (N_("Fade curve:"),
+        {VALUE_STRING, 0, "crossfade", "curve"},
+        {curve_list, ARRAY_LEN (curve_list)})
 };
 
 static const PluginPreferences crossfade_prefs = {
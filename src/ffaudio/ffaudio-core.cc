@@ -31,6 +31,7 @@
 #include <libaudcore/i18n.h>
 #include <libaudcore/input.h>
 #include <libaudcore/multihash.h>
+#include <libaudcore/preferences.h>
 #include <libaudcore/runtime.h>
 
 typedef struct
@@ -44,6 +45,11 @@ CodecInfo;
 
 static SimpleHash<String, AVInputFormat *> extension_dict;
 
+static const char * const ffaudio_defaults[] = {
+ "io_buffer_kb", "64",
+ "prefetch_mb", "0",
+ NULL};
+
 static void create_extension_dict ();
 
 static gint lockmgr (void * * mutexp, enum AVLockOp op)
@@ -71,6 +77,8 @@ static gint lockmgr (void * * mutexp, enum AVLockOp op)
 
 static gboolean ffaudio_init (void)
 {
+    aud_config_set_defaults ("ffaudio", ffaudio_defaults);
+
     av_register_all();
     av_lockmgr_register (lockmgr);
 
@@ -192,7 +200,7 @@ static AVInputFormat * get_format (const gchar * name, VFSFile * file)
     return f ? f : get_format_by_content (name, file);
 }
 
-static AVFormatContext * open_input_file (const gchar * name, VFSFile * file)
+static AVFormatContext * open_input_file (const gchar * name, VFSFile * file, bool_t prefetch)
 {
     AVInputFormat * f = get_format (name, file);
 
@@ -203,7 +211,7 @@ static AVFormatContext * open_input_file (const gchar * name, VFSFile * file)
     }
 
     AVFormatContext * c = avformat_alloc_context ();
-    AVIOContext * io = io_context_new (file);
+    AVIOContext * io = io_context_new (file, prefetch);
     c->pb = io;
 
     gint ret = avformat_open_input (& c, name, f, NULL);
@@ -308,7 +316,7 @@ static void read_metadata_dict (Tuple & tuple, AVDictionary * dict)
 static Tuple read_tuple (const gchar * filename, VFSFile * file)
 {
     Tuple tuple;
-    AVFormatContext * ic = open_input_file (filename, file);
+    AVFormatContext * ic = open_input_file (filename, file, FALSE);
 
     if (ic)
     {
@@ -377,7 +385,10 @@ static gboolean ffaudio_play (const gchar * filename, VFSFile * file)
     void *buf = NULL;
     gint bufsize = 0;
 
-    AVFormatContext * ic = open_input_file (filename, file);
+    /* reused for every decoded frame */
+    AVFrame * frame = NULL;
+
+    AVFormatContext * ic = open_input_file (filename, file, TRUE);
     if (! ic)
         return FALSE;
 
@@ -426,6 +437,20 @@ static gboolean ffaudio_play (const gchar * filename, VFSFile * file)
 
     aud_input_set_bitrate(ic->bit_rate);
 
+#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
+    frame = av_frame_alloc ();
+#else
+    frame = avcodec_alloc_frame ();
+#endif
+
+    /* mono planar data is already interleaved, so only multichannel planar
+     * formats need a buffer; size it for a typical frame up front */
+    if (planar && cinfo.context->channels > 1 && cinfo.context->frame_size > 0)
+    {
+        bufsize = FMT_SIZEOF (out_fmt) * cinfo.context->channels * cinfo.context->frame_size;
+        buf = g_malloc (bufsize);
+    }
+
     errcount = 0;
 
     while (! aud_input_check_stop ())
@@ -485,11 +510,6 @@ static gboolean ffaudio_play (const gchar * filename, VFSFile * file)
             if (seek_value >= 0)
                 break;
 
-#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
-            AVFrame * frame = av_frame_alloc ();
-#else
-            AVFrame * frame = avcodec_alloc_frame ();
-#endif
             int decoded = 0;
             int len = avcodec_decode_audio4 (cinfo.context, frame, & decoded, & tmp);
 
@@ -507,7 +527,7 @@ static gboolean ffaudio_play (const gchar * filename, VFSFile * file)
 
             gint size = FMT_SIZEOF (out_fmt) * cinfo.context->channels * frame->nb_samples;
 
-            if (planar)
+            if (planar && cinfo.context->channels > 1)
             {
                 if (bufsize < size)
                 {
@@ -521,14 +541,6 @@ static gboolean ffaudio_play (const gchar * filename, VFSFile * file)
             }
             else
                 aud_input_write_audio (frame->data[0], size);
-
-#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
-            av_frame_free (& frame);
-#elif CHECK_LIBAVCODEC_VERSION (54, 59, 100, 54, 28, 0)
-            avcodec_free_frame (& frame);
-#else
-            av_free (frame);
-#endif
         }
 
         if (pkt.data)
@@ -536,6 +548,16 @@ static gboolean ffaudio_play (const gchar * filename, VFSFile * file)
     }
 
 error_exit:
+    if (frame)
+    {
+#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
+        av_frame_free (& frame);
+#elif CHECK_LIBAVCODEC_VERSION (54, 59, 100, 54, 28, 0)
+        avcodec_free_frame (& frame);
+#else
+        av_free (frame);
+#endif
+    }
     if (pkt.data)
         av_free_packet(&pkt);
     if (codec_opened)
@@ -556,6 +578,21 @@ static const char ffaudio_about[] =
     "William Pitcock <nenolod@nenolod.net>\n"
     "Matti Hämäläinen <ccr@tnsp.org>");
 
+static const PreferencesWidget ffaudio_widgets[] = {
+    WidgetLabel (N_("<b>Input</b>")),
+    WidgetSpin (N_("Read buffer:"),
+        {VALUE_INT, 0, "ffaudio", "io_buffer_kb"},
+        {4, 4096, 4, N_("KiB")}),
+    WidgetSpin (N_("Read ahead during playback:"),
+        {VALUE_INT, 0, "ffaudio", "prefetch_mb"},
+        {0, 64, 1, N_("MiB (0 = off)")})
+};
+
+static const PluginPreferences ffaudio_prefs = {
+    ffaudio_widgets,
+    ARRAY_LEN (ffaudio_widgets)
+};
+
 static const gchar *ffaudio_fmts[] = {
     /* musepack, SV7/SV8 */
     "mpc", "mp+", "mpp",
@@ -604,6 +641,7 @@ static const char * const ffaudio_mimes[] = {"application/ogg", NULL};
 
 #define AUD_PLUGIN_NAME        N_("FFmpeg Plugin")
 #define AUD_PLUGIN_ABOUT       ffaudio_about
+#define AUD_PLUGIN_PREFS       & ffaudio_prefs
 #define AUD_PLUGIN_INIT        ffaudio_init
 #define AUD_PLUGIN_CLEANUP     ffaudio_cleanup
 #define AUD_INPUT_EXTS         ffaudio_fmts
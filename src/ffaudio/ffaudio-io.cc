@@ -16,9 +16,43 @@
  * implied. In no event shall the authors be liable for any damages arising from
  */
 
+#include <pthread.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <libaudcore/runtime.h>
+
 #include "ffaudio-stdinc.h"
 
-#define IOBUF 4096
+#define MIN_IOBUF_KB 4
+#define MAX_IOBUF_KB 4096
+#define MAX_PREFETCH_MB 64
+#define PREFETCH_BLOCK 65536
+
+/* Optional read-ahead: a background thread keeps up to "size" bytes of the
+ * file ahead of the demuxer in a ring buffer.  The window covers file offsets
+ * [pos, pos + len).  Only the thread touches the VFSFile while it is running;
+ * seeks outside the window are handed to it and the ring is discarded. */
+typedef struct
+{
+    VFSFile * file;
+    int64_t file_size;
+
+    char * ring;
+    int size, head, len;
+    int64_t pos;
+    bool_t eof, quit;
+
+    bool_t seek_pending;
+    int64_t seek_target;
+    int seek_result;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+}
+Prefetch;
 
 static int read_cb (void * file, unsigned char * buf, int size)
 {
@@ -34,14 +68,213 @@ static int64_t seek_cb (void * file, int64_t offset, int whence)
     return vfs_ftell ((VFSFile *) file);
 }
 
-AVIOContext * io_context_new (VFSFile * file)
+static void * prefetch_worker (void * data)
+{
+    Prefetch * p = (Prefetch *) data;
+
+    pthread_mutex_lock (& p->mutex);
+
+    while (! p->quit)
+    {
+        if (p->seek_pending)
+        {
+            int64_t target = p->seek_target;
+
+            pthread_mutex_unlock (& p->mutex);
+            int result = vfs_fseek (p->file, target, SEEK_SET);
+            pthread_mutex_lock (& p->mutex);
+
+            if (! result)
+            {
+                p->head = 0;
+                p->len = 0;
+                p->pos = target;
+                p->eof = FALSE;
+            }
+            else
+            {
+                /* the file position is unknown now (a read may have been
+                 * dropped above), so keep what is buffered and stop there */
+                p->eof = TRUE;
+            }
+
+            p->seek_result = result;
+            p->seek_pending = FALSE;
+
+            pthread_cond_broadcast (& p->cond);
+            continue;
+        }
+
+        if (p->eof || p->len == p->size)
+        {
+            pthread_cond_wait (& p->cond, & p->mutex);
+            continue;
+        }
+
+        /* the free part of the ring is never read by the demuxer */
+        int offset = (p->head + p->len) % p->size;
+        int chunk = MIN (p->size - p->len, p->size - offset);
+        chunk = MIN (chunk, PREFETCH_BLOCK);
+
+        pthread_mutex_unlock (& p->mutex);
+        int64_t got = vfs_fread (p->ring + offset, 1, chunk, p->file);
+        pthread_mutex_lock (& p->mutex);
+
+        /* a seek came in while we were reading; the data is stale */
+        if (p->seek_pending)
+            continue;
+
+        if (got <= 0)
+            p->eof = TRUE;
+        else
+            p->len += got;
+
+        pthread_cond_broadcast (& p->cond);
+    }
+
+    pthread_mutex_unlock (& p->mutex);
+    return NULL;
+}
+
+static int prefetch_read_cb (void * data, unsigned char * buf, int size)
+{
+    Prefetch * p = (Prefetch *) data;
+
+    pthread_mutex_lock (& p->mutex);
+
+    while (! p->len && ! p->eof)
+        pthread_cond_wait (& p->cond, & p->mutex);
+
+    int done = 0;
+
+    while (done < size && p->len)
+    {
+        int chunk = MIN (size - done, p->len);
+        chunk = MIN (chunk, p->size - p->head);
+
+        memcpy (buf + done, p->ring + p->head, chunk);
+
+        p->head = (p->head + chunk) % p->size;
+        p->len -= chunk;
+        p->pos += chunk;
+        done += chunk;
+    }
+
+    pthread_cond_broadcast (& p->cond);
+    pthread_mutex_unlock (& p->mutex);
+
+    return done;
+}
+
+static int64_t prefetch_seek_cb (void * data, int64_t offset, int whence)
 {
-    void * buf = av_malloc (IOBUF);
-    return avio_alloc_context ((unsigned char *) buf, IOBUF, 0, file, read_cb, NULL, seek_cb);
+    Prefetch * p = (Prefetch *) data;
+
+    if (whence == AVSEEK_SIZE)
+        return p->file_size;
+
+    pthread_mutex_lock (& p->mutex);
+
+    switch (whence & ~(int) AVSEEK_FORCE)
+    {
+    case SEEK_CUR:
+        offset += p->pos;
+        break;
+    case SEEK_END:
+        offset = (p->file_size >= 0) ? p->file_size + offset : -1;
+        break;
+    }
+
+    int64_t result = -1;
+
+    if (offset >= p->pos && offset <= p->pos + p->len)
+    {
+        /* forward seek within the window; just drop the skipped data */
+        int skip = offset - p->pos;
+
+        p->head = (p->head + skip) % p->size;
+        p->len -= skip;
+        p->pos = offset;
+        result = offset;
+
+        pthread_cond_broadcast (& p->cond);
+    }
+    else if (offset >= 0)
+    {
+        p->seek_target = offset;
+        p->seek_pending = TRUE;
+        pthread_cond_broadcast (& p->cond);
+
+        while (p->seek_pending)
+            pthread_cond_wait (& p->cond, & p->mutex);
+
+        if (! p->seek_result)
+            result = offset;
+    }
+
+    pthread_mutex_unlock (& p->mutex);
+    return result;
+}
+
+static Prefetch * prefetch_new (VFSFile * file, int size)
+{
+    Prefetch * p = g_new0 (Prefetch, 1);
+
+    p->file = file;
+    p->file_size = vfs_fsize (file);
+    p->ring = (char *) g_malloc (size);
+    p->size = size;
+    p->pos = vfs_ftell (file);
+
+    pthread_mutex_init (& p->mutex, NULL);
+    pthread_cond_init (& p->cond, NULL);
+
+    if (pthread_create (& p->thread, NULL, prefetch_worker, p))
+    {
+        pthread_mutex_destroy (& p->mutex);
+        pthread_cond_destroy (& p->cond);
+        g_free (p->ring);
+        g_free (p);
+        return NULL;
+    }
+
+    return p;
+}
+
+static void prefetch_free (Prefetch * p)
+{
+    pthread_mutex_lock (& p->mutex);
+    p->quit = TRUE;
+    pthread_cond_broadcast (& p->cond);
+    pthread_mutex_unlock (& p->mutex);
+
+    pthread_join (p->thread, NULL);
+
+    pthread_mutex_destroy (& p->mutex);
+    pthread_cond_destroy (& p->cond);
+    g_free (p->ring);
+    g_free (p);
+}
+
+AVIOContext * io_context_new (VFSFile * file, bool_t prefetch)
+{
+    int iobuf = 1024 * CLAMP (aud_get_int ("ffaudio", "io_buffer_kb"), MIN_IOBUF_KB, MAX_IOBUF_KB);
+    int ahead = CLAMP (aud_get_int ("ffaudio", "prefetch_mb"), 0, MAX_PREFETCH_MB);
+
+    void * buf = av_malloc (iobuf);
+    Prefetch * p = (prefetch && ahead) ? prefetch_new (file, ahead << 20) : NULL;
+
+    if (p)
+        return avio_alloc_context ((unsigned char *) buf, iobuf, 0, p, prefetch_read_cb, NULL, prefetch_seek_cb);
+
+    return avio_alloc_context ((unsigned char *) buf, iobuf, 0, file, read_cb, NULL, seek_cb);
 }
 
 void io_context_free (AVIOContext * io)
 {
+    if (io->read_packet == prefetch_read_cb)
+        prefetch_free ((Prefetch *) io->opaque);
+
     av_free (io->buffer);
     av_free (io);
 }
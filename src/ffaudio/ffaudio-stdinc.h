@@ -44,7 +44,7 @@ extern "C" {
 #error Please define either HAVE_FFMPEG or HAVE_LIBAV
 #endif
 
-AVIOContext * io_context_new (VFSFile * file);
+AVIOContext * io_context_new (VFSFile * file, bool_t prefetch);
 void io_context_free (AVIOContext * context);
 
 #endif
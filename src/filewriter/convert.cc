@@ -1,45 +1,56 @@
 #include "convert.h"
 
-gpointer convert_output = NULL;
-static gint nch;
-static gint in_fmt;
-static gint out_fmt;
-
-gboolean convert_init(gint input_fmt, gint output_fmt, gint channels)
+gboolean convert_init(struct convert_state *state, gint input_fmt, gint output_fmt, gint channels)
 {
-    in_fmt = input_fmt;
-    out_fmt = output_fmt;
-    nch = channels;
+    state->in_fmt = input_fmt;
+    state->out_fmt = output_fmt;
+    state->nch = channels;
+    state->output = NULL;
+    state->output_size = 0;
+    state->temp = NULL;
+    state->temp_size = 0;
 
     return TRUE;
 }
 
-gint convert_process(gpointer ptr, gint length)
+gint convert_process(struct convert_state *state, gpointer ptr, gint length)
 {
+    gint in_fmt = state->in_fmt, out_fmt = state->out_fmt;
     gint samples = length / FMT_SIZEOF (in_fmt);
-    gfloat * temp;
 
-    convert_output = g_realloc (convert_output, FMT_SIZEOF (out_fmt) * samples);
+    if (state->output_size < FMT_SIZEOF (out_fmt) * samples)
+    {
+        state->output_size = FMT_SIZEOF (out_fmt) * samples;
+        state->output = g_realloc (state->output, state->output_size);
+    }
 
     if (in_fmt == out_fmt)
-        memcpy (convert_output, ptr, FMT_SIZEOF (in_fmt) * samples);
+        memcpy (state->output, ptr, FMT_SIZEOF (in_fmt) * samples);
     else if (in_fmt == FMT_FLOAT)
-        audio_to_int ((float *) ptr, convert_output, out_fmt, samples);
+        audio_to_int ((float *) ptr, state->output, out_fmt, samples);
     else if (out_fmt == FMT_FLOAT)
-        audio_from_int (ptr, in_fmt, (float *) convert_output, samples);
+        audio_from_int (ptr, in_fmt, (float *) state->output, samples);
     else
     {
-        temp = g_new (float, samples);
-        audio_from_int (ptr, in_fmt, temp, samples);
-        audio_to_int (temp, convert_output, out_fmt, samples);
-        g_free (temp);
+        if (state->temp_size < samples)
+        {
+            state->temp_size = samples;
+            state->temp = g_renew (gfloat, state->temp, samples);
+        }
+
+        audio_from_int (ptr, in_fmt, state->temp, samples);
+        audio_to_int (state->temp, state->output, out_fmt, samples);
     }
 
     return FMT_SIZEOF (out_fmt) * samples;
 }
 
-void convert_free(void)
+void convert_free(struct convert_state *state)
 {
-    g_free (convert_output);
-    convert_output = NULL;
+    g_free (state->output);
+    g_free (state->temp);
+    state->output = NULL;
+    state->output_size = 0;
+    state->temp = NULL;
+    state->temp_size = 0;
 }
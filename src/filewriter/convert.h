@@ -3,12 +3,21 @@
 
 #include "filewriter.h"
 
-extern gpointer convert_output;
+/* state of one conversion stream, so that several can run side by side */
+struct convert_state {
+    gint in_fmt;
+    gint out_fmt;
+    gint nch;
+    gpointer output;
+    gint output_size;   /* bytes allocated, reused from call to call */
+    gfloat *temp;
+    gint temp_size;     /* samples allocated */
+};
 
-gboolean convert_init(gint input_fmt, gint output_fmt, gint channels);
+gboolean convert_init(struct convert_state *state, gint input_fmt, gint output_fmt, gint channels);
 
-gint convert_process(gpointer ptr, gint length);
+gint convert_process(struct convert_state *state, gpointer ptr, gint length);
 
-void convert_free(void);
+void convert_free(struct convert_state *state);
 
 #endif
@@ -21,6 +21,7 @@
  */
 
 #include <gtk/gtk.h>
+#include <pthread.h>
 #include <stdlib.h>
 
 #include <libaudcore/runtime.h>
@@ -32,7 +33,7 @@
 #include "plugins.h"
 #include "convert.h"
 
-struct format_info input;
+static struct format_info input;
 
 static GtkWidget * path_hbox, * path_dirbrowser;
 static GtkWidget * fileext_combo, * plugin_button;
@@ -82,10 +83,34 @@ static gboolean prependnumber;
 
 static String file_path;
 
-VFSFile *output_file = NULL;
-Tuple tuple;
+static VFSFile *output_file = NULL;
+static Tuple tuple;
 
 static gint64 samples_written;
+static struct convert_state convert;
+
+/* the backend encoding the current song, and its state */
+static FileWriter *stream_plugin;
+static void *stream;
+
+/* Audio is handed to a separate thread for conversion and encoding, through
+ * a ring of buffers that are reused from track to track.  When all of them
+ * are filled, file_write() waits for the encoder to catch up. */
+#define QUEUE_BUFFERS 8
+
+struct queue_buffer {
+    void * data;
+    gint size;  /* bytes allocated */
+    gint len;   /* bytes used */
+};
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t encoder_thread;
+
+static struct queue_buffer queue[QUEUE_BUFFERS];
+static gint queue_head, queue_len;  /* filled buffers */
+static gboolean encoder_running, encoder_stop;
 
 FileWriter *plugins[FILEEXT_MAX] = {
     &wav_plugin,
@@ -108,11 +133,6 @@ static void set_plugin(void)
     plugin = plugins[fileext];
 }
 
-static gint file_write_output (void * data, gint length)
-{
-    return vfs_fwrite (data, 1, length, output_file);
-}
-
 static const gchar * const filewriter_defaults[] = {
  "fileext", "0", /* WAV */
  "filenamefromtags", "TRUE",
@@ -140,16 +160,73 @@ static gboolean file_init (void)
 
     set_plugin();
     if (plugin->init)
-        plugin->init(&file_write_output);
+        plugin->init();
 
     return TRUE;
 }
 
 static void file_cleanup (void)
 {
+    for (struct queue_buffer & buf : queue)
+    {
+        g_free (buf.data);
+        buf.data = NULL;
+        buf.size = 0;
+    }
+
     file_path = String ();
 }
 
+static void * encoder_loop (void * unused)
+{
+    pthread_mutex_lock (& queue_mutex);
+
+    while (1)
+    {
+        while (! queue_len && ! encoder_stop)
+            pthread_cond_wait (& queue_cond, & queue_mutex);
+
+        /* everything queued is written before stopping */
+        if (! queue_len)
+            break;
+
+        struct queue_buffer * buf = & queue[queue_head];
+        pthread_mutex_unlock (& queue_mutex);
+
+        int len = convert_process (& convert, buf->data, buf->len);
+        stream_plugin->write (stream, convert.output, len);
+
+        pthread_mutex_lock (& queue_mutex);
+        queue_head = (queue_head + 1) % QUEUE_BUFFERS;
+        queue_len --;
+        pthread_cond_broadcast (& queue_cond);
+    }
+
+    pthread_mutex_unlock (& queue_mutex);
+    return NULL;
+}
+
+static void encoder_start (void)
+{
+    queue_head = queue_len = 0;
+    encoder_stop = FALSE;
+    encoder_running = ! pthread_create (& encoder_thread, NULL, encoder_loop, NULL);
+}
+
+static void encoder_finish (void)
+{
+    if (! encoder_running)
+        return;
+
+    pthread_mutex_lock (& queue_mutex);
+    encoder_stop = TRUE;
+    pthread_cond_broadcast (& queue_cond);
+    pthread_mutex_unlock (& queue_mutex);
+
+    pthread_join (encoder_thread, NULL);
+    encoder_running = FALSE;
+}
+
 static VFSFile * safe_create (const gchar * filename)
 {
     if (! vfs_file_test (filename, G_FILE_TEST_EXISTS))
@@ -175,7 +252,6 @@ static gint file_open(gint fmt, gint rate, gint nch)
     gchar *filename = NULL, *temp = NULL;
     gchar * directory;
     gint pos;
-    gint rv;
     gint playlist;
 
     input.format = fmt;
@@ -249,32 +325,79 @@ static gint file_open(gint fmt, gint rate, gint nch)
     if (output_file == NULL)
         return 0;
 
-    convert_init (fmt, plugin->format_required (fmt), nch);
+    stream_plugin = plugin;
+    stream = plugin->open (output_file, & input, tuple);
+
+    if (! stream)
+    {
+        vfs_fclose (output_file);
+        output_file = NULL;
+        return 0;
+    }
 
-    rv = (plugin->open)();
+    convert_init (& convert, fmt, plugin->format_required (fmt), nch);
+    encoder_start ();
 
     samples_written = 0;
 
-    return rv;
+    return 1;
 }
 
 static void file_write(void *ptr, gint length)
 {
-    int len = convert_process (ptr, length);
+    if (encoder_running)
+    {
+        pthread_mutex_lock (& queue_mutex);
 
-    plugin->write(convert_output, len);
+        while (queue_len == QUEUE_BUFFERS)
+            pthread_cond_wait (& queue_cond, & queue_mutex);
+
+        /* the slot after the filled ones is not touched by the encoder */
+        struct queue_buffer * buf = & queue[(queue_head + queue_len) % QUEUE_BUFFERS];
+        pthread_mutex_unlock (& queue_mutex);
+
+        if (buf->size < length)
+        {
+            buf->size = length;
+            buf->data = g_realloc (buf->data, length);
+        }
+
+        memcpy (buf->data, ptr, length);
+        buf->len = length;
+
+        pthread_mutex_lock (& queue_mutex);
+        queue_len ++;
+        pthread_cond_broadcast (& queue_cond);
+        pthread_mutex_unlock (& queue_mutex);
+    }
+    else
+    {
+        int len = convert_process (& convert, ptr, length);
+        stream_plugin->write (stream, convert.output, len);
+    }
 
     samples_written += length / FMT_SIZEOF (input.format);
 }
 
 static void file_drain (void)
 {
+    pthread_mutex_lock (& queue_mutex);
+
+    while (queue_len)
+        pthread_cond_wait (& queue_cond, & queue_mutex);
+
+    pthread_mutex_unlock (& queue_mutex);
 }
 
 static void file_close(void)
 {
-    plugin->close();
-    convert_free();
+    encoder_finish ();
+
+    if (stream)
+        stream_plugin->close (stream);
+    stream = NULL;
+
+    convert_free (& convert);
 
     if (output_file != NULL)
         vfs_fclose(output_file);
@@ -324,7 +447,7 @@ static void fileext_cb(GtkWidget *combo, gpointer data)
     fileext = gtk_combo_box_get_active(GTK_COMBO_BOX(fileext_combo));
     set_plugin();
     if (plugin->init)
-        plugin->init(&file_write_output);
+        plugin->init();
 
     gtk_widget_set_sensitive(plugin_button, plugin->configure != NULL);
 }
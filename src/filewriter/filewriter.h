@@ -36,21 +36,16 @@ struct format_info {
     int channels;
 };
 
-extern struct format_info input;
-
-extern VFSFile *output_file;
-extern guint64 offset;
-extern Tuple tuple;
-
-typedef gint (*write_output_callback)(void *ptr, gint length);
-
+/* An encoder backend.  open() returns the state of a new output stream (or
+ * NULL on failure), which is passed to write() and close(); streams share
+ * nothing but the configuration, so several can be encoded at once. */
 typedef struct _FileWriter
 {
-    void (*init)(write_output_callback write_output_func);
+    void (*init)(void);
     void (*configure)(void);
-    gint (*open)(void);
-    void (*write)(void *ptr, gint length);
-    void (*close)(void);
+    void * (*open)(VFSFile *file, const struct format_info *info, const Tuple &tuple);
+    void (*write)(void *stream, void *ptr, gint length);
+    void (*close)(void *stream);
     int (*format_required)(int fmt);
 } FileWriter;
 
@@ -26,8 +26,41 @@
 #include <FLAC/all.h>
 #include <stdlib.h>
 
-static FLAC__StreamEncoder *flac_encoder;
-static FLAC__StreamMetadata *flac_metadata;
+#include <libaudcore/runtime.h>
+
+/* FLAC__stream_encoder_set_num_threads appeared in libFLAC 1.5.0 */
+#if defined (FLAC_API_VERSION_CURRENT) && FLAC_API_VERSION_CURRENT >= 14
+#define FLAC_HAVE_THREADS
+#endif
+
+#define FLAC_MAX_THREADS 64
+
+static const gchar * const flac_defaults[] = {
+ "compression_level", "5",
+ "threads", "1",
+ NULL};
+
+static gint compression_level;
+static gint encoder_threads;
+
+struct flac_stream {
+    FLAC__StreamEncoder *encoder;
+    FLAC__StreamMetadata *metadata;
+    gint channels;
+    gint out_format;
+
+    /* kept across writes; only needed to widen 16-bit input */
+    FLAC__int32 *encbuffer;
+    gint encbuffer_samples;
+};
+
+static void flac_init(void)
+{
+    aud_config_set_defaults ("filewriter_flac", flac_defaults);
+
+    compression_level = aud_get_int ("filewriter_flac", "compression_level");
+    encoder_threads = aud_get_int ("filewriter_flac", "threads");
+}
 
 static FLAC__StreamEncoderWriteStatus flac_write_cb(const FLAC__StreamEncoder *encoder,
     const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame, gpointer data)
@@ -98,107 +131,197 @@ static void insert_vorbis_comment (FLAC__StreamMetadata * meta,
     g_free (temp);
 }
 
-static gint flac_open(void)
+static int flac_format_required (int fmt)
 {
-    flac_encoder = FLAC__stream_encoder_new();
+    switch (fmt)
+    {
+        case FMT_S8:
+        case FMT_U8:
+        case FMT_S16_LE:
+        case FMT_S16_BE:
+        case FMT_U16_LE:
+        case FMT_U16_BE:
+            return FMT_S16_NE;
+
+        default:
+            return FMT_S24_NE;
+    }
+}
+
+static void flac_close(void *_stream);
+
+static void * flac_open(VFSFile *file, const struct format_info *info, const Tuple &tuple)
+{
+    if (info->channels < 1 || info->channels > (int) FLAC__MAX_CHANNELS)
+        return NULL;
 
-    FLAC__stream_encoder_set_channels(flac_encoder, input.channels);
-    FLAC__stream_encoder_set_sample_rate(flac_encoder, input.frequency);
+    struct flac_stream *stream = g_new0 (struct flac_stream, 1);
+
+    stream->channels = info->channels;
+    stream->out_format = flac_format_required (info->format);
+    stream->encoder = FLAC__stream_encoder_new();
+
+    if (! stream->encoder)
+    {
+        g_free (stream);
+        return NULL;
+    }
+
+    FLAC__StreamEncoder *encoder = stream->encoder;
+
+    FLAC__stream_encoder_set_channels(encoder, info->channels);
+    FLAC__stream_encoder_set_sample_rate(encoder, info->frequency);
+    FLAC__stream_encoder_set_bits_per_sample(encoder, (stream->out_format == FMT_S16_NE) ? 16 : 24);
+
+    /* the defaults were set by flac_init(); the dialog saves changes at once */
+    gint level = aud_get_int ("filewriter_flac", "compression_level");
+    FLAC__stream_encoder_set_compression_level(encoder, CLAMP (level, 0, 8));
+
+#ifdef FLAC_HAVE_THREADS
+    gint threads = aud_get_int ("filewriter_flac", "threads");
+    FLAC__stream_encoder_set_num_threads(encoder, CLAMP (threads, 1, FLAC_MAX_THREADS));
+#endif
 
     if (tuple)
     {
-        flac_metadata = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
-
-        insert_vorbis_comment (flac_metadata, "TITLE", tuple, FIELD_TITLE);
-        insert_vorbis_comment (flac_metadata, "ARTIST", tuple, FIELD_ARTIST);
-        insert_vorbis_comment (flac_metadata, "ALBUM", tuple, FIELD_ALBUM);
-        insert_vorbis_comment (flac_metadata, "GENRE", tuple, FIELD_GENRE);
-        insert_vorbis_comment (flac_metadata, "COMMENT", tuple, FIELD_COMMENT);
-        insert_vorbis_comment (flac_metadata, "DATE", tuple, FIELD_DATE);
-        insert_vorbis_comment (flac_metadata, "YEAR", tuple, FIELD_YEAR);
-        insert_vorbis_comment (flac_metadata, "TRACKNUMBER", tuple, FIELD_TRACK_NUMBER);
-
-        FLAC__stream_encoder_set_metadata(flac_encoder, &flac_metadata, 1);
+        stream->metadata = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
+
+        insert_vorbis_comment (stream->metadata, "TITLE", tuple, FIELD_TITLE);
+        insert_vorbis_comment (stream->metadata, "ARTIST", tuple, FIELD_ARTIST);
+        insert_vorbis_comment (stream->metadata, "ALBUM", tuple, FIELD_ALBUM);
+        insert_vorbis_comment (stream->metadata, "GENRE", tuple, FIELD_GENRE);
+        insert_vorbis_comment (stream->metadata, "COMMENT", tuple, FIELD_COMMENT);
+        insert_vorbis_comment (stream->metadata, "DATE", tuple, FIELD_DATE);
+        insert_vorbis_comment (stream->metadata, "YEAR", tuple, FIELD_YEAR);
+        insert_vorbis_comment (stream->metadata, "TRACKNUMBER", tuple, FIELD_TRACK_NUMBER);
+
+        FLAC__stream_encoder_set_metadata(encoder, &stream->metadata, 1);
     }
 
-    FLAC__stream_encoder_init_stream(flac_encoder, flac_write_cb, flac_seek_cb,
-     flac_tell_cb, NULL, output_file);
+    if (FLAC__stream_encoder_init_stream(encoder, flac_write_cb, flac_seek_cb,
+     flac_tell_cb, NULL, file) != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+    {
+        flac_close(stream);
+        return NULL;
+    }
 
-    return 1;
+    return stream;
 }
 
-static void flac_write(gpointer data, gint length)
+static void flac_write(void *_stream, gpointer data, gint length)
 {
-#if 1
-    FLAC__int32 *encbuffer[2];
-    int16_t *tmpdata = (int16_t *) data;
-    int i;
+    struct flac_stream *stream = (struct flac_stream *) _stream;
+    gint samples = length / FMT_SIZEOF (stream->out_format);
 
-    encbuffer[0] = g_new0(FLAC__int32, length / input.channels);
-    encbuffer[1] = g_new0(FLAC__int32, length / input.channels);
-
-    if (input.channels == 1)
+    if (stream->out_format == FMT_S24_NE)
     {
-        for (i = 0; i < (length / 2); i++)
-        {
-            encbuffer[0][i] = tmpdata[i];
-            encbuffer[1][i] = tmpdata[i];
-        }
+        /* 24-bit samples already come in 32-bit words */
+        FLAC__stream_encoder_process_interleaved(stream->encoder,
+         (const FLAC__int32 *) data, samples / stream->channels);
+        return;
     }
-    else
+
+    if (samples > stream->encbuffer_samples)
     {
-        for (i = 0; i < (length / 4); i++)
-        {
-            encbuffer[0][i] = tmpdata[2 * i];
-            encbuffer[1][i] = tmpdata[2 * i + 1];
-        }
+        stream->encbuffer = g_renew(FLAC__int32, stream->encbuffer, samples);
+        stream->encbuffer_samples = samples;
     }
 
-    FLAC__stream_encoder_process(flac_encoder, (const FLAC__int32 **)encbuffer, length / (input.channels * 2));
+    const int16_t *tmpdata = (const int16_t *) data;
 
-    g_free(encbuffer[0]);
-    g_free(encbuffer[1]);
-#else
-    FLAC__int32 *encbuffer;
-    gint16 *tmpdata = data;
-    int i;
+    for (gint i = 0; i < samples; i++)
+        stream->encbuffer[i] = tmpdata[i];
 
-    encbuffer = g_new0(FLAC__int32, length);
+    FLAC__stream_encoder_process_interleaved(stream->encoder, stream->encbuffer,
+     samples / stream->channels);
+}
 
-    for (i=0; i < length; i++) {
-        encbuffer[i] = tmpdata[i];
-    }
+static void flac_close(void *_stream)
+{
+    struct flac_stream *stream = (struct flac_stream *) _stream;
 
-    FLAC__stream_encoder_process_interleaved(flac_encoder, encbuffer, length);
+    FLAC__stream_encoder_finish(stream->encoder);
+    FLAC__stream_encoder_delete(stream->encoder);
 
-    g_free(encbuffer);
-#endif
+    if (stream->metadata)
+        FLAC__metadata_object_delete(stream->metadata);
+
+    g_free(stream->encbuffer);
+    g_free(stream);
 }
 
-static void flac_close(void)
+/* configuration stuff */
+static GtkWidget *configure_win = NULL;
+static GtkWidget *level_spin, *threads_spin;
+
+static void level_change(GtkSpinButton *spin, gpointer user_data)
 {
-    if (flac_encoder)
-    {
-        FLAC__stream_encoder_finish(flac_encoder);
-        FLAC__stream_encoder_delete(flac_encoder);
-        flac_encoder = NULL;
-    }
+    compression_level = gtk_spin_button_get_value_as_int (spin);
+    aud_set_int ("filewriter_flac", "compression_level", compression_level);
+}
 
-    if (flac_metadata)
-    {
-        FLAC__metadata_object_delete(flac_metadata);
-        flac_metadata = NULL;
-    }
+static void threads_change(GtkSpinButton *spin, gpointer user_data)
+{
+    encoder_threads = gtk_spin_button_get_value_as_int (spin);
+    aud_set_int ("filewriter_flac", "threads", encoder_threads);
 }
 
-static int flac_format_required (int fmt)
+static void add_spin_row(GtkWidget *vbox, const gchar *text, GtkWidget *spin)
+{
+    GtkWidget * hbox = gtk_hbox_new (FALSE, 5);
+    gtk_container_set_border_width(GTK_CONTAINER(hbox), 10);
+    gtk_container_add(GTK_CONTAINER(vbox), hbox);
+
+    GtkWidget * label = gtk_label_new(text);
+    gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+    gtk_box_pack_start(GTK_BOX(hbox), label, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), spin, TRUE, TRUE, 0);
+}
+
+static void flac_configure(void)
 {
-    return FMT_S16_NE;
+    if (! configure_win)
+    {
+        configure_win = gtk_dialog_new_with_buttons
+         (_("FLAC Encoder Configuration"), NULL, (GtkDialogFlags) 0,
+          _("_Close"), GTK_RESPONSE_CLOSE, NULL);
+
+        g_signal_connect (configure_win, "response", (GCallback) gtk_widget_destroy, NULL);
+        g_signal_connect (configure_win, "destroy", (GCallback)
+         gtk_widget_destroyed, & configure_win);
+
+        GtkWidget * vbox = gtk_dialog_get_content_area ((GtkDialog *) configure_win);
+
+        GtkWidget * frame = gtk_frame_new(_("Encoding"));
+        gtk_container_set_border_width(GTK_CONTAINER(frame), 5);
+        gtk_box_pack_start(GTK_BOX(vbox), frame, FALSE, FALSE, 2);
+
+        GtkWidget * frame_vbox = gtk_vbox_new (FALSE, 5);
+        gtk_container_set_border_width(GTK_CONTAINER(frame_vbox), 10);
+        gtk_container_add(GTK_CONTAINER(frame), frame_vbox);
+
+        level_spin = gtk_spin_button_new_with_range (0, 8, 1);
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(level_spin), compression_level);
+        add_spin_row(frame_vbox, _("Compression level (0 - 8):"), level_spin);
+        g_signal_connect(level_spin, "value-changed", G_CALLBACK(level_change), NULL);
+
+        threads_spin = gtk_spin_button_new_with_range (1, FLAC_MAX_THREADS, 1);
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(threads_spin), encoder_threads);
+        add_spin_row(frame_vbox, _("Encoder threads:"), threads_spin);
+        g_signal_connect(threads_spin, "value-changed", G_CALLBACK(threads_change), NULL);
+
+#ifndef FLAC_HAVE_THREADS
+        /* this libFLAC cannot encode in parallel */
+        gtk_widget_set_sensitive(threads_spin, FALSE);
+#endif
+    }
+
+    gtk_widget_show_all(configure_win);
 }
 
 FileWriter flac_plugin = {
-    nullptr,  // init
-    nullptr,  // configure
+    flac_init,
+    flac_configure,
     flac_open,
     flac_write,
     flac_close,
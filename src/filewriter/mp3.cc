@@ -38,8 +38,6 @@ static const gint modes[MODES] = {MODE_AUTO, MODE_JOINT, MODE_STEREO, MODE_MONO}
 static const gchar * const mode_names[MODES] = {N_("Auto"), N_("Joint Stereo"),
  N_("Stereo"), N_("Mono")};
 
-static gint (*write_output)(void *ptr, gint length);
-
 static GtkWidget *configure_win = NULL;
 static GtkWidget *alg_quality_spin;
 static GtkWidget *alg_quality_hbox;
@@ -70,7 +68,6 @@ static GtkWidget *tags_id3_frame, *tags_id3_vbox, *tags_id3_hbox,
 
 static GtkWidget *enc_quality_vbox, *hbox1, *hbox2;
 
-static unsigned long numsamples = 0;
 static int inside;
 
 static gint available_samplerates[] =
@@ -88,14 +85,19 @@ struct lameid3_t {
     String track_number;
 };
 
-static lameid3_t lameid3;
+struct mp3_stream {
+    VFSFile *file;
+    gint channels;
 
-static lame_global_flags *gfp;
-static unsigned char encbuffer[LAME_MAXMP3BUFFER];
-static int id3v2_size;
+    lame_global_flags *gfp;
+    lameid3_t lameid3;
+    unsigned char encbuffer[LAME_MAXMP3BUFFER];
+    int id3v2_size;
+    unsigned long numsamples;
 
-static guchar * write_buffer;
-static gint write_buffer_size;
+    guchar * write_buffer;
+    gint write_buffer_size;
+};
 
 static void lame_debugf(const char *format, va_list ap)
 {
@@ -133,7 +135,7 @@ static gint vbr_on, vbr_type, vbr_min_val, vbr_max_val, enforce_min_val,
 static gfloat compression_val;
 static gint enc_toggle_val, audio_mode_val, enforce_iso_val, error_protect_val;
 
-static void mp3_init(write_output_callback write_output_func)
+static void mp3_init(void)
 {
     aud_config_set_defaults ("filewriter_mp3", mp3_defaults);
 
@@ -158,18 +160,28 @@ static void mp3_init(write_output_callback write_output_func)
     audio_mode_val = aud_get_int ("filewriter_mp3", "audio_mode_val");
     enforce_iso_val = aud_get_int ("filewriter_mp3", "enforce_iso_val");
     error_protect_val = aud_get_int ("filewriter_mp3", "error_protect_val");
+}
 
-    if (write_output_func)
-        write_output=write_output_func;
+static void write_output (struct mp3_stream *stream, void *ptr, gint length)
+{
+    if (vfs_fwrite (ptr, 1, length, stream->file) != length)
+        AUDDBG("write error\n");
 }
 
-static gint mp3_open(void)
+static void * mp3_open(VFSFile *file, const struct format_info *info, const Tuple &tuple)
 {
     int imp3;
 
-    gfp = lame_init();
+    lame_global_flags *gfp = lame_init();
     if (gfp == NULL)
-        return 0;
+        return NULL;
+
+    struct mp3_stream *stream = new mp3_stream ();
+    lameid3_t &lameid3 = stream->lameid3;
+
+    stream->file = file;
+    stream->channels = info->channels;
+    stream->gfp = gfp;
 
     /* setup id3 data */
     id3tag_init(gfp);
@@ -207,8 +219,8 @@ static gint mp3_open(void)
 
     /* input stream description */
 
-    lame_set_in_samplerate(gfp, input.frequency);
-    lame_set_num_channels(gfp, input.channels);
+    lame_set_in_samplerate(gfp, info->frequency);
+    lame_set_num_channels(gfp, info->channels);
     /* Maybe implement this? */
     /* lame_set_scale(lame_global_flags *, float); */
     lame_set_out_samplerate(gfp, out_samplerate_val);
@@ -253,104 +265,106 @@ static gint mp3_open(void)
     /* not to write id3 tag automatically. */
     lame_set_write_id3tag_automatic(gfp, 0);
 
-    if (lame_init_params(gfp) == -1)
-        return 0;
+    if (lame_init_params(gfp) == -1) {
+        lame_close(gfp);
+        delete stream;
+        return NULL;
+    }
 
     /* write id3v2 header */
-    imp3 = lame_get_id3v2_tag(gfp, encbuffer, sizeof(encbuffer));
+    imp3 = lame_get_id3v2_tag(gfp, stream->encbuffer, sizeof(stream->encbuffer));
 
     if (imp3 > 0) {
-        write_output(encbuffer, imp3);
-        id3v2_size = imp3;
+        write_output(stream, stream->encbuffer, imp3);
+        stream->id3v2_size = imp3;
     }
     else {
-        id3v2_size = 0;
+        stream->id3v2_size = 0;
     }
 
-    write_buffer = NULL;
-    write_buffer_size = 0;
-
-    return 1;
+    return stream;
 }
 
-static void mp3_write(void *ptr, gint length)
+static void mp3_write(void *_stream, void *ptr, gint length)
 {
+    struct mp3_stream *stream = (struct mp3_stream *) _stream;
     gint encoded;
 
-    if (write_buffer_size == 0)
+    if (stream->write_buffer_size == 0)
     {
-        write_buffer_size = 8192;
-        write_buffer = g_renew (guchar, write_buffer, write_buffer_size);
+        stream->write_buffer_size = 8192;
+        stream->write_buffer = g_renew (guchar, stream->write_buffer, stream->write_buffer_size);
     }
 
 RETRY:
-    if (input.channels == 1)
-        encoded = lame_encode_buffer (gfp, (int16_t *) ptr, (int16_t *) ptr,
-         length / 2, write_buffer, write_buffer_size);
+    if (stream->channels == 1)
+        encoded = lame_encode_buffer (stream->gfp, (int16_t *) ptr, (int16_t *) ptr,
+         length / 2, stream->write_buffer, stream->write_buffer_size);
     else
-        encoded = lame_encode_buffer_interleaved (gfp, (int16_t *) ptr,
-         length / 4, write_buffer, write_buffer_size);
+        encoded = lame_encode_buffer_interleaved (stream->gfp, (int16_t *) ptr,
+         length / 4, stream->write_buffer, stream->write_buffer_size);
 
     if (encoded == -1)
     {
-        write_buffer_size *= 2;
-        write_buffer = g_renew (guchar, write_buffer, write_buffer_size);
+        stream->write_buffer_size *= 2;
+        stream->write_buffer = g_renew (guchar, stream->write_buffer, stream->write_buffer_size);
         goto RETRY;
     }
 
     if (encoded > 0)
-        write_output (write_buffer, encoded);
+        write_output (stream, stream->write_buffer, encoded);
 
-    numsamples += length / (2 * input.channels);
+    stream->numsamples += length / (2 * stream->channels);
 }
 
-static void mp3_close(void)
+static void mp3_close(void *_stream)
 {
-    if (output_file) {
-        int imp3, encout;
-
-        /* write remaining mp3 data */
-        encout = lame_encode_flush_nogap(gfp, encbuffer, LAME_MAXMP3BUFFER);
-        write_output(encbuffer, encout);
-
-        /* set gfp->num_samples for valid TLEN tag */
-        lame_set_num_samples(gfp, numsamples);
-
-        /* append v1 tag */
-        imp3 = lame_get_id3v1_tag(gfp, encbuffer, sizeof(encbuffer));
-        if (imp3 > 0)
-            write_output(encbuffer, imp3);
-
-        /* update v2 tag */
-        imp3 = lame_get_id3v2_tag(gfp, encbuffer, sizeof(encbuffer));
-        if (imp3 > 0) {
-            if (vfs_fseek(output_file, 0, SEEK_SET) != 0) {
-                AUDDBG("can't rewind\n");
-            }
-            else {
-                write_output(encbuffer, imp3);
-            }
+    struct mp3_stream *stream = (struct mp3_stream *) _stream;
+    lame_global_flags *gfp = stream->gfp;
+    unsigned char *encbuffer = stream->encbuffer;
+
+    int imp3, encout;
+
+    /* write remaining mp3 data */
+    encout = lame_encode_flush_nogap(gfp, encbuffer, LAME_MAXMP3BUFFER);
+    write_output(stream, encbuffer, encout);
+
+    /* set gfp->num_samples for valid TLEN tag */
+    lame_set_num_samples(gfp, stream->numsamples);
+
+    /* append v1 tag */
+    imp3 = lame_get_id3v1_tag(gfp, encbuffer, LAME_MAXMP3BUFFER);
+    if (imp3 > 0)
+        write_output(stream, encbuffer, imp3);
+
+    /* update v2 tag */
+    imp3 = lame_get_id3v2_tag(gfp, encbuffer, LAME_MAXMP3BUFFER);
+    if (imp3 > 0) {
+        if (vfs_fseek(stream->file, 0, SEEK_SET) != 0) {
+            AUDDBG("can't rewind\n");
+        }
+        else {
+            write_output(stream, encbuffer, imp3);
         }
+    }
 
-        /* update lame tag */
-        if (id3v2_size) {
-            if (vfs_fseek(output_file, id3v2_size, SEEK_SET) != 0) {
-                AUDDBG("fatal error: can't update LAME-tag frame!\n");
-            }
-            else {
-                imp3 = lame_get_lametag_frame(gfp, encbuffer, sizeof(encbuffer));
-                write_output(encbuffer, imp3);
-            }
+    /* update lame tag */
+    if (stream->id3v2_size) {
+        if (vfs_fseek(stream->file, stream->id3v2_size, SEEK_SET) != 0) {
+            AUDDBG("fatal error: can't update LAME-tag frame!\n");
+        }
+        else {
+            imp3 = lame_get_lametag_frame(gfp, encbuffer, LAME_MAXMP3BUFFER);
+            write_output(stream, encbuffer, imp3);
         }
     }
 
-    g_free (write_buffer);
+    g_free (stream->write_buffer);
 
     lame_close(gfp);
     AUDDBG("lame_close() done\n");
 
-    lameid3 = lameid3_t ();
-    numsamples = 0;
+    delete stream;
 }
 
 /*****************/
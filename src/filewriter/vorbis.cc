@@ -30,16 +30,19 @@
 #include <libaudcore/runtime.h>
 #include <libaudcore/audstrings.h>
 
-static gint (*write_output)(void *ptr, gint length);
-
-static ogg_stream_state os;
-static ogg_page og;
-static ogg_packet op;
-
-static vorbis_dsp_state vd;
-static vorbis_block vb;
-static vorbis_info vi;
-static vorbis_comment vc;
+struct vorbis_stream {
+    VFSFile *file;
+    gint channels;
+
+    ogg_stream_state os;
+    ogg_page og;
+    ogg_packet op;
+
+    vorbis_dsp_state vd;
+    vorbis_block vb;
+    vorbis_info vi;
+    vorbis_comment vc;
+};
 
 static const gchar * const vorbis_defaults[] = {
  "base_quality", "0.5",
@@ -47,14 +50,17 @@ static const gchar * const vorbis_defaults[] = {
 
 static gdouble v_base_quality;
 
-static void vorbis_init(write_output_callback write_output_func)
+static void vorbis_init(void)
 {
     aud_config_set_defaults ("filewriter_vorbis", vorbis_defaults);
 
     v_base_quality = aud_get_double ("filewriter_vorbis", "base_quality");
+}
 
-    if (write_output_func)
-        write_output=write_output_func;
+static void write_page (struct vorbis_stream *stream)
+{
+    vfs_fwrite (stream->og.header, 1, stream->og.header_len, stream->file);
+    vfs_fwrite (stream->og.body, 1, stream->og.body_len, stream->file);
 }
 
 static void add_string_from_tuple (vorbis_comment * vc, const char * name,
@@ -65,120 +71,124 @@ static void add_string_from_tuple (vorbis_comment * vc, const char * name,
         vorbis_comment_add_tag (vc, name, val);
 }
 
-static gint vorbis_open(void)
+static void * vorbis_open(VFSFile *file, const struct format_info *info, const Tuple &tuple)
 {
     ogg_packet header;
     ogg_packet header_comm;
     ogg_packet header_code;
 
-    vorbis_init(NULL);
+    vorbis_init();
+
+    struct vorbis_stream *stream = g_new0 (struct vorbis_stream, 1);
+    vorbis_comment *vc = &stream->vc;
+
+    stream->file = file;
+    stream->channels = info->channels;
 
-    vorbis_info_init(&vi);
-    vorbis_comment_init(&vc);
+    vorbis_info_init(&stream->vi);
+    vorbis_comment_init(vc);
 
     if (tuple)
     {
         gint scrint;
 
-        add_string_from_tuple (& vc, "title", tuple, FIELD_TITLE);
-        add_string_from_tuple (& vc, "artist", tuple, FIELD_ARTIST);
-        add_string_from_tuple (& vc, "album", tuple, FIELD_ALBUM);
-        add_string_from_tuple (& vc, "genre", tuple, FIELD_GENRE);
-        add_string_from_tuple (& vc, "date", tuple, FIELD_DATE);
-        add_string_from_tuple (& vc, "comment", tuple, FIELD_COMMENT);
+        add_string_from_tuple (vc, "title", tuple, FIELD_TITLE);
+        add_string_from_tuple (vc, "artist", tuple, FIELD_ARTIST);
+        add_string_from_tuple (vc, "album", tuple, FIELD_ALBUM);
+        add_string_from_tuple (vc, "genre", tuple, FIELD_GENRE);
+        add_string_from_tuple (vc, "date", tuple, FIELD_DATE);
+        add_string_from_tuple (vc, "comment", tuple, FIELD_COMMENT);
 
         if ((scrint = tuple.get_int (FIELD_TRACK_NUMBER)) > 0)
-            vorbis_comment_add_tag(&vc, "tracknumber", int_to_str (scrint));
+            vorbis_comment_add_tag(vc, "tracknumber", int_to_str (scrint));
 
         if ((scrint = tuple.get_int (FIELD_YEAR)) > 0)
-            vorbis_comment_add_tag(&vc, "year", int_to_str (scrint));
+            vorbis_comment_add_tag(vc, "year", int_to_str (scrint));
     }
 
-    if (vorbis_encode_init_vbr (& vi, input.channels, input.frequency,
+    if (vorbis_encode_init_vbr (& stream->vi, info->channels, info->frequency,
      v_base_quality))
     {
-        vorbis_info_clear(&vi);
-        return 0;
+        vorbis_comment_clear(vc);
+        vorbis_info_clear(&stream->vi);
+        g_free(stream);
+        return NULL;
     }
 
-    vorbis_analysis_init(&vd, &vi);
-    vorbis_block_init(&vd, &vb);
+    vorbis_analysis_init(&stream->vd, &stream->vi);
+    vorbis_block_init(&stream->vd, &stream->vb);
 
-    srand(time(NULL));
-    ogg_stream_init(&os, rand());
+    ogg_stream_init(&stream->os, g_random_int ());
 
-    vorbis_analysis_headerout(&vd, &vc, &header, &header_comm, &header_code);
+    vorbis_analysis_headerout(&stream->vd, vc, &header, &header_comm, &header_code);
 
-    ogg_stream_packetin(&os, &header);
-    ogg_stream_packetin(&os, &header_comm);
-    ogg_stream_packetin(&os, &header_code);
+    ogg_stream_packetin(&stream->os, &header);
+    ogg_stream_packetin(&stream->os, &header_comm);
+    ogg_stream_packetin(&stream->os, &header_code);
 
-    while (ogg_stream_flush (& os, & og))
-    {
-        write_output(og.header, og.header_len);
-        write_output(og.body, og.body_len);
-    }
+    while (ogg_stream_flush (& stream->os, & stream->og))
+        write_page (stream);
 
-    return 1;
+    return stream;
 }
 
-static void vorbis_write_real (void * data, gint length)
+static void vorbis_write_real (struct vorbis_stream * stream, void * data, gint length)
 {
     int samples = length / sizeof (float);
-    int channel, result;
+    int channels = stream->channels;
+    int channel;
     float * end = (float *) data + samples;
-    float * * buffer = vorbis_analysis_buffer (& vd, samples / input.channels);
+    float * * buffer = vorbis_analysis_buffer (& stream->vd, samples / channels);
     float * from, * to;
 
-    for (channel = 0; channel < input.channels; channel ++)
+    for (channel = 0; channel < channels; channel ++)
     {
         to = buffer[channel];
 
-        for (from = (float *) data + channel; from < end; from += input.channels)
+        for (from = (float *) data + channel; from < end; from += channels)
             * to ++ = * from;
     }
 
-    vorbis_analysis_wrote (& vd, samples / input.channels);
+    vorbis_analysis_wrote (& stream->vd, samples / channels);
 
-    while(vorbis_analysis_blockout(&vd, &vb) == 1)
+    while(vorbis_analysis_blockout(&stream->vd, &stream->vb) == 1)
     {
-        vorbis_analysis(&vb, &op);
-        vorbis_bitrate_addblock(&vb);
+        vorbis_analysis(&stream->vb, &stream->op);
+        vorbis_bitrate_addblock(&stream->vb);
 
-        while (vorbis_bitrate_flushpacket(&vd, &op))
+        while (vorbis_bitrate_flushpacket(&stream->vd, &stream->op))
         {
-            ogg_stream_packetin(&os, &op);
+            ogg_stream_packetin(&stream->os, &stream->op);
 
-            while ((result = ogg_stream_pageout(&os, &og)))
-            {
-                write_output(og.header, og.header_len);
-                write_output(og.body, og.body_len);
-            }
+            while (ogg_stream_pageout(&stream->os, &stream->og))
+                write_page (stream);
         }
     }
 }
 
-static void vorbis_write (void * data, gint length)
+static void vorbis_write (void * stream, void * data, gint length)
 {
     if (length > 0) /* don't signal end of file yet */
-        vorbis_write_real (data, length);
+        vorbis_write_real ((struct vorbis_stream *) stream, data, length);
 }
 
-static void vorbis_close(void)
+static void vorbis_close(void * _stream)
 {
-    vorbis_write_real (NULL, 0); /* signal end of file */
+    struct vorbis_stream *stream = (struct vorbis_stream *) _stream;
 
-    while (ogg_stream_flush (& os, & og))
-    {
-        write_output (og.header, og.header_len);
-        write_output (og.body, og.body_len);
-    }
+    vorbis_write_real (stream, NULL, 0); /* signal end of file */
+
+    while (ogg_stream_flush (& stream->os, & stream->og))
+        write_page (stream);
+
+    ogg_stream_clear(&stream->os);
 
-    ogg_stream_clear(&os);
+    vorbis_block_clear(&stream->vb);
+    vorbis_dsp_clear(&stream->vd);
+    vorbis_comment_clear(&stream->vc);
+    vorbis_info_clear(&stream->vi);
 
-    vorbis_block_clear(&vb);
-    vorbis_dsp_clear(&vd);
-    vorbis_info_clear(&vi);
+    g_free(stream);
 }
 
 /* configuration stuff */
@@ -44,40 +44,50 @@ struct wavhead
 };
 #pragma pack(pop)
 
-static struct wavhead header;
-
-static guint64 written;
+struct wav_stream {
+    VFSFile *file;
+    gint format;
+    struct wavhead header;
+    guint64 written;
+};
 
-static gint wav_open(void)
+static void * wav_open(VFSFile *file, const struct format_info *info, const Tuple &tuple)
 {
+    struct wav_stream *stream = g_new0 (struct wav_stream, 1);
+    struct wavhead &header = stream->header;
+
+    stream->file = file;
+    stream->format = info->format;
+
     memcpy(&header.main_chunk, "RIFF", 4);
     header.length = TO_LE32(0);
     memcpy(&header.chunk_type, "WAVE", 4);
     memcpy(&header.sub_chunk, "fmt ", 4);
     header.sc_len = TO_LE32(16);
-    if (input.format == FMT_FLOAT)
+    if (info->format == FMT_FLOAT)
         header.format = TO_LE16(3);
     else
         header.format = TO_LE16(1);
-    header.modus = TO_LE16(input.channels);
-    header.sample_fq = TO_LE32(input.frequency);
-    if (input.format == FMT_S16_LE)
+    header.modus = TO_LE16(info->channels);
+    header.sample_fq = TO_LE32(info->frequency);
+    if (info->format == FMT_S16_LE)
         header.bit_p_spl = TO_LE16(16);
-    else if (input.format == FMT_S24_LE)
+    else if (info->format == FMT_S24_LE)
         header.bit_p_spl = TO_LE16(24);
     else
         header.bit_p_spl = TO_LE16(32);
-    header.byte_p_sec = TO_LE32(input.frequency * header.modus * (FROM_LE16(header.bit_p_spl) / 8));
-    header.byte_p_spl = TO_LE16((FROM_LE16(header.bit_p_spl) / (8 / input.channels)));
+    header.byte_p_sec = TO_LE32(info->frequency * header.modus * (FROM_LE16(header.bit_p_spl) / 8));
+    header.byte_p_spl = TO_LE16((FROM_LE16(header.bit_p_spl) / (8 / info->channels)));
     memcpy(&header.data_chunk, "data", 4);
     header.data_length = TO_LE32(0);
 
-    if (vfs_fwrite (& header, 1, sizeof header, output_file) != sizeof header)
-        return 0;
-
-    written = 0;
+    if (vfs_fwrite (& header, 1, sizeof header, file) != sizeof header)
+    {
+        g_free (stream);
+        return NULL;
+    }
 
-    return 1;
+    return stream;
 }
 
 static void pack24 (void * * data, int * len)
@@ -97,30 +107,34 @@ static void pack24 (void * * data, int * len)
     }
 }
 
-static void wav_write (void * data, gint len)
+static void wav_write (void * _stream, void * data, gint len)
 {
-    if (input.format == FMT_S24_LE)
+    struct wav_stream *stream = (struct wav_stream *) _stream;
+
+    if (stream->format == FMT_S24_LE)
         pack24 (& data, & len);
 
-    written += len;
-    if (vfs_fwrite (data, 1, len, output_file) != len)
+    stream->written += len;
+    if (vfs_fwrite (data, 1, len, stream->file) != len)
         fprintf (stderr, "Error while writing to .wav output file.\n");
 
-    if (input.format == FMT_S24_LE)
+    if (stream->format == FMT_S24_LE)
         g_free (data);
 }
 
-static void wav_close(void)
+static void wav_close(void * _stream)
 {
-    if (output_file)
-    {
-        header.length = TO_LE32(written + sizeof (struct wavhead) - 8);
-        header.data_length = TO_LE32(written);
+    struct wav_stream *stream = (struct wav_stream *) _stream;
+    struct wavhead &header = stream->header;
 
-        if (vfs_fseek (output_file, 0, SEEK_SET) || vfs_fwrite (& header, 1,
-         sizeof header, output_file) != sizeof header)
-            fprintf (stderr, "Error while writing to .wav output file.\n");
-    }
+    header.length = TO_LE32(stream->written + sizeof (struct wavhead) - 8);
+    header.data_length = TO_LE32(stream->written);
+
+    if (vfs_fseek (stream->file, 0, SEEK_SET) || vfs_fwrite (& header, 1,
+     sizeof header, stream->file) != sizeof header)
+        fprintf (stderr, "Error while writing to .wav output file.\n");
+
+    g_free (stream);
 }
 
 static int wav_format_required (int fmt)
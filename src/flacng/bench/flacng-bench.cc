@@ -0,0 +1,182 @@
+/*
+ *  A FLAC decoder plugin for the Audacious Media Player
+ *  Copyright (C) 2005 Ralf Ertzinger
+ *  Copyright (C) 2010-2012 Michał Lipski
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Micro-benchmark for write_callback.  Random blocks are run through the
+ * current write_callback and through the old two-pass code (interleave into
+ * 32-bit samples, then squeeze_audio to the output size), for each sample
+ * size and channel count.  The outputs are compared before timing.
+ *
+ * usage: flacng-bench [blocks]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+
+#include "../flacng.h"
+
+#define BLOCKSIZE 4096
+
+static const unsigned channel_counts[] = {1, 2, 6, 8};
+static const unsigned sample_sizes[] = {8, 16, 24};
+
+/* the code this replaced, from the old write_callback and plugin.c */
+
+static void old_write(const FLAC__Frame *frame, const FLAC__int32 *const buffer[], int32_t *write_pointer)
+{
+    for (unsigned sample = 0; sample < frame->header.blocksize; sample++)
+        for (unsigned channel = 0; channel < frame->header.channels; channel++)
+            *(write_pointer++) = buffer[channel][sample];
+}
+
+static void squeeze_audio(int32_t* src, void* dst, unsigned count, unsigned res)
+{
+    int32_t* rp = src;
+    int8_t*  wp = (int8_t*) dst;
+    int16_t* wp2 = (int16_t*) dst;
+    int32_t* wp4 = (int32_t*) dst;
+
+    switch (res)
+    {
+        case 8:
+            for (unsigned i = 0; i < count; i++, wp++, rp++)
+                *wp = *rp & 0xff;
+            break;
+
+        case 16:
+            for (unsigned i = 0; i < count; i++, wp2++, rp++)
+                *wp2 = *rp & 0xffff;
+            break;
+
+        case 24:
+        case 32:
+            for (unsigned i = 0; i < count; i++, wp4++, rp++)
+                *wp4 = *rp;
+            break;
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    int blocks = (argc > 1) ? atoi(argv[1]) : 20000;
+
+    if (blocks < 1)
+    {
+        fprintf(stderr, "usage: %s [blocks]\n", argv[0]);
+        return 2;
+    }
+
+    FLAC__int32 *planes[FLAC__MAX_CHANNELS];
+    int32_t *wide = g_new(int32_t, BLOCKSIZE * FLAC__MAX_CHANNELS);
+    char *expected = (char *) g_malloc(BUFFER_SIZE_BYTE);
+
+    callback_info info = callback_info();
+    info.output_buffer = (char *) g_malloc(BUFFER_SIZE_BYTE);
+    info.sample_rate = 44100;
+
+    FLAC__Frame frame = FLAC__Frame();
+    frame.header.blocksize = BLOCKSIZE;
+    frame.header.sample_rate = info.sample_rate;
+
+    int failures = 0;
+
+    printf("%d blocks of %d frames\n\n", blocks, BLOCKSIZE);
+
+    for (unsigned bits : sample_sizes)
+    {
+        for (unsigned channels : channel_counts)
+        {
+            /* random samples that fit in the sample size */
+            for (unsigned channel = 0; channel < channels; channel++)
+            {
+                planes[channel] = g_new(FLAC__int32, BLOCKSIZE);
+
+                for (int i = 0; i < BLOCKSIZE; i++)
+                    planes[channel][i] = (FLAC__int32) ((unsigned) rand() << 1) >> (32 - bits);
+            }
+
+            info.bits_per_sample = bits;
+            info.channels = channels;
+            frame.header.channels = channels;
+            frame.header.bits_per_sample = bits;
+
+            unsigned samples = BLOCKSIZE * channels;
+            unsigned bytes = samples * SAMPLE_SIZE(bits);
+
+            old_write(&frame, planes, wide);
+            squeeze_audio(wide, expected, samples, bits);
+
+            info.write_pointer = info.output_buffer;
+            info.buffer_used = 0;
+            write_callback(NULL, &frame, planes, &info);
+
+            if (info.buffer_used != samples || memcmp(info.output_buffer, expected, bytes))
+            {
+                printf("%2u bit %u ch: output differs from the old code\n", bits, channels);
+                failures++;
+            }
+
+            double start = now();
+
+            for (int i = 0; i < blocks; i++)
+            {
+                old_write(&frame, planes, wide);
+                squeeze_audio(wide, expected, samples, bits);
+            }
+
+            double old_time = now() - start;
+            start = now();
+
+            for (int i = 0; i < blocks; i++)
+            {
+                info.write_pointer = info.output_buffer;
+                info.buffer_used = 0;
+                write_callback(NULL, &frame, planes, &info);
+            }
+
+            double new_time = now() - start;
+            double frames = (double) blocks * BLOCKSIZE;
+
+            printf("%2u bit %u ch:  old %7.1f Mframes/s  new %7.1f Mframes/s  %5.2fx\n",
+             bits, channels, frames / old_time / 1e6, frames / new_time / 1e6,
+             old_time / new_time);
+
+            for (unsigned channel = 0; channel < channels; channel++)
+                g_free(planes[channel]);
+        }
+    }
+
+    g_free(info.output_buffer);
+    g_free(expected);
+    g_free(wide);
+
+    return failures ? 1 : 0;
+}
@@ -41,13 +41,18 @@ typedef struct callback_info {
     unsigned sample_rate;
     unsigned channels;
     unsigned long total_samples;
-    int32_t* output_buffer;
-    int32_t* write_pointer;
-    unsigned buffer_used;
+    char* output_buffer;  /* packed to the output format by write_callback */
+    char* write_pointer;
+    unsigned buffer_used; /* samples */
     VFSFile* fd;
     int bitrate;
 } callback_info;
 
+typedef struct decoder_instance {
+    FLAC__StreamDecoder* decoder;
+    callback_info* info;
+} decoder_instance;
+
 /* metadata.c */
 bool_t flac_update_song_tuple(const char *filename, VFSFile *fd, const Tuple &tuple);
 bool_t flac_get_image(const char *filename, VFSFile *fd, void **data, int64_t *length);
@@ -68,5 +73,8 @@ callback_info* init_callback_info(void);
 void clean_callback_info(callback_info* info);
 void reset_info(callback_info* info);
 bool_t read_metadata(FLAC__StreamDecoder* decoder, callback_info* info);
+decoder_instance* get_decoder_instance(void);
+void put_decoder_instance(decoder_instance* inst);
+void clean_decoder_pool(void);
 
 #endif
@@ -28,52 +28,9 @@
 
 #include "flacng.h"
 
-static FLAC__StreamDecoder *decoder;
-static callback_info *info;
-
-static bool_t flac_init (void)
-{
-    FLAC__StreamDecoderInitStatus ret;
-
-    /* Callback structure and decoder for main decoding loop */
-
-    if ((info = init_callback_info()) == NULL)
-    {
-        FLACNG_ERROR("Could not initialize the main callback structure!\n");
-        return FALSE;
-    }
-
-    if ((decoder = FLAC__stream_decoder_new()) == NULL)
-    {
-        FLACNG_ERROR("Could not create the main FLAC decoder instance!\n");
-        return FALSE;
-    }
-
-    if (FLAC__STREAM_DECODER_INIT_STATUS_OK != (ret = FLAC__stream_decoder_init_stream(
-        decoder,
-        read_callback,
-        seek_callback,
-        tell_callback,
-        length_callback,
-        eof_callback,
-        write_callback,
-        metadata_callback,
-        error_callback,
-        info)))
-    {
-        FLACNG_ERROR("Could not initialize the main FLAC decoder: %s(%d)\n",
-            FLAC__StreamDecoderInitStatusString[ret], ret);
-        return FALSE;
-    }
-
-    AUDDBG("Plugin initialized.\n");
-    return TRUE;
-}
-
 static void flac_cleanup(void)
 {
-    FLAC__stream_decoder_delete(decoder);
-    clean_callback_info(info);
+    clean_decoder_pool();
 }
 
 bool_t flac_is_our_fd(const char *filename, VFSFile *fd)
@@ -90,44 +47,20 @@ bool_t flac_is_our_fd(const char *filename, VFSFile *fd)
     return ! strncmp (buf, "fLaC", sizeof buf);
 }
 
-static void squeeze_audio(int32_t* src, void* dst, unsigned count, unsigned res)
-{
-    int32_t* rp = src;
-    int8_t*  wp = (int8_t*) dst;
-    int16_t* wp2 = (int16_t*) dst;
-    int32_t* wp4 = (int32_t*) dst;
-
-    switch (res)
-    {
-        case 8:
-            for (unsigned i = 0; i < count; i++, wp++, rp++)
-                *wp = *rp & 0xff;
-            break;
-
-        case 16:
-            for (unsigned i = 0; i < count; i++, wp2++, rp++)
-                *wp2 = *rp & 0xffff;
-            break;
-
-        case 24:
-        case 32:
-            for (unsigned i = 0; i < count; i++, wp4++, rp++)
-                *wp4 = *rp;
-            break;
-
-        default:
-            FLACNG_ERROR("Can not convert to %u bps\n", res);
-    }
-}
-
 static bool_t flac_play (const char * filename, VFSFile * file)
 {
     if (!file)
         return FALSE;
 
-    void * play_buffer = NULL;
     bool_t error = FALSE;
 
+    decoder_instance *inst = get_decoder_instance();
+    if (! inst)
+        return FALSE;
+
+    FLAC__StreamDecoder *decoder = inst->decoder;
+    callback_info *info = inst->info;
+
     info->fd = file;
 
     if (read_metadata(decoder, info) == FALSE)
@@ -137,8 +70,6 @@ static bool_t flac_play (const char * filename, VFSFile * file)
         goto ERR_NO_CLOSE;
     }
 
-    play_buffer = g_malloc (BUFFER_SIZE_BYTE);
-
     if (! aud_input_open_audio (SAMPLE_FMT (info->bits_per_sample),
         info->sample_rate, info->channels))
     {
@@ -166,18 +97,13 @@ static bool_t flac_play (const char * filename, VFSFile * file)
             break;
         }
 
-        squeeze_audio(info->output_buffer, play_buffer, info->buffer_used, info->bits_per_sample);
-        aud_input_write_audio(play_buffer, info->buffer_used * SAMPLE_SIZE(info->bits_per_sample));
+        aud_input_write_audio(info->output_buffer, info->buffer_used * SAMPLE_SIZE(info->bits_per_sample));
 
         reset_info(info);
     }
 
 ERR_NO_CLOSE:
-    g_free (play_buffer);
-    reset_info(info);
-
-    if (FLAC__stream_decoder_flush(decoder) == FALSE)
-        FLACNG_ERROR("Could not flush decoder state!\n");
+    put_decoder_instance(inst);
 
     return ! error;
 }
@@ -191,7 +117,6 @@ static const char *flac_fmts[] = { "flac", "fla", NULL };
 
 #define AUD_PLUGIN_NAME        N_("FLAC Decoder")
 #define AUD_PLUGIN_ABOUT       flac_about
-#define AUD_PLUGIN_INIT        flac_init
 #define AUD_PLUGIN_CLEANUP     flac_cleanup
 #define AUD_INPUT_PLAY         flac_play
 #define AUD_INPUT_READ_TUPLE   flac_probe_for_tuple
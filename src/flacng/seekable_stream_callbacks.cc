@@ -18,13 +18,200 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#include <stdint.h>
 #include <string.h>
 #include <FLAC/all.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <libaudcore/runtime.h>
 
 #include "flacng.h"
 
+/*
+ * Interleaving and packing to the output sample size is done in one pass.
+ * The channel count is made a compile-time constant for the common layouts so
+ * that the inner loop can be unrolled, and stereo and 5.1 have SSE2 versions.
+ */
+
+template<class T>
+static void pack_any(const FLAC__int32 *const in[], unsigned channels, unsigned frames, T *out)
+{
+    for (unsigned sample = 0; sample < frames; sample++)
+        for (unsigned channel = 0; channel < channels; channel++)
+            *(out++) = in[channel][sample];
+}
+
+template<class T, unsigned CH>
+static void pack_fixed(const FLAC__int32 *const in[], unsigned frames, T *out)
+{
+    for (unsigned sample = 0; sample < frames; sample++)
+        for (unsigned channel = 0; channel < CH; channel++)
+            *(out++) = in[channel][sample];
+}
+
+template<class T>
+static void pack_stereo(const FLAC__int32 *const in[], unsigned frames, T *out)
+{
+    pack_fixed<T, 2>(in, frames, out);
+}
+
+template<class T>
+static void pack_6ch(const FLAC__int32 *const in[], unsigned frames, T *out)
+{
+    pack_fixed<T, 6>(in, frames, out);
+}
+
+#ifdef __SSE2__
+
+template<>
+void pack_stereo<int16_t>(const FLAC__int32 *const in[], unsigned frames, int16_t *out)
+{
+    unsigned sample = 0;
+
+    for (; sample + 4 <= frames; sample += 4)
+    {
+        __m128i l = _mm_loadu_si128((const __m128i *) (in[0] + sample));
+        __m128i r = _mm_loadu_si128((const __m128i *) (in[1] + sample));
+
+        /* 16-bit samples always fit, so the saturation never kicks in */
+        l = _mm_packs_epi32(l, l);
+        r = _mm_packs_epi32(r, r);
+
+        _mm_storeu_si128((__m128i *) (out + 2 * sample), _mm_unpacklo_epi16(l, r));
+    }
+
+    for (; sample < frames; sample++)
+    {
+        out[2 * sample] = in[0][sample];
+        out[2 * sample + 1] = in[1][sample];
+    }
+}
+
+template<>
+void pack_stereo<int32_t>(const FLAC__int32 *const in[], unsigned frames, int32_t *out)
+{
+    unsigned sample = 0;
+
+    for (; sample + 4 <= frames; sample += 4)
+    {
+        __m128i l = _mm_loadu_si128((const __m128i *) (in[0] + sample));
+        __m128i r = _mm_loadu_si128((const __m128i *) (in[1] + sample));
+
+        _mm_storeu_si128((__m128i *) (out + 2 * sample), _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128((__m128i *) (out + 2 * sample + 4), _mm_unpackhi_epi32(l, r));
+    }
+
+    for (; sample < frames; sample++)
+    {
+        out[2 * sample] = in[0][sample];
+        out[2 * sample + 1] = in[1][sample];
+    }
+}
+
+/* Interleaves three vectors of 32-bit units: x0 y0 z0 x1 y1 z1 ... */
+static inline void interleave3_epi32(__m128i x, __m128i y, __m128i z, __m128i *out)
+{
+    __m128 xy = _mm_castsi128_ps(_mm_unpacklo_epi32(x, y)); /* x0 y0 x1 y1 */
+    __m128 zx = _mm_castsi128_ps(_mm_unpacklo_epi32(z, x)); /* z0 x0 z1 x1 */
+    __m128 yz = _mm_castsi128_ps(_mm_unpacklo_epi32(y, z)); /* y0 z0 y1 z1 */
+    __m128 xy2 = _mm_castsi128_ps(_mm_unpackhi_epi32(x, y)); /* x2 y2 x3 y3 */
+    __m128 zx2 = _mm_castsi128_ps(_mm_unpackhi_epi32(z, x)); /* z2 x2 z3 x3 */
+    __m128 yz2 = _mm_castsi128_ps(_mm_unpackhi_epi32(y, z)); /* y2 z2 y3 z3 */
+
+    _mm_storeu_si128(out, _mm_castps_si128(_mm_shuffle_ps(xy, zx, _MM_SHUFFLE(3, 0, 1, 0))));
+    _mm_storeu_si128(out + 1, _mm_castps_si128(_mm_shuffle_ps(yz, xy2, _MM_SHUFFLE(1, 0, 3, 2))));
+    _mm_storeu_si128(out + 2, _mm_castps_si128(_mm_shuffle_ps(zx2, yz2, _MM_SHUFFLE(3, 2, 3, 0))));
+}
+
+/* Interleaves three vectors of 64-bit units: x0 y0 z0 x1 y1 z1 */
+static inline void interleave3_epi64(__m128i x, __m128i y, __m128i z, __m128i *out)
+{
+    __m128d zx = _mm_shuffle_pd(_mm_castsi128_pd(z), _mm_castsi128_pd(x), 2); /* z0 x1 */
+
+    _mm_storeu_si128(out, _mm_unpacklo_epi64(x, y));
+    _mm_storeu_si128(out + 1, _mm_castpd_si128(zx));
+    _mm_storeu_si128(out + 2, _mm_unpackhi_epi64(y, z));
+}
+
+/* 5.1: pairs of channels are interleaved first, then the three pairs */
+
+template<>
+void pack_6ch<int16_t>(const FLAC__int32 *const in[], unsigned frames, int16_t *out)
+{
+    unsigned sample = 0;
+
+    for (; sample + 8 <= frames; sample += 8)
+    {
+        __m128i c[6];
+
+        for (int channel = 0; channel < 6; channel++)
+            c[channel] = _mm_packs_epi32(
+             _mm_loadu_si128((const __m128i *) (in[channel] + sample)),
+             _mm_loadu_si128((const __m128i *) (in[channel] + sample + 4)));
+
+        __m128i *dest = (__m128i *) (out + 6 * sample);
+
+        interleave3_epi32(_mm_unpacklo_epi16(c[0], c[1]),
+         _mm_unpacklo_epi16(c[2], c[3]), _mm_unpacklo_epi16(c[4], c[5]), dest);
+        interleave3_epi32(_mm_unpackhi_epi16(c[0], c[1]),
+         _mm_unpackhi_epi16(c[2], c[3]), _mm_unpackhi_epi16(c[4], c[5]), dest + 3);
+    }
+
+    for (; sample < frames; sample++)
+        for (unsigned channel = 0; channel < 6; channel++)
+            out[6 * sample + channel] = in[channel][sample];
+}
+
+template<>
+void pack_6ch<int32_t>(const FLAC__int32 *const in[], unsigned frames, int32_t *out)
+{
+    unsigned sample = 0;
+
+    for (; sample + 4 <= frames; sample += 4)
+    {
+        __m128i c[6];
+
+        for (int channel = 0; channel < 6; channel++)
+            c[channel] = _mm_loadu_si128((const __m128i *) (in[channel] + sample));
+
+        __m128i *dest = (__m128i *) (out + 6 * sample);
+
+        interleave3_epi64(_mm_unpacklo_epi32(c[0], c[1]),
+         _mm_unpacklo_epi32(c[2], c[3]), _mm_unpacklo_epi32(c[4], c[5]), dest);
+        interleave3_epi64(_mm_unpackhi_epi32(c[0], c[1]),
+         _mm_unpackhi_epi32(c[2], c[3]), _mm_unpackhi_epi32(c[4], c[5]), dest + 3);
+    }
+
+    for (; sample < frames; sample++)
+        for (unsigned channel = 0; channel < 6; channel++)
+            out[6 * sample + channel] = in[channel][sample];
+}
+
+#endif
+
+template<class T>
+static void pack(const FLAC__int32 *const in[], unsigned channels, unsigned frames, char *out)
+{
+    switch (channels)
+    {
+        case 1:
+            pack_fixed<T, 1>(in, frames, (T *) out);
+            break;
+        case 2:
+            pack_stereo<T>(in, frames, (T *) out);
+            break;
+        case 6:
+            pack_6ch<T>(in, frames, (T *) out);
+            break;
+        default:
+            pack_any<T>(in, channels, frames, (T *) out);
+            break;
+    }
+}
+
 FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
 {
     callback_info* info = (callback_info*) client_data;
@@ -128,15 +315,31 @@ FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder
         return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
     }
 
-    for (unsigned sample = 0; sample < frame->header.blocksize; sample++)
+    unsigned frames = frame->header.blocksize;
+
+    switch (info->bits_per_sample)
     {
-        for (unsigned channel = 0; channel < frame->header.channels; channel++)
-        {
-            *(info->write_pointer++) = buffer[channel][sample];
-            info->buffer_used += 1;
-        }
+        case 8:
+            pack<int8_t>(buffer, info->channels, frames, info->write_pointer);
+            break;
+
+        case 16:
+            pack<int16_t>(buffer, info->channels, frames, info->write_pointer);
+            break;
+
+        case 24:
+        case 32:
+            pack<int32_t>(buffer, info->channels, frames, info->write_pointer);
+            break;
+
+        default:
+            FLACNG_ERROR("Can not convert to %u bps\n", info->bits_per_sample);
+            return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
     }
 
+    info->write_pointer += frames * info->channels * SAMPLE_SIZE(info->bits_per_sample);
+    info->buffer_used += frames * info->channels;
+
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
@@ -0,0 +1,291 @@
+/*
+ *  A FLAC decoder plugin for the Audacious Media Player
+ *  Copyright (C) 2005 Ralf Ertzinger
+ *  Copyright (C) 2010-2012 Michał Lipski
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Stress test for the decoder pool.  Every file is first decoded once with
+ * libFLAC's own file decoder as a reference.  Then several threads decode all
+ * of the files at once through get_decoder_instance() and the plugin's
+ * callbacks, the way flac_play() does.  Every other pass starts with a seek,
+ * and the files are probed for tuples in between.  Each decode must match the
+ * reference bit for bit.
+ *
+ * usage: flacng-stress [-t threads] [-r rounds] file.flac ...
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include <libaudcore/runtime.h>
+
+#include "../flacng.h"
+
+typedef struct {
+    char *filename;
+    char *uri;
+    unsigned channels;
+    unsigned bits_per_sample;
+    unsigned sample_rate;
+    FLAC__uint64 total_samples;
+    GByteArray *data; /* packed like the plugin's output buffer */
+} reference;
+
+static reference *refs;
+static int n_refs;
+static int rounds = 10;
+static int failures;
+
+static FLAC__StreamDecoderWriteStatus ref_write(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 *const buffer[], void *client_data)
+{
+    reference *ref = (reference *) client_data;
+    unsigned size = SAMPLE_SIZE(ref->bits_per_sample);
+
+    for (unsigned sample = 0; sample < frame->header.blocksize; sample++)
+    {
+        for (unsigned channel = 0; channel < ref->channels; channel++)
+        {
+            int8_t s8 = buffer[channel][sample];
+            int16_t s16 = buffer[channel][sample];
+            int32_t s32 = buffer[channel][sample];
+
+            g_byte_array_append(ref->data, size == 1 ? (guint8 *) &s8 :
+             size == 2 ? (guint8 *) &s16 : (guint8 *) &s32, size);
+        }
+    }
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void ref_metadata(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data)
+{
+    reference *ref = (reference *) client_data;
+
+    if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO)
+    {
+        ref->channels = metadata->data.stream_info.channels;
+        ref->bits_per_sample = metadata->data.stream_info.bits_per_sample;
+        ref->sample_rate = metadata->data.stream_info.sample_rate;
+        ref->total_samples = metadata->data.stream_info.total_samples;
+    }
+}
+
+static void ref_error(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+    fprintf(stderr, "%s: decoder error %d\n", ((reference *) client_data)->filename, status);
+}
+
+static bool_t decode_reference(reference *ref)
+{
+    FLAC__StreamDecoder *decoder = FLAC__stream_decoder_new();
+    bool_t ok = FALSE;
+
+    ref->data = g_byte_array_new();
+
+    if (FLAC__stream_decoder_init_file(decoder, ref->filename, ref_write,
+     ref_metadata, ref_error, ref) == FLAC__STREAM_DECODER_INIT_STATUS_OK)
+        ok = FLAC__stream_decoder_process_until_end_of_stream(decoder);
+
+    FLAC__stream_decoder_delete(decoder);
+    return ok && ref->channels;
+}
+
+/* decodes a file the way flac_play() does and compares the output with the
+ * reference, starting at the given sample */
+static bool_t check_decode(const reference *ref, FLAC__uint64 start)
+{
+    VFSFile *file = vfs_fopen(ref->uri, "r");
+    if (! file)
+    {
+        fprintf(stderr, "%s: cannot open\n", ref->filename);
+        return FALSE;
+    }
+
+    decoder_instance *inst = get_decoder_instance();
+    if (! inst)
+    {
+        vfs_fclose(file);
+        return FALSE;
+    }
+
+    callback_info *info = inst->info;
+    unsigned frame_bytes = ref->channels * SAMPLE_SIZE(ref->bits_per_sample);
+    int64_t pos = start * frame_bytes;
+    bool_t ok = FALSE;
+
+    info->fd = file;
+
+    if (! read_metadata(inst->decoder, info))
+        goto DONE;
+
+    if (info->channels != ref->channels || info->sample_rate != ref->sample_rate ||
+     info->bits_per_sample != ref->bits_per_sample)
+        goto DONE;
+
+    /* the seek itself delivers the first (partial) frame */
+    if (start && ! FLAC__stream_decoder_seek_absolute(inst->decoder, start))
+        goto DONE;
+
+    while (1)
+    {
+        unsigned bytes = info->buffer_used * SAMPLE_SIZE(ref->bits_per_sample);
+
+        if (pos + bytes > ref->data->len ||
+         memcmp(info->output_buffer, ref->data->data + pos, bytes))
+            goto DONE;
+
+        pos += bytes;
+        reset_info(info);
+
+        if (FLAC__stream_decoder_get_state(inst->decoder) == FLAC__STREAM_DECODER_END_OF_STREAM)
+            break;
+
+        if (! FLAC__stream_decoder_process_single(inst->decoder))
+            goto DONE;
+    }
+
+    ok = (pos == ref->data->len);
+
+DONE:
+    put_decoder_instance(inst);
+    vfs_fclose(file);
+
+    if (! ok)
+        fprintf(stderr, "%s: output differs from the reference (start %lu)\n",
+         ref->filename, (unsigned long) start);
+
+    return ok;
+}
+
+static bool_t check_probe(const reference *ref)
+{
+    VFSFile *file = vfs_fopen(ref->uri, "r");
+    if (! file)
+        return FALSE;
+
+    Tuple tuple = flac_probe_for_tuple(ref->uri, file);
+    vfs_fclose(file);
+
+    int length = (ref->total_samples / ref->sample_rate) * 1000;
+
+    if (tuple.get_int(FIELD_LENGTH) != length)
+    {
+        fprintf(stderr, "%s: probe gave the wrong length\n", ref->filename);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void *worker(void *arg)
+{
+    int index = GPOINTER_TO_INT(arg);
+
+    for (int round = 0; round < rounds; round++)
+    {
+        /* each thread walks the files from a different place so that
+         * different files are decoded at the same time */
+        for (int i = 0; i < n_refs; i++)
+        {
+            const reference *ref = &refs[(i + index) % n_refs];
+            FLAC__uint64 start = ((round + index) & 1) ? ref->total_samples / 3 : 0;
+
+            if (! check_decode(ref, start))
+                g_atomic_int_inc(&failures);
+
+            if (! check_probe(ref))
+                g_atomic_int_inc(&failures);
+        }
+    }
+
+    return NULL;
+}
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-r rounds] file.flac ...\n", name);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 8;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            default:
+                return usage(argv[0]);
+        }
+    }
+
+    if (optind == argc || threads < 1 || rounds < 1)
+        return usage(argv[0]);
+
+    n_refs = argc - optind;
+    refs = g_new0(reference, n_refs);
+
+    for (int i = 0; i < n_refs; i++)
+    {
+        reference *ref = &refs[i];
+
+        ref->filename = argv[optind + i];
+        ref->uri = g_filename_to_uri(ref->filename, NULL, NULL);
+
+        if (! ref->uri || ! decode_reference(ref))
+        {
+            fprintf(stderr, "%s: cannot decode\n", ref->filename);
+            return 2;
+        }
+    }
+
+    pthread_t *tids = g_new(pthread_t, threads);
+
+    for (int i = 0; i < threads; i++)
+        pthread_create(&tids[i], NULL, worker, GINT_TO_POINTER(i));
+    for (int i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+
+    clean_decoder_pool();
+
+    printf("%d files, %d threads, %d rounds: %d failures\n", n_refs, threads,
+     rounds, failures);
+
+    for (int i = 0; i < n_refs; i++)
+    {
+        g_free(refs[i].uri);
+        g_byte_array_free(refs[i].data, TRUE);
+    }
+
+    g_free(refs);
+    g_free(tids);
+
+    return failures ? 1 : 0;
+}
@@ -19,6 +19,7 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#include <pthread.h>
 #include <string.h>
 #include <glib.h>
 
@@ -26,12 +27,20 @@
 
 #include "flacng.h"
 
+/* Idle decoders are kept around so that they need not be re-created for
+ * every track; any number may be in use at once. */
+#define MAX_POOLED_DECODERS 4
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static decoder_instance* pool[MAX_POOLED_DECODERS];
+static int pooled;
+
 callback_info *init_callback_info(void)
 {
     callback_info *info;
 
     info = g_new0 (callback_info, 1);
-    info->output_buffer = (int32_t*) g_malloc (BUFFER_SIZE_BYTE);
+    info->output_buffer = (char*) g_malloc (BUFFER_SIZE_BYTE);
 
     reset_info(info);
 
@@ -77,3 +86,98 @@ bool_t read_metadata(FLAC__StreamDecoder *decoder, callback_info *info)
 
     return TRUE;
 }
+
+static void free_decoder_instance(decoder_instance *inst)
+{
+    if (inst->decoder)
+        FLAC__stream_decoder_delete(inst->decoder);
+    if (inst->info)
+        clean_callback_info(inst->info);
+
+    g_free (inst);
+}
+
+static decoder_instance *new_decoder_instance(void)
+{
+    FLAC__StreamDecoderInitStatus ret;
+    decoder_instance *inst = g_new0 (decoder_instance, 1);
+
+    if ((inst->info = init_callback_info()) == NULL)
+    {
+        FLACNG_ERROR("Could not initialize the callback structure!\n");
+        goto ERR;
+    }
+
+    if ((inst->decoder = FLAC__stream_decoder_new()) == NULL)
+    {
+        FLACNG_ERROR("Could not create a FLAC decoder instance!\n");
+        goto ERR;
+    }
+
+    if (FLAC__STREAM_DECODER_INIT_STATUS_OK != (ret = FLAC__stream_decoder_init_stream(
+        inst->decoder,
+        read_callback,
+        seek_callback,
+        tell_callback,
+        length_callback,
+        eof_callback,
+        write_callback,
+        metadata_callback,
+        error_callback,
+        inst->info)))
+    {
+        FLACNG_ERROR("Could not initialize the FLAC decoder: %s(%d)\n",
+            FLAC__StreamDecoderInitStatusString[ret], ret);
+        goto ERR;
+    }
+
+    return inst;
+
+ERR:
+    free_decoder_instance(inst);
+    return NULL;
+}
+
+decoder_instance *get_decoder_instance(void)
+{
+    decoder_instance *inst = NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (pooled > 0)
+        inst = pool[--pooled];
+    pthread_mutex_unlock(&pool_mutex);
+
+    return inst ? inst : new_decoder_instance();
+}
+
+void put_decoder_instance(decoder_instance *inst)
+{
+    reset_info(inst->info);
+    inst->info->fd = NULL;
+
+    if (FLAC__stream_decoder_flush(inst->decoder) == false)
+    {
+        FLACNG_ERROR("Could not flush decoder state!\n");
+        free_decoder_instance(inst);
+        return;
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    if (pooled < MAX_POOLED_DECODERS)
+    {
+        pool[pooled++] = inst;
+        inst = NULL;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (inst)
+        free_decoder_instance(inst);
+}
+
+void clean_decoder_pool(void)
+{
+    pthread_mutex_lock(&pool_mutex);
+    while (pooled > 0)
+        free_decoder_instance(pool[--pooled]);
+    pthread_mutex_unlock(&pool_mutex);
+}
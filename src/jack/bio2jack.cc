@@ -139,13 +139,22 @@ typedef struct jack_driver_s
   long clientBytesInJack;       /* number of INPUT bytes(from the client of bio2jack) we wrote to jack(not necessary the number of bytes we wrote to jack) */
   long jack_buffer_size;        /* size of the buffer jack will pass in to the process callback */
 
-  unsigned long callback_buffer1_size;  /* number of bytes in the buffer allocated for processing data in JACK_Callback */
+  /* the callback buffers are sized for jack_buffer_size frames by JACK_OpenDevice() and */
+  /* JACK_bufsize(); JACK_Callback() never allocates, locks or resamples */
+  unsigned long callback_buffer1_size;  /* number of bytes in the buffer allocated for recording in JACK_Callback */
   char *callback_buffer1;
-  unsigned long callback_buffer2_size;  /* number of bytes in the buffer allocated for processing data in JACK_Callback */
+  unsigned long callback_buffer2_size;  /* number of bytes in the buffer allocated for playback in JACK_Callback */
   char *callback_buffer2;
 
   unsigned long rw_buffer1_size;        /* number of bytes in the buffer allocated for processing data in JACK_(Read|Write) */
   char *rw_buffer1;
+  unsigned long rw_buffer2_size;        /* number of bytes in the buffer allocated for sample rate conversion in JACK_(Read|Write) */
+  char *rw_buffer2;
+
+  int xruns;                    /* underruns and overruns so far, see JACK_GetXruns(), use g_atomic_int_* */
+  bool underrun;                /* true while the playback ringbuffer is running dry, only touched by the callback */
+  int ran_dry;                  /* set by the callback when playback runs dry, counted as an xrun only if JACK_Write() */
+                                /* brings more data (otherwise it was just the end of the stream), use g_atomic_int_* */
 
   struct timeval previousTime;  /* time of last JACK_Callback() write to jack, allows for MS accurate bytes played  */
 
@@ -168,8 +177,8 @@ typedef struct jack_driver_s
   jack_ringbuffer_t *pPlayPtr;  /* the playback ringbuffer */
   jack_ringbuffer_t *pRecPtr;   /* the recording ringbuffer */
 
-  SRC_STATE *output_src;        /* SRC object for the output stream */
-  SRC_STATE *input_src;         /* SRC object for the output stream */
+  SRC_STATE *output_src;        /* SRC object for the output stream, only used by JACK_Write() */
+  SRC_STATE *input_src;         /* SRC object for the input stream, only used by JACK_Read() */
 
   enum status_enum state;       /* one of PLAYING, PAUSED, STOPPED, CLOSED, RESET etc */
 
@@ -299,34 +308,6 @@ getDriver(int deviceID)
   return drv;
 }
 
-#if TRACE_getReleaseDevice
-#define tryGetDriver(x) _tryGetDriver(x,fprintf(OUTFILE, "%s::%s(%d) trying to get driver %d\n", __FILE__, __FUNCTION__, __LINE__,x)); TRACE("got driver %d\n",x);
-jack_driver_t *
-_tryGetDriver(int deviceID, int ignored)
-{
-  fflush(OUTFILE);
-#else
-jack_driver_t *
-tryGetDriver(int deviceID)
-{
-#endif
-  jack_driver_t *drv = &outDev[deviceID];
-
-  int err;
-  if((err = pthread_mutex_trylock(&drv->mutex)) == 0)
-    return drv;
-
-  if(err == EBUSY)
-  {
-    TRACE("driver %d is busy\n",deviceID);
-    return 0;
-  }
-
-  ERR("lock returned an error\n");
-  return 0;
-}
-
-
 /* release a device's mutex */
 /* */
 /* This macro is similar to the one for getDriver above, only simpler since we only
@@ -516,20 +497,45 @@ ensure_buffer_size(char **buffer, unsigned long *cur_size,
   return FALSE;
 }
 
+/* make sure the callback buffers can hold a period of nframes frames */
+/* NOTE: never call this from JACK_callback(), it may realloc */
+static bool
+alloc_callback_buffers(jack_driver_t * drv, nframes_t nframes)
+{
+  return ensure_buffer_size(&drv->callback_buffer1,
+                            &drv->callback_buffer1_size,
+                            nframes * drv->bytes_per_jack_input_frame) &&
+    ensure_buffer_size(&drv->callback_buffer2, &drv->callback_buffer2_size,
+                       nframes * drv->bytes_per_jack_output_frame);
+}
+
+/* convert a number of frames at jack's rate into client bytes */
+static long
+client_bytes_from_jack_frames(jack_driver_t * drv, long frames)
+{
+  if(drv->output_src && drv->output_sample_rate_ratio != 1.0)
+    frames = (long) (frames / drv->output_sample_rate_ratio);
+
+  return frames * drv->bytes_per_output_frame;
+}
+
 /******************************************************************
  *    JACK_callback
  *
  * every time the jack server wants something from us it calls this
  * function, so we either deliver it some sound to play or deliver it nothing
  * to play
+ *
+ * this runs in jack's realtime thread: it doesn't take the device mutex or
+ * allocate memory, and the ringbuffers already hold float samples at jack's
+ * rate (JACK_Write and JACK_Read do the format and sample rate conversion),
+ * so all that is left to do here is volume and (de)muxing
  */
 static int
 JACK_callback(nframes_t nframes, void *arg)
 {
   jack_driver_t *drv = (jack_driver_t *) arg;
 
-  int src_error = 0;
-
   TIMER("start\n");
   gettimeofday(&drv->previousTime, 0);  /* record the current time */
 
@@ -549,6 +555,19 @@ JACK_callback(nframes_t nframes, void *arg)
   for(unsigned i = 0; i < drv->num_input_channels; i++)
     in_buffer[i] = (sample_t *) jack_port_get_buffer(drv->input_port[i], nframes);
 
+  /* JACK_bufsize() should have resized the buffers before we get a period this large */
+  if(nframes * drv->bytes_per_jack_output_frame > drv->callback_buffer2_size ||
+     nframes * drv->bytes_per_jack_input_frame > drv->callback_buffer1_size)
+  {
+    ERR("period of %lu frames is larger than our buffers\n", (unsigned long) nframes);
+
+    for(unsigned i = 0; i < drv->num_output_channels; i++)
+      sample_silence_float(out_buffer[i], nframes);
+
+    g_atomic_int_inc(&drv->xruns);
+    return 0;
+  }
+
   /* handle playing state */
   if(drv->state == PLAYING)
   {
@@ -557,11 +576,8 @@ JACK_callback(nframes_t nframes, void *arg)
     {
       unsigned long jackFramesAvailable = nframes;      /* frames we have left to write to jack */
       unsigned long numFramesToWrite;   /* num frames we are writing */
-      size_t inputBytesAvailable = jack_ringbuffer_read_space(drv->pPlayPtr);
-      unsigned long inputFramesAvailable;       /* frames we have available */
-
-      inputFramesAvailable = inputBytesAvailable / drv->bytes_per_jack_output_frame;
-      size_t jackBytesAvailable = jackFramesAvailable * drv->bytes_per_jack_output_frame;
+      unsigned long inputFramesAvailable =      /* frames we have available */
+        jack_ringbuffer_read_space(drv->pPlayPtr) / drv->bytes_per_jack_output_frame;
 
       long read = 0;
 
@@ -579,97 +595,16 @@ JACK_callback(nframes_t nframes, void *arg)
       }
 #endif
 
-      /* make sure our buffer is large enough for the data we are writing */
-      /* ie. callback_buffer2_size < (bytes we already wrote + bytes we are going to write in this loop) */
-      if(!ensure_buffer_size
-         (&drv->callback_buffer2, &drv->callback_buffer2_size,
-          jackBytesAvailable))
+      /* read as much data from the buffer as is available */
+      if(inputFramesAvailable > 0)
       {
-        ERR("allocated %lu bytes, need %lu bytes\n",
-            drv->callback_buffer2_size, (unsigned long)jackBytesAvailable);
-        return -1;
-      }
-
-      /* do sample rate conversion if needed & requested */
-      if(drv->output_src && drv->output_sample_rate_ratio != 1.0)
-      {
-        long bytes_needed_write = nframes * drv->bytes_per_jack_output_frame;
-
-        /* make a very good guess at how many raw bytes we'll need to satisfy jack's request after conversion */
-        long bytes_needed_read = min(inputBytesAvailable,
-                                     (double) (bytes_needed_write +
-                                               drv->
-                                               output_sample_rate_ratio
-                                               *
-                                               drv->
-                                               bytes_per_jack_output_frame)
-                                     / drv->output_sample_rate_ratio);
-        DEBUG("guessing that we need %ld bytes in and %ld out for rate conversion ratio = %f\n",
-           bytes_needed_read, bytes_needed_write,
-           drv->output_sample_rate_ratio);
-
-        if(!ensure_buffer_size(&drv->callback_buffer1,
-                               &drv->callback_buffer1_size,
-                               bytes_needed_read))
-        {
-          ERR("could not realloc callback_buffer2!\n");
-          return 1;
-        }
-        if(!ensure_buffer_size(&drv->callback_buffer2,
-                               &drv->callback_buffer2_size,
-                               bytes_needed_write))
-        {
-          ERR("could not realloc callback_buffer2!\n");
-          return 1;
-        }
-
-        if(jackFramesAvailable && inputBytesAvailable > 0)
-        {
-          /* read in the data, but don't move the read pointer until we know how much SRC used */
-          jack_ringbuffer_peek(drv->pPlayPtr, drv->callback_buffer1,
-                               bytes_needed_read);
-
-          SRC_DATA srcdata;
-          srcdata.data_in = (sample_t *) drv->callback_buffer1;
-          srcdata.input_frames = bytes_needed_read / drv->bytes_per_jack_output_frame;
-          srcdata.src_ratio = drv->output_sample_rate_ratio;
-          srcdata.data_out = (sample_t *) drv->callback_buffer2;
-          srcdata.output_frames = nframes;
-          srcdata.end_of_input = 0;     // it's a stream, it never ends
-          DEBUG("input_frames = %ld, output_frames = %ld\n",
-                srcdata.input_frames, srcdata.output_frames);
-          /* convert the sample rate */
-          src_error = src_process(drv->output_src, &srcdata);
-          DEBUG("used = %ld, generated = %ld, error = %d: %s.\n",
-                srcdata.input_frames_used, srcdata.output_frames_gen,
-                src_error, src_strerror(src_error));
-
-          if(src_error == 0)
-          {
-            /* now we can move the read pointer */
-            jack_ringbuffer_read_advance(drv->pPlayPtr,
-                                         srcdata.
-                                         input_frames_used *
-                                         drv->bytes_per_jack_output_frame);
-            /* add on what we wrote */
-            read = srcdata.input_frames_used * drv->bytes_per_output_frame;
-            jackFramesAvailable -= srcdata.output_frames_gen;   /* take away what was used */
-          }
-        }
-      }
-      else                      /* no resampling needed or requested */
-      {
-        /* read as much data from the buffer as is available */
-        if(jackFramesAvailable && inputBytesAvailable > 0)
-        {
-          /* write as many bytes as we have space remaining, or as much as we have data to write */
-          numFramesToWrite = min(jackFramesAvailable, inputFramesAvailable);
-          jack_ringbuffer_read(drv->pPlayPtr, drv->callback_buffer2,
-                               jackBytesAvailable);
-          /* add on what we wrote */
-          read = numFramesToWrite * drv->bytes_per_output_frame;
-          jackFramesAvailable -= numFramesToWrite;      /* take away what was written */
-        }
+        /* write as many frames as we have space remaining, or as much as we have data to write */
+        numFramesToWrite = min(jackFramesAvailable, inputFramesAvailable);
+        jack_ringbuffer_read(drv->pPlayPtr, drv->callback_buffer2,
+                             numFramesToWrite * drv->bytes_per_jack_output_frame);
+        /* add on what we wrote */
+        read = client_bytes_from_jack_frames(drv, numFramesToWrite);
+        jackFramesAvailable -= numFramesToWrite;        /* take away what was written */
       }
 
       drv->written_client_bytes += read;
@@ -686,39 +621,43 @@ JACK_callback(nframes_t nframes, void *arg)
           sample_silence_float(out_buffer[i] +
                                (nframes - jackFramesAvailable),
                                jackFramesAvailable);
+
+        /* note each time we run dry once, not every empty period after it; */
+        /* the ringbuffer also runs dry when the stream ends, so JACK_Write() */
+        /* decides whether this was an underrun */
+        if(!drv->underrun)
+          g_atomic_int_set(&drv->ran_dry, 1);
+        drv->underrun = TRUE;
       }
+      else
+        drv->underrun = FALSE;
 
-      /* if we aren't converting or we are converting and src_error == 0 then we should */
-      /* apply volume and demux */
-      if(!(drv->output_src && drv->output_sample_rate_ratio != 1.0) || (src_error == 0))
+      /* apply volume */
+      for(unsigned i = 0; i < drv->num_output_channels; i++)
       {
-          /* apply volume */
-          for(unsigned i = 0; i < drv->num_output_channels; i++)
+          if(drv->volumeEffectType == dbAttenuation)
           {
-              if(drv->volumeEffectType == dbAttenuation)
-              {
-                  /* assume the volume setting is dB of attenuation, a volume of 0 */
-                  /* is 0dB attenuation */
-                  float volume = powf(10.0, -((float) drv->volume[i]) / 20.0);
-                  float_volume_effect((sample_t *) drv->callback_buffer2 + i,
-                                      (nframes - jackFramesAvailable), volume, drv->num_output_channels);
-              } else
-              {
-                  float_volume_effect((sample_t *) drv->callback_buffer2 + i, (nframes - jackFramesAvailable),
-                                      ((float) drv->volume[i] / 100.0),
-                                      drv->num_output_channels);
-              }
-          }
-
-          /* demux the stream: we skip over the number of samples we have output channels as the channel data */
-          /* is encoded like chan1,chan2,chan3,chan1,chan2,chan3... */
-          for(unsigned i = 0; i < drv->num_output_channels; i++)
+              /* assume the volume setting is dB of attenuation, a volume of 0 */
+              /* is 0dB attenuation */
+              float volume = powf(10.0, -((float) drv->volume[i]) / 20.0);
+              float_volume_effect((sample_t *) drv->callback_buffer2 + i,
+                                  (nframes - jackFramesAvailable), volume, drv->num_output_channels);
+          } else
           {
-              demux(out_buffer[i],
-                    (sample_t *) drv->callback_buffer2 + i,
-                    (nframes - jackFramesAvailable), drv->num_output_channels);
+              float_volume_effect((sample_t *) drv->callback_buffer2 + i, (nframes - jackFramesAvailable),
+                                  ((float) drv->volume[i] / 100.0),
+                                  drv->num_output_channels);
           }
       }
+
+      /* demux the stream: we skip over the number of samples we have output channels as the channel data */
+      /* is encoded like chan1,chan2,chan3,chan1,chan2,chan3... */
+      for(unsigned i = 0; i < drv->num_output_channels; i++)
+      {
+          demux(out_buffer[i],
+                (sample_t *) drv->callback_buffer2 + i,
+                (nframes - jackFramesAvailable), drv->num_output_channels);
+      }
     }
 
     /* handle record data, if any */
@@ -726,13 +665,6 @@ JACK_callback(nframes_t nframes, void *arg)
     {
       long jack_bytes = nframes * drv->bytes_per_jack_input_frame;      /* how many bytes jack is feeding us */
 
-      if(!ensure_buffer_size(&drv->callback_buffer1, &drv->callback_buffer1_size, jack_bytes))
-      {
-        ERR("allocated %lu bytes, need %ld bytes\n",
-            drv->callback_buffer1_size, jack_bytes);
-        return -1;
-      }
-
       /* mux the invividual channels into one stream */
       for(unsigned i = 0; i < drv->num_input_channels; i++)
       {
@@ -740,101 +672,18 @@ JACK_callback(nframes_t nframes, void *arg)
             nframes, drv->num_input_channels);
       }
 
-      /* do sample rate conversion if needed & requested */
-      if(drv->input_src && drv->input_sample_rate_ratio != 1.0)
+      /* the read pointer belongs to JACK_Read(), so if there isn't enough room we
+         can't make some by throwing away old data; drop what doesn't fit instead */
+      long write_space = jack_ringbuffer_write_space(drv->pRecPtr);
+      if(write_space < jack_bytes)
       {
-        /* make a very good guess at how many raw bytes we'll need to read all the data jack gave us */
-        long bytes_needed_write = (double) (jack_bytes +
-                                            drv->input_sample_rate_ratio *
-                                            drv->bytes_per_jack_input_frame) *
-          drv->input_sample_rate_ratio;
-        DEBUG("guessing that we need %ld bytes in and %ld out for rate conversion ratio = %f\n",
-              nframes * drv->bytes_per_jack_input_frame,
-              bytes_needed_write, drv->input_sample_rate_ratio);
-
-        if(!ensure_buffer_size(&drv->callback_buffer2,
-                               &drv->callback_buffer2_size,
-                               bytes_needed_write))
-        {
-          ERR("could not realloc callback_buffer2!\n");
-          return 1;
-        }
-
-        SRC_DATA srcdata;
-        srcdata.data_in = (sample_t *) drv->callback_buffer1;
-        srcdata.input_frames = nframes;
-        srcdata.src_ratio = drv->input_sample_rate_ratio;
-        srcdata.data_out = (sample_t *) drv->callback_buffer2;
-        srcdata.output_frames = drv->callback_buffer2_size / drv->bytes_per_jack_input_frame;
-        srcdata.end_of_input = 0;       // it's a stream, it never ends
-        DEBUG("input_frames = %ld, output_frames = %ld\n",
-              srcdata.input_frames, srcdata.output_frames);
-        /* convert the sample rate */
-        src_error = src_process(drv->input_src, &srcdata);
-        DEBUG("used = %ld, generated = %ld, error = %d: %s.\n",
-              srcdata.input_frames_used, srcdata.output_frames_gen,
-              src_error, src_strerror(src_error));
-
-        if(src_error == 0)
-        {
-          long write_space = jack_ringbuffer_write_space(drv->pRecPtr);
-          long bytes_used =  srcdata.output_frames_gen * drv->bytes_per_jack_input_frame;
-          /* if there isn't enough room, make some.  sure this discards data, but when dealing with input sources
-             it seems like it's better to throw away old data than new */
-          if(write_space < bytes_used)
-          {
-            /* the ringbuffer is designed such that only one thread should ever access each pointer.
-               since calling read_advance here will be touching the read pointer which is also accessed
-               by JACK_Read, we need to lock the mutex first for safety */
-            jack_driver_t *d = tryGetDriver(drv->deviceID);
-            if( d )
-            {
-              /* double check the write space after we've gained the lock, just
-                 in case JACK_Read was being called before we gained it */
-              write_space = jack_ringbuffer_write_space(drv->pRecPtr);
-              if(write_space < bytes_used)
-              {
-                /* hey, we warn about underruns, we might as well warn about overruns as well */
-                WARN("buffer overrun of %ld bytes\n", jack_bytes - write_space);
-                jack_ringbuffer_read_advance(drv->pRecPtr, bytes_used - write_space);
-              }
-
-              releaseDriver(drv);
-            }
-          }
-
-          jack_ringbuffer_write(drv->pRecPtr, drv->callback_buffer2,
-                                bytes_used);
-        }
+        WARN("buffer overrun of %ld bytes\n", jack_bytes - write_space);
+        jack_bytes = write_space / drv->bytes_per_jack_input_frame *
+          drv->bytes_per_jack_input_frame;
+        g_atomic_int_inc(&drv->xruns);
       }
-      else                      /* no resampling needed */
-      {
-        long write_space = jack_ringbuffer_write_space(drv->pRecPtr);
-        /* if there isn't enough room, make some.  sure this discards data, but when dealing with input sources
-           it seems like it's better to throw away old data than new */
-        if(write_space < jack_bytes)
-        {
-          /* the ringbuffer is designed such that only one thread should ever access each pointer.
-             since calling read_advance here will be touching the read pointer which is also accessed
-             by JACK_Read, we need to lock the mutex first for safety */
-	        jack_driver_t *d = tryGetDriver(drv->deviceID);
-          if( d )
-          {
-            /* double check the write space after we've gained the lock, just
-               in case JACK_Read was being called before we gained it */
-            write_space = jack_ringbuffer_write_space(drv->pRecPtr);
-            if(write_space < jack_bytes)
-            {
-             ERR("buffer overrun of %ld bytes\n", jack_bytes - write_space);
-             jack_ringbuffer_read_advance(drv->pRecPtr, jack_bytes - write_space);
-            }
-	          releaseDriver(drv);
-          }
-        }
 
-        jack_ringbuffer_write(drv->pRecPtr, drv->callback_buffer1,
-                              jack_bytes);
-      }
+      jack_ringbuffer_write(drv->pRecPtr, drv->callback_buffer1, jack_bytes);
     }
   }
   else if(drv->state == PAUSED  ||
@@ -866,6 +715,10 @@ JACK_callback(nframes_t nframes, void *arg)
       if(drv->pRecPtr)
         jack_ringbuffer_reset(drv->pRecPtr);
 
+      /* don't count the wait for the first write as an underrun */
+      drv->underrun = TRUE;
+      g_atomic_int_set(&drv->ran_dry, 0);
+
       drv->state = STOPPED;     /* transition to STOPPED */
     }
   }
@@ -891,6 +744,14 @@ JACK_bufsize(nframes_t nframes, void *arg)
 
   drv->jack_buffer_size = nframes;
 
+  /* jack doesn't run the process callback while the buffer size is changing,
+     so this is where the callback buffers grow */
+  if(!alloc_callback_buffers(drv, nframes))
+  {
+    ERR("couldn't allocate buffers for %lu frames\n", (unsigned long) nframes);
+    return 1;
+  }
+
   return 0;
 }
 
@@ -905,11 +766,10 @@ JACK_srate(nframes_t nframes, void *arg)
   drv->jack_sample_rate = (long) nframes;
 
   /* make sure to recalculate the ratios needed for proper sample rate conversion */
+  /* NOTE: the SRC objects belong to JACK_Write() and JACK_Read(), which pass the */
+  /* new ratio to src_process() on their next call */
   drv->output_sample_rate_ratio = (double) drv->jack_sample_rate / (double) drv->client_sample_rate;
-  if(drv->output_src) src_set_ratio(drv->output_src, drv->output_sample_rate_ratio);
-
   drv->input_sample_rate_ratio = (double) drv->client_sample_rate / (double) drv->jack_sample_rate;
-  if(drv->input_src) src_set_ratio(drv->input_src, drv->input_sample_rate_ratio);
 
   TRACE("the sample rate is now %lu/sec\n", (long) nframes);
   return 0;
@@ -986,6 +846,9 @@ JACK_OpenDevice(jack_driver_t * drv)
       return ERR_OPENING_JACK;
 
     TRACE("using existing client\n");
+    if(!alloc_callback_buffers(drv, drv->jack_buffer_size))
+      return ERR_OPENING_JACK;
+
     drv->in_use = TRUE;
     return ERR_SUCCESS;
   }
@@ -1045,6 +908,15 @@ JACK_OpenDevice(jack_driver_t * drv)
 
   drv->jack_buffer_size = jack_get_buffer_size(drv->client);
 
+  /* the callback may run as soon as we activate, so allocate its buffers now */
+  if(!alloc_callback_buffers(drv, drv->jack_buffer_size))
+  {
+    ERR("couldn't allocate buffers for %ld frames\n", drv->jack_buffer_size);
+    jack_client_close(drv->client);
+    drv->client = 0;
+    return ERR_OPENING_JACK;
+  }
+
   /* create the output ports */
   TRACE("creating output ports\n");
   for(unsigned i = 0; i < drv->num_output_channels; i++)
@@ -1425,6 +1297,12 @@ JACK_ResetFromDriver(jack_driver_t * drv)
   /* variables that the callback modifies while the callback is running */
   /* we set the state to RESET and the callback clears the variables out for us */
   drv->state = RESET;           /* tell the callback that we are to reset, the callback will transition this to STOPPED */
+
+  /* the SRC objects are only used with the mutex held, so they can be reset right here */
+  if(drv->output_src)
+    src_reset(drv->output_src);
+  if(drv->input_src)
+    src_reset(drv->input_src);
 }
 
 /* Clear out any buffered data, stop playing, zero out some variables */
@@ -1595,6 +1473,8 @@ JACK_OpenEx(int *deviceID, unsigned int bits_per_channel,
 
   /* initialize some variables */
   drv->in_use = FALSE;
+  g_atomic_int_set(&drv->xruns, 0);
+  g_atomic_int_set(&drv->ran_dry, 0);
 
   JACK_ResetFromDriver(drv);    /* flushes all queued buffers, sets status to STOPPED and resets some variables */
 
@@ -1729,6 +1609,10 @@ JACK_Close(int deviceID)
   if(drv->rw_buffer1) g_free(drv->rw_buffer1);
   drv->rw_buffer1 = 0;
 
+  drv->rw_buffer2_size = 0;
+  if(drv->rw_buffer2) g_free(drv->rw_buffer2);
+  drv->rw_buffer2 = 0;
+
   if(drv->pPlayPtr) jack_ringbuffer_free(drv->pPlayPtr);
   drv->pPlayPtr = 0;
 
@@ -1794,16 +1678,35 @@ JACK_Write(int deviceID, unsigned char *data, unsigned long bytes)
     return 0;                   /* indicate that we couldn't write any bytes */
   }
 
-  frames = min(frames, frames_free);
+  /* the callback ran dry and the client still had more to play, so that was */
+  /* an underrun rather than the end of the stream */
+  if(g_atomic_int_compare_and_exchange(&drv->ran_dry, 1, 0))
+    g_atomic_int_inc(&drv->xruns);
+
+  /* the ringbuffer holds frames at jack's rate, so take only as many client */
+  /* frames as will still fit after sample rate conversion */
+  bool resample = drv->output_src && drv->output_sample_rate_ratio != 1.0;
+  if(resample)
+    frames = min(frames, (long) (frames_free / drv->output_sample_rate_ratio));
+  else
+    frames = min(frames, frames_free);
+
+  if(frames < 1)
+  {
+    TRACE("no room left after sample rate conversion\n");
+    releaseDriver(drv);
+    return 0;
+  }
+
   long jack_bytes = frames * drv->bytes_per_jack_output_frame;
-  if(!ensure_buffer_size(&drv->rw_buffer1, &drv->rw_buffer1_size, jack_bytes))
+  if(!ensure_buffer_size(&drv->rw_buffer1, &drv->rw_buffer1_size, jack_bytes) ||
+     (resample && !ensure_buffer_size(&drv->rw_buffer2, &drv->rw_buffer2_size,
+                                      frames_free * drv->bytes_per_jack_output_frame)))
   {
     ERR("couldn't allocate enough space for the buffer\n");
     releaseDriver(drv);
     return 0;
   }
-  /* adjust bytes to be how many client bytes we're actually writing */
-  bytes = frames * drv->bytes_per_output_frame;
 
   /* convert from client samples to jack samples
      we have to tell it how many samples there are, which is frames * channels */
@@ -1830,11 +1733,49 @@ JACK_Write(int deviceID, unsigned char *data, unsigned long bytes)
     break;
   }
 
+  /* do sample rate conversion if needed & requested */
+  /* this used to happen in the callback, but it has no business in jack's realtime thread */
+  char *jack_data = drv->rw_buffer1;
+  if(resample)
+  {
+    SRC_DATA srcdata;
+    srcdata.data_in = (sample_t *) drv->rw_buffer1;
+    srcdata.input_frames = frames;
+    srcdata.src_ratio = drv->output_sample_rate_ratio;
+    srcdata.data_out = (sample_t *) drv->rw_buffer2;
+    srcdata.output_frames = frames_free;
+    srcdata.end_of_input = 0;   // it's a stream, it never ends
+    DEBUG("input_frames = %ld, output_frames = %ld\n",
+          srcdata.input_frames, srcdata.output_frames);
+    /* convert the sample rate */
+    int src_error = src_process(drv->output_src, &srcdata);
+    DEBUG("used = %ld, generated = %ld, error = %d: %s.\n",
+          srcdata.input_frames_used, srcdata.output_frames_gen,
+          src_error, src_strerror(src_error));
+
+    if(src_error == 0)
+    {
+      frames = srcdata.input_frames_used;
+      jack_bytes = srcdata.output_frames_gen * drv->bytes_per_jack_output_frame;
+    }
+    else
+    {
+      /* drop the data rather than have the client retry it forever */
+      ERR("sample rate conversion failed: %s\n", src_strerror(src_error));
+      jack_bytes = 0;
+    }
+
+    jack_data = drv->rw_buffer2;
+  }
+
+  /* adjust bytes to be how many client bytes we're actually writing */
+  bytes = frames * drv->bytes_per_output_frame;
+
   DEBUG("ringbuffer read space = %d, write space = %d\n",
         jack_ringbuffer_read_space(drv->pPlayPtr),
         jack_ringbuffer_write_space(drv->pPlayPtr));
 
-  jack_ringbuffer_write(drv->pPlayPtr, drv->rw_buffer1, jack_bytes);
+  jack_ringbuffer_write(drv->pPlayPtr, jack_data, jack_bytes);
   DEBUG("wrote %lu bytes, %lu jack_bytes\n", bytes, jack_bytes);
 
   DEBUG("ringbuffer read space = %d, write space = %d\n",
@@ -1887,9 +1828,18 @@ JACK_Read(int deviceID, unsigned char *data, unsigned long bytes)
     return 0;
   }
 
-  frames = min(frames, frames_available);
-  long jack_bytes = frames * drv->bytes_per_jack_input_frame;
-  if(!ensure_buffer_size(&drv->rw_buffer1, &drv->rw_buffer1_size, jack_bytes))
+  /* the ringbuffer holds frames at jack's rate, convert them to the client's rate here */
+  bool resample = drv->input_src && drv->input_sample_rate_ratio != 1.0;
+  long jack_frames = frames_available;
+  if(resample)
+    jack_frames = min(jack_frames, (long) ceil(frames / drv->input_sample_rate_ratio));
+  else
+    jack_frames = frames = min(frames, frames_available);
+
+  long jack_bytes = jack_frames * drv->bytes_per_jack_input_frame;
+  if(!ensure_buffer_size(&drv->rw_buffer1, &drv->rw_buffer1_size, jack_bytes) ||
+     (resample && !ensure_buffer_size(&drv->rw_buffer2, &drv->rw_buffer2_size,
+                                      frames * drv->bytes_per_jack_input_frame)))
   {
     ERR("couldn't allocate enough space for the buffer\n");
     releaseDriver(drv);
@@ -1900,8 +1850,40 @@ JACK_Read(int deviceID, unsigned char *data, unsigned long bytes)
         jack_ringbuffer_read_space(drv->pRecPtr),
         jack_ringbuffer_write_space(drv->pRecPtr));
 
-  jack_ringbuffer_read(drv->pRecPtr, drv->rw_buffer1,
-                       frames * drv->bytes_per_jack_input_frame);
+  sample_t *buffer = (sample_t *) drv->rw_buffer1;
+  if(resample)
+  {
+    /* read in the data, but don't move the read pointer until we know how much SRC used */
+    jack_ringbuffer_peek(drv->pRecPtr, drv->rw_buffer1, jack_bytes);
+
+    SRC_DATA srcdata;
+    srcdata.data_in = (sample_t *) drv->rw_buffer1;
+    srcdata.input_frames = jack_frames;
+    srcdata.src_ratio = drv->input_sample_rate_ratio;
+    srcdata.data_out = (sample_t *) drv->rw_buffer2;
+    srcdata.output_frames = frames;
+    srcdata.end_of_input = 0;   // it's a stream, it never ends
+    /* convert the sample rate */
+    int src_error = src_process(drv->input_src, &srcdata);
+    DEBUG("used = %ld, generated = %ld, error = %d: %s.\n",
+          srcdata.input_frames_used, srcdata.output_frames_gen,
+          src_error, src_strerror(src_error));
+
+    if(src_error != 0)
+    {
+      ERR("sample rate conversion failed: %s\n", src_strerror(src_error));
+      releaseDriver(drv);
+      return 0;
+    }
+
+    /* now we can move the read pointer */
+    jack_ringbuffer_read_advance(drv->pRecPtr,
+                                 srcdata.input_frames_used * drv->bytes_per_jack_input_frame);
+    frames = srcdata.output_frames_gen;
+    buffer = (sample_t *) drv->rw_buffer2;
+  }
+  else
+    jack_ringbuffer_read(drv->pRecPtr, drv->rw_buffer1, jack_bytes);
 
   DEBUG("ringbuffer read space = %d, write space = %d\n",
         jack_ringbuffer_read_space(drv->pRecPtr),
@@ -1915,11 +1897,11 @@ JACK_Read(int deviceID, unsigned char *data, unsigned long bytes)
       /* assume the volume setting is dB of attenuation, a volume of 0 */
       /* is 0dB attenuation */
       float volume = powf(10.0, -((float) drv->volume[i]) / 20.0);
-      float_volume_effect((sample_t *) drv->rw_buffer1 + i,
+      float_volume_effect(buffer + i,
                           frames, volume, drv->num_output_channels);
     } else
     {
-      float_volume_effect((sample_t *) drv->rw_buffer1 + i, frames,
+      float_volume_effect(buffer + i, frames,
                           ((float) drv->volume[i] / 100.0),
                           drv->num_output_channels);
     }
@@ -1930,11 +1912,11 @@ JACK_Read(int deviceID, unsigned char *data, unsigned long bytes)
   switch (drv->bits_per_channel)
   {
   case 8:
-    sample_move_float_char((unsigned char *) data, (sample_t *) drv->rw_buffer1,
+    sample_move_float_char((unsigned char *) data, buffer,
                            frames * drv->num_input_channels);
     break;
   case 16:
-    sample_move_float_short((short *) data, (sample_t *) drv->rw_buffer1,
+    sample_move_float_short((short *) data, buffer,
                             frames * drv->num_input_channels);
     break;
   }
@@ -2175,8 +2157,7 @@ JACK_GetBytesStoredFromDriver(jack_driver_t * drv)
   {
     /* adjust from jack bytes to client bytes */
     return_val =
-      return_val / drv->bytes_per_jack_output_frame *
-      drv->bytes_per_output_frame;
+      client_bytes_from_jack_frames(drv, return_val / drv->bytes_per_jack_output_frame);
   }
 
   return return_val;
@@ -2212,8 +2193,7 @@ JACK_GetBytesFreeSpaceFromDriver(jack_driver_t * drv)
   {
     /* adjust from jack bytes to client bytes */
     return_val =
-      return_val / drv->bytes_per_jack_output_frame *
-      drv->bytes_per_output_frame;
+      client_bytes_from_jack_frames(drv, return_val / drv->bytes_per_jack_output_frame);
   }
 
   return return_val;
@@ -2616,6 +2596,17 @@ JACK_GetJackBufferedBytes(int deviceID)
   return return_val;
 }
 
+/* number of times since the device was opened that the callback ran */
+/* dry in the middle of the stream, or could not store a period */
+int
+JACK_GetXruns(int deviceID)
+{
+  jack_driver_t *drv = getDriver(deviceID);
+  int return_val = g_atomic_int_get(&drv->xruns);
+  releaseDriver(drv);
+  return return_val;
+}
+
 /* value = TRUE, perform sample rate conversion */
 void
 JACK_DoSampleRateConversion(bool value)
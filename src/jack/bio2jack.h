@@ -85,6 +85,11 @@ long JACK_GetMaxInputBufferedBytes(int deviceID);
 /* bytes that jack requests during each callback */
 unsigned long JACK_GetJackBufferedBytes(int deviceID);
 
+/* times the callback ran dry because too little was written (or, when */
+/* recording, couldn't store because too little was read) since the device */
+/* was opened; running dry at the end of the stream doesn't count */
+int JACK_GetXruns(int deviceID);
+
 /* Properties of the jack driver */
 
 /* linear means 0 volume is silence, 100 is full volume */
@@ -42,6 +42,7 @@ static format_info_t output;
 
 static bool_t output_opened; /* true if we have a connection to jack */
 static bool_t paused;
+static int xruns; /* underruns reported so far */
 
 
 /* Giacomo's note: removed the destructor from the original xmms-jack, cause
@@ -348,6 +349,7 @@ static int jack_open(int fmt, int sample_rate, int num_channels)
   jack_set_volume(jack_cfg.volume_left, jack_cfg.volume_right); /* sets the volume to stored value */
   output_opened = TRUE;
   paused = FALSE;
+  xruns = 0;
 
   return 1;
 }
@@ -370,6 +372,15 @@ static void jack_write(void * ptr, int length)
     length-=written;
     buf+=written;
   }
+
+  /* the jack callback only counts underruns, we log them from here */
+  int new_xruns = JACK_GetXruns(driver);
+  if(new_xruns != xruns)
+  {
+    ERR("%d buffer underrun(s) since the device was opened\n", new_xruns);
+    xruns = new_xruns;
+  }
+
   TRACE("finished\n");
 }
 
@@ -19,12 +19,103 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <time.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include <libaudcore/runtime.h>
 
 #include "ladspa.h"
 #include "plugin.h"
 
+/* The snapshot of loadeds used by the audio thread.  The audio thread
+ * announces the snapshot it is working on in chain_in_use; a snapshot that has
+ * been replaced is freed only when the audio thread is no longer using it. */
+struct Chain {
+    Index<LoadedPlugin *> plugins;
+};
+
+static std::atomic<Chain *> chain;
+static std::atomic<Chain *> chain_in_use;
+
 static int ladspa_channels, ladspa_rate;
 
+/* The chain works on planar audio.  A plugin that can process in place reads
+ * and writes the same buffers; any other plugin writes to the spare set, which
+ * then becomes the current one.  Each set holds LADSPA_BUFLEN frames per
+ * channel. */
+static float * planar_mem[2];
+static float * * planes[2];
+
+/* Helper threads for running the instances of a plugin (one per group of
+ * channels) concurrently.  The audio thread takes part as worker 0. */
+static struct {
+    pthread_t threads[MAX_THREADS];
+    int n_workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond, done_cond;
+    int generation, pending;
+    bool quit;
+
+    /* the block currently being processed */
+    LoadedPlugin * job;
+    int job_frames;
+} pool = {{}, 1, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+ PTHREAD_COND_INITIALIZER};
+
+void publish_loadeds_locked (void)
+{
+    Chain * c = nullptr;
+
+    if (loadeds.len ())
+    {
+        c = new Chain;
+        for (LoadedPlugin * loaded : loadeds)
+            c->plugins.append (loaded);
+    }
+
+    Chain * old = chain.exchange (c);
+
+    /* wait for the audio thread to finish the block it is processing */
+    while (old && chain_in_use.load () == old)
+        g_usleep (1000);
+
+    delete old;
+}
+
+static Chain * enter_chain (void)
+{
+    Chain * c;
+
+    /* the snapshot must still be current after we have announced it, or it
+     * may already have been freed */
+    do
+    {
+        c = chain.load ();
+        chain_in_use.store (c);
+    }
+    while (c != chain.load ());
+
+    return c;
+}
+
+static void leave_chain (void)
+{
+    chain_in_use.store (nullptr);
+}
+
+static void apply_controls (LoadedPlugin * loaded)
+{
+    if (! loaded->changed.exchange (false, std::memory_order_acquire))
+        return;
+
+    int count = loaded->plugin->controls.len ();
+    for (int i = 0; i < count; i ++)
+        loaded->values[i] = loaded->targets[i].load (std::memory_order_relaxed);
+}
+
 static void start_plugin (LoadedPlugin * loaded)
 {
     if (loaded->active)
@@ -52,9 +143,6 @@ static void start_plugin (LoadedPlugin * loaded)
 
     int instances = ladspa_channels / ports;
 
-    loaded->in_bufs = g_new (float *, ladspa_channels);
-    loaded->out_bufs = g_new (float *, ladspa_channels);
-
     for (int i = 0; i < instances; i ++)
     {
         LADSPA_Handle handle = desc->instantiate (desc, ladspa_rate);
@@ -67,19 +155,16 @@ static void start_plugin (LoadedPlugin * loaded)
             desc->connect_port (handle, control->port, & loaded->values[c]);
         }
 
+        /* the audio ports are connected again before each block */
         for (unsigned p = 0; p < ports; p ++)
         {
             int channel = ports * i + p;
 
-            float * in = g_new (float, LADSPA_BUFLEN);
-            loaded->in_bufs[channel] = in;
             int in_port = g_array_index (plugin->in_ports, int, p);
-            desc->connect_port (handle, in_port, in);
+            desc->connect_port (handle, in_port, planes[0][channel]);
 
-            float * out = g_new (float, LADSPA_BUFLEN);
-            loaded->out_bufs[channel] = out;
             int out_port = g_array_index (plugin->out_ports, int, p);
-            desc->connect_port (handle, out_port, out);
+            desc->connect_port (handle, out_port, planes[1][channel]);
         }
 
         if (desc->activate)
@@ -87,10 +172,172 @@ static void start_plugin (LoadedPlugin * loaded)
     }
 }
 
-static void run_plugin (LoadedPlugin * loaded, float * data, int samples)
+static int64_t thread_cpu_time (void)
 {
-    if (! loaded->instances.len ())
+    struct timespec ts;
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, & ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* runs every n-th instance, starting with the given one */
+static void run_instances (LoadedPlugin * loaded, int frames, int first, int n)
+{
+    const LADSPA_Descriptor * desc = loaded->plugin->desc;
+    int instances = loaded->instances.len ();
+
+    int64_t start = thread_cpu_time ();
+
+    for (int i = first; i < instances; i += n)
+        desc->run (loaded->instances[i], frames);
+
+    loaded->cpu_time.fetch_add (thread_cpu_time () - start, std::memory_order_relaxed);
+}
+
+static void * pool_worker (void * arg)
+{
+    int index = GPOINTER_TO_INT (arg);
+    int seen = 0;
+
+    pthread_mutex_lock (& pool.mutex);
+
+    while (1)
+    {
+        while (! pool.quit && pool.generation == seen)
+            pthread_cond_wait (& pool.start_cond, & pool.mutex);
+
+        if (pool.quit)
+            break;
+
+        seen = pool.generation;
+        LoadedPlugin * loaded = pool.job;
+        int frames = pool.job_frames;
+        int n_workers = pool.n_workers;
+
+        pthread_mutex_unlock (& pool.mutex);
+
+        run_instances (loaded, frames, index, n_workers);
+
+        pthread_mutex_lock (& pool.mutex);
+
+        if (! -- pool.pending)
+            pthread_cond_signal (& pool.done_cond);
+    }
+
+    pthread_mutex_unlock (& pool.mutex);
+    return NULL;
+}
+
+static void pool_stop (void)
+{
+    pthread_mutex_lock (& pool.mutex);
+    pool.quit = true;
+    pthread_cond_broadcast (& pool.start_cond);
+    pthread_mutex_unlock (& pool.mutex);
+
+    for (int i = 1; i < pool.n_workers; i ++)
+        pthread_join (pool.threads[i - 1], NULL);
+
+    pool.n_workers = 1;
+    pool.quit = false;
+}
+
+static void pool_start (int n_workers)
+{
+    if (n_workers == pool.n_workers)
+        return;
+
+    pool_stop ();
+
+    for (int i = 1; i < n_workers; i ++)
+    {
+        if (pthread_create (& pool.threads[i - 1], NULL, pool_worker, GINT_TO_POINTER (i)))
+            break;
+
+        pool.n_workers = i + 1;
+    }
+}
+
+static void run_parallel (LoadedPlugin * loaded, int frames)
+{
+    if (pool.n_workers < 2 || loaded->instances.len () < 2)
+    {
+        run_instances (loaded, frames, 0, 1);
         return;
+    }
+
+    pthread_mutex_lock (& pool.mutex);
+    pool.job = loaded;
+    pool.job_frames = frames;
+    pool.generation ++;
+    pool.pending = pool.n_workers - 1;
+    pthread_cond_broadcast (& pool.start_cond);
+    pthread_mutex_unlock (& pool.mutex);
+
+    run_instances (loaded, frames, 0, pool.n_workers);
+
+    pthread_mutex_lock (& pool.mutex);
+
+    while (pool.pending)
+        pthread_cond_wait (& pool.done_cond, & pool.mutex);
+
+    pthread_mutex_unlock (& pool.mutex);
+}
+
+static void deinterleave (const float * data, float * * bufs, int frames)
+{
+    int f = 0;
+
+#ifdef __SSE__
+    if (ladspa_channels == 2)
+    {
+        for (; f + 4 <= frames; f += 4)
+        {
+            __m128 a = _mm_loadu_ps (data + 2 * f);
+            __m128 b = _mm_loadu_ps (data + 2 * f + 4);
+            _mm_storeu_ps (bufs[0] + f, _mm_shuffle_ps (a, b, _MM_SHUFFLE (2, 0, 2, 0)));
+            _mm_storeu_ps (bufs[1] + f, _mm_shuffle_ps (a, b, _MM_SHUFFLE (3, 1, 3, 1)));
+        }
+    }
+#endif
+
+    for (; f < frames; f ++)
+    {
+        for (int c = 0; c < ladspa_channels; c ++)
+            bufs[c][f] = data[ladspa_channels * f + c];
+    }
+}
+
+static void interleave (float * * bufs, float * data, int frames)
+{
+    int f = 0;
+
+#ifdef __SSE__
+    if (ladspa_channels == 2)
+    {
+        for (; f + 4 <= frames; f += 4)
+        {
+            __m128 l = _mm_loadu_ps (bufs[0] + f);
+            __m128 r = _mm_loadu_ps (bufs[1] + f);
+            _mm_storeu_ps (data + 2 * f, _mm_unpacklo_ps (l, r));
+            _mm_storeu_ps (data + 2 * f + 4, _mm_unpackhi_ps (l, r));
+        }
+    }
+#endif
+
+    for (; f < frames; f ++)
+    {
+        for (int c = 0; c < ladspa_channels; c ++)
+            data[ladspa_channels * f + c] = bufs[c][f];
+    }
+}
+
+/* Runs a plugin on one block of planar audio and returns the buffers holding
+ * the output, which are either bufs or spare. */
+static float * * run_plugin (LoadedPlugin * loaded, float * * bufs,
+ float * * spare, int frames)
+{
+    if (! loaded->instances.len ())
+        return bufs;
 
     PluginData * plugin = loaded->plugin;
     const LADSPA_Descriptor * desc = plugin->desc;
@@ -99,45 +346,55 @@ static void run_plugin (LoadedPlugin * loaded, float * data, int samples)
     int instances = loaded->instances.len ();
     assert (ports * instances == ladspa_channels);
 
-    while (samples / ladspa_channels > 0)
+    float * * out = LADSPA_IS_INPLACE_BROKEN (desc->Properties) ? spare : bufs;
+
+    for (int i = 0; i < instances; i ++)
     {
-        int frames = MIN (samples / ladspa_channels, LADSPA_BUFLEN);
+        LADSPA_Handle handle = loaded->instances[i];
 
-        for (int i = 0; i < instances; i ++)
+        for (int p = 0; p < ports; p ++)
         {
-            LADSPA_Handle handle = loaded->instances[i];
+            int channel = ports * i + p;
 
-            for (int p = 0; p < ports; p ++)
-            {
-                int channel = ports * i + p;
-                float * get = data + channel;
-                float * in = loaded->in_bufs[channel];
-                float * in_end = in + frames;
-
-                while (in < in_end)
-                {
-                    * in ++ = * get;
-                    get += ladspa_channels;
-                }
-            }
+            desc->connect_port (handle, g_array_index (plugin->in_ports, int, p), bufs[channel]);
+            desc->connect_port (handle, g_array_index (plugin->out_ports, int, p), out[channel]);
+        }
+    }
 
-            desc->run (handle, frames);
+    run_parallel (loaded, frames);
+    return out;
+}
 
-            for (int p = 0; p < ports; p ++)
+/* Converts to planar once on entry and back to interleaved once on exit. */
+static void run_chain (Chain * c, float * data, int samples)
+{
+    for (LoadedPlugin * loaded : c->plugins)
+    {
+        apply_controls (loaded);
+        start_plugin (loaded);
+    }
+
+    while (samples / ladspa_channels > 0)
+    {
+        int frames = MIN (samples / ladspa_channels, LADSPA_BUFLEN);
+        float * * bufs = planes[0];
+        float * * spare = planes[1];
+
+        deinterleave (data, bufs, frames);
+
+        for (LoadedPlugin * loaded : c->plugins)
+        {
+            float * * out = run_plugin (loaded, bufs, spare, frames);
+
+            if (out != bufs)
             {
-                int channel = ports * i + p;
-                float * set = data + channel;
-                float * out = loaded->out_bufs[channel];
-                float * out_end = out + frames;
-
-                while (out < out_end)
-                {
-                    * set = * out ++;
-                    set += ladspa_channels;
-                }
+                spare = bufs;
+                bufs = out;
             }
         }
 
+        interleave (bufs, data, frames);
+
         data += ladspa_channels * frames;
         samples -= ladspa_channels * frames;
     }
@@ -184,66 +441,89 @@ void shutdown_plugin_locked (LoadedPlugin * loaded)
         desc->cleanup (handle);
     }
 
-    for (int channel = 0; channel < ladspa_channels; channel ++)
-    {
-        g_free (loaded->in_bufs[channel]);
-        g_free (loaded->out_bufs[channel]);
-    }
-
     loaded->instances.clear ();
+}
 
-    g_free (loaded->in_bufs);
-    loaded->in_bufs = NULL;
-    g_free (loaded->out_bufs);
-    loaded->out_bufs = NULL;
+static void free_planes (void)
+{
+    for (int i = 0; i < 2; i ++)
+    {
+        g_free (planar_mem[i]);
+        planar_mem[i] = NULL;
+        g_free (planes[i]);
+        planes[i] = NULL;
+    }
 }
 
 void ladspa_start (int * channels, int * rate)
 {
-    pthread_mutex_lock (& mutex);
+    Chain * c = enter_chain ();
 
-    for (LoadedPlugin * loaded : loadeds)
-        shutdown_plugin_locked (loaded);
+    if (c)
+    {
+        for (LoadedPlugin * loaded : c->plugins)
+            shutdown_plugin_locked (loaded);
+    }
 
     ladspa_channels = * channels;
     ladspa_rate = * rate;
 
-    pthread_mutex_unlock (& mutex);
+    free_planes ();
+
+    for (int i = 0; i < 2; i ++)
+    {
+        planar_mem[i] = g_new (float, ladspa_channels * LADSPA_BUFLEN);
+        planes[i] = g_new (float *, ladspa_channels);
+
+        for (int channel = 0; channel < ladspa_channels; channel ++)
+            planes[i][channel] = planar_mem[i] + channel * LADSPA_BUFLEN;
+    }
+
+    leave_chain ();
+
+    pool_start (CLAMP (aud_get_int ("ladspa", "threads"), 1, MAX_THREADS));
+}
+
+void ladspa_effect_cleanup (void)
+{
+    pool_stop ();
+    free_planes ();
 }
 
 void ladspa_process (float * * data, int * samples)
 {
-    pthread_mutex_lock (& mutex);
+    Chain * c = enter_chain ();
 
-    for (LoadedPlugin * loaded : loadeds)
-    {
-        start_plugin (loaded);
-        run_plugin (loaded, * data, * samples);
-    }
+    if (c)
+        run_chain (c, * data, * samples);
 
-    pthread_mutex_unlock (& mutex);
+    leave_chain ();
 }
 
 void ladspa_flush (void)
 {
-    pthread_mutex_lock (& mutex);
+    Chain * c = enter_chain ();
 
-    for (LoadedPlugin * loaded : loadeds)
-        flush_plugin (loaded);
+    if (c)
+    {
+        for (LoadedPlugin * loaded : c->plugins)
+            flush_plugin (loaded);
+    }
 
-    pthread_mutex_unlock (& mutex);
+    leave_chain ();
 }
 
 void ladspa_finish (float * * data, int * samples)
 {
-    pthread_mutex_lock (& mutex);
+    Chain * c = enter_chain ();
 
-    for (LoadedPlugin * loaded : loadeds)
+    if (c)
     {
-        start_plugin (loaded);
-        run_plugin (loaded, * data, * samples);
-        shutdown_plugin_locked (loaded);
+        run_chain (c, * data, * samples);
+
+        for (LoadedPlugin * loaded : c->plugins)
+            shutdown_plugin_locked (loaded);
     }
 
-    pthread_mutex_unlock (& mutex);
+    leave_chain ();
 }
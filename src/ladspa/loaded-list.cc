@@ -17,16 +17,48 @@
  * the use of this software.
  */
 
+#include <libaudcore/audstrings.h>
 #include <libaudgui/list.h>
 
 #include "plugin.h"
 
+#define CPU_UPDATE_DELAY 1000
+
+static int64_t cpu_update_time;
+
 static void get_value (void * user, int row, int column, GValue * value)
 {
     g_return_if_fail (row >= 0 && row < loadeds.len ());
-    g_return_if_fail (column == 0);
+    g_return_if_fail (column >= 0 && column < 2);
+
+    if (column == 0)
+        g_value_set_string (value, loadeds[row]->plugin->desc->Name);
+    else
+        g_value_set_string (value, str_printf ("%.1f%%", loadeds[row]->cpu_load));
+}
+
+/* CPU load is shown as a percentage of real time, so it can exceed 100% when
+ * the plugin runs in several threads. */
+static int update_cpu_load (GtkWidget * list)
+{
+    int64_t now = g_get_monotonic_time ();
+    int64_t elapsed = now - cpu_update_time;
+    cpu_update_time = now;
+
+    for (LoadedPlugin * loaded : loadeds)
+    {
+        int64_t cpu_time = loaded->cpu_time.load (std::memory_order_relaxed);
+        loaded->cpu_load = (cpu_time - loaded->cpu_time_shown) / (10.0f * elapsed);
+        loaded->cpu_time_shown = cpu_time;
+    }
 
-    g_value_set_string (value, loadeds[row]->plugin->desc->Name);
+    audgui_list_update_rows (list, 0, loadeds.len ());
+    return TRUE;
+}
+
+static void stop_cpu_updates (GtkWidget * list, void * source)
+{
+    g_source_remove (GPOINTER_TO_INT (source));
 }
 
 static int get_selected (void * user, int row)
@@ -93,6 +125,7 @@ static void shift_rows (void * user, int row, int before)
         move.move_from (others, 0, 0, -1, true, true);
 
     loadeds.move_from (move, 0, begin, end - begin, false, true);
+    publish_loadeds_locked ();
 
     pthread_mutex_unlock (& mutex);
 
@@ -114,7 +147,20 @@ GtkWidget * create_loaded_list (void)
 {
     GtkWidget * list = audgui_list_new (& callbacks, NULL, loadeds.len ());
     audgui_list_add_column (list, NULL, 0, G_TYPE_STRING, -1);
+    audgui_list_add_column (list, NULL, 1, G_TYPE_STRING, 6);
     gtk_tree_view_set_headers_visible ((GtkTreeView *) list, 0);
+
+    cpu_update_time = g_get_monotonic_time ();
+
+    for (LoadedPlugin * loaded : loadeds)
+    {
+        loaded->cpu_time_shown = loaded->cpu_time.load (std::memory_order_relaxed);
+        loaded->cpu_load = 0;
+    }
+
+    int source = g_timeout_add (CPU_UPDATE_DELAY, (GSourceFunc) update_cpu_load, list);
+    g_signal_connect (list, "destroy", (GCallback) stop_cpu_updates, GINT_TO_POINTER (source));
+
     return list;
 }
 
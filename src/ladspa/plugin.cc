@@ -36,6 +36,7 @@
 
 static const gchar * const ladspa_defaults[] = {
  "plugin_count", "0",
+ "threads", "1",
  NULL};
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -243,12 +244,19 @@ LoadedPlugin * enable_plugin_locked (PluginData * plugin)
     loaded->plugin = plugin;
 
     int count = plugin->controls.len ();
+    loaded->targets = new std::atomic<float>[count];
     loaded->values = g_new (float, count);
+    loaded->changed = false;
+    loaded->cpu_time = 0;
 
     for (int i = 0; i < count; i ++)
+    {
+        loaded->targets[i] = plugin->controls[i]->def;
         loaded->values[i] = plugin->controls[i]->def;
+    }
 
     loadeds.append (loaded);
+    publish_loadeds_locked ();
     return loaded;
 }
 
@@ -257,14 +265,24 @@ void disable_plugin_locked (int i)
     g_return_if_fail (i >= 0 && i < loadeds.len ());
     LoadedPlugin * loaded = loadeds[i];
 
+    /* once the new list is published, the audio thread is done with it */
+    loadeds.remove (i, 1);
+    publish_loadeds_locked ();
+
     if (loaded->settings_win)
         gtk_widget_destroy (loaded->settings_win);
 
     shutdown_plugin_locked (loaded);
 
+    delete[] loaded->targets;
     g_free (loaded->values);
     delete loaded;
-    loadeds.remove (i, 1);
+}
+
+void set_control (LoadedPlugin * loaded, int control, float value)
+{
+    loaded->targets[control].store (value, std::memory_order_relaxed);
+    loaded->changed.store (true, std::memory_order_release);
 }
 
 static PluginData * find_plugin (const char * path, const char * label)
@@ -301,7 +319,7 @@ static void save_enabled_to_config (void)
         temp.insert (0, loaded->plugin->controls.len ());
 
         for (int ci = 0; ci < temp.len (); ci ++)
-            temp[ci] = loaded->values[ci];
+            temp[ci] = loaded->targets[ci];
 
         aud_set_str ("ladspa", key, double_array_to_str (temp.begin (), temp.len ()));
 
@@ -352,7 +370,7 @@ static void load_enabled_from_config (void)
             if (str_to_double_array (controls, temp.begin (), temp.len ()))
             {
                 for (int ci = 0; ci < temp.len (); ci ++)
-                    loaded->values[ci] = temp[ci];
+                    set_control (loaded, ci, temp[ci]);
             }
             else
             {
@@ -360,7 +378,7 @@ static void load_enabled_from_config (void)
                 for (int ci = 0; ci < temp.len (); ci ++)
                 {
                     snprintf (key, sizeof key, "plugin%d_control%d", i, ci);
-                    loaded->values[ci] = aud_get_double ("ladspa", key);
+                    set_control (loaded, ci, aud_get_double ("ladspa", key));
                     aud_set_str ("ladspa", key, "");
                 }
             }
@@ -401,6 +419,8 @@ static void cleanup (void)
     module_path = String ();
 
     pthread_mutex_unlock (& mutex);
+
+    ladspa_effect_cleanup ();
 }
 
 static void set_module_path (GtkEntry * entry)
@@ -423,6 +443,11 @@ static void set_module_path (GtkEntry * entry)
         update_loaded_list (loaded_list);
 }
 
+static void set_threads (GtkSpinButton * spin)
+{
+    aud_set_int ("ladspa", "threads", gtk_spin_button_get_value_as_int (spin));
+}
+
 static void enable_selected (void)
 {
     pthread_mutex_lock (& mutex);
@@ -460,18 +485,16 @@ static void disable_selected (void)
         update_loaded_list (loaded_list);
 }
 
-static void control_toggled (GtkToggleButton * toggle, float * value)
+static void control_toggled (GtkToggleButton * toggle, LoadedPlugin * loaded)
 {
-    pthread_mutex_lock (& mutex);
-    * value = gtk_toggle_button_get_active (toggle) ? 1 : 0;
-    pthread_mutex_unlock (& mutex);
+    int control = GPOINTER_TO_INT (g_object_get_data ((GObject *) toggle, "control"));
+    set_control (loaded, control, gtk_toggle_button_get_active (toggle) ? 1 : 0);
 }
 
-static void control_changed (GtkSpinButton * spin, float * value)
+static void control_changed (GtkSpinButton * spin, LoadedPlugin * loaded)
 {
-    pthread_mutex_lock (& mutex);
-    * value = gtk_spin_button_get_value (spin);
-    pthread_mutex_unlock (& mutex);
+    int control = GPOINTER_TO_INT (g_object_get_data ((GObject *) spin, "control"));
+    set_control (loaded, control, gtk_spin_button_get_value (spin));
 }
 
 static void configure_plugin (LoadedPlugin * loaded)
@@ -504,10 +527,11 @@ static void configure_plugin (LoadedPlugin * loaded)
         if (control->is_toggle)
         {
             GtkWidget * toggle = gtk_check_button_new_with_label (control->name);
-            gtk_toggle_button_set_active ((GtkToggleButton *) toggle, (loaded->values[i] > 0) ? 1 : 0);
+            gtk_toggle_button_set_active ((GtkToggleButton *) toggle, (loaded->targets[i] > 0) ? 1 : 0);
             gtk_box_pack_start ((GtkBox *) hbox, toggle, 0, 0, 0);
 
-            g_signal_connect (toggle, "toggled", (GCallback) control_toggled, & loaded->values[i]);
+            g_object_set_data ((GObject *) toggle, "control", GINT_TO_POINTER (i));
+            g_signal_connect (toggle, "toggled", (GCallback) control_toggled, loaded);
         }
         else
         {
@@ -516,10 +540,11 @@ static void configure_plugin (LoadedPlugin * loaded)
             gtk_box_pack_start ((GtkBox *) hbox, label, 0, 0, 0);
 
             GtkWidget * spin = gtk_spin_button_new_with_range (control->min, control->max, 0.01);
-            gtk_spin_button_set_value ((GtkSpinButton *) spin, loaded->values[i]);
+            gtk_spin_button_set_value ((GtkSpinButton *) spin, loaded->targets[i]);
             gtk_box_pack_start ((GtkBox *) hbox, spin, 0, 0, 0);
 
-            g_signal_connect (spin, "value-changed", (GCallback) control_changed, & loaded->values[i]);
+            g_object_set_data ((GObject *) spin, "control", GINT_TO_POINTER (i));
+            g_signal_connect (spin, "value-changed", (GCallback) control_changed, loaded);
         }
     }
 
@@ -575,6 +600,24 @@ static void configure (void)
     GtkWidget * entry = gtk_entry_new ();
     gtk_box_pack_start ((GtkBox *) hbox, entry, 1, 1, 0);
 
+    hbox = gtk_hbox_new (FALSE, 6);
+    gtk_box_pack_start ((GtkBox *) vbox, hbox, 0, 0, 0);
+
+    label = gtk_label_new (_("Threads per plugin:"));
+    gtk_box_pack_start ((GtkBox *) hbox, label, 0, 0, 0);
+
+    GtkWidget * threads = gtk_spin_button_new_with_range (1, MAX_THREADS, 1);
+    gtk_spin_button_set_value ((GtkSpinButton *) threads, aud_get_int ("ladspa", "threads"));
+    gtk_box_pack_start ((GtkBox *) hbox, threads, 0, 0, 0);
+
+    label = gtk_label_new (0);
+    gtk_label_set_markup ((GtkLabel *) label, _("<small>Plugins used on several "
+     "groups of channels run each group in a separate thread.  Takes effect "
+     "with the next song.</small>"));
+    gtk_misc_set_padding ((GtkMisc *) label, 12, 6);
+    gtk_misc_set_alignment ((GtkMisc *) label, 0, 0);
+    gtk_box_pack_start ((GtkBox *) vbox, label, 0, 0, 0);
+
     hbox = gtk_hbox_new (FALSE, 6);
     gtk_box_pack_start ((GtkBox *) vbox, hbox, 1, 1, 0);
 
@@ -625,6 +668,7 @@ static void configure (void)
     g_signal_connect (config_win, "response", (GCallback) gtk_widget_destroy, NULL);
     g_signal_connect (config_win, "destroy", (GCallback) gtk_widget_destroyed, & config_win);
     g_signal_connect (entry, "activate", (GCallback) set_module_path, NULL);
+    g_signal_connect (threads, "value-changed", (GCallback) set_threads, NULL);
     g_signal_connect (plugin_list, "destroy", (GCallback) gtk_widget_destroyed, & plugin_list);
     g_signal_connect (enable_button, "clicked", (GCallback) enable_selected, NULL);
     g_signal_connect (loaded_list, "destroy", (GCallback) gtk_widget_destroyed, & loaded_list);
@@ -21,6 +21,7 @@
 #define AUD_LADSPA_PLUGIN_H
 
 #include <pthread.h>
+#include <atomic>
 #include <gtk/gtk.h>
 
 #include <libaudcore/index.h>
@@ -29,6 +30,7 @@
 #include "ladspa.h"
 
 #define LADSPA_BUFLEN 1024
+#define MAX_THREADS 16
 
 typedef struct {
     int port;
@@ -47,19 +49,34 @@ typedef struct {
 
 typedef struct {
     PluginData * plugin;
+
+    /* Control values are owned by the main thread; the audio thread copies
+     * them to the ports (values) at the start of a block when changed is set.
+     * Only the latest value of each control matters, so a newer change simply
+     * replaces one that has not been picked up yet. */
+    std::atomic<float> * targets;
+    std::atomic<bool> changed;
     float * values;
+
     char selected;
     char active;
+
+    /* CPU time spent running the plugin in nanoseconds, added to by the audio
+     * thread and its helpers; the rest is for the loaded plugins list */
+    std::atomic<int64_t> cpu_time;
+    int64_t cpu_time_shown;
+    float cpu_load;
+
     Index<LADSPA_Handle> instances;
-    float * * in_bufs, * * out_bufs;
     GtkWidget * settings_win;
 } LoadedPlugin;
 
 /* plugin.c */
 
-/* The mutex needs to be locked when the main thread is writing to the data
- * structures below (but not when it is only reading from them) and when the
- * audio thread is reading from them. */
+/* The data structures below belong to the main thread; the mutex needs to be
+ * locked when writing to them.  The audio thread never takes the mutex.  It
+ * works on a snapshot of loadeds, which is replaced by publish_loadeds_locked
+ * after any change to the list. */
 
 extern pthread_mutex_t mutex;
 extern String module_path;
@@ -74,10 +91,13 @@ extern GtkWidget * loaded_list;
 
 LoadedPlugin * enable_plugin_locked (PluginData * plugin);
 void disable_plugin_locked (int i);
+void set_control (LoadedPlugin * loaded, int control, float value);
 
 /* effect.c */
 
 void shutdown_plugin_locked (LoadedPlugin * loaded);
+void publish_loadeds_locked (void);
+void ladspa_effect_cleanup (void);
 
 void ladspa_start (gint * channels, gint * rate);
 void ladspa_process (gfloat * * data, gint * samples);
@@ -19,7 +19,9 @@
  */
 
 #include <stdio.h>
+#include <time.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <gtk/gtk.h>
 #include <libxml/parser.h>
@@ -32,6 +34,7 @@
 #include <libaudcore/playlist.h>
 #include <libaudcore/plugin.h>
 #include <libaudcore/plugins.h>
+#include <libaudcore/runtime.h>
 #include <libaudcore/audstrings.h>
 #include <libaudcore/hook.h>
 #include <libaudcore/vfs_async.h>
@@ -44,6 +47,99 @@ typedef struct {
 
 static LyricsState state;
 
+/* one chain of requests, for the playing song or for prefetching */
+typedef struct {
+	String title, artist;
+	String uri; /* URI we are trying to retrieve */
+	bool_t prefetch; /* only store the result in the cache */
+} LyricsFetch;
+
+static String prefetch_key; /* artist and title of the last prefetch */
+static bool_t prefetch_waiting; /* for the next song to be scanned */
+
+#define CACHE_TTL (30 * 24 * 60 * 60) /* seconds */
+
+static const char * const lyricwiki_defaults[] = {
+ "base_uri", "http://lyrics.wikia.com",
+ NULL};
+
+/* lower case, Unicode-normalized, with white space collapsed; g_free() result */
+static char *normalize_field(const char *str)
+{
+	char *norm = g_utf8_normalize(str, -1, G_NORMALIZE_ALL);
+	char *fold = g_utf8_casefold(norm ? norm : str, -1);
+	g_free(norm);
+
+	char *out = fold;
+	bool_t space = TRUE; /* drops leading white space */
+
+	for (const char *in = fold; *in; in++)
+	{
+		if (g_ascii_isspace(*in))
+		{
+			if (!space)
+				*out++ = ' ';
+			space = TRUE;
+		}
+		else
+		{
+			*out++ = *in;
+			space = FALSE;
+		}
+	}
+
+	if (out > fold && out[-1] == ' ')
+		out--;
+
+	*out = 0;
+	return fold;
+}
+
+/* g_free() returned path */
+static char *cache_path(const char *artist, const char *title)
+{
+	char *norm_artist = normalize_field(artist);
+	char *norm_title = normalize_field(title);
+	char *key = g_strconcat(norm_artist, "\n", norm_title, NULL);
+	char *sum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+	char *name = g_strconcat(sum, ".txt", NULL);
+	char *path = g_build_filename(aud_get_path(AUD_PATH_USER_DIR), "lyrics", name, NULL);
+
+	g_free(norm_artist);
+	g_free(norm_title);
+	g_free(key);
+	g_free(sum);
+	g_free(name);
+
+	return path;
+}
+
+/* g_free() returned text; NULL if not cached or expired */
+static char *cache_read(const char *artist, const char *title)
+{
+	char *path = cache_path(artist, title);
+	char *lyrics = NULL;
+	GStatBuf st;
+
+	if (!g_stat(path, &st) && time(NULL) - st.st_mtime < CACHE_TTL)
+		g_file_get_contents(path, &lyrics, NULL, NULL);
+
+	g_free(path);
+	return lyrics;
+}
+
+static void cache_write(const char *artist, const char *title, const char *lyrics)
+{
+	char *path = cache_path(artist, title);
+	char *dir = g_path_get_dirname(path);
+
+	if (g_mkdir_with_parents(dir, 0755) < 0 || !g_file_set_contents(path, lyrics, -1, NULL))
+		fprintf(stderr, "lyricwiki: Unable to write %s\n", path);
+
+	g_free(dir);
+	g_free(path);
+}
+
 /*
  * Suppress libxml warnings, because lyricwiki does not generate anything near
  * valid HTML.
@@ -176,8 +272,8 @@ static String scrape_uri_from_lyricwiki_search_result(const char *buf, int64_t l
 				lyric = xmlNodeGetContent(cur);
 				basename = g_path_get_basename((gchar *) lyric);
 
-				uri = String (str_printf ("http://lyrics.wikia.com/index.php?"
-				 "action=edit&title=%s", basename));
+				uri = String (str_printf ("%s/index.php?action=edit&title=%s",
+				 (const char *) aud_get_str ("lyricwiki", "base_uri"), basename));
 
 				g_free(basename);
 				xmlFree(lyric);
@@ -193,78 +289,180 @@ static String scrape_uri_from_lyricwiki_search_result(const char *buf, int64_t l
 }
 
 static void update_lyrics_window(const char *title, const char *artist, const char *lyrics);
+static void prefetch_next(void);
 
-static bool_t get_lyrics_step_3(void *buf, int64_t len, void *requri)
+/* a response for the playing song that is still wanted */
+static bool_t fetch_is_current(LyricsFetch *fetch)
 {
-	if (!state.uri || strcmp(state.uri, (char *) requri))
-	{
-		g_free(buf);
-		str_unref((char *) requri);
-		return FALSE;
-	}
-	str_unref((char *) requri);
+	return !fetch->prefetch && state.uri && !strcmp(state.uri, fetch->uri);
+}
+
+static void fetch_error(LyricsFetch *fetch, const char *format)
+{
+	if (fetch_is_current(fetch))
+		update_lyrics_window (_("Error"), NULL,
+		 str_printf (format, (const char *) fetch->uri));
+}
+
+static void fetch_done(LyricsFetch *fetch)
+{
+	if (fetch_is_current(fetch))
+		prefetch_next();
+
+	delete fetch;
+}
+
+static bool_t get_lyrics_step_3(void *buf, int64_t len, void *data)
+{
+	LyricsFetch *fetch = (LyricsFetch *) data;
 
 	if(!len)
 	{
-		update_lyrics_window (_("Error"), NULL,
-		 str_printf (_("Unable to fetch %s"), (const char *) state.uri));
+		fetch_error(fetch, _("Unable to fetch %s"));
 		g_free(buf);
+		fetch_done(fetch);
 		return FALSE;
 	}
 
 	char *lyrics = scrape_lyrics_from_lyricwiki_edit_page((char *) buf, len);
+	g_free(buf);
 
 	if(!lyrics)
 	{
-		update_lyrics_window (_("Error"), NULL,
-		 str_printf (_("Unable to parse %s"), (const char *) state.uri));
-		g_free(buf);
+		fetch_error(fetch, _("Unable to parse %s"));
+		fetch_done(fetch);
 		return FALSE;
 	}
 
-	update_lyrics_window(state.title, state.artist, lyrics);
+	/* cache the lyrics even if the song has changed meanwhile, but not the
+	 * placeholder, since somebody may add the lyrics later */
+	if (strcmp(lyrics, _("No lyrics available")))
+		cache_write(fetch->artist, fetch->title, lyrics);
+
+	if (fetch_is_current(fetch))
+		update_lyrics_window(fetch->title, fetch->artist, lyrics);
 
 	g_free(lyrics);
+	fetch_done(fetch);
 	return TRUE;
 }
 
-static bool_t get_lyrics_step_2(void *buf, int64_t len, void *requri)
+static bool_t get_lyrics_step_2(void *buf, int64_t len, void *data)
 {
-	if (strcmp(state.uri, (char *) requri))
+	LyricsFetch *fetch = (LyricsFetch *) data;
+
+	/* the song has changed meanwhile */
+	if (!fetch->prefetch && !fetch_is_current(fetch))
 	{
 		g_free(buf);
-		str_unref((char *) requri);
+		delete fetch;
 		return FALSE;
 	}
-	str_unref((char *) requri);
 
 	if(!len)
 	{
-		update_lyrics_window (_("Error"), NULL,
-		 str_printf (_("Unable to fetch %s"), (const char *) state.uri));
+		fetch_error(fetch, _("Unable to fetch %s"));
 		g_free(buf);
+		fetch_done(fetch);
 		return FALSE;
 	}
 
 	String uri = scrape_uri_from_lyricwiki_search_result((char *) buf, len);
+	g_free(buf);
 
 	if(!uri)
 	{
-		update_lyrics_window (_("Error"), NULL,
-		 str_printf (_("Unable to parse %s"), (const char *) state.uri));
-		g_free(buf);
+		fetch_error(fetch, _("Unable to parse %s"));
+		fetch_done(fetch);
 		return FALSE;
 	}
 
-	state.uri = uri;
+	if (!fetch->prefetch)
+	{
+		state.uri = uri;
+		update_lyrics_window(fetch->title, fetch->artist, _("Looking for lyrics ..."));
+	}
 
-	update_lyrics_window(state.title, state.artist, _("Looking for lyrics ..."));
-	vfs_async_file_get_contents(uri, get_lyrics_step_3, str_ref(state.uri));
+	fetch->uri = uri;
+	vfs_async_file_get_contents(uri, get_lyrics_step_3, fetch);
 
-	g_free(buf);
 	return TRUE;
 }
 
+static void start_fetch(const char *title, const char *artist, bool_t prefetch)
+{
+	StringBuf title_buf = str_encode_percent (title);
+	StringBuf artist_buf = str_encode_percent (artist);
+
+	LyricsFetch *fetch = new LyricsFetch ();
+	fetch->title = String (title);
+	fetch->artist = String (artist);
+	fetch->prefetch = prefetch;
+	fetch->uri = String (str_printf ("%s/api.php?"
+	 "action=lyrics&artist=%s&song=%s&fmt=xml",
+	 (const char *) aud_get_str ("lyricwiki", "base_uri"),
+	 (const char *) artist_buf, (const char *) title_buf));
+
+	if (!prefetch)
+		state.uri = fetch->uri;
+
+	vfs_async_file_get_contents(fetch->uri, get_lyrics_step_2, fetch);
+}
+
+static void prefetch_next(void);
+
+static void prefetch_retry(void *data, void *user)
+{
+	prefetch_next();
+}
+
+static void prefetch_stop_waiting(void)
+{
+	if (prefetch_waiting)
+	{
+		hook_dissociate("playlist update", prefetch_retry);
+		prefetch_waiting = FALSE;
+	}
+}
+
+/* fetch the lyrics of the next song into the cache while this one plays */
+static void prefetch_next(void)
+{
+	prefetch_stop_waiting();
+
+	int playlist = aud_playlist_get_playing();
+	if (playlist < 0)
+		return;
+
+	int pos = aud_playlist_get_position(playlist) + 1;
+	if (pos < 1 || pos >= aud_playlist_entry_count(playlist))
+		return;
+
+	String title, artist, album;
+	/* don't block the main thread scanning the file; if it hasn't been
+	 * scanned yet, try again when the playlist is updated */
+	aud_playlist_entry_describe(playlist, pos, title, artist, album, TRUE);
+
+	if (!artist || !title)
+	{
+		hook_associate("playlist update", prefetch_retry, NULL);
+		prefetch_waiting = TRUE;
+		return;
+	}
+
+	StringBuf key = str_concat ({artist, "\n", title});
+	if (prefetch_key && !strcmp(prefetch_key, key))
+		return;
+
+	prefetch_key = String (key);
+
+	char *lyrics = cache_read(artist, title);
+	if (lyrics)
+		g_free(lyrics);
+	else
+		start_fetch(title, artist, TRUE);
+}
+
 static void get_lyrics_step_1(void)
 {
 	if(!state.artist || !state.title)
@@ -273,15 +471,18 @@ static void get_lyrics_step_1(void)
 		return;
 	}
 
-	StringBuf title_buf = str_encode_percent (state.title);
-	StringBuf artist_buf = str_encode_percent (state.artist);
+	char *lyrics = cache_read(state.artist, state.title);
 
-	state.uri = String (str_printf ("http://lyrics.wikia.com/api.php?"
-	 "action=lyrics&artist=%s&song=%s&fmt=xml", (const char *) artist_buf,
-	 (const char *) title_buf));
+	if (lyrics)
+	{
+		update_lyrics_window(state.title, state.artist, lyrics);
+		g_free(lyrics);
+		prefetch_next();
+		return;
+	}
 
 	update_lyrics_window(state.title, state.artist, _("Connecting to lyrics.wikia.com ..."));
-	vfs_async_file_get_contents(state.uri, get_lyrics_step_2, str_ref(state.uri));
+	start_fetch(state.title, state.artist, FALSE);
 }
 
 static GtkWidget *scrollview, *vbox;
@@ -371,6 +572,8 @@ static void cleanup ()
 	state.title = String ();
 	state.artist = String ();
 	state.uri = String ();
+	prefetch_key = String ();
+	prefetch_stop_waiting ();
 
 	hook_dissociate ("title change", (HookFunction) lyricwiki_playback_began);
 	hook_dissociate ("playback ready", (HookFunction) lyricwiki_playback_began);
@@ -392,7 +595,14 @@ static void * get_widget ()
 	return vbox;
 }
 
+static bool_t lyricwiki_init (void)
+{
+	aud_config_set_defaults ("lyricwiki", lyricwiki_defaults);
+	return TRUE;
+}
+
 #define AUD_PLUGIN_NAME         N_("LyricWiki Plugin")
+#define AUD_PLUGIN_INIT         lyricwiki_init
 #define AUD_GENERAL_GET_WIDGET  get_widget
 
 #define AUD_DECLARE_GENERAL
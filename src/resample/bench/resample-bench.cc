@@ -0,0 +1,178 @@
+/*
+ * Sample Rate Converter Plugin for Audacious
+ * Copyright 2010-2012 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Throughput benchmark: converts a few seconds of noise with each method and
+ * channel count, in blocks of the size the effect chain passes to us, and
+ * prints input frames converted per second of wall time.
+ *
+ * usage: resample-bench [seconds] [in-rate] [out-rate] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <glib.h>
+#include <samplerate.h>
+
+#include "sinc.h"
+
+#define BLOCK 4096 /* frames */
+
+static const int channel_counts[] = {1, 2, 6, 8};
+static const int thread_counts[] = {1, 2, 4};
+
+static const struct {
+    int method;
+    const char * name;
+} src_methods[] = {
+ {SRC_ZERO_ORDER_HOLD, "skip/repeat"},
+ {SRC_LINEAR, "linear"},
+ {SRC_SINC_FASTEST, "fast sinc"},
+ {SRC_SINC_MEDIUM_QUALITY, "medium sinc"},
+ {SRC_SINC_BEST_QUALITY, "best sinc"}};
+
+static double now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_noise (float * data, int samples)
+{
+    unsigned seed = 1;
+
+    for (int i = 0; i < samples; i ++)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (float) (seed >> 8) / (1 << 23) - 1;
+    }
+}
+
+static double run_src (int method, int channels, double ratio,
+ const float * in, int frames, float * out, int out_frames)
+{
+    int error;
+    SRC_STATE * state = src_new (method, channels, & error);
+
+    if (! state)
+    {
+        fprintf (stderr, "src_new: %s\n", src_strerror (error));
+        exit (1);
+    }
+
+    double start = now ();
+
+    for (int pos = 0; pos < frames; pos += BLOCK)
+    {
+        SRC_DATA d = {0};
+
+        d.data_in = in + (long) pos * channels;
+        d.input_frames = MIN (BLOCK, frames - pos);
+        d.data_out = out;
+        d.output_frames = out_frames;
+        d.src_ratio = ratio;
+        d.end_of_input = (pos + BLOCK >= frames);
+
+        if ((error = src_process (state, & d)))
+        {
+            fprintf (stderr, "src_process: %s\n", src_strerror (error));
+            exit (1);
+        }
+    }
+
+    double elapsed = now () - start;
+    src_delete (state);
+    return elapsed;
+}
+
+static double run_sinc (int threads, int channels, double ratio,
+ const float * in, int frames, float * out)
+{
+    SincState * state = sinc_new (channels, ratio, threads);
+
+    double start = now ();
+
+    for (int pos = 0; pos < frames; pos += BLOCK)
+        sinc_process (state, in + (long) pos * channels,
+         MIN (BLOCK, frames - pos), out, pos + BLOCK >= frames);
+
+    double elapsed = now () - start;
+    sinc_delete (state);
+    return elapsed;
+}
+
+static void report (const char * name, int channels, int frames, int in_rate,
+ double elapsed)
+{
+    printf ("%-22s %2d ch  %10.0f frames/s  %7.1fx realtime\n", name,
+     channels, frames / elapsed, frames / elapsed / in_rate);
+}
+
+int main (int argc, char * * argv)
+{
+    double seconds = (argc > 1) ? atof (argv[1]) : 10;
+    int in_rate = (argc > 2) ? atoi (argv[2]) : 44100;
+    int out_rate = (argc > 3) ? atoi (argv[3]) : 48000;
+
+    if (seconds <= 0 || in_rate <= 0 || out_rate <= 0)
+    {
+        fprintf (stderr, "usage: %s [seconds] [in-rate] [out-rate]\n", argv[0]);
+        return 1;
+    }
+
+    double ratio = (double) out_rate / in_rate;
+    int frames = (int) (seconds * in_rate);
+    int max_channels = channel_counts[G_N_ELEMENTS (channel_counts) - 1];
+    int out_frames = (int) ((BLOCK + 64) * ratio) + 256;
+
+    float * in = g_new (float, (long) frames * max_channels);
+    float * out = g_new (float, (long) out_frames * max_channels);
+
+    fill_noise (in, frames * max_channels);
+
+    printf ("%d Hz -> %d Hz, %g seconds of audio, %d-frame blocks\n\n",
+     in_rate, out_rate, seconds, BLOCK);
+
+    for (int channels : channel_counts)
+    {
+        for (auto & m : src_methods)
+            report (m.name, channels, frames, in_rate, run_src (m.method,
+             channels, ratio, in, frames, out, out_frames));
+
+        for (int threads : thread_counts)
+        {
+            if (threads > channels)
+                break;
+
+            char name[32];
+            snprintf (name, sizeof name, "builtin, %d thread%s", threads,
+             threads > 1 ? "s" : "");
+
+            report (name, channels, frames, in_rate, run_sinc (threads,
+             channels, ratio, in, frames, out));
+        }
+
+        printf ("\n");
+    }
+
+    g_free (in);
+    g_free (out);
+    return 0;
+}
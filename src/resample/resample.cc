@@ -30,9 +30,15 @@
 #include <libaudcore/preferences.h>
 #include <libaudcore/audstrings.h>
 
+#include "sinc.h"
+
 #define MIN_RATE 8000
 #define MAX_RATE 192000
 #define RATE_STEP 50
+#define MAX_THREADS 16
+
+/* not a libsamplerate converter; selects the built-in engine in sinc.cc */
+#define METHOD_BUILTIN_SINC 100
 
 #define RESAMPLE_ERROR(e) fprintf (stderr, "resample: %s\n", src_strerror (e))
 
@@ -40,6 +46,7 @@ static const char * const resample_defaults[] = {
  "method", "2", /* SRC_SINC_FASTEST */
  "default-rate", "44100",
  "use-mappings", "FALSE",
+ "threads", "0",
  "8000", "48000",
  "16000", "48000",
  "22050", "44100",
@@ -53,6 +60,7 @@ static const char * const resample_defaults[] = {
  NULL};
 
 static SRC_STATE * state;
+static SincState * sinc_state;
 static int stored_channels;
 static double ratio;
 static float * buffer;
@@ -64,7 +72,7 @@ bool_t resample_init (void)
     return TRUE;
 }
 
-void resample_cleanup (void)
+static void resample_free (void)
 {
     if (state)
     {
@@ -72,6 +80,17 @@ void resample_cleanup (void)
         state = NULL;
     }
 
+    if (sinc_state)
+    {
+        sinc_delete (sinc_state);
+        sinc_state = NULL;
+    }
+}
+
+void resample_cleanup (void)
+{
+    resample_free ();
+
     g_free (buffer);
     buffer = NULL;
     buffer_samples = 0;
@@ -79,11 +98,7 @@ void resample_cleanup (void)
 
 void resample_start (int * channels, int * rate)
 {
-    if (state)
-    {
-        src_delete (state);
-        state = NULL;
-    }
+    resample_free ();
 
     int new_rate = 0;
 
@@ -101,19 +116,48 @@ void resample_start (int * channels, int * rate)
     int method = aud_get_int ("resample", "method");
     int error;
 
-    if ((state = src_new (method, * channels, & error)) == NULL)
+    ratio = (double) new_rate / * rate;
+
+    if (method == METHOD_BUILTIN_SINC)
+    {
+        int threads = CLAMP (aud_get_int ("resample", "threads"), 0, MAX_THREADS);
+        sinc_state = sinc_new (* channels, ratio, threads);
+    }
+    else if ((state = src_new (method, * channels, & error)) == NULL)
     {
         RESAMPLE_ERROR (error);
         return;
     }
 
     stored_channels = * channels;
-    ratio = (double) new_rate / * rate;
     * rate = new_rate;
 }
 
+static void do_sinc_resample (float * * data, int * samples, bool_t finish)
+{
+    int frames = * samples / stored_channels;
+    int needed = stored_channels * sinc_max_output (sinc_state, frames);
+
+    if (buffer_samples < needed)
+    {
+        buffer_samples = needed;
+        buffer = g_renew (float, buffer, buffer_samples);
+    }
+
+    int frames_out = sinc_process (sinc_state, * data, frames, buffer, finish);
+
+    * data = buffer;
+    * samples = stored_channels * frames_out;
+}
+
 void do_resample (float * * data, int * samples, bool_t finish)
 {
+    if (sinc_state && (* samples || finish))
+    {
+        do_sinc_resample (data, samples, finish);
+        return;
+    }
+
     if (! state || ! * samples)
         return;
 
@@ -153,6 +197,9 @@ void resample_flush (void)
     int error;
     if (state && (error = src_reset (state)))
         RESAMPLE_ERROR (error);
+
+    if (sinc_state)
+        sinc_reset (sinc_state);
 }
 
 void resample_finish (float * * data, int * samples)
@@ -170,7 +217,8 @@ static const ComboBoxElements method_list[] = {
  {"4", N_("Linear interpolation")}, /* SRC_LINEAR */
  {"2", N_("Fast sinc interpolation")}, /* SRC_SINC_FASTEST */
  {"1", N_("Medium sinc interpolation")}, /* SRC_SINC_MEDIUM_QUALITY */
- {"0", N_("Best sinc interpolation")}}; /* SRC_SINC_BEST_QUALITY */
+ {"0", N_("Best sinc interpolation")}, /* SRC_SINC_BEST_QUALITY */
+ {"100", N_("Multithreaded sinc interpolation")}}; /* METHOD_BUILTIN_SINC */
 
 static const PreferencesWidget resample_widgets[] = {
     WidgetLabel (N_("<b>Conversion</b>")),
@@ -180,6 +228,9 @@ static const PreferencesWidget resample_widgets[] = {
     WidgetSpin (N_("Rate:"),
         {VALUE_INT, 0, "resample", "default-rate"},
         {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}),
+    WidgetSpin (N_("Threads:"),
+        {VALUE_INT, 0, "resample", "threads"},
+        {0, MAX_THREADS, 1, N_("(0 = automatic)")}),
     WidgetLabel (N_("<b>Rate Mappings</b>")),
     WidgetCheck (N_("Use rate mappings"),
         {VALUE_BOOLEAN, 0, "resample", "use-mappings"}),
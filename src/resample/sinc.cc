@@ -0,0 +1,445 @@
+/*
+ * Sample Rate Converter Plugin for Audacious
+ * Copyright 2010-2012 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "sinc.h"
+
+#define HALF_TAPS 32
+#define TAPS (2 * HALF_TAPS)
+#define PHASES 256
+#define KAISER_BETA 8.0
+#define MAX_THREADS 16
+
+struct SincWorker {
+    SincState * state;
+    int index;
+    pthread_t thread;
+};
+
+struct SincState {
+    int channels;
+    double step; /* input frames per output frame */
+    float * table; /* (PHASES + 1) rows of TAPS coefficients */
+
+    /* planar input history and output, one buffer per channel */
+    float * * hist, * * out;
+    int hist_size, hist_len, out_size;
+    double pos;
+
+    /* the block currently being processed */
+    const float * job_in;
+    int job_frames, job_pad, job_outputs, job_shift;
+
+    int n_threads;
+    SincWorker * workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond, done_cond;
+    int generation, pending;
+    bool quit;
+};
+
+/* zeroth order modified Bessel function of the first kind */
+static double bessel_i0 (double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 32; k ++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+static float * make_table (double cutoff)
+{
+    float * table = g_new (float, (PHASES + 1) * TAPS);
+    double norm = bessel_i0 (KAISER_BETA);
+
+    for (int p = 0; p <= PHASES; p ++)
+    {
+        float * row = table + p * TAPS;
+        double sum = 0;
+
+        for (int k = 0; k < TAPS; k ++)
+        {
+            double x = (k - HALF_TAPS + 1) - (double) p / PHASES;
+            double r = x / HALF_TAPS;
+            double window = (r > -1 && r < 1) ?
+             bessel_i0 (KAISER_BETA * sqrt (1 - r * r)) / norm : 0;
+            double sinc = (x == 0) ? 1 : sin (M_PI * cutoff * x) / (M_PI * cutoff * x);
+
+            row[k] = cutoff * sinc * window;
+            sum += row[k];
+        }
+
+        /* normalize each phase to unity gain at DC */
+        for (int k = 0; k < TAPS; k ++)
+            row[k] /= sum;
+    }
+
+    return table;
+}
+
+/* computes the dot products of x with both a and b in a single pass */
+#if defined(__AVX__)
+
+static inline float hsum256 (__m256 v)
+{
+    __m128 s = _mm_add_ps (_mm256_castps256_ps128 (v), _mm256_extractf128_ps (v, 1));
+    s = _mm_add_ps (s, _mm_movehl_ps (s, s));
+    s = _mm_add_ss (s, _mm_shuffle_ps (s, s, 1));
+    return _mm_cvtss_f32 (s);
+}
+
+static inline void dot2 (const float * a, const float * b, const float * x,
+ float * ra, float * rb)
+{
+    __m256 sa = _mm256_setzero_ps (), sb = _mm256_setzero_ps ();
+
+    for (int k = 0; k < TAPS; k += 8)
+    {
+        __m256 v = _mm256_loadu_ps (x + k);
+        sa = _mm256_add_ps (sa, _mm256_mul_ps (_mm256_loadu_ps (a + k), v));
+        sb = _mm256_add_ps (sb, _mm256_mul_ps (_mm256_loadu_ps (b + k), v));
+    }
+
+    * ra = hsum256 (sa);
+    * rb = hsum256 (sb);
+}
+
+#elif defined(__SSE__)
+
+static inline float hsum128 (__m128 s)
+{
+    s = _mm_add_ps (s, _mm_movehl_ps (s, s));
+    s = _mm_add_ss (s, _mm_shuffle_ps (s, s, 1));
+    return _mm_cvtss_f32 (s);
+}
+
+static inline void dot2 (const float * a, const float * b, const float * x,
+ float * ra, float * rb)
+{
+    __m128 sa = _mm_setzero_ps (), sb = _mm_setzero_ps ();
+
+    for (int k = 0; k < TAPS; k += 4)
+    {
+        __m128 v = _mm_loadu_ps (x + k);
+        sa = _mm_add_ps (sa, _mm_mul_ps (_mm_loadu_ps (a + k), v));
+        sb = _mm_add_ps (sb, _mm_mul_ps (_mm_loadu_ps (b + k), v));
+    }
+
+    * ra = hsum128 (sa);
+    * rb = hsum128 (sb);
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static inline float hsum128 (float32x4_t v)
+{
+    float32x2_t s = vadd_f32 (vget_low_f32 (v), vget_high_f32 (v));
+    return vget_lane_f32 (vpadd_f32 (s, s), 0);
+}
+
+static inline void dot2 (const float * a, const float * b, const float * x,
+ float * ra, float * rb)
+{
+    float32x4_t sa = vdupq_n_f32 (0), sb = vdupq_n_f32 (0);
+
+    for (int k = 0; k < TAPS; k += 4)
+    {
+        float32x4_t v = vld1q_f32 (x + k);
+        sa = vmlaq_f32 (sa, vld1q_f32 (a + k), v);
+        sb = vmlaq_f32 (sb, vld1q_f32 (b + k), v);
+    }
+
+    * ra = hsum128 (sa);
+    * rb = hsum128 (sb);
+}
+
+#else
+
+static inline void dot2 (const float * a, const float * b, const float * x,
+ float * ra, float * rb)
+{
+    float sa = 0, sb = 0;
+
+    for (int k = 0; k < TAPS; k ++)
+    {
+        sa += a[k] * x[k];
+        sb += b[k] * x[k];
+    }
+
+    * ra = sa;
+    * rb = sb;
+}
+
+#endif
+
+static void process_channel (SincState * s, int c)
+{
+    float * hist = s->hist[c];
+    float * out = s->out[c];
+    float * dest = hist + s->hist_len;
+    const float * in = s->job_in + c;
+
+    for (int i = 0; i < s->job_frames; i ++)
+    {
+        dest[i] = * in;
+        in += s->channels;
+    }
+
+    memset (dest + s->job_frames, 0, sizeof (float) * s->job_pad);
+
+    double pos = s->pos;
+
+    for (int i = 0; i < s->job_outputs; i ++)
+    {
+        int whole = (int) pos;
+        double phase = (pos - whole) * PHASES;
+        int row = (int) phase;
+        float frac = phase - row;
+
+        const float * a = s->table + row * TAPS;
+        float ra, rb;
+
+        dot2 (a, a + TAPS, hist + whole - HALF_TAPS + 1, & ra, & rb);
+        out[i] = ra + (rb - ra) * frac;
+
+        pos += s->step;
+    }
+
+    int len = s->hist_len + s->job_frames + s->job_pad;
+    memmove (hist, hist + s->job_shift, sizeof (float) * (len - s->job_shift));
+}
+
+static void process_worker (SincState * s, int index)
+{
+    for (int c = index; c < s->channels; c += s->n_threads)
+        process_channel (s, c);
+}
+
+static void * worker_thread (void * arg)
+{
+    SincWorker * w = (SincWorker *) arg;
+    SincState * s = w->state;
+    int seen = 0;
+
+    pthread_mutex_lock (& s->mutex);
+
+    while (1)
+    {
+        while (! s->quit && s->generation == seen)
+            pthread_cond_wait (& s->start_cond, & s->mutex);
+
+        if (s->quit)
+            break;
+
+        seen = s->generation;
+        pthread_mutex_unlock (& s->mutex);
+
+        process_worker (s, w->index);
+
+        pthread_mutex_lock (& s->mutex);
+
+        if (! -- s->pending)
+            pthread_cond_signal (& s->done_cond);
+    }
+
+    pthread_mutex_unlock (& s->mutex);
+    return NULL;
+}
+
+SincState * sinc_new (int channels, double ratio, int threads)
+{
+    SincState * s = g_new0 (SincState, 1);
+
+    s->channels = channels;
+    s->step = 1 / ratio;
+    s->table = make_table (0.97 * MIN (ratio, 1));
+
+    s->hist = g_new0 (float *, channels);
+    s->out = g_new0 (float *, channels);
+
+    sinc_reset (s);
+
+    if (! threads)
+        threads = sysconf (_SC_NPROCESSORS_ONLN);
+
+    s->n_threads = CLAMP (MIN (threads, channels), 1, MAX_THREADS);
+
+    pthread_mutex_init (& s->mutex, NULL);
+    pthread_cond_init (& s->start_cond, NULL);
+    pthread_cond_init (& s->done_cond, NULL);
+
+    /* worker 0 is the calling thread */
+    s->workers = g_new0 (SincWorker, s->n_threads);
+
+    for (int i = 1; i < s->n_threads; i ++)
+    {
+        s->workers[i].state = s;
+        s->workers[i].index = i;
+
+        if (pthread_create (& s->workers[i].thread, NULL, worker_thread, & s->workers[i]))
+        {
+            /* run the remaining channels on the threads we already have */
+            s->n_threads = i;
+            break;
+        }
+    }
+
+    return s;
+}
+
+void sinc_delete (SincState * s)
+{
+    pthread_mutex_lock (& s->mutex);
+    s->quit = true;
+    pthread_cond_broadcast (& s->start_cond);
+    pthread_mutex_unlock (& s->mutex);
+
+    for (int i = 1; i < s->n_threads; i ++)
+        pthread_join (s->workers[i].thread, NULL);
+
+    pthread_mutex_destroy (& s->mutex);
+    pthread_cond_destroy (& s->start_cond);
+    pthread_cond_destroy (& s->done_cond);
+
+    for (int c = 0; c < s->channels; c ++)
+    {
+        g_free (s->hist[c]);
+        g_free (s->out[c]);
+    }
+
+    g_free (s->hist);
+    g_free (s->out);
+    g_free (s->table);
+    g_free (s->workers);
+    g_free (s);
+}
+
+static void grow_buffers (float * * bufs, int channels, int * size, int needed)
+{
+    if (needed <= * size)
+        return;
+
+    for (int c = 0; c < channels; c ++)
+        bufs[c] = g_renew (float, bufs[c], needed);
+
+    * size = needed;
+}
+
+void sinc_reset (SincState * s)
+{
+    /* start with enough silence that the first output lines up exactly with
+     * the first input frame */
+    grow_buffers (s->hist, s->channels, & s->hist_size, TAPS);
+
+    for (int c = 0; c < s->channels; c ++)
+        memset (s->hist[c], 0, sizeof (float) * (HALF_TAPS - 1));
+
+    s->hist_len = HALF_TAPS - 1;
+    s->pos = HALF_TAPS - 1;
+}
+
+int sinc_max_output (SincState * s, int in_frames)
+{
+    return (int) ((in_frames + TAPS) / s->step) + 2;
+}
+
+int sinc_process (SincState * s, const float * in, int in_frames,
+ float * out, bool finish)
+{
+    int pad = finish ? HALF_TAPS : 0;
+    int len = s->hist_len + in_frames + pad;
+
+    grow_buffers (s->hist, s->channels, & s->hist_size, len);
+
+    /* an output frame at pos needs input up to floor (pos) + HALF_TAPS */
+    double limit = len - HALF_TAPS;
+    double pos = s->pos;
+    int outputs = 0;
+
+    while (pos < limit)
+    {
+        pos += s->step;
+        outputs ++;
+    }
+
+    grow_buffers (s->out, s->channels, & s->out_size, outputs);
+
+    /* keep only the history needed for the next output frame */
+    int shift = MIN ((int) pos - HALF_TAPS + 1, len);
+
+    s->job_in = in;
+    s->job_frames = in_frames;
+    s->job_pad = pad;
+    s->job_outputs = outputs;
+    s->job_shift = MAX (shift, 0);
+
+    if (s->n_threads > 1)
+    {
+        pthread_mutex_lock (& s->mutex);
+        s->generation ++;
+        s->pending = s->n_threads - 1;
+        pthread_cond_broadcast (& s->start_cond);
+        pthread_mutex_unlock (& s->mutex);
+
+        process_worker (s, 0);
+
+        pthread_mutex_lock (& s->mutex);
+
+        while (s->pending)
+            pthread_cond_wait (& s->done_cond, & s->mutex);
+
+        pthread_mutex_unlock (& s->mutex);
+    }
+    else
+        process_worker (s, 0);
+
+    s->hist_len = len - s->job_shift;
+    s->pos = pos - s->job_shift;
+
+    for (int c = 0; c < s->channels; c ++)
+    {
+        const float * src = s->out[c];
+        float * dest = out + c;
+
+        for (int i = 0; i < outputs; i ++)
+        {
+            * dest = src[i];
+            dest += s->channels;
+        }
+    }
+
+    return outputs;
+}
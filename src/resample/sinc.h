@@ -0,0 +1,42 @@
+/*
+ * Sample Rate Converter Plugin for Audacious
+ * Copyright 2010-2012 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_RESAMPLE_SINC_H
+#define AUDACIOUS_RESAMPLE_SINC_H
+
+/* Built-in polyphase sinc resampler.  Each channel is filtered independently,
+ * so the channels can be split across a small pool of worker threads. */
+
+typedef struct SincState SincState;
+
+/* threads = 0 picks a thread count based on the number of processors */
+SincState * sinc_new (int channels, double ratio, int threads);
+void sinc_delete (SincState * state);
+void sinc_reset (SincState * state);
+
+/* Returns the maximum number of frames that sinc_process can output for the
+ * given number of input frames. */
+int sinc_max_output (SincState * state, int in_frames);
+
+/* Converts interleaved input to interleaved output and returns the number of
+ * frames written.  If finish is set, the filter history is drained as well. */
+int sinc_process (SincState * state, const float * in, int in_frames,
+ float * out, bool finish);
+
+#endif
@@ -46,6 +46,10 @@ static   guint queue_function_ID   = 0;
 
 static pthread_t communicator;
 
+static const char * const scrobbler_defaults[] = {
+ "api_url", SCROBBLER_URL,
+ NULL};
+
 static void cleanup_current_track(void) {
 
     timestamp = 0;
@@ -205,6 +209,8 @@ static bool_t scrobbler_init (void) {
     // the version it was compiled for and the actual libXML in use
     LIBXML_TEST_VERSION
 
+    aud_config_set_defaults("scrobbler", scrobbler_defaults);
+
     if (scrobbler_communication_init() == FALSE) {
         aud_ui_show_error(_("The Scrobbler plugin could not be started.\n"
                                    "There might be a problem with your installation."));
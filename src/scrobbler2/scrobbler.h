@@ -19,6 +19,7 @@
 
 //audacious includes
 #include <libaudcore/i18n.h>
+#include <libaudcore/index.h>
 #include <libaudcore/preferences.h>
 #include <libaudcore/runtime.h>
 #include <libaudcore/tuple.h>
@@ -47,6 +48,7 @@ extern pthread_mutex_t communication_mutex;
 extern pthread_cond_t communication_signal;
 
 //to avoid reading/writing the log file while other thread is accessing it
+//(the log is an append-only journal, see scrobble_cached_queue())
 extern pthread_mutex_t log_access_mutex;
 
 /* All "something"_requested variables are set to TRUE by the requester.
@@ -71,6 +73,7 @@ extern Tuple now_playing_track;
 //scrobbler_communication.c
 extern bool_t   scrobbler_communication_init();
 extern gpointer scrobbling_thread(gpointer data);
+extern void     scrobble_cached_queue();
 
 
 
@@ -89,6 +92,7 @@ extern bool_t read_authentication_test_result(String &error_code, String &error_
 extern bool_t read_token(String &error_code, String &error_detail);
 extern bool_t read_session_key(String &error_code, String &error_detail);
 extern bool_t read_scrobble_result(String &error_code, String &error_detail, bool_t *ignored, String &ignored_code);
+extern bool_t read_scrobble_results(String &error_code, String &error_detail, Index<String> &ignored_codes);
 
 //scrobbler.c
 extern StringBuf clean_string(const char *string);
@@ -6,6 +6,7 @@
 #include <curl/curl.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include <libaudcore/audstrings.h>
 #include <libaudcore/interface.h>
@@ -70,6 +71,36 @@ static char * scrobbler_get_signature (Index<API_Parameter> & params)
     return g_compute_checksum_for_string (G_CHECKSUM_MD5, buf, -1);
 }
 
+/*
+ * The same as below, with the parameters (other than the method) already
+ * gathered in a list; api_sig is added to it.
+ */
+static String create_message_to_lastfm (const char * method_name, Index<API_Parameter> & params)
+{
+    StringBuf buf = str_concat ({"method=", method_name});
+
+    for (const API_Parameter & param : params)
+    {
+        char * esc = curl_easy_escape (curlHandle, param.argument, 0);
+        str_insert (buf, -1, "&");
+        str_insert (buf, -1, param.paramName);
+        str_insert (buf, -1, "=");
+        str_insert (buf, -1, esc);
+        curl_free (esc);
+    }
+
+    params.append ({String ("method"), String (method_name)});
+
+    char * api_sig = scrobbler_get_signature (params);
+    str_insert (buf, -1, "&api_sig=");
+    str_insert (buf, -1, api_sig);
+    g_free (api_sig);
+
+    AUDDBG ("FINAL message: %s.\n", (const char *) buf);
+
+    return String (buf);
+}
+
 /*
  * n_args should count with the given authentication parameters
  * At most 2: api_key, session_key.
@@ -84,9 +115,6 @@ static char * scrobbler_get_signature (Index<API_Parameter> & params)
 static String create_message_to_lastfm (const char * method_name, int n_args, ...)
 {
     Index<API_Parameter> params;
-    params.append ({String ("method"), String (method_name)});
-
-    StringBuf buf = str_concat ({"method=", method_name});
 
     va_list vl;
     va_start (vl, n_args);
@@ -97,25 +125,11 @@ static String create_message_to_lastfm (const char * method_name, int n_args, ..
         const char * arg = va_arg (vl, const char *);
 
         params.append ({String (name), String (arg)});
-
-        char * esc = curl_easy_escape (curlHandle, arg, 0);
-        str_insert (buf, -1, "&");
-        str_insert (buf, -1, name);
-        str_insert (buf, -1, "=");
-        str_insert (buf, -1, esc);
-        curl_free (esc);
     }
 
     va_end (vl);
 
-    char * api_sig = scrobbler_get_signature (params);
-    str_insert (buf, -1, "&api_sig=");
-    str_insert (buf, -1, api_sig);
-    g_free (api_sig);
-
-    AUDDBG ("FINAL message: %s.\n", (const char *) buf);
-
-    return String (buf);
+    return create_message_to_lastfm (method_name, params);
 }
 
 static bool_t send_message_to_lastfm (const char * data)
@@ -270,7 +284,9 @@ bool_t scrobbler_communication_init() {
         return FALSE;
     }
 
-    curl_requests_result = curl_easy_setopt(curlHandle, CURLOPT_URL, SCROBBLER_URL);
+    //curl keeps its own copy of the URL
+    String api_url = aud_get_str("scrobbler", "api_url");
+    curl_requests_result = curl_easy_setopt(curlHandle, CURLOPT_URL, (const char *) api_url);
     if (curl_requests_result != CURLE_OK) {
         AUDDBG("Could not define scrobbler destination URL: %s.\n", curl_easy_strerror(curl_requests_result));
         return FALSE;
@@ -285,205 +301,340 @@ bool_t scrobbler_communication_init() {
     return TRUE;
 }
 
-static void set_timestamp_to_current(gchar **line) {
-    //line[0] line[1] line[2] line[3] line[4] line[5] line[6]   line[7]
-    //artist  album   title   number  length  "L"     timestamp NULL
+/*
+ * scrobbler.log is an append-only journal: queue_track_to_scrobble() adds
+ * new tracks at its end and we never rewrite what is behind the committed
+ * offset, which is kept in scrobbler.log.offset.  Everything before the
+ * offset has been dealt with; once that is more than half of the file, the
+ * rest is moved to the front (see compact_journal()), so flushing a long
+ * queue costs time linear in its length.
+ *
+ * Each rewrite starts the journal with a "#generation" line carrying a new
+ * number, and the offset file names the generation it was written for, so an
+ * offset left over from before a rewrite is never applied to the new file.
+ */
+
+#define SCROBBLE_BATCH 50 //the most tracks track.scrobble accepts at once
+#define JOURNAL_HEADER "#generation\t"
+
+enum batch_result {
+    BATCH_DONE,      //the tracks can be dropped from the queue
+    BATCH_DONE_STOP, //the same, but don't send any more for now
+    BATCH_RETRY      //leave the tracks on the queue for later
+};
 
-    gchar **splitted_line = g_strsplit(*line, "\t", 0);
-    g_free(splitted_line[6]);
-    splitted_line[6] = g_strdup_printf("%" G_GINT64_FORMAT, g_get_real_time() / G_USEC_PER_SEC);
-    AUDDBG("splitted line's timestamp is now: %s.\n", splitted_line[6]);
-    g_free(*line);
-    (*line) = g_strjoinv("\t", splitted_line);
+static gchar *journal_offset_path() {
+    return g_build_filename(aud_get_path(AUD_PATH_USER_DIR), "scrobbler.log.offset", NULL);
 }
 
-static void delete_lines_from_scrobble_log (GSList **lines_to_remove_ptr, GSList **lines_to_retry_ptr, gchar *queuepath) {
-    GSList *lines_to_remove = *lines_to_remove_ptr;
-    GSList *lines_to_retry = *lines_to_retry_ptr;
+//a journal without a header line (as created by scrobbler.cc) is generation 0
+static gint64 journal_generation(const gchar *contents, gsize length, gsize *header_len) {
+    gsize prefix = strlen(JOURNAL_HEADER);
+    *header_len = 0;
+
+    if (length < prefix || strncmp(contents, JOURNAL_HEADER, prefix) != 0)
+        return 0;
+
+    const gchar *newline = (const gchar *) memchr(contents, '\n', length);
+    if (newline == NULL)
+        return 0;
+
+    *header_len = newline + 1 - contents;
+    return g_ascii_strtoll(contents + prefix, NULL, 10);
+}
+
+static gint64 read_committed_offset(gint64 *generation) {
+    gchar *path = journal_offset_path();
     gchar *contents = NULL;
-    gchar **lines = NULL;
-    gchar **finallines = g_new (char *, 1);
-    int n_finallines;
+    gint64 offset = 0;
+
+    *generation = 0;
 
-    if (lines_to_remove != NULL) {
-        lines_to_remove = g_slist_reverse(lines_to_remove);
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        gchar *end = NULL;
+        offset = g_ascii_strtoll(contents, &end, 10);
+        if (offset < 0)
+            offset = 0;
+        if (end != NULL)
+            *generation = g_ascii_strtoll(end, NULL, 10);
     }
-    if (lines_to_retry != NULL) {
-        lines_to_retry = g_slist_reverse(lines_to_retry);
+
+    g_free(contents);
+    g_free(path);
+    return offset;
+}
+
+static void write_committed_offset(gint64 offset, gint64 generation) {
+    gchar *path = journal_offset_path();
+    gchar *contents = g_strdup_printf("%" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+     offset, generation);
+
+    if (!g_file_set_contents(path, contents, -1, NULL)) {
+        AUDDBG("Could not write to scrobbler.log.offset!\n");
     }
 
+    g_free(contents);
+    g_free(path);
+}
 
+static void append_to_journal(const gchar *queuepath, GString *lines) {
     pthread_mutex_lock(&log_access_mutex);
 
-    gboolean success = g_file_get_contents(queuepath, &contents, NULL, NULL);
-    if (!success) {
-        AUDDBG("Could not read scrobbler.log contents.\n");
+    FILE *f = g_fopen(queuepath, "a");
+    if (f == NULL) {
+        perror("fopen");
     } else {
-        lines = g_strsplit(contents, "\n", 0);
+        if (fwrite(lines->str, 1, lines->len, f) != lines->len) {
+            perror("fwrite");
+        }
+        fclose(f);
+    }
 
-        n_finallines = 0;
-        for (int i = 0 ; lines[i] != NULL && strlen(lines[i]) > 0; i++) {
-            if (lines_to_remove != NULL && *((int *) (lines_to_remove->data)) == i) {
-                //this line is to remove
-                lines_to_remove = g_slist_next(lines_to_remove);
-            } else {
-                //keep this line
-                AUDDBG("Going to keep line %i\n", i);
-                if (lines_to_retry != NULL && *((int *) (lines_to_retry->data)) == i) {
-                  lines_to_retry = g_slist_next(lines_to_retry);
-                  //this line will be retried with a zero timestamp
-                  AUDDBG("Going to zero this line.\n");
-                  AUDDBG("Line before: %s.\n", lines[i]);
-                  set_timestamp_to_current(&(lines[i]));
-                  AUDDBG("Line after: %s.\n", lines[i]);
+    pthread_mutex_unlock(&log_access_mutex);
+}
 
-                } else {
-                  AUDDBG("not zeroing this line\n");
-                }
-                n_finallines++;
-                finallines = g_renew (char *, finallines, n_finallines);
-                finallines[n_finallines-1] = g_strdup(lines[i]);
-            }
-        }
+//drops the committed part of the journal once it is more than half of it
+//must be called with log_access_mutex held
+static void compact_journal(const gchar *queuepath, gint64 offset, gint64 generation) {
+    gchar *contents = NULL;
+    gsize length = 0;
+    gsize header_len;
 
-        finallines = g_renew (char *, finallines, n_finallines + 2);
-        finallines[n_finallines] = g_strdup("");
-        finallines[n_finallines+1] = NULL;
-        g_free(contents);
-        contents = g_strjoinv("\n", finallines);
-        success = g_file_set_contents(queuepath, contents, -1, NULL);
-        if (!success) {
+    if (!g_file_get_contents(queuepath, &contents, &length, NULL)) {
+        AUDDBG("Could not read scrobbler.log contents.\n");
+        return;
+    }
+
+    if (journal_generation(contents, length, &header_len) == generation &&
+     offset * 2 > (gint64) length && offset <= (gint64) length) {
+        //if we are interrupted before the offset is saved, the generation
+        //in the offset file no longer matches and the new file is read
+        //from its start
+        gchar *header = g_strdup_printf(JOURNAL_HEADER "%" G_GINT64_FORMAT "\n", generation + 1);
+        gsize new_header_len = strlen(header);
+        GString *rest = g_string_new(header);
+        g_string_append_len(rest, contents + offset, length - offset);
+
+        if (g_file_set_contents(queuepath, rest->str, rest->len, NULL)) {
+            write_committed_offset(new_header_len, generation + 1);
+        } else {
             AUDDBG("Could not write to scrobbler.log!\n");
         }
 
+        g_string_free(rest, TRUE);
+        g_free(header);
     }
 
-    pthread_mutex_unlock(&log_access_mutex);
+    g_free(contents);
+}
 
+static bool_t is_scrobbable(gchar **line) {
+    //line[0] line[1] line[2] line[3] line[4] line[5] line[6]   line[7]
+    //artist  album   title   number  length  "L"     timestamp NULL
+    return g_strv_length(line) == 7 && line[0][0] && line[2][0] &&
+     strcmp(line[5], "L") == 0 && line[6][0];
+}
 
-    g_strfreev(finallines);
-    g_strfreev(lines);
-    g_free(contents);
+static void requeue_line(GString *requeue, gchar **line, bool_t new_timestamp) {
+    if (new_timestamp) {
+        g_free(line[6]);
+        line[6] = g_strdup_printf("%" G_GINT64_FORMAT, g_get_real_time() / G_USEC_PER_SEC);
+    }
+
+    gchar *joined = g_strjoinv("\t", line);
+    g_string_append(requeue, joined);
+    g_string_append_c(requeue, '\n');
+    g_free(joined);
 }
 
-static void save_line_to_remove(GSList **lines_to_remove, int linenumber) {
-    int *rem = g_new (int, 1);
-    *rem = linenumber;
-    (*lines_to_remove) = g_slist_prepend((*lines_to_remove), rem);
+static void add_track_param(Index<API_Parameter> &params, const char *name, int i, const char *value) {
+    params.append({String(str_printf("%s[%d]", name, i)), String(value)});
+}
+
+//sends up to SCROBBLE_BATCH tracks in a single request
+//tracks that should be sent again later are added to requeue
+static batch_result scrobble_batch(gchar ***tracks, int n_tracks, GString *requeue) {
+    Index<API_Parameter> params;
+
+    for (int i = 0; i < n_tracks; i++) {
+        gchar **line = tracks[i];
+        add_track_param(params, "artist", i, line[0]);
+        add_track_param(params, "album", i, line[1]);
+        add_track_param(params, "track", i, line[2]);
+        add_track_param(params, "trackNumber", i, line[3]);
+        add_track_param(params, "duration", i, line[4]);
+        add_track_param(params, "timestamp", i, line[6]);
+    }
+
+    params.append({String("api_key"), String(SCROBBLER_API_KEY)});
+    params.append({String("sk"), session_key});
+
+    String scrobblemsg = create_message_to_lastfm("track.scrobble", params);
+
+    if (send_message_to_lastfm(scrobblemsg) == FALSE) {
+        AUDDBG("Could not scrobble the tracks on the queue. Network problem?\n");
+        scrobbling_enabled = FALSE;
+        return BATCH_RETRY;
+    }
+
+    String error_code;
+    String error_detail;
+    Index<String> ignored_codes;
+
+    if (read_scrobble_results(error_code, error_detail, ignored_codes) == FALSE) {
+        AUDDBG("SCROBBLE NOT OK. Error code: %s. Error detail: %s.\n",
+         (const char *)error_code, (const char *)error_detail);
+
+        if (error_code == NULL) { //net error(?) or the answer from last.fm was not well read
+            return BATCH_RETRY;
+        }
+        else if (g_strcmp0(error_code, "11") == 0 ||
+                 g_strcmp0(error_code, "16") == 0){
+            //error code 11: Service Offline - This service is temporarily offline. Try again later.
+            //error code 16: The service is temporarily unavailable, please try again.
+            return BATCH_RETRY;
+        }
+        else if (g_strcmp0(error_code,  "9") == 0) {
+            //Bad Session. Reauth.
+            scrobbling_enabled = FALSE;
+            session_key = String();
+            aud_set_str("scrobbler", "session_key", "");
+            return BATCH_RETRY;
+        }
+
+        //sending the same tracks again won't help, but the error may be
+        //caused by just one of them; send them one at a time so that only
+        //the tracks the server rejects are dropped
+        if (n_tracks > 1) {
+            AUDDBG("Sending the batch one track at a time.\n");
+
+            for (int i = 0; i < n_tracks; i++) {
+                batch_result single = scrobble_batch(&tracks[i], 1, requeue);
+                if (single == BATCH_DONE)
+                    continue;
+
+                //keep what has not been sent for the next flush; a track
+                //stopped by the daily limit has already been requeued
+                for (int j = (single == BATCH_RETRY) ? i : i + 1; j < n_tracks; j++)
+                    requeue_line(requeue, tracks[j], FALSE);
+
+                return BATCH_DONE_STOP;
+            }
+        }
+
+        return BATCH_DONE;
+    }
+
+    batch_result result = BATCH_DONE;
+
+    for (int i = 0; i < ignored_codes.len() && i < n_tracks; i++) {
+        if (strcmp(ignored_codes[i], "3") == 0) {
+            //3: Timestamp was too old
+            AUDDBG("Scrobble %d ignored as too old, will retry it.\n", i);
+            requeue_line(requeue, tracks[i], TRUE);
+        } else if (strcmp(ignored_codes[i], "5") == 0) {
+            //5: Daily scrobble limit exceeded
+            AUDDBG("Daily scrobble limit reached.\n");
+            requeue_line(requeue, tracks[i], FALSE);
+            result = BATCH_DONE_STOP;
+        } else if (strcmp(ignored_codes[i], "0") != 0) {
+            AUDDBG("Scrobble %d ignored, code: %s.\n", i, (const char *)ignored_codes[i]);
+        }
+    }
+
+    return result;
 }
 
-static void scrobble_cached_queue() {
+void scrobble_cached_queue() {
 
     gchar *queuepath = g_build_filename(aud_get_path(AUD_PATH_USER_DIR),"scrobbler.log", NULL);
     gchar *contents = NULL;
-    gboolean success;
-    gchar **lines = NULL;
-    gchar **line;
-    GSList *lines_to_remove = NULL; //lines to remove because they were scrobbled (or ignored, and will not be retried)
-    GSList *lines_to_retry = NULL; //lines to retry later because they were too old TODO: or "daily scrobble limit reached"
+    gsize length = 0;
 
     pthread_mutex_lock(&log_access_mutex);
-    success = g_file_get_contents(queuepath, &contents, NULL, NULL);
+    gboolean success = g_file_get_contents(queuepath, &contents, &length, NULL);
     pthread_mutex_unlock(&log_access_mutex);
+
     if (!success) {
         AUDDBG("Couldn't access the queue file.\n");
-    } else {
+        g_free(queuepath);
+        return;
+    }
 
-        lines = g_strsplit(contents, "\n", 0);
-
-        for (int i = 0; lines[i] != NULL && strlen(lines[i]) > 0 && scrobbling_enabled; i++) {
-            line = g_strsplit(lines[i], "\t", 0);
-
-            //line[0] line[1] line[2] line[3] line[4] line[5] line[6]   line[7]
-            //artist  album   title   number  length  "L"     timestamp NULL
-
-            if (line[0] && line[2] && (strcmp(line[5], "L") == 0) && line[6] && (line[7] == NULL))
-            {
-                String scrobblemsg = create_message_to_lastfm ("track.scrobble",
-                 8, "artist", line[0], "album", line[1], "track", line[2],
-                 "trackNumber", line[3], "duration", line[4],
-                 "timestamp", line[6], "api_key", SCROBBLER_API_KEY,
-                 "sk", (const char *) session_key);
-
-                if (send_message_to_lastfm(scrobblemsg) == TRUE) {
-                    String error_code;
-                    String error_detail;
-                    bool_t ignored = FALSE;
-                    String ignored_code;
-
-                    if (read_scrobble_result(error_code, error_detail, &ignored, ignored_code) == TRUE) {
-                        AUDDBG("SCROBBLE OK. Error code: %s. Error detail: %s\n",
-                         (const char *)error_code, (const char *)error_detail);
-                        AUDDBG("SCROBBLE OK. ignored: %i.\n", ignored);
-                        AUDDBG("SCROBBLE OK. ignored code: %s.\n",
-                         (const char *)ignored_code);
-                        if (ignored == TRUE && g_strcmp0(ignored_code, "3") == 0) { //3: Timestamp was too old
-                            AUDDBG("SCROBBLE IGNORED!!! %i, detail: %s\n",
-                             ignored, (const char *)ignored_code);
-                            save_line_to_remove(&lines_to_retry, i);
-                        } else if (ignored == TRUE && g_strcmp0(ignored_code, "") == 0) { //5: Daily scrobble limit reached
-                           //TODO: a track might not be scrobbled due to "daily scrobble limit exeeded".
-                           //This message comes on the ignoredMessage attribute, inside the XML of the response.
-                           //We are not dealing with this case currently and are losing that scrobble.
-                           //TODO
-
-                        } else {
-                            AUDDBG("Not ignored. Carrying on...\n");
-                            save_line_to_remove(&lines_to_remove, i);
-                        }
-                    } else {
-                        AUDDBG("SCROBBLE NOT OK. Error code: %s. Error detail: %s.\n",
-                         (const char *)error_code, (const char *)error_detail);
-
-                        if (error_code == NULL) { //net error(?) or the answer from last.fm was not well read
-                            //scrobble to be retried
-                        }
-                        else if (g_strcmp0(error_code, "11") == 0 ||
-                                 g_strcmp0(error_code, "16") == 0){
-                            //error code 11: Service Offline - This service is temporarily offline. Try again later.
-                            //error code 16: The service is temporarily unavailable, please try again.
-                            //scrobble to be retried
-                        }
-                        else if (g_strcmp0(error_code,  "9") == 0) {
-                            //Bad Session. Reauth.
-                            scrobbling_enabled = FALSE;
-                            session_key = String();
-                            aud_set_str("scrobbler", "session_key", "");
-                        }
-                        else {
-                            save_line_to_remove(&lines_to_remove, i);
-                        }
-                    }
-                } else {
-                    AUDDBG("Could not scrobble a track on the queue. Network problem?\n");
-                    //scrobble to be retried
-                    scrobbling_enabled = FALSE;
-                }
+    gsize header_len;
+    gint64 generation = journal_generation(contents, length, &header_len);
+    gint64 offset_generation;
+    gint64 offset = read_committed_offset(&offset_generation);
+
+    if (offset_generation != generation || offset > (gint64) length) {
+        //the offset was saved for an earlier version of the journal (we were
+        //interrupted while compacting it); nothing in this one is committed
+        offset = 0;
+    }
+
+    if (offset < (gint64) header_len)
+        offset = header_len;
+
+    gchar **batch[SCROBBLE_BATCH];
+    GString *requeue = g_string_new(NULL);
+    gint64 committed = offset;
+    batch_result result = BATCH_DONE;
+
+    while (result == BATCH_DONE && scrobbling_enabled) {
+        int n_tracks = 0;
+        gint64 batch_end = committed;
+
+        //stops at a line without its newline; there is nothing after it yet
+        while (n_tracks < SCROBBLE_BATCH) {
+            gchar *start = contents + batch_end;
+            gchar *newline = (gchar *) memchr(start, '\n', length - batch_end);
+            if (newline == NULL)
+                break;
 
-                //TODO: Avoid spamming last.fm --- It's not as simple as just adding a wait here:
-                //If audacious is closed while we're on this loop, tracks might be re-scrobbled.
-                //This shall be doable if we only pick one track at a time from the scrobbler.log
+            *newline = '\0';
+            batch_end = newline + 1 - contents;
+
+            gchar **line = g_strsplit(start, "\t", 0);
+            if (is_scrobbable(line)) {
+                batch[n_tracks++] = line;
             } else {
-                AUDDBG("Unscrobbable line.\n");
-                //leave entry on the cache file
+                if (start[0])
+                    AUDDBG("Unscrobbable line, dropping it: %s\n", start);
+                g_strfreev(line);
             }
-            g_strfreev(line);
-        }//for
+        }
 
+        if (batch_end == committed)
+            break; //queue is empty
 
-        delete_lines_from_scrobble_log(&lines_to_remove, &lines_to_retry, queuepath);
+        if (n_tracks > 0)
+            result = scrobble_batch(batch, n_tracks, requeue);
 
-        if (lines_to_remove != NULL) {
-            g_slist_free_full(lines_to_remove, g_free);
-        }
-        if (lines_to_retry != NULL) {
-            g_slist_free_full(lines_to_retry, g_free);
+        for (int i = 0; i < n_tracks; i++)
+            g_strfreev(batch[i]);
+
+        if (result == BATCH_RETRY)
+            break;
+
+        //the requeued lines must be in the journal before we commit past the originals
+        if (requeue->len > 0) {
+            append_to_journal(queuepath, requeue);
+            g_string_truncate(requeue, 0);
         }
 
-        g_strfreev(lines);
+        committed = batch_end;
+        write_committed_offset(committed, generation);
     }
 
+    g_string_free(requeue, TRUE);
     g_free(contents);
+
+    if (committed > offset) {
+        pthread_mutex_lock(&log_access_mutex);
+        compact_journal(queuepath, committed, generation);
+        pthread_mutex_unlock(&log_access_mutex);
+    }
+
     g_free(queuepath);
 }
 
@@ -167,8 +167,7 @@ bool_t read_scrobble_result(String &error_code, String &error_detail,
         result = FALSE;
 
     } else {
-        //TODO: We are assuming that only one track is scrobbled per request! This will have to be
-        //re-done to support multiple tracks being scrobbled in batch
+        //only one track per request here, see read_scrobble_results for batches
         String ignored_scrobble = get_attribute_value("/lfm/scrobbles[@ignored]", "ignored");
 
         if (ignored_scrobble && strcmp(ignored_scrobble, "0")) {
@@ -185,6 +184,56 @@ bool_t read_scrobble_result(String &error_code, String &error_detail,
     return result;
 }
 
+/*
+ * The same as read_scrobble_result, for a request with several tracks.
+ * Returns:
+ *  * TRUE if the request was successful
+ *    * ignored_codes holds the ignoredMessage code of each track, in the
+ *      order they were sent ("0" if the track was scrobbled OK)
+ *  * FALSE if the request was unsuccessful (see read_scrobble_result)
+ */
+bool_t read_scrobble_results(String &error_code, String &error_detail,
+ Index<String> &ignored_codes) {
+
+    if (!prepare_data()) {
+        AUDDBG("Could not read received data from last.fm. What's up?\n");
+        return FALSE;
+    }
+
+    String status = check_status(error_code, error_detail);
+
+    if (!status) {
+        AUDDBG("Status was NULL. Invalid API answer.\n");
+        clean_data();
+        return FALSE;
+    }
+
+    if (!strcmp(status, "failed")) {
+        AUDDBG("Error code: %s. Detail: %s.\n", (const char *)error_code,
+         (const char *)error_detail);
+        clean_data();
+        return FALSE;
+    }
+
+    xmlXPathObjectPtr statusObj = xmlXPathEvalExpression((xmlChar *)
+     "/lfm/scrobbles/scrobble/ignoredMessage", context);
+
+    if (statusObj != NULL && !xmlXPathNodeSetIsEmpty(statusObj->nodesetval)) {
+        for (int i = 0; i < statusObj->nodesetval->nodeNr; i++) {
+            xmlChar *code = xmlGetProp(statusObj->nodesetval->nodeTab[i], (xmlChar *) "code");
+            ignored_codes.append(String((code && code[0]) ? (const char *) code : "0"));
+            xmlFree(code);
+        }
+    }
+
+    if (statusObj != NULL)
+        xmlXPathFreeObject(statusObj);
+
+    AUDDBG("%d scrobble results.\n", ignored_codes.len());
+    clean_data();
+    return TRUE;
+}
+
 //returns
 //FALSE if there was an error with the connection
 bool_t read_authentication_test_result (String &error_code, String &error_detail) {
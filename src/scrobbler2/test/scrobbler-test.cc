@@ -0,0 +1,481 @@
+/*
+ * Scrobbler Plugin v2.0 for Audacious by Pitxyoki
+ *
+ * Copyright 2012-2013 Luís Picciochi Oliveira <Pitxyoki@Gmail.com>
+ *
+ * This plugin is part of the Audacious Media Player.
+ * It is licensed under the GNU General Public License, version 3.
+ */
+
+/*
+ * Test for scrobble_cached_queue().  A small HTTP server on 127.0.0.1 stands
+ * in for the last.fm API ("api_url" points at it).  It answers track.scrobble
+ * the way last.fm does, and can be told to reject a track, to go offline, to
+ * stop at a daily limit or to drop the session.  Each case queues tracks in
+ * scrobbler.log, flushes the queue and checks that every track reaches the
+ * server exactly once and in order, and with how many requests.
+ *
+ * The user directory is a temporary one (XDG_CONFIG_HOME is set before
+ * anything asks for it), so the real scrobbler.log is not touched.
+ *
+ * usage: scrobbler-test
+ */
+
+//external includes
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <libaudcore/audstrings.h>
+
+//plugin includes
+#include "../scrobbler.h"
+
+//stand-ins for what scrobbler.cc and config_window.cc define
+bool_t scrobbler_running        = TRUE;
+bool_t migrate_config_requested = FALSE;
+bool_t now_playing_requested    = FALSE;
+Tuple now_playing_track;
+
+pthread_mutex_t communication_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t communication_signal = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t log_access_mutex = PTHREAD_MUTEX_INITIALIZER;
+String session_key;
+String request_token;
+
+bool_t          permission_check_requested   = FALSE;
+bool_t          invalidate_session_requested = FALSE;
+enum permission perm_result                  = PERMISSION_UNKNOWN;
+String          username;
+
+StringBuf clean_string (const char *string) {
+    StringBuf temp = str_copy (string ? string : "");
+    str_replace_char (temp, '\t', ' ');
+    return temp;
+}
+
+#define SESSION_KEY "test-session"
+#define REJECTED_TITLE "Rejected"
+
+//how the stand-in server behaves; set by the test cases
+static pthread_mutex_t server_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool_t server_offline;     //answer with error 11 (service offline)
+static bool_t server_bad_session; //answer with error 9 (invalid session key)
+static int server_quota;          //scrobbles accepted before the daily limit
+static int server_requests;       //requests so far
+static GPtrArray *server_accepted; //titles of the accepted scrobbles
+
+static int listen_fd = -1;
+static pthread_t server_thread;
+static int next_track;
+static int failures;
+
+//reads the request, gives its urlencoded body; g_free() result
+static gchar *read_request(int fd) {
+    GString *request = g_string_new(NULL);
+    gchar *body = NULL;
+    gsize header_len = 0;
+    char buf[4096];
+    ssize_t got;
+
+    while (header_len == 0 && (got = read(fd, buf, sizeof buf)) > 0) {
+        g_string_append_len(request, buf, got);
+        const gchar *end = strstr(request->str, "\r\n\r\n");
+        if (end != NULL)
+            header_len = end + 4 - request->str;
+    }
+
+    if (header_len == 0) {
+        g_string_free(request, TRUE);
+        return NULL;
+    }
+
+    gchar *headers = g_ascii_strdown(request->str, header_len);
+    const gchar *length_header = strstr(headers, "\r\ncontent-length:");
+    gsize length = length_header ? g_ascii_strtoull(length_header + 17, NULL, 10) : 0;
+
+    //libcurl waits for this before sending a large body
+    if (strstr(headers, "\r\nexpect: 100-continue") != NULL) {
+        const char *reply = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (write(fd, reply, strlen(reply)) < 0)
+            perror("write");
+    }
+
+    while (request->len < header_len + length && (got = read(fd, buf, sizeof buf)) > 0)
+        g_string_append_len(request, buf, got);
+
+    if (request->len >= header_len + length)
+        body = g_strndup(request->str + header_len, length);
+
+    g_free(headers);
+    g_string_free(request, TRUE);
+    return body;
+}
+
+//the value of a field of the urlencoded body, or NULL; g_free() result
+static gchar *get_field(gchar **fields, const char *name) {
+    for (int i = 0; fields[i] != NULL; i++) {
+        gchar *equals = strchr(fields[i], '=');
+        if (equals == NULL)
+            continue;
+
+        gchar *key = g_uri_unescape_segment(fields[i], equals, NULL);
+        bool_t match = (key != NULL && strcmp(key, name) == 0);
+        g_free(key);
+
+        if (match)
+            return g_uri_unescape_string(equals + 1, NULL);
+    }
+
+    return NULL;
+}
+
+static gchar *failed_answer(int code) {
+    return g_strdup_printf("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+     "<lfm status=\"failed\"><error code=\"%d\">Stand-in error</error></lfm>\n", code);
+}
+
+//answers a request the way last.fm would; g_free() result
+static gchar *answer(const gchar *body) {
+    gchar **fields = g_strsplit(body, "&", 0);
+    gchar *method = get_field(fields, "method");
+    gchar *sk = get_field(fields, "sk");
+    gchar *result;
+
+    pthread_mutex_lock(&server_mutex);
+    server_requests++;
+
+    if (g_strcmp0(method, "track.scrobble") != 0) {
+        result = failed_answer(3); //Invalid Method
+    } else if (server_offline) {
+        result = failed_answer(11);
+    } else if (server_bad_session || g_strcmp0(sk, SESSION_KEY) != 0) {
+        result = failed_answer(9);
+    } else {
+        GPtrArray *titles = g_ptr_array_new_with_free_func(g_free);
+        bool_t rejected = FALSE;
+        gchar *title;
+
+        while ((title = get_field(fields, str_printf("track[%d]", titles->len))) != NULL) {
+            if (strcmp(title, REJECTED_TITLE) == 0)
+                rejected = TRUE;
+            g_ptr_array_add(titles, title);
+        }
+
+        if (titles->len == 0 || rejected) {
+            result = failed_answer(6); //Invalid parameters
+        } else {
+            GString *xml = g_string_new("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+             "<lfm status=\"ok\"><scrobbles>");
+
+            for (guint i = 0; i < titles->len; i++) {
+                int code = 0;
+
+                if (server_quota > 0) {
+                    server_quota--;
+                    g_ptr_array_add(server_accepted, g_strdup((gchar *) titles->pdata[i]));
+                } else {
+                    code = 5; //Daily scrobble limit exceeded
+                }
+
+                g_string_append_printf(xml, "<scrobble><ignoredMessage code=\"%d\">"
+                 "</ignoredMessage></scrobble>", code);
+            }
+
+            g_string_append(xml, "</scrobbles></lfm>\n");
+            result = g_string_free(xml, FALSE);
+        }
+
+        g_ptr_array_free(titles, TRUE);
+    }
+
+    pthread_mutex_unlock(&server_mutex);
+
+    g_free(sk);
+    g_free(method);
+    g_strfreev(fields);
+    return result;
+}
+
+static void *serve(void *data) {
+    int fd;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        gchar *body = read_request(fd);
+
+        if (body != NULL) {
+            gchar *xml = answer(body);
+            gchar *reply = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+             "Content-Type: text/xml\r\nContent-Length: %d\r\n"
+             "Connection: close\r\n\r\n%s", (int) strlen(xml), xml);
+
+            if (write(fd, reply, strlen(reply)) < 0)
+                perror("write");
+
+            g_free(reply);
+            g_free(xml);
+            g_free(body);
+        }
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+//returns the port, or 0 on error
+static int start_server() {
+    struct sockaddr_in addr = sockaddr_in();
+    socklen_t addr_len = sizeof addr;
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+     listen(listen_fd, 8) < 0 || getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len) < 0) {
+        perror("stand-in server");
+        return 0;
+    }
+
+    server_accepted = g_ptr_array_new_with_free_func(g_free);
+    pthread_create(&server_thread, NULL, serve, NULL);
+
+    return ntohs(addr.sin_port);
+}
+
+static void stop_server() {
+    shutdown(listen_fd, SHUT_RDWR);
+    pthread_join(server_thread, NULL);
+    close(listen_fd);
+    g_ptr_array_free(server_accepted, TRUE);
+}
+
+//sets up the server for a test case
+static void reset_server(int quota) {
+    pthread_mutex_lock(&server_mutex);
+    server_offline = FALSE;
+    server_bad_session = FALSE;
+    server_quota = quota;
+    server_requests = 0;
+    g_ptr_array_set_size(server_accepted, 0);
+    pthread_mutex_unlock(&server_mutex);
+}
+
+//appends tracks to scrobbler.log the way queue_track_to_scrobble() does;
+//with reject_at >= 0, that one is given the title the server rejects
+static void queue_tracks(int n_tracks, int reject_at) {
+    gchar *queuepath = g_build_filename(aud_get_path(AUD_PATH_USER_DIR), "scrobbler.log", NULL);
+    FILE *f = g_fopen(queuepath, "a");
+
+    for (int i = 0; i < n_tracks; i++) {
+        if (i == reject_at)
+            fprintf(f, "Artist\tAlbum\t%s\t\t180\tL\t%" G_GINT64_FORMAT "\n",
+             REJECTED_TITLE, g_get_real_time() / G_USEC_PER_SEC);
+        else
+            fprintf(f, "Artist\tAlbum\tTrack %d\t%d\t180\tL\t%" G_GINT64_FORMAT "\n",
+             next_track, next_track % 20 + 1, g_get_real_time() / G_USEC_PER_SEC);
+
+        next_track++;
+    }
+
+    fclose(f);
+    g_free(queuepath);
+}
+
+//checks that the server accepted exactly the tracks first .. first + n - 1,
+//in order, leaving out the rejected one, in the given number of requests
+static void check(const char *name, int first, int n_tracks, int reject_at, int requests) {
+    GString *problems = g_string_new(NULL);
+    int accepted = 0;
+
+    pthread_mutex_lock(&server_mutex);
+
+    for (int i = 0; i < n_tracks; i++) {
+        if (i == reject_at)
+            continue;
+
+        gchar *expected = g_strdup_printf("Track %d", first + i);
+
+        if (accepted >= (int) server_accepted->len)
+            g_string_append_printf(problems, " %s missing;", expected);
+        else if (strcmp((gchar *) server_accepted->pdata[accepted], expected) != 0)
+            g_string_append_printf(problems, " got %s for %s;",
+             (gchar *) server_accepted->pdata[accepted], expected);
+
+        accepted++;
+        g_free(expected);
+    }
+
+    if ((int) server_accepted->len > accepted)
+        g_string_append_printf(problems, " %d extra scrobbles;",
+         (int) server_accepted->len - accepted);
+    if (requests >= 0 && server_requests != requests)
+        g_string_append_printf(problems, " %d requests, expected %d;",
+         server_requests, requests);
+
+    pthread_mutex_unlock(&server_mutex);
+
+    if (problems->len) {
+        printf("FAIL %s:%s\n", name, problems->str);
+        failures++;
+    } else {
+        printf("PASS %s\n", name);
+    }
+
+    g_string_free(problems, TRUE);
+}
+
+//more than two batches
+static void test_batches() {
+    int first = next_track;
+
+    reset_server(G_MAXINT);
+    queue_tracks(120, -1);
+    scrobble_cached_queue();
+    check("120 tracks", first, 120, -1, 3);
+
+    //everything was committed, so nothing is sent again
+    reset_server(G_MAXINT);
+    scrobble_cached_queue();
+    check("nothing left after 120 tracks", first, 0, -1, 0);
+}
+
+//a track the server rejects must not take the rest of its batch with it
+static void test_rejected() {
+    int first = next_track;
+
+    reset_server(G_MAXINT);
+    queue_tracks(10, 4);
+    scrobble_cached_queue();
+    check("one rejected track", first, 10, 4, 1 + 10);
+
+    reset_server(G_MAXINT);
+    scrobble_cached_queue();
+    check("nothing left after a rejected track", first, 0, -1, 0);
+}
+
+//tracks stay queued while the service is offline
+static void test_offline() {
+    int first = next_track;
+
+    reset_server(G_MAXINT);
+    server_offline = TRUE;
+    queue_tracks(5, -1);
+    scrobble_cached_queue();
+    check("service offline", first, 0, -1, 1);
+
+    reset_server(G_MAXINT);
+    scrobble_cached_queue();
+    check("back online", first, 5, -1, 1);
+}
+
+//the tracks over the daily limit are sent again later, after the others
+static void test_daily_limit() {
+    int first = next_track;
+
+    reset_server(3);
+    queue_tracks(10, -1);
+    scrobble_cached_queue();
+    check("daily limit", first, 3, -1, 1);
+
+    reset_server(G_MAXINT);
+    scrobble_cached_queue();
+    check("after the daily limit", first + 3, 7, -1, 1);
+}
+
+//a bad session disables scrobbling but keeps the tracks
+static void test_bad_session() {
+    int first = next_track;
+
+    reset_server(G_MAXINT);
+    server_bad_session = TRUE;
+    queue_tracks(5, -1);
+    scrobble_cached_queue();
+    check("bad session", first, 0, -1, 1);
+
+    if (scrobbling_enabled || (session_key && session_key[0])) {
+        printf("FAIL bad session: scrobbling was not disabled\n");
+        failures++;
+    }
+
+    //as if the user had authorized us again
+    session_key = String(SESSION_KEY);
+    scrobbling_enabled = TRUE;
+
+    reset_server(G_MAXINT);
+    scrobble_cached_queue();
+    check("new session", first, 5, -1, 1);
+}
+
+static void remove_user_dir(const gchar *home) {
+    const gchar *user_dir = aud_get_path(AUD_PATH_USER_DIR);
+    GDir *dir = g_dir_open(user_dir, 0, NULL);
+
+    if (dir != NULL) {
+        const gchar *name;
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            gchar *path = g_build_filename(user_dir, name, NULL);
+            g_unlink(path);
+            g_free(path);
+        }
+        g_dir_close(dir);
+    }
+
+    g_rmdir(user_dir);
+    g_rmdir(home);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        fprintf(stderr, "usage: %s\n", argv[0]);
+        return 2;
+    }
+
+    gchar *home = g_dir_make_tmp("scrobbler-test-XXXXXX", NULL);
+    if (home == NULL) {
+        perror("g_dir_make_tmp");
+        return 2;
+    }
+
+    g_setenv("XDG_CONFIG_HOME", home, TRUE);
+    aud_init_paths();
+    g_mkdir_with_parents(aud_get_path(AUD_PATH_USER_DIR), 0700);
+
+    int port = start_server();
+    if (!port)
+        return 2;
+
+    aud_set_str("scrobbler", "api_url", str_printf("http://127.0.0.1:%d/2.0/", port));
+
+    LIBXML_TEST_VERSION
+
+    if (!scrobbler_communication_init()) {
+        fprintf(stderr, "scrobbler_communication_init failed\n");
+        return 2;
+    }
+
+    session_key = String(SESSION_KEY);
+    scrobbling_enabled = TRUE;
+
+    test_batches();
+    test_rejected();
+    test_offline();
+    test_daily_limit();
+    test_bad_session();
+
+    printf("%d failures\n", failures);
+
+    stop_server();
+    remove_user_dir(home);
+    aud_cleanup_paths();
+    g_free(home);
+
+    return failures ? 1 : 0;
+}
@@ -18,6 +18,7 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 
 #include <gtk/gtk.h>
@@ -35,6 +36,17 @@
 #define MAX_RESULTS 20
 #define SEARCH_DELAY 300
 
+/* a range of entries larger than this fraction of the playlist is handled by
+ * rebuilding the whole database */
+#define MAX_INCREMENTAL_DIVISOR 4
+
+/* the background build hands over entries in chunks of this size */
+#define BUILD_CHUNK 256
+#define BUILD_POLL_DELAY 100
+
+#define CACHE_NAME "search-tool-cache"
+#define CACHE_HEADER "search-tool cache v1"
+
 enum {GENRE = 0, ARTIST, ALBUM, TITLE, FIELDS};
 
 struct Key
@@ -48,6 +60,17 @@ struct Key
         { return field + name.hash (); }
 };
 
+/* three bytes of a folded name, used as the key of the inverted index */
+struct Trigram
+{
+    unsigned code;
+
+    bool operator== (const Trigram & b) const
+        { return code == b.code; }
+    unsigned hash () const
+        { return code ^ (code >> 7) ^ (code >> 15); }
+};
+
 struct Item
 {
     int field;
@@ -55,12 +78,16 @@ struct Item
     Item * parent;
     SimpleHash<Key, Item> children;
     Index<int> matches;
+    int stamp;
+    bool dead; /* about to be removed, see unindex_items () */
 
     Item (int field, const String & name, Item * parent) :
         field (field),
         name (name),
         folded (str_tolower_utf8 (name)),
-        parent (parent) {}
+        parent (parent),
+        stamp (0),
+        dead (false) {}
 
     Item (Item &&) = default;
     Item & operator= (Item &&) = default;
@@ -71,12 +98,43 @@ struct SearchState {
     int mask;
 };
 
+/* fields of one playlist entry, as gathered by the build thread */
+struct EntryFields {
+    int entry;
+    String filename;
+    String fields[FIELDS];
+};
+
+struct UpdateState {
+    int at, end, delta; /* remove matches in [at, end), shift the rest by delta */
+    Index<Item *> emptied;
+};
+
 static int playlist_id;
 static Index<String> search_terms;
 
 static SimpleHash<String, bool> added_table;
 static SimpleHash<Key, Item> database;
+static SimpleHash<Trigram, Index<Item *>> trigram_index;
 static bool database_valid;
+static int database_entries;
+static int search_stamp;
+
+/* Background build state.  build_results, build_done and build_cancel are
+ * shared with the build thread and guarded by build_mutex; the rest belong to
+ * the main thread. */
+static pthread_mutex_t build_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t build_thread;
+static Index<EntryFields> build_results;
+static bool build_done, build_cancel;
+static bool build_running;
+static int build_playlist_id, build_entries, build_received;
+static int build_source;
+
+/* metadata updates that came in during the build, applied when it is done */
+static bool pending_update;
+static int pending_at, pending_end;
+
 static Index<const Item *> items;
 static int hidden_items;
 static Index<bool> selection;
@@ -146,56 +204,471 @@ static String get_path ()
     return String (g_get_home_dir ());
 }
 
+static Trigram make_trigram (const char * s)
+{
+    return {(unsigned) (unsigned char) s[0] | (unsigned) (unsigned char) s[1] << 8 |
+     (unsigned) (unsigned char) s[2] << 16};
+}
+
+static void index_item (Item * item)
+{
+    const char * folded = item->folded;
+    int len = strlen (folded);
+
+    for (int i = 0; i + 3 <= len; i ++)
+    {
+        Trigram tri = make_trigram (folded + i);
+        Index<Item *> * list = trigram_index.lookup (tri);
+
+        if (! list)
+            list = trigram_index.add (tri, Index<Item *> ());
+
+        /* a repeated trigram is seen while this item is still the last one */
+        if (! list->len () || (* list)[list->len () - 1] != item)
+            list->append (item);
+    }
+}
+
+static void compact_cb (const Trigram & tri, bool & unused, void *)
+{
+    Index<Item *> * list = trigram_index.lookup (tri);
+    if (! list)
+        return;
+
+    int out = 0;
+
+    for (Item * item : * list)
+    {
+        if (! item->dead)
+            (* list)[out ++] = item;
+    }
+
+    list->remove (out, -1);
+}
+
+/* Drops items from the trigram index before they are deleted.  Common
+ * trigrams are shared by most items, so rather than searching their lists
+ * once per item, the items are marked and each affected list is compacted
+ * in a single pass. */
+static void unindex_items (const Index<Item *> & dead)
+{
+    SimpleHash<Trigram, bool> touched;
+
+    for (Item * item : dead)
+    {
+        const char * folded = item->folded;
+        int len = strlen (folded);
+
+        item->dead = true;
+
+        for (int i = 0; i + 3 <= len; i ++)
+        {
+            Trigram tri = make_trigram (folded + i);
+            if (! touched.lookup (tri))
+                touched.add (tri, true);
+        }
+    }
+
+    touched.iterate (compact_cb, nullptr);
+}
+
+/* keeps the match list sorted, since entries may be added out of order */
+static void add_match (Item * item, int entry)
+{
+    int pos = item->matches.len ();
+
+    while (pos > 0 && item->matches[pos - 1] > entry)
+        pos --;
+
+    if (pos == item->matches.len ())
+        item->matches.append (entry);
+    else
+    {
+        item->matches.insert (pos, 1);
+        item->matches[pos] = entry;
+    }
+}
+
+static void add_fields (int e, const String fields[FIELDS])
+{
+    if (! fields[TITLE])
+        return;
+
+    Item * parent = nullptr;
+    SimpleHash<Key, Item> * hash = & database;
+
+    for (int f = 0; f < FIELDS; f ++)
+    {
+        if (fields[f])
+        {
+            Key key = {f, fields[f]};
+            Item * item = hash->lookup (key);
+
+            if (! item)
+            {
+                item = hash->add (key, Item (f, fields[f], parent));
+                index_item (item);
+            }
+
+            add_match (item, e);
+
+            /* genre is outside the normal hierarchy */
+            if (f != GENRE)
+            {
+                parent = item;
+                hash = & item->children;
+            }
+        }
+    }
+}
+
+static void describe_entry (int list, int e, String fields[FIELDS])
+{
+    aud_playlist_entry_describe (list, e, fields[TITLE], fields[ARTIST], fields[ALBUM], true);
+    fields[GENRE] = aud_playlist_entry_get_tuple (list, e, true).get_str (FIELD_GENRE);
+}
+
+static void add_entry (int list, int e)
+{
+    String fields[FIELDS];
+    describe_entry (list, e, fields);
+    add_fields (e, fields);
+}
+
+static StringBuf cache_path ()
+{
+    return filename_build ({aud_get_path (AUD_PATH_USER_DIR), CACHE_NAME});
+}
+
+/* The cache maps filenames to the fields gathered by the last full build.
+ * Each line holds the percent-encoded filename, genre, artist, album and
+ * title, separated by tabs; a missing field is left empty. */
+static void load_cache (SimpleHash<String, EntryFields> & cache)
+{
+    char * data = nullptr;
+
+    if (! g_file_get_contents (cache_path (), & data, nullptr, nullptr))
+        return;
+
+    char * line = data;
+    char * next = strchr (line, '\n');
+
+    if (! next || next - line != (int) strlen (CACHE_HEADER) ||
+     strncmp (line, CACHE_HEADER, next - line))
+    {
+        g_free (data);
+        return;
+    }
+
+    for (line = next + 1; (next = strchr (line, '\n')); line = next + 1)
+    {
+        * next = 0;
+
+        char * parts[1 + FIELDS];
+        int n = 0;
+
+        for (char * p = line; p && n < 1 + FIELDS; n ++)
+        {
+            parts[n] = p;
+
+            if ((p = strchr (p, '\t')))
+                * p ++ = 0;
+        }
+
+        if (n < 1 + FIELDS || ! parts[0][0])
+            continue;
+
+        EntryFields entry;
+        entry.entry = -1;
+        entry.filename = String (str_decode_percent (parts[0]));
+
+        for (int f = 0; f < FIELDS; f ++)
+        {
+            if (parts[1 + f][0])
+                entry.fields[f] = String (str_decode_percent (parts[1 + f]));
+        }
+
+        String filename = entry.filename;
+        cache.add (filename, std::move (entry));
+    }
+
+    g_free (data);
+}
+
+static void save_cache (const Index<EntryFields> & entries)
+{
+    GString * out = g_string_new (CACHE_HEADER "\n");
+
+    for (const EntryFields & entry : entries)
+    {
+        if (! entry.filename)
+            continue;
+
+        g_string_append (out, str_encode_percent (entry.filename));
+
+        for (int f = 0; f < FIELDS; f ++)
+        {
+            g_string_append_c (out, '\t');
+            if (entry.fields[f])
+                g_string_append (out, str_encode_percent (entry.fields[f]));
+        }
+
+        g_string_append_c (out, '\n');
+    }
+
+    g_file_set_contents (cache_path (), out->str, out->len, nullptr);
+    g_string_free (out, true);
+}
+
+/* Gathers the fields of every entry, using the cache for entries whose
+ * metadata is not loaded yet, and passes them to the main thread in chunks. */
+static void * build_worker (void * unused)
+{
+    SimpleHash<String, EntryFields> cache;
+    load_cache (cache);
+
+    Index<EntryFields> all, chunk;
+    bool cancelled = false;
+
+    for (int e = 0; e < build_entries && ! cancelled; e ++)
+    {
+        int list = aud_playlist_by_unique_id (build_playlist_id);
+        if (list < 0)
+            break;
+
+        EntryFields & entry = chunk.append ();
+        entry.entry = e;
+        entry.filename = aud_playlist_entry_get_filename (list, e);
+
+        /* fresh metadata always wins, so retagged files are picked up */
+        EntryFields * cached = nullptr;
+        if (entry.filename && ! aud_playlist_entry_get_tuple (list, e, true))
+            cached = cache.lookup (entry.filename);
+
+        if (cached)
+        {
+            for (int f = 0; f < FIELDS; f ++)
+                entry.fields[f] = cached->fields[f];
+        }
+        else
+            describe_entry (list, e, entry.fields);
+
+        if (chunk.len () >= BUILD_CHUNK || e == build_entries - 1)
+        {
+            pthread_mutex_lock (& build_mutex);
+
+            cancelled = build_cancel;
+
+            for (const EntryFields & done : chunk)
+            {
+                all.append () = done;
+                build_results.append () = done;
+            }
+
+            pthread_mutex_unlock (& build_mutex);
+
+            chunk.clear ();
+        }
+    }
+
+    if (! cancelled && all.len () == build_entries)
+        save_cache (all);
+
+    pthread_mutex_lock (& build_mutex);
+    build_done = true;
+    pthread_mutex_unlock (& build_mutex);
+
+    return nullptr;
+}
+
+static void cancel_build ()
+{
+    if (! build_running)
+        return;
+
+    pthread_mutex_lock (& build_mutex);
+    build_cancel = true;
+    pthread_mutex_unlock (& build_mutex);
+
+    pthread_join (build_thread, nullptr);
+
+    if (build_source)
+    {
+        g_source_remove (build_source);
+        build_source = 0;
+    }
+
+    build_results.clear ();
+    build_running = false;
+    pending_update = false;
+}
+
 static void destroy_database ()
 {
+    cancel_build ();
+
     items.clear ();
     hidden_items = 0;
+    trigram_index.clear ();
     database.clear ();
     database_valid = false;
+    database_entries = 0;
 }
 
-static void create_database (int list)
+static void update_cb (const Key & key, Item & item, void * _state)
 {
-    destroy_database ();
+    UpdateState * state = (UpdateState *) _state;
+
+    int out = 0;
+
+    for (int entry : item.matches)
+    {
+        if (entry < state->at)
+            item.matches[out ++] = entry;
+        else if (entry >= state->end)
+            item.matches[out ++] = entry + state->delta;
+    }
+
+    item.matches.remove (out, -1);
 
+    item.children.iterate (update_cb, state);
+
+    /* children come first, so they are removed before their parent */
+    if (! out)
+        state->emptied.append (& item);
+}
+
+/* Replaces the entries in [at, at + count) after a playlist update.  Entries
+ * outside the range are unchanged, apart from being shifted if the number of
+ * entries has changed.  Returns false if the database has to be rebuilt
+ * instead. */
+static bool update_database_range (int list, int at, int count)
+{
     int entries = aud_playlist_entry_count (list);
+    int delta = entries - database_entries;
+    int old_count = count - delta;
+
+    if (build_running || old_count < 0 || at + old_count > database_entries ||
+     (old_count + count) * MAX_INCREMENTAL_DIVISOR > entries)
+        return false;
+
+    /* results may point to items that are about to go away */
+    items.clear ();
+    hidden_items = 0;
 
-    for (int e = 0; e < entries; e ++)
+    UpdateState state;
+    state.at = at;
+    state.end = at + old_count;
+    state.delta = delta;
+
+    database.iterate (update_cb, & state);
+
+    unindex_items (state.emptied);
+
+    for (Item * item : state.emptied)
     {
-        String fields[FIELDS];
+        SimpleHash<Key, Item> * hash = item->parent ? & item->parent->children : & database;
+        Key key = {item->field, item->name};
 
-        aud_playlist_entry_describe (list, e, fields[TITLE], fields[ARTIST], fields[ALBUM], true);
-        fields[GENRE] = aud_playlist_entry_get_tuple (list, e, true).get_str (FIELD_GENRE);
+        hash->remove (key);
+    }
 
-        if (! fields[TITLE])
-            continue;
+    for (int e = at; e < at + count; e ++)
+        add_entry (list, e);
 
-        Item * parent = nullptr;
-        SimpleHash<Key, Item> * hash = & database;
+    database_entries = entries;
+    return true;
+}
 
-        for (int f = 0; f < FIELDS; f ++)
+/* Returns true if every search term is found in the item or its ancestors. */
+static bool item_matches (const Item * item)
+{
+    for (const String & term : search_terms)
+    {
+        const Item * i = item;
+
+        while (i && ! strstr (i->folded, term))
+            i = i->parent;
+
+        if (! i)
+            return false;
+    }
+
+    return true;
+}
+
+static void indexed_cb (const Key & key, Item & item, void * _state)
+{
+    SearchState * state = (SearchState *) _state;
+
+    /* adding an item with exactly one child is redundant, so avoid it */
+    if (item.children.n_items () != 1 && item_matches (& item))
+        state->items.append (& item);
+
+    item.children.iterate (indexed_cb, state);
+}
+
+/* Finds results through the trigram index.  Every result must be, or descend
+ * from, an item matching the longest-indexable term directly, so only those
+ * items and their descendants are visited.  Returns false if no term is long
+ * enough to use the index. */
+static bool search_indexed (SearchState * state)
+{
+    const String * best_term = nullptr;
+    Index<Item *> * best = nullptr;
+
+    for (const String & term : search_terms)
+    {
+        const char * str = term;
+        int len = strlen (str);
+
+        for (int i = 0; i + 3 <= len; i ++)
         {
-            if (fields[f])
+            Index<Item *> * list = trigram_index.lookup (make_trigram (str + i));
+
+            /* a trigram that appears nowhere means there are no results */
+            if (! list || ! list->len ())
+                return true;
+
+            if (! best || list->len () < best->len ())
             {
-                Key key = {f, fields[f]};
-                Item * item = hash->lookup (key);
+                best = list;
+                best_term = & term;
+            }
+        }
+    }
 
-                if (! item)
-                    item = hash->add (key, Item (f, fields[f], parent));
+    if (! best)
+        return false;
 
-                item->matches.append (e);
+    search_stamp ++;
 
-                /* genre is outside the normal hierarchy */
-                if (f != GENRE)
-                {
-                    parent = item;
-                    hash = & item->children;
-                }
-            }
+    Index<Item *> found;
+
+    for (Item * item : * best)
+    {
+        if (strstr (item->folded, * best_term))
+        {
+            item->stamp = search_stamp;
+            found.append (item);
         }
     }
 
-    database_valid = true;
+    for (Item * item : found)
+    {
+        /* skip items whose ancestor will be visited anyway */
+        const Item * p = item->parent;
+        while (p && p->stamp != search_stamp)
+            p = p->parent;
+
+        if (! p)
+        {
+            Key key = {item->field, item->name};
+            indexed_cb (key, * item, state);
+        }
+    }
+
+    return true;
 }
 
 static void search_cb (const Key & key, Item & item, void * _state)
@@ -265,7 +738,8 @@ static void do_search ()
     /* effectively limits number of search terms to 32 */
     state.mask = (1 << search_terms.len ()) - 1;
 
-    database.iterate (search_cb, & state);
+    if (! search_indexed (& state))
+        database.iterate (search_cb, & state);
 
     items = std::move (state.items);
 
@@ -381,6 +855,14 @@ static int search_timeout (void * unused = nullptr)
          "(%d hidden)", hidden_items), hidden_items));
     }
 
+    if (build_running)
+    {
+        int percent = build_entries ? build_received * 100 / build_entries : 100;
+
+        str_insert (stats, -1, " ");
+        stats.combine (str_printf (_("(loading library: %d%%)"), percent));
+    }
+
     gtk_label_set_text ((GtkLabel *) stats_label, stats);
 
     if (search_source)
@@ -400,13 +882,87 @@ static void schedule_search ()
     search_source = g_timeout_add (SEARCH_DELAY, search_timeout, nullptr);
 }
 
+static void update_database ();
+
+static void apply_pending_update ()
+{
+    int list = get_playlist (true, true);
+
+    pending_update = false;
+
+    if (list < 0 || ! update_database_range (list, pending_at, pending_end - pending_at))
+        update_database ();
+}
+
+/* Adds the entries gathered so far by the build thread, so that results can
+ * be shown before the build is finished. */
+static int build_poll (void * unused)
+{
+    Index<EntryFields> results;
+
+    pthread_mutex_lock (& build_mutex);
+    results = std::move (build_results);
+    bool done = build_done;
+    pthread_mutex_unlock (& build_mutex);
+
+    for (const EntryFields & entry : results)
+        add_fields (entry.entry, entry.fields);
+
+    build_received += results.len ();
+
+    if (done)
+    {
+        pthread_join (build_thread, nullptr);
+        build_running = false;
+        build_source = 0;
+
+        /* changes in the number of entries would have restarted the build */
+        database_entries = build_received;
+
+        if (pending_update)
+            apply_pending_update ();
+    }
+
+    if (results.len () || done)
+        search_timeout ();
+
+    return ! done;
+}
+
+static void start_build (int list)
+{
+    destroy_database ();
+
+    build_playlist_id = aud_playlist_get_unique_id (list);
+    build_entries = aud_playlist_entry_count (list);
+    build_received = 0;
+    build_done = false;
+    build_cancel = false;
+
+    /* partial results are shown while the build runs */
+    database_valid = true;
+
+    if (pthread_create (& build_thread, nullptr, build_worker, nullptr))
+    {
+        /* fall back to building in the main thread */
+        for (int e = 0; e < build_entries; e ++)
+            add_entry (list, e);
+
+        database_entries = build_entries;
+        return;
+    }
+
+    build_running = true;
+    build_source = g_timeout_add (BUILD_POLL_DELAY, build_poll, nullptr);
+}
+
 static void update_database ()
 {
     int list = get_playlist (true, true);
 
     if (list >= 0)
     {
-        create_database (list);
+        start_build (list);
         search_timeout ();
     }
     else
@@ -443,6 +999,31 @@ static void scan_complete_cb (void * unused, void * unused2)
         update_database ();
 }
 
+/* Remembers an update that arrives while the build is running, so that the
+ * build need not start over for every tag that is read in the meantime. */
+static void queue_update (int list, int at, int count)
+{
+    /* the build thread reads entries by position, so if their number has
+     * changed, what it has gathered so far is of no use */
+    if (aud_playlist_entry_count (list) != build_entries)
+    {
+        update_database ();
+        return;
+    }
+
+    if (pending_update)
+    {
+        pending_at = MIN (pending_at, at);
+        pending_end = MAX (pending_end, at + count);
+    }
+    else
+    {
+        pending_at = at;
+        pending_end = at + count;
+        pending_update = true;
+    }
+}
+
 static void playlist_update_cb (void * data, void * unused)
 {
     if (! database_valid)
@@ -452,9 +1033,18 @@ static void playlist_update_cb (void * data, void * unused)
         int list = get_playlist (true, true);
         int at, count;
 
-        if (list < 0 || aud_playlist_updated_range (list, & at, & count) >=
-         PLAYLIST_UPDATE_METADATA)
+        if (list < 0)
             update_database ();
+        else if (aud_playlist_updated_range (list, & at, & count) >=
+         PLAYLIST_UPDATE_METADATA)
+        {
+            if (build_running)
+                queue_update (list, at, count);
+            else if (update_database_range (list, at, count))
+                search_timeout ();
+            else
+                update_database ();
+        }
     }
 }
 
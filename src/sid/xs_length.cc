@@ -32,9 +32,29 @@
 #include "xmms-sid.h"
 #include "xs_support.h"
 
-/* Free memory allocated for given SLDB node
+#define XS_SLDB_INDEX_NAME  "sid-songlengths.idx"
+#define XS_SLDB_INDEX_MAGIC "XSSLDB1"
+
+/* SLDB entry as parsed from the text file, before it goes into the index
  */
-static void xs_sldb_node_free(sldb_node_t *node)
+typedef struct {
+    xs_md5hash_t    md5Hash;
+    int             nlengths;
+    int             *lengths;
+} sldb_entry_t;
+
+
+/* Header of the index contents, followed by the sorted nodes and then
+ * the lengths table
+ */
+typedef struct {
+    uint32_t n, nlengths;
+} sldb_index_header_t;
+
+
+/* Free memory allocated for given SLDB entry
+ */
+static void xs_sldb_node_free(sldb_entry_t *node)
 {
     if (node) {
         /* Nothing much to do here ... */
@@ -44,26 +64,6 @@ static void xs_sldb_node_free(sldb_node_t *node)
 }
 
 
-/* Insert given node to db linked list
- */
-static void xs_sldb_node_insert(xs_sldb_t *db, sldb_node_t *node)
-{
-    assert(db);
-
-    if (db->nodes) {
-        /* The first node's prev points to last node */
-        node->prev = db->nodes->prev;    /* New node's prev = Previous last node */
-        db->nodes->prev->next = node;    /* Previous last node's next = New node */
-        db->nodes->prev = node;    /* New last node = New node */
-        node->next = NULL;    /* But next is NULL! */
-    } else {
-        db->nodes = node;    /* First node ... */
-        node->prev = node;    /* ... it's also last */
-        node->next = NULL;    /* But next is NULL! */
-    }
-}
-
-
 /* Parse a time-entry in SLDB format
  */
 static int xs_sldb_gettime(char *str, size_t *pos)
@@ -104,15 +104,15 @@ static int xs_sldb_gettime(char *str, size_t *pos)
 
 /* Parse one SLDB definition line, return SLDB node
  */
-sldb_node_t * xs_sldb_read_entry(char *inLine)
+static sldb_entry_t * xs_sldb_read_entry(char *inLine)
 {
     size_t linePos;
     int i;
     bool_t isOK;
-    sldb_node_t *tmnode;
+    sldb_entry_t *tmnode;
 
     /* Allocate new node */
-    tmnode = g_new0 (sldb_node_t, 1);
+    tmnode = g_new0 (sldb_entry_t, 1);
 
     /* Get hash value */
     linePos = 0;
@@ -185,15 +185,45 @@ sldb_node_t * xs_sldb_read_entry(char *inLine)
 }
 
 
-/* Read database to memory
+/* Compare two given MD5-hashes.
+ * Return: 0 if equal
+ *         negative if testHash1 < testHash2
+ *         positive if testHash1 > testHash2
  */
-int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
+static int xs_sldb_cmphash(const xs_md5hash_t testHash1, const xs_md5hash_t testHash2)
+{
+    int i, d;
+
+    /* Compute difference of hashes */
+    for (i = 0, d = 0; (i < XS_MD5HASH_LENGTH) && !d; i++)
+        d = (testHash1[i] - testHash2[i]);
+
+    return d;
+}
+
+
+/* Compare two entries
+ */
+static int xs_sldb_cmp(const void *node1, const void *node2)
+{
+    /* We assume here that we never ever get NULL-pointers or similar */
+    return xs_sldb_cmphash(
+        (*(sldb_entry_t **) node1)->md5Hash,
+        (*(sldb_entry_t **) node2)->md5Hash);
+}
+
+
+/* Parse the text database and append its index, sorted by hash
+ */
+static int xs_sldb_build(const char *dbFilename, GByteArray *out)
 {
     FILE *inFile;
     char inLine[XS_BUF_SIZE];
     size_t lineNum;
-    sldb_node_t *tmnode;
-    assert(db);
+    sldb_entry_t *tmnode;
+    GPtrArray *entries;
+    sldb_index_header_t header;
+    unsigned i;
 
     /* Try to open the file */
     if ((inFile = fopen(dbFilename, "r")) == NULL) {
@@ -202,6 +232,7 @@ int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
     }
 
     /* Read and parse the data */
+    entries = g_ptr_array_new();
     lineNum = 0;
 
     while (fgets(inLine, XS_BUF_SIZE, inFile) != NULL) {
@@ -220,9 +251,9 @@ int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
                 xs_error("Invalid MD5-hash in SongLengthDB file '%s' line #%d!\n",
                     dbFilename, (int)lineNum);
             } else {
-                /* Parse and add node to db */
+                /* Parse and add entry */
                 if ((tmnode = xs_sldb_read_entry(inLine)) != NULL) {
-                    xs_sldb_node_insert(db, tmnode);
+                    g_ptr_array_add(entries, tmnode);
                 } else {
                     xs_error("Invalid entry in SongLengthDB file '%s' line #%d!\n",
                         dbFilename, (int)lineNum);
@@ -238,76 +269,76 @@ int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
     /* Close the file */
     fclose(inFile);
 
-    return 0;
-}
+    /* Sort the entries and write out nodes, then lengths */
+    qsort(entries->pdata, entries->len, sizeof(sldb_entry_t *), xs_sldb_cmp);
 
+    header.n = entries->len;
+    header.nlengths = 0;
+    for (i = 0; i < entries->len; i++)
+        header.nlengths += ((sldb_entry_t *) entries->pdata[i])->nlengths;
 
-/* Compare two given MD5-hashes.
- * Return: 0 if equal
- *         negative if testHash1 < testHash2
- *         positive if testHash1 > testHash2
- */
-static int xs_sldb_cmphash(xs_md5hash_t testHash1, xs_md5hash_t testHash2)
-{
-    int i, d;
+    g_byte_array_append(out, (const guint8 *) &header, sizeof header);
 
-    /* Compute difference of hashes */
-    for (i = 0, d = 0; (i < XS_MD5HASH_LENGTH) && !d; i++)
-        d = (testHash1[i] - testHash2[i]);
+    header.nlengths = 0;
+    for (i = 0; i < entries->len; i++) {
+        sldb_entry_t *entry = (sldb_entry_t *) entries->pdata[i];
+        sldb_node_t node;
 
-    return d;
-}
+        memcpy(node.md5Hash, entry->md5Hash, sizeof node.md5Hash);
+        node.first = header.nlengths;
+        node.nlengths = entry->nlengths;
+        g_byte_array_append(out, (const guint8 *) &node, sizeof node);
 
+        header.nlengths += entry->nlengths;
+    }
 
-/* Compare two nodes
- */
-static int xs_sldb_cmp(const void *node1, const void *node2)
-{
-    /* We assume here that we never ever get NULL-pointers or similar */
-    return xs_sldb_cmphash(
-        (*(sldb_node_t **) node1)->md5Hash,
-        (*(sldb_node_t **) node2)->md5Hash);
+    for (i = 0; i < entries->len; i++) {
+        sldb_entry_t *entry = (sldb_entry_t *) entries->pdata[i];
+        int j;
+
+        for (j = 0; j < entry->nlengths; j++) {
+            int32_t length = entry->lengths[j];
+            g_byte_array_append(out, (const guint8 *) &length, sizeof length);
+        }
+
+        xs_sldb_node_free(entry);
+    }
+
+    g_ptr_array_free(entries, TRUE);
+
+    return 0;
 }
 
 
-/* (Re)create index
+/* Open database, via its binary index
  */
-void xs_sldb_index(xs_sldb_t * db)
+int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
 {
-    sldb_node_t *pCurr;
-    size_t i;
+    sldb_index_header_t header;
     assert(db);
 
-    /* Free old index */
-    if (db->pindex) {
-        g_free(db->pindex);
-        db->pindex = NULL;
-    }
+    if (xs_index_open(&db->index, XS_SLDB_INDEX_NAME, XS_SLDB_INDEX_MAGIC,
+     dbFilename, xs_sldb_build) != 0)
+        return -1;
 
-    /* Get size of db */
-    pCurr = db->nodes;
-    db->n = 0;
-    while (pCurr) {
-        db->n++;
-        pCurr = pCurr->next;
-    }
+    /* Check that the contents are complete */
+    if (db->index.size < sizeof header)
+        return -2;
 
-    /* Check number of nodes */
-    if (db->n > 0) {
-        /* Allocate memory for index-table */
-        db->pindex = g_new (sldb_node_t *, db->n);
-
-        /* Get node-pointers to table */
-        i = 0;
-        pCurr = db->nodes;
-        while (pCurr && (i < db->n)) {
-            db->pindex[i++] = pCurr;
-            pCurr = pCurr->next;
-        }
+    memcpy(&header, db->index.data, sizeof header);
 
-        /* Sort the indexes */
-        qsort(db->pindex, db->n, sizeof(sldb_node_t *), xs_sldb_cmp);
+    if ((db->index.size - sizeof header) / sizeof(sldb_node_t) < header.n ||
+     (db->index.size - sizeof header - header.n * sizeof(sldb_node_t)) / sizeof(int32_t) < header.nlengths) {
+        xs_error("SongLengthDB index for '%s' is corrupt\n", dbFilename);
+        return -2;
     }
+
+    db->nodes = (const sldb_node_t *) (db->index.data + sizeof header);
+    db->lengths = (const int32_t *) (db->nodes + header.n);
+    db->n = header.n;
+    db->nlengths = header.nlengths;
+
+    return 0;
 }
 
 
@@ -315,29 +346,10 @@ void xs_sldb_index(xs_sldb_t * db)
  */
 void xs_sldb_free(xs_sldb_t * db)
 {
-    sldb_node_t *pCurr, *next;
-
     if (!db)
         return;
 
-    /* Free the memory allocated for nodes */
-    pCurr = db->nodes;
-    while (pCurr) {
-        next = pCurr->next;
-        xs_sldb_node_free(pCurr);
-        pCurr = next;
-    }
-
-    db->nodes = NULL;
-
-    /* Free memory allocated for index */
-    if (db->pindex) {
-        g_free(db->pindex);
-        db->pindex = NULL;
-    }
-
-    /* Free structure */
-    db->n = 0;
+    xs_index_close(&db->index);
     g_free(db);
 }
 
@@ -484,28 +496,41 @@ static int xs_get_sid_hash(const char *filename, xs_md5hash_t hash)
 }
 
 
-/* Get node from db index via binary search
+/* Compare a hash with a node in the index
  */
-sldb_node_t *xs_sldb_get(xs_sldb_t *db, const char *filename)
+static int xs_sldb_cmpnode(const void *hash, const void *node)
 {
-    sldb_node_t keyItem, *key, **item;
+    return xs_sldb_cmphash((const unsigned char *) hash,
+        ((const sldb_node_t *) node)->md5Hash);
+}
+
+
+/* Look up lengths of the given file via binary search, and copy up to
+ * max of them. Return: number of lengths copied, or -1 if not found.
+ */
+int xs_sldb_get(xs_sldb_t *db, const char *filename, int *lengths, int max)
+{
+    xs_md5hash_t hash;
+    const sldb_node_t *item;
+    int i, n;
 
     /* Check the database pointers */
-    if (!db || !db->nodes || !db->pindex)
-        return NULL;
+    if (!db || !db->nodes)
+        return -1;
 
     /* Get the hash and then look up from db */
-    if (xs_get_sid_hash(filename, keyItem.md5Hash) == 0) {
-        key = &keyItem;
-        item = (sldb_node_t * *) bsearch (& key, db->pindex, db->n,
-         sizeof db->pindex[0], xs_sldb_cmp);
-
-        if (item)
-            return *item;
-        else
-            return NULL;
-    } else
-        return NULL;
-}
+    if (xs_get_sid_hash(filename, hash) != 0)
+        return -1;
+
+    item = (const sldb_node_t *) bsearch(hash, db->nodes, db->n,
+     sizeof db->nodes[0], xs_sldb_cmpnode);
 
+    if (!item || item->first > db->nlengths || item->nlengths > db->nlengths - item->first)
+        return -1;
+
+    n = MIN((int) item->nlengths, max);
+    for (i = 0; i < n; i++)
+        lengths[i] = db->lengths[item->first + i];
 
+    return n;
+}
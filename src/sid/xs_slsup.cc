@@ -66,9 +66,6 @@ int xs_stil_init(void)
         return -3;
     }
 
-    /* Create index */
-    xs_stildb_index (xs_stildb_db);
-
     pthread_mutex_unlock(&xs_cfg_mutex);
     pthread_mutex_unlock(&xs_stildb_db_mutex);
     return 0;
@@ -84,9 +81,13 @@ void xs_stil_close(void)
 }
 
 
-stil_node_t *xs_stil_get(char *filename)
+/* Get STIL information on a subtune (0 for the whole file); the strings
+ * remain valid until xs_stil_close()
+ */
+int xs_stil_get(char *filename, int subTune, stil_subnode_t *info)
 {
-    stil_node_t *result;
+    const stil_node_t *node;
+    int result = -1;
     char *tmpFilename;
 
     pthread_mutex_lock(&xs_stildb_db_mutex);
@@ -108,9 +109,10 @@ stil_node_t *xs_stil_get(char *filename)
         } else
             tmpFilename = filename;
 
-        result = xs_stildb_get_node(xs_stildb_db, tmpFilename);
-    } else
-        result = NULL;
+        node = xs_stildb_get_node(xs_stildb_db, tmpFilename);
+        if (node)
+            result = xs_stildb_get_subtune(xs_stildb_db, node, subTune, info);
+    }
 
     pthread_mutex_unlock(&xs_stildb_db_mutex);
     pthread_mutex_unlock(&xs_cfg_mutex);
@@ -148,9 +150,6 @@ int xs_songlen_init(void)
         return -3;
     }
 
-    /* Create index */
-    xs_sldb_index (xs_sldb_db);
-
     pthread_mutex_unlock(&xs_cfg_mutex);
     pthread_mutex_unlock(&xs_sldb_db_mutex);
     return 0;
@@ -166,16 +165,16 @@ void xs_songlen_close(void)
 }
 
 
-sldb_node_t *xs_songlen_get(const char * filename)
+int xs_songlen_get(const char * filename, int *lengths, int max)
 {
-    sldb_node_t *result;
+    int result;
 
     pthread_mutex_lock(&xs_sldb_db_mutex);
 
     if (xs_cfg.songlenDBEnable && xs_sldb_db)
-        result = xs_sldb_get(xs_sldb_db, filename);
+        result = xs_sldb_get(xs_sldb_db, filename, lengths, max);
     else
-        result = NULL;
+        result = -1;
 
     pthread_mutex_unlock(&xs_sldb_db_mutex);
 
@@ -192,7 +191,7 @@ xs_tuneinfo_t *xs_tuneinfo_new(const char * filename,
         int dataFileLen, const char *sidFormat, int sidModel)
 {
     xs_tuneinfo_t *result;
-    sldb_node_t *tmpLength;
+    int *lengths, nlengths;
     int i;
 
     /* Allocate structure */
@@ -218,19 +217,22 @@ xs_tuneinfo_t *xs_tuneinfo_new(const char * filename,
 
     result->sidModel = sidModel;
 
-    /* Get length information (NOTE: Do not free this!) */
-    tmpLength = xs_songlen_get(filename);
+    /* Get length information */
+    lengths = g_new (int, nsubTunes + 1);
+    nlengths = xs_songlen_get(filename, lengths, nsubTunes);
 
     /* Fill in sub-tune information */
     for (i = 0; i < result->nsubTunes; i++) {
-        if (tmpLength && (i < tmpLength->nlengths))
-            result->subTunes[i].tuneLength = tmpLength->lengths[i];
+        if (i < nlengths)
+            result->subTunes[i].tuneLength = lengths[i];
         else
             result->subTunes[i].tuneLength = -1;
 
         result->subTunes[i].tuneSpeed = -1;
     }
 
+    g_free(lengths);
+
     return result;
 }
 
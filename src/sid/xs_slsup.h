@@ -7,11 +7,11 @@
 
 int xs_stil_init(void);
 void xs_stil_close(void);
-stil_node_t *xs_stil_get(char *filename);
+int xs_stil_get(char *filename, int subTune, stil_subnode_t *info);
 
 int xs_songlen_init(void);
 void xs_songlen_close(void);
-sldb_node_t *xs_songlen_get(const char *filename);
+int xs_songlen_get(const char *filename, int *lengths, int max);
 
 xs_tuneinfo_t *xs_tuneinfo_new(const char *pcFilename, int nsubTunes,
  int startTune, const char *sidName, const char *sidComposer,
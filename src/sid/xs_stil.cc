@@ -31,15 +31,46 @@
 #include "xmms-sid.h"
 #include "xs_support.h"
 
+#define XS_STIL_INDEX_NAME  "sid-stil.idx"
+#define XS_STIL_INDEX_MAGIC "XSSTIL1"
+
+/* STIL entry as parsed from the text file, before it goes into the index
+ */
+typedef struct {
+    char *name, *author, *title, *info;
+} stil_entry_sub_t;
+
+
+typedef struct _stil_entry_t {
+    char *filename;
+    int nsubTunes;
+    stil_entry_sub_t **subTunes;
+    struct _stil_entry_t *prev, *next;
+} stil_entry_t;
+
+
+typedef struct {
+    stil_entry_t *nodes;
+} stil_list_t;
+
+
+/* Header of the index contents, followed by the sorted nodes, the
+ * subtunes table and the string pool
+ */
+typedef struct {
+    uint32_t n, nsubTunes, poolSize, reserved;
+} stil_index_header_t;
+
+
 /* Database handling functions
  */
-static void xs_stildb_node_realloc(stil_node_t *node, int nsubTunes)
+static void xs_stildb_node_realloc(stil_entry_t *node, int nsubTunes)
 {
     /* Re-allocate subTune structure if needed */
     if (nsubTunes > node->nsubTunes) {
         int clearIndex, clearLength;
 
-        node->subTunes = g_renew (stil_subnode_t *, node->subTunes, nsubTunes + 1);
+        node->subTunes = g_renew (stil_entry_sub_t *, node->subTunes, nsubTunes + 1);
 
         /* Clear the newly allocated memory */
         if (node->nsubTunes == 0) {
@@ -49,21 +80,21 @@ static void xs_stildb_node_realloc(stil_node_t *node, int nsubTunes)
             clearIndex = node->nsubTunes + 1;
             clearLength = (nsubTunes - clearIndex + 1);
         }
-        memset(&(node->subTunes[clearIndex]), 0, clearLength * sizeof(stil_subnode_t **));
+        memset(&(node->subTunes[clearIndex]), 0, clearLength * sizeof(stil_entry_sub_t *));
 
         node->nsubTunes = nsubTunes;
     }
 
     /* Allocate memory for subTune */
     if (! node->subTunes[nsubTunes])
-        node->subTunes[nsubTunes] = g_new0 (stil_subnode_t, 1);
+        node->subTunes[nsubTunes] = g_new0 (stil_entry_sub_t, 1);
 }
 
 
-static void xs_stildb_node_free(stil_node_t *node)
+static void xs_stildb_node_free(stil_entry_t *node)
 {
     int i;
-    stil_subnode_t *subnode;
+    stil_entry_sub_t *subnode;
 
     if (node == NULL) return;
 
@@ -84,14 +115,14 @@ static void xs_stildb_node_free(stil_node_t *node)
 }
 
 
-static stil_node_t *xs_stildb_node_new(char *filename)
+static stil_entry_t *xs_stildb_node_new(char *filename)
 {
-    stil_node_t *result;
+    stil_entry_t *result;
 
 //fprintf(stderr, "LL: %s\n", filename);
 
     /* Allocate memory for new node */
-    result = g_new0 (stil_node_t, 1);
+    result = g_new0 (stil_entry_t, 1);
 
     /* Allocate filename and initial space for one subtune */
     result->filename = g_strdup(filename);
@@ -103,7 +134,7 @@ static stil_node_t *xs_stildb_node_new(char *filename)
 
 /* Insert given node to db linked list
  */
-static void xs_stildb_node_insert(xs_stildb_t *db, stil_node_t *node)
+static void xs_stildb_node_insert(stil_list_t *db, stil_entry_t *node)
 {
     assert(db != NULL);
 
@@ -121,7 +152,7 @@ static void xs_stildb_node_insert(xs_stildb_t *db, stil_node_t *node)
 }
 
 
-/* Read database (additively) to given db-structure
+/* Read database (additively) to given list
  */
 #define XS_STILDB_MULTI                                         \
     if (multi) {                                                \
@@ -140,11 +171,11 @@ static void XS_STILDB_ERR(int linenum, char *line, const char *fmt, ...)
     xs_error("#%d: '%s'\n", linenum, line);
 }
 
-int xs_stildb_read(xs_stildb_t *db, char *filename)
+static int xs_stildb_parse(stil_list_t *db, const char *filename)
 {
     FILE *f;
     char line[XS_BUF_SIZE + 16];    /* Since we add some chars here and there */
-    stil_node_t *node;
+    stil_entry_t *node;
     bool_t multi;
     int lineNum, subEntry;
     assert(db != NULL);
@@ -289,54 +320,159 @@ int xs_stildb_read(xs_stildb_t *db, char *filename)
 }
 
 
-/* Compare two nodes
+/* Compare two entries
  */
 static int xs_stildb_cmp(const void *node1, const void *node2)
 {
     /* We assume here that we never ever get NULL-pointers or similar */
     return strcmp(
-        (*(stil_node_t **) node1)->filename,
-        (*(stil_node_t **) node2)->filename);
+        (*(stil_entry_t **) node1)->filename,
+        (*(stil_entry_t **) node2)->filename);
+}
+
+
+/* Add a string to the pool, return its offset
+ */
+static uint32_t xs_stildb_pool_add(GByteArray *pool, const char *str)
+{
+    uint32_t offset;
+
+    if (!str)
+        return 0;
+
+    offset = pool->len;
+    g_byte_array_append(pool, (const guint8 *) str, strlen(str) + 1);
+    return offset;
 }
 
 
-/* (Re)create index
+/* Parse the text database and append its index, sorted by filename
  */
-void xs_stildb_index(xs_stildb_t *db)
+static int xs_stildb_build(const char *filename, GByteArray *out)
 {
-    stil_node_t *curr;
-    size_t i;
+    stil_list_t list = {NULL};
+    stil_entry_t *curr, *next;
+    GPtrArray *entries;
+    GByteArray *subTunes, *pool;
+    stil_index_header_t header;
+    guint start = out->len;
+    unsigned i;
+
+    if (xs_stildb_parse(&list, filename) != 0)
+        return -1;
+
+    entries = g_ptr_array_new();
+    for (curr = list.nodes; curr; curr = curr->next)
+        g_ptr_array_add(entries, curr);
 
-    /* Free old index */
-    if (db->pindex) {
-        g_free(db->pindex);
-        db->pindex = NULL;
+    qsort(entries->pdata, entries->len, sizeof(stil_entry_t *), xs_stildb_cmp);
+
+    /* Offset 0 of the pool stands for a missing string */
+    subTunes = g_byte_array_new();
+    pool = g_byte_array_new();
+    g_byte_array_append(pool, (const guint8 *) "", 1);
+
+    memset(&header, 0, sizeof header);
+    header.n = entries->len;
+
+    for (i = 0; i < entries->len; i++) {
+        stil_entry_t *entry = (stil_entry_t *) entries->pdata[i];
+        int j;
+
+        for (j = 0; j <= entry->nsubTunes; j++) {
+            stil_entry_sub_t *sub = entry->subTunes[j];
+            uint32_t fields[4] = {0, 0, 0, 0};
+
+            if (sub) {
+                fields[0] = xs_stildb_pool_add(pool, sub->name);
+                fields[1] = xs_stildb_pool_add(pool, sub->author);
+                fields[2] = xs_stildb_pool_add(pool, sub->title);
+                fields[3] = xs_stildb_pool_add(pool, sub->info);
+            }
+
+            g_byte_array_append(subTunes, (const guint8 *) fields, sizeof fields);
+        }
+    }
+
+    header.nsubTunes = subTunes->len / (4 * sizeof(uint32_t));
+    g_byte_array_append(out, (const guint8 *) &header, sizeof header);
+
+    /* Nodes refer to the subtunes in the order they were added above */
+    header.nsubTunes = 0;
+    for (i = 0; i < entries->len; i++) {
+        stil_entry_t *entry = (stil_entry_t *) entries->pdata[i];
+        stil_node_t node;
+
+        node.filename = xs_stildb_pool_add(pool, entry->filename);
+        node.nsubTunes = entry->nsubTunes;
+        node.first = header.nsubTunes;
+        g_byte_array_append(out, (const guint8 *) &node, sizeof node);
+
+        header.nsubTunes += entry->nsubTunes + 1;
     }
 
-    /* Get size of db */
-    curr = db->nodes;
-    db->n = 0;
-    while (curr) {
-        db->n++;
-        curr = curr->next;
+    g_byte_array_append(out, subTunes->data, subTunes->len);
+    g_byte_array_append(out, pool->data, pool->len);
+
+    /* The pool size is only known now */
+    header.poolSize = pool->len;
+    memcpy(out->data + start, &header, sizeof header);
+
+    g_byte_array_free(subTunes, TRUE);
+    g_byte_array_free(pool, TRUE);
+    g_ptr_array_free(entries, TRUE);
+
+    for (curr = list.nodes; curr; curr = next) {
+        next = curr->next;
+        xs_stildb_node_free(curr);
     }
 
-    /* Check number of nodes */
-    if (db->n > 0) {
-        /* Allocate memory for index-table */
-        db->pindex = g_new (stil_node_t *, db->n);
-
-        /* Get node-pointers to table */
-        i = 0;
-        curr = db->nodes;
-        while (curr && (i < db->n)) {
-            db->pindex[i++] = curr;
-            curr = curr->next;
-        }
+    return 0;
+}
+
+
+/* Open database, via its binary index
+ */
+int xs_stildb_read(xs_stildb_t *db, const char *filename)
+{
+    stil_index_header_t header;
+    size_t size;
+    assert(db != NULL);
+
+    if (xs_index_open(&db->index, XS_STIL_INDEX_NAME, XS_STIL_INDEX_MAGIC,
+     filename, xs_stildb_build) != 0)
+        return -1;
+
+    /* Check that the contents are complete */
+    if (db->index.size < sizeof header)
+        return -2;
+
+    memcpy(&header, db->index.data, sizeof header);
+    size = db->index.size - sizeof header;
 
-        /* Sort the indexes */
-        qsort(db->pindex, db->n, sizeof(stil_node_t *), xs_stildb_cmp);
+    if (size / sizeof(stil_node_t) < header.n ||
+     (size -= header.n * sizeof(stil_node_t)) / (4 * sizeof(uint32_t)) < header.nsubTunes ||
+     (size -= header.nsubTunes * 4 * sizeof(uint32_t)) != header.poolSize ||
+     header.poolSize == 0) {
+        xs_error("STIL index for '%s' is corrupt\n", filename);
+        return -2;
     }
+
+    db->nodes = (const stil_node_t *) (db->index.data + sizeof header);
+    db->subTunes = (const uint32_t *) (db->nodes + header.n);
+    db->pool = (const char *) (db->subTunes + 4 * header.nsubTunes);
+    db->n = header.n;
+    db->nsubTunes = header.nsubTunes;
+    db->poolSize = header.poolSize;
+
+    /* Make sure that every string is terminated */
+    if (db->pool[db->poolSize - 1]) {
+        xs_error("STIL index for '%s' is corrupt\n", filename);
+        db->nodes = NULL;
+        return -2;
+    }
+
+    return 0;
 }
 
 
@@ -344,51 +480,64 @@ void xs_stildb_index(xs_stildb_t *db)
  */
 void xs_stildb_free(xs_stildb_t *db)
 {
-    stil_node_t *curr, *next;
-
     if (!db)
         return;
 
-    /* Free the memory allocated for nodes */
-    curr = db->nodes;
-    while (curr) {
-        next = curr->next;
-        xs_stildb_node_free(curr);
-        curr = next;
-    }
+    xs_index_close(&db->index);
+    g_free(db);
+}
 
-    db->nodes = NULL;
 
-    /* Free memory allocated for index */
-    if (db->pindex) {
-        g_free(db->pindex);
-        db->pindex = NULL;
-    }
+static const char *xs_stildb_string(xs_stildb_t *db, uint32_t offset)
+{
+    return (offset && offset < db->poolSize) ? db->pool + offset : NULL;
+}
 
-    /* Free structure */
-    db->n = 0;
-    g_free(db);
+
+/* Compare a filename with a node in the index
+ */
+static xs_stildb_t *xs_stildb_cmp_db;
+
+static int xs_stildb_cmpnode(const void *filename, const void *node)
+{
+    const char *str = xs_stildb_string(xs_stildb_cmp_db,
+        ((const stil_node_t *) node)->filename);
+
+    return strcmp((const char *) filename, str ? str : "");
 }
 
 
 /* Get STIL information node from database
  */
-stil_node_t *xs_stildb_get_node(xs_stildb_t *db, char *filename)
+const stil_node_t *xs_stildb_get_node(xs_stildb_t *db, const char *filename)
 {
-    stil_node_t keyItem, *key, **item;
-
     /* Check the database pointers */
-    if (!db || !db->nodes || !db->pindex)
+    if (!db || !db->nodes)
         return NULL;
 
-    /* Look-up index using binary search */
-    keyItem.filename = filename;
-    key = &keyItem;
-    item = (stil_node_t * *) bsearch (& key, db->pindex, db->n,
-     sizeof (stil_node_t *), xs_stildb_cmp);
+    /* Look-up index using binary search (callers hold the db mutex) */
+    xs_stildb_cmp_db = db;
+    return (const stil_node_t *) bsearch(filename, db->nodes, db->n,
+     sizeof (stil_node_t), xs_stildb_cmpnode);
+}
 
-    if (item)
-        return *item;
-    else
-        return NULL;
+
+/* Get information on a subtune of the given node; the strings remain
+ * valid until the database is freed
+ */
+int xs_stildb_get_subtune(xs_stildb_t *db, const stil_node_t *node, int subTune, stil_subnode_t *result)
+{
+    const uint32_t *fields;
+
+    if (subTune < 0 || (uint32_t) subTune > node->nsubTunes ||
+     node->first > db->nsubTunes || node->nsubTunes >= db->nsubTunes - node->first)
+        return -1;
+
+    fields = db->subTunes + 4 * (node->first + subTune);
+    result->name = xs_stildb_string(db, fields[0]);
+    result->author = xs_stildb_string(db, fields[1]);
+    result->title = xs_stildb_string(db, fields[2]);
+    result->info = xs_stildb_string(db, fields[3]);
+
+    return 0;
 }
@@ -1,34 +1,41 @@
 #ifndef XS_STIL_H
 #define XS_STIL_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
+#include "xs_support.h"
+
 /* Types
  */
 typedef struct {
-    char *name, *author, *title, *info;
+    const char *name, *author, *title, *info;
 } stil_subnode_t;
 
 
-typedef struct _stil_node_t {
-    char *filename;
-    int nsubTunes;
-    stil_subnode_t **subTunes;
-    struct _stil_node_t *prev, *next;
+/* Node in the binary index; subtune 0 is the file as a whole
+ */
+typedef struct {
+    uint32_t filename;          /* Offset in string pool */
+    uint32_t nsubTunes;
+    uint32_t first;             /* Index of subtune 0 in subtunes table */
 } stil_node_t;
 
 
 typedef struct {
-    stil_node_t *nodes, **pindex;
-    size_t n;
+    xs_index_t index;           /* Binary index file */
+    const stil_node_t *nodes;   /* Sorted by filename */
+    const uint32_t *subTunes;   /* name, author, title and info of each */
+    const char *pool;           /* Strings; offset 0 means none */
+    size_t n, nsubTunes, poolSize;
 } xs_stildb_t;
 
 
 /* Functions
  */
-int xs_stildb_read(xs_stildb_t *, char *);
-void xs_stildb_index(xs_stildb_t *);
+int xs_stildb_read(xs_stildb_t *, const char *);
 void xs_stildb_free(xs_stildb_t *);
-stil_node_t *xs_stildb_get_node(xs_stildb_t *, char *);
+const stil_node_t *xs_stildb_get_node(xs_stildb_t *, const char *);
+int xs_stildb_get_subtune(xs_stildb_t *, const stil_node_t *, int, stil_subnode_t *);
 
 #endif /* XS_STIL_H */
@@ -27,10 +27,15 @@
 #include <string.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
+
+#include <libaudcore/runtime.h>
 
 #define WANT_AUD_BSWAP
 #include <libaudcore/audio.h>
 
+#include "xmms-sid.h"
+
 uint16_t xs_fread_be16(VFSFile *f)
 {
     uint16_t val;
@@ -107,3 +112,103 @@ void xs_findnum(const char *str, size_t *pos)
         (*pos)++;
 }
 
+
+
+/* Index files start with this header; if any of it differs from the text
+ * file currently configured, the index is regenerated.
+ */
+typedef struct {
+    char magic[8];
+    int64_t srcTime;
+    int64_t srcSize;
+    uint32_t srcHash;       /* Hash of the text file's path */
+    uint32_t reserved;
+} xs_index_header_t;
+
+
+static bool_t xs_index_use(xs_index_t *idx, GMappedFile *mapped, const xs_index_header_t *header)
+{
+    const char *contents = g_mapped_file_get_contents(mapped);
+    size_t size = g_mapped_file_get_length(mapped);
+
+    if (size < sizeof *header || memcmp(contents, header, sizeof *header))
+        return FALSE;
+
+    idx->mapped = mapped;
+    idx->data = contents + sizeof *header;
+    idx->size = size - sizeof *header;
+    return TRUE;
+}
+
+
+int xs_index_open(xs_index_t *idx, const char *name, const char *magic,
+    const char *srcFilename, xs_index_build_t build)
+{
+    xs_index_header_t header;
+    GStatBuf st;
+    GMappedFile *mapped;
+    GByteArray *out;
+    char *path;
+
+    memset(idx, 0, sizeof *idx);
+
+    if (g_stat(srcFilename, &st) != 0) {
+        xs_error("Could not open '%s'\n", srcFilename);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof header);
+    strncpy(header.magic, magic, sizeof header.magic);
+    header.srcTime = st.st_mtime;
+    header.srcSize = st.st_size;
+    header.srcHash = g_str_hash(srcFilename);
+
+    path = g_build_filename(aud_get_path(AUD_PATH_USER_DIR), name, NULL);
+
+    /* Use the cached index if it is up to date */
+    if ((mapped = g_mapped_file_new(path, FALSE, NULL)) != NULL) {
+        if (xs_index_use(idx, mapped, &header)) {
+            g_free(path);
+            return 0;
+        }
+        g_mapped_file_unref(mapped);
+    }
+
+    /* Otherwise generate it again */
+    out = g_byte_array_new();
+    g_byte_array_append(out, (const guint8 *) &header, sizeof header);
+
+    if (build(srcFilename, out) != 0) {
+        g_byte_array_free(out, TRUE);
+        g_free(path);
+        return -1;
+    }
+
+    if (g_file_set_contents(path, (const char *) out->data, out->len, NULL) &&
+     (mapped = g_mapped_file_new(path, FALSE, NULL)) != NULL) {
+        if (xs_index_use(idx, mapped, &header)) {
+            g_byte_array_free(out, TRUE);
+            g_free(path);
+            return 0;
+        }
+        g_mapped_file_unref(mapped);
+    }
+
+    /* Could not save it, so keep it in memory */
+    xs_error("Could not save index '%s'\n", path);
+    idx->size = out->len - sizeof header;
+    idx->buffer = (char *) g_byte_array_free(out, FALSE);
+    idx->data = idx->buffer + sizeof header;
+
+    g_free(path);
+    return 0;
+}
+
+
+void xs_index_close(xs_index_t *idx)
+{
+    if (idx->mapped)
+        g_mapped_file_unref(idx->mapped);
+    g_free(idx->buffer);
+    memset(idx, 0, sizeof *idx);
+}
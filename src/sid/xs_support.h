@@ -2,6 +2,7 @@
 #define XS_SUPPORT_H
 
 #include <sys/types.h>
+#include <glib.h>
 #include <libaudcore/vfs.h>
 
 /* VFS replacement functions
@@ -18,4 +19,22 @@ void xs_findnext(const char *, size_t *);
 void xs_findeol(const char *, size_t *);
 void xs_findnum(const char *, size_t *);
 
+
+/* Binary index of a text database, cached in the user directory and
+ * memory-mapped. It is regenerated whenever the text file changes.
+ */
+typedef struct {
+    GMappedFile *mapped;
+    char *buffer;           /* Used instead if the index could not be saved */
+    const char *data;       /* Contents, after the header */
+    size_t size;
+} xs_index_t;
+
+/* Appends the index contents generated from the given text file */
+typedef int (* xs_index_build_t) (const char *, GByteArray *);
+
+int xs_index_open(xs_index_t *, const char *name, const char *magic,
+    const char *srcFilename, xs_index_build_t);
+void xs_index_close(xs_index_t *);
+
 #endif /* XS_SUPPORT_H */
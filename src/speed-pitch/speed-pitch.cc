@@ -23,6 +23,10 @@
 
 #include <glib.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include <samplerate.h>
 
 #include <libaudcore/i18n.h>
@@ -34,13 +38,18 @@
  * into pieces, spaced at a time interval A, using a cosine-shaped window
  * function.  The pieces are then reassembled by adding them together again,
  * spaced at another time interval B.  By varying the ratio A:B, we change the
- * speed of the audio.  To get better results at the two ends of a song, we add
- * a short period of silence (half the width of the cosine window, to be exact)
- * to each end of the input signal beforehand and afterwards trim the same
- * amount from each end of the output signal. */
-
-#define FREQ    10
-#define OVERLAP  3
+ * speed of the audio.
+ *
+ * To avoid the phase cancellation ("roughness") that comes from adding
+ * unrelated pieces together, each piece may be moved up to a certain distance
+ * from its nominal position (WSOLA).  The position chosen is the one where the
+ * piece best matches the natural continuation of the previous piece, measured
+ * by cross-correlation.
+ *
+ * To get better results at the two ends of a song, we add a short period of
+ * silence (half the width of the cosine window, to be exact) to each end of
+ * the input signal beforehand and afterwards trim the same amount from each
+ * end of the output signal. */
 
 #define CFGSECT "speed-pitch"
 #define MINSPEED 0.5
@@ -48,6 +57,9 @@
 #define MINPITCH 0.5
 #define MAXPITCH 2.0
 
+/* the search is done in steps of this many frames and then refined */
+#define SEARCH_STEP 4
+
 #define BYTES(frames) ((frames) * curchans * sizeof (float))
 #define OFFSET(buf,frames) ((buf) + (frames) * curchans)
 
@@ -56,20 +68,35 @@ typedef struct {
     int size, len;
 } Buffer;
 
+/* Window width and search distance in milliseconds; larger windows suit music
+ * better, smaller ones give less latency and suit speech. */
+static const struct {
+    int width, search, converter;
+} quality_table[] = {
+    {20, 4, SRC_LINEAR},
+    {30, 8, SRC_SINC_FASTEST},
+    {50, 12, SRC_SINC_MEDIUM_QUALITY}
+};
+
 static int curchans, currate;
 static SRC_STATE * srcstate;
-static int outstep, width;
-static double * cosine;
+static int outstep, width, search;
+static float * window; /* one value per sample, not per frame */
 static Buffer in, out;
+static int inpos, prevpos;
+static bool_t have_prev;
 static int trim, written;
 static bool_t ending;
 
+static double speed, pitch;
+
 static void bufgrow (Buffer * b, int len)
 {
     if (len > b->size)
     {
-        b->mem = (float *) g_realloc (b->mem, BYTES (len));
-        b->size = len;
+        /* grow geometrically so that the buffers soon stop being reallocated */
+        b->size = MAX (len, b->size * 2);
+        b->mem = (float *) g_realloc (b->mem, BYTES (b->size));
     }
 
     if (len > b->len)
@@ -79,33 +106,159 @@ static void bufgrow (Buffer * b, int len)
     }
 }
 
+/* Only the overlap with the next call remains after a cut, which is at most a
+ * window and a search distance, so this does not move much memory. */
 static void bufcut (Buffer * b, int len)
 {
     memmove (b->mem, OFFSET (b->mem, len), BYTES (b->len - len));
     b->len -= len;
 }
 
-static void bufadd (Buffer * b, float * data, int len, double ratio)
+static void bufadd (Buffer * b, float * data, int len, double ratio, bool_t end)
 {
-    int oldlen = b->len;
-    int max = len * ratio + 100;
-    bufgrow (b, oldlen + max);
+    int pos = b->len;
+
+    if (ratio == 1)
+    {
+        bufgrow (b, pos + len);
+        memcpy (OFFSET (b->mem, pos), data, BYTES (len));
+        return;
+    }
 
     SRC_DATA d;
 
-    d.data_in = data;
-    d.input_frames = len;
-    d.data_out = OFFSET (b->mem, oldlen);
-    d.output_frames = max;
     d.src_ratio = ratio;
+    d.end_of_input = end;
+
+    /* At the end of input, the converter also gives back what is left in its
+     * delay line, which may take more than one call. */
+    do
+    {
+        int max = len * ratio + 100;
+        bufgrow (b, pos + max);
+
+        d.data_in = data;
+        d.input_frames = len;
+        d.data_out = OFFSET (b->mem, pos);
+        d.output_frames = max;
+
+        if (src_process (srcstate, & d))
+            break;
+
+        pos += d.output_frames_gen;
+        data = OFFSET (data, d.input_frames_used);
+        len -= d.input_frames_used;
+    }
+    while (end && (d.input_frames_used || d.output_frames_gen));
+
+    b->len = pos;
+
+    if (end)
+        src_reset (srcstate);
+}
+
+/* computes the dot products of x with itself and with y */
+static void correlate (const float * x, const float * y, int len, float * xy, float * xx)
+{
+    int i = 0;
+
+#ifdef __SSE__
+    __m128 sxy = _mm_setzero_ps (), sxx = _mm_setzero_ps ();
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps (x + i);
+        sxy = _mm_add_ps (sxy, _mm_mul_ps (vx, _mm_loadu_ps (y + i)));
+        sxx = _mm_add_ps (sxx, _mm_mul_ps (vx, vx));
+    }
+
+    float txy[4], txx[4];
+    _mm_storeu_ps (txy, sxy);
+    _mm_storeu_ps (txx, sxx);
+
+    * xy = txy[0] + txy[1] + txy[2] + txy[3];
+    * xx = txx[0] + txx[1] + txx[2] + txx[3];
+#else
+    * xy = * xx = 0;
+#endif
+
+    for (; i < len; i ++)
+    {
+        * xy += x[i] * y[i];
+        * xx += x[i] * x[i];
+    }
+}
+
+static float match_score (int pos, const float * ref)
+{
+    float xy, xx;
+    correlate (OFFSET (in.mem, pos), ref, outstep * curchans, & xy, & xx);
+
+    /* normalized so that loud passages are not preferred */
+    return xy / sqrtf (xx + 1e-9f);
+}
+
+/* Returns the position within search distance of nominal where a piece of
+ * input best continues the piece previously taken from prevpos. */
+static int find_match (int nominal)
+{
+    const float * ref = OFFSET (in.mem, prevpos + outstep);
+    int lo = MAX (nominal - search, 0);
+    int hi = nominal + search;
+
+    int best = nominal;
+    float best_score = match_score (nominal, ref);
 
-    src_process (srcstate, & d);
-    b->len = oldlen + d.output_frames_gen;
+    for (int pos = lo; pos <= hi; pos += SEARCH_STEP)
+    {
+        float score = match_score (pos, ref);
+
+        if (score > best_score)
+        {
+            best = pos;
+            best_score = score;
+        }
+    }
+
+    int center = best;
+
+    for (int pos = MAX (center - SEARCH_STEP + 1, lo);
+     pos <= MIN (center + SEARCH_STEP - 1, hi); pos ++)
+    {
+        float score = match_score (pos, ref);
+
+        if (score > best_score)
+        {
+            best = pos;
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
+static void overlap_add (float * dest, const float * src)
+{
+    int len = width * curchans;
+    int i = 0;
+
+#ifdef __SSE__
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 sum = _mm_add_ps (_mm_loadu_ps (dest + i),
+         _mm_mul_ps (_mm_loadu_ps (src + i), _mm_loadu_ps (window + i)));
+        _mm_storeu_ps (dest + i, sum);
+    }
+#endif
+
+    for (; i < len; i ++)
+        dest[i] += src[i] * window[i];
 }
 
 static void speed_flush (void)
 {
-    src_reset (srcstate);
+    if (srcstate)
+        src_reset (srcstate);
 
     in.len = 0;
     out.len = 0;
@@ -113,6 +266,9 @@ static void speed_flush (void)
     /* Add silence to the beginning of the input signal. */
     bufgrow (& in, width / 2);
 
+    inpos = 0;
+    prevpos = 0;
+    have_prev = FALSE;
     trim = width / 2;
     written = 0;
     ending = FALSE;
@@ -123,62 +279,94 @@ static void speed_start (int * chans, int * rate)
     curchans = * chans;
     currate = * rate;
 
+    int quality = CLAMP (aud_get_int (CFGSECT, "quality"), 0, (int) ARRAY_LEN (quality_table) - 1);
+
     if (srcstate)
         src_delete (srcstate);
 
-    srcstate = src_new (SRC_LINEAR, curchans, NULL);
+    srcstate = src_new (quality_table[quality].converter, curchans, NULL);
 
-    /* Calculate the width of the cosine window and the spacing interval for
-     * output. */
-    outstep = currate / FREQ;
-    width = outstep * OVERLAP;
+    /* Calculate the width of the cosine window, the spacing interval for
+     * output, and the search distance. */
+    outstep = currate * quality_table[quality].width / 2000;
+    width = outstep * 2;
+    search = currate * quality_table[quality].search / 1000;
 
-    /* Generate the cosine window, scaled vertically to compensate for the
-     * overlap of the reassembled pieces of audio. */
-    cosine = g_renew (double, cosine, width);
+    /* Generate the cosine window.  With the pieces overlapping by half, the
+     * windows add up to exactly one. */
+    window = g_renew (float, window, width * curchans);
     for (int i = 0; i < width; i ++)
-        cosine[i] = (1.0 - cos (2.0 * M_PI * i / width)) / OVERLAP;
+    for (int c = 0; c < curchans; c ++)
+        window[i * curchans + c] = 0.5f - 0.5f * cosf (2 * (float) M_PI * i / width);
+
+    /* the buffers hold about a second; they grow if more is passed at once */
+    bufgrow (& in, currate);
+    bufgrow (& out, currate);
 
     speed_flush ();
 }
 
 static void speed_process (float * * data, int * samples)
 {
-    double pitch = aud_get_double (CFGSECT, "pitch");
-    double speed = aud_get_double (CFGSECT, "speed");
+    /* read every time, since the settings may be changed from anywhere */
+    pitch = aud_get_double (CFGSECT, "pitch");
+    speed = aud_get_double (CFGSECT, "speed");
 
     /* Remove audio that has already been played from the output buffer. */
     bufcut (& out, written);
 
-    /* Copy the passed audio to the input buffer, scaled to adjust pitch. */
-    bufadd (& in, * data, * samples / curchans, 1.0 / pitch);
-
-    /* If we are ending, add silence to the end of the input signal. */
-    if (ending)
-        bufgrow (& in, in.len + width / 2);
+    /* Copy the passed audio to the input buffer, scaled to adjust pitch.  If
+     * we are ending, the converter is drained as well. */
+    bufadd (& in, * data, * samples / curchans, 1.0 / pitch, ending);
 
     /* Calculate the spacing interval for input. */
     int instep = round (outstep * speed / pitch);
 
+    /* If we are ending, add enough silence to the end of the input signal that
+     * all of the real input gets processed. */
+    int end = in.len;
+
+    if (ending)
+        bufgrow (& in, in.len + search + MAX (width, instep));
+
     /* Run the speed change algorithm. */
-    int src = 0;
     int dst = 0;
 
-    while (src + MAX (width, instep) <= in.len)
+    while (inpos + search + MAX (width, instep) <= in.len)
     {
-        bufgrow (& out, dst + width);
-        out.len = dst + width;
+        int pos = have_prev ? find_match (inpos) : inpos;
 
-        for (int i = 0; i < width; i ++)
-        for (int c = 0; c < curchans; c ++)
-            OFFSET (out.mem, dst + i)[c] += OFFSET (in.mem, src + i)[c] * cosine[i];
+        bufgrow (& out, dst + width);
+        overlap_add (OFFSET (out.mem, dst), OFFSET (in.mem, pos));
 
-        src += instep;
+        prevpos = pos;
+        have_prev = TRUE;
+        inpos += instep;
         dst += outstep;
     }
 
-    /* Remove processed audio from the input buffer. */
-    bufcut (& in, src);
+    /* If we are ending, find where the real input ends in the output.  Input
+     * at the center of a piece is output at the center of the piece. */
+    if (ending)
+    {
+        int center = dst + width / 2;
+        dst = center + (int64_t) (end - inpos - width / 2) * outstep / instep;
+        dst = CLAMP (dst, 0, out.len);
+    }
+
+    /* Remove processed audio from the input buffer, keeping what the next
+     * search may still look at. */
+    int cut = inpos - search;
+
+    if (have_prev)
+        cut = MIN (cut, prevpos + outstep);
+
+    if (cut > 0)
+    {
+        bufcut (& in, cut);
+        inpos -= cut;
+        prevpos -= cut;
+    }
 
     /* Trim silence from the beginning of the output buffer. */
     if (trim > 0)
@@ -189,11 +377,6 @@ static void speed_process (float * * data, int * samples)
         trim -= cut;
     }
 
-    /* If we are ending, return all of the output buffer except the silence that
-     * we trim from the end of it. */
-    if (ending)
-        dst = out.len - width / 2;
-
     /* Return processed audio in the output buffer and mark it to be removed on
      * the next call. */
     * data = out.mem;
@@ -215,15 +398,20 @@ static void speed_finish (float * * data, int * samples)
 static int speed_adjust_delay (int delay)
 {
     /* Not sample-accurate, but should be a decent estimate. */
-    double speed = aud_get_double (CFGSECT, "speed");
-    return delay * speed + width * 1000 / currate;
+    return delay * speed + (width + search) * 1000 / currate;
 }
 
 static const char * const speed_defaults[] = {
  "speed", "1",
  "pitch", "1",
+ "quality", "1",
  NULL};
 
+static const ComboBoxElements quality_list[] = {
+ {"0", N_("Low latency")},
+ {"1", N_("Normal")},
+ {"2", N_("High quality")}};
+
 static const PreferencesWidget speed_widgets[] = {
     WidgetLabel (N_("<b>Speed and Pitch</b>")),
     WidgetSpin (N_("Speed:"),
@@ -231,7 +419,10 @@ static const PreferencesWidget speed_widgets[] = {
         {MINSPEED, MAXSPEED, 0.05}),
     WidgetSpin (N_("Pitch:"),
         {VALUE_FLOAT, 0, CFGSECT, "pitch"},
-        {MINPITCH, MAXPITCH, 0.05})
+        {MINPITCH, MAXPITCH, 0.05}),
+    WidgetCombo (N_("Quality:"),
+        {VALUE_STRING, 0, CFGSECT, "quality"},
+        {quality_list, ARRAY_LEN (quality_list)})
 };
 
 static const PluginPreferences speed_prefs = {
@@ -252,16 +443,18 @@ static void speed_cleanup (void)
 
     srcstate = NULL;
 
-    g_free (cosine);
-    cosine = NULL;
+    g_free (window);
+    window = NULL;
 
     g_free (in.mem);
     in.mem = NULL;
     in.size = 0;
+    in.len = 0;
 
     g_free (out.mem);
     out.mem = NULL;
     out.size = 0;
+    out.len = 0;
 }
 
 #define AUD_PLUGIN_NAME        N_("Speed and Pitch")
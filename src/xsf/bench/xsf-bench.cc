@@ -0,0 +1,224 @@
+/*
+	Audio Overload SDK - main driver.  for demonstration only, not user friendly!
+
+	Copyright (c) 2007-2008 R. Belmont and Richard Bannister.
+
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+	* Neither the names of R. Belmont and Richard Bannister nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+	CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+	EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+	PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+	PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+	LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+	NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+	SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Benchmark for the 2SF emulator.  Each file is rendered for its tagged length
+ * and fade (two minutes if it has none, or the time given with -s) without any
+ * output, and the speed is printed as emulated seconds per wall second, along
+ * with a checksum of the samples so that two builds can be compared.  With -j,
+ * that many files are rendered at once, each by its own emulator.
+ *
+ * usage: xsf-bench [-j threads] [-s seconds] file.2sf ... */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <zlib.h>
+
+#include "ao.h"
+#include "corlett.h"
+#include "vio2sf.h"
+
+/* same steps as in playback */
+#define RATE 44100
+#define SEGMENT (RATE / 60)
+
+#define DEFAULT_SECONDS 120
+
+typedef struct {
+	const char *filename;
+	int ms;
+	double seconds;
+	double elapsed;
+	uLong crc;
+	int ok;
+} Job;
+
+static Job *jobs;
+static int job_count, next_job;
+static int fixed_ms;
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* xsf_get_lib: called to load secondary files */
+int xsf_get_lib(const char *libdir, char *filename, void **buffer, unsigned int *length)
+{
+	char *path = g_build_filename(libdir, filename, NULL);
+	gchar *contents;
+	gsize size;
+	int ok = g_file_get_contents(path, &contents, &size, NULL);
+
+	g_free(path);
+
+	if (!ok)
+		return AO_FAIL;
+
+	*buffer = contents;
+	*length = size;
+
+	return AO_SUCCESS;
+}
+
+static void render(Job *job)
+{
+	gchar *buffer;
+	gsize size;
+	corlett_t *c;
+
+	if (!g_file_get_contents(job->filename, &buffer, &size, NULL))
+		return;
+
+	job->ms = fixed_ms;
+
+	if (!job->ms)
+	{
+		job->ms = DEFAULT_SECONDS * 1000;
+
+		if (corlett_decode((uint8_t *) buffer, size, NULL, NULL, &c) == AO_SUCCESS)
+		{
+			if (c->inf_length[0])
+				job->ms = psfTimeToMS(c->inf_length) + psfTimeToMS(c->inf_fade);
+			free(c);
+		}
+	}
+
+	char *libdir = g_path_get_dirname(job->filename);
+	int16_t samples[SEGMENT * 2];
+	int steps = ((int64_t) job->ms * RATE + SEGMENT * 1000 - 1) / (SEGMENT * 1000);
+	double start = now();
+
+	xsf_emu *emu = xsf_start(buffer, size, libdir);
+
+	if (emu)
+	{
+		job->crc = crc32(0, Z_NULL, 0);
+
+		for (int step = 0; step < steps; step++)
+		{
+			xsf_gen(emu, samples, SEGMENT);
+			job->crc = crc32(job->crc, (const Bytef *) samples, sizeof samples);
+		}
+
+		xsf_term(emu);
+
+		job->elapsed = now() - start;
+		job->seconds = (double) steps * SEGMENT / RATE;
+		job->ok = 1;
+	}
+
+	g_free(libdir);
+	g_free(buffer);
+}
+
+static void *worker(void *unused)
+{
+	while (1)
+	{
+		pthread_mutex_lock(&job_mutex);
+		int i = next_job++;
+		pthread_mutex_unlock(&job_mutex);
+
+		if (i >= job_count)
+			return NULL;
+
+		render(&jobs[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int threads = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:s:")) != -1)
+	{
+		if (opt == 'j')
+			threads = atoi(optarg);
+		else if (opt == 's')
+			fixed_ms = atof(optarg) * 1000;
+		else
+			threads = 0;
+	}
+
+	if (threads < 1 || fixed_ms < 0 || optind >= argc)
+	{
+		fprintf(stderr, "usage: %s [-j threads] [-s seconds] file.2sf ...\n", argv[0]);
+		return 1;
+	}
+
+	job_count = argc - optind;
+	jobs = (Job *) calloc(job_count, sizeof(Job));
+
+	for (int i = 0; i < job_count; i++)
+		jobs[i].filename = argv[optind + i];
+
+	threads = MIN(threads, job_count);
+	pthread_t *handles = (pthread_t *) malloc(threads * sizeof(pthread_t));
+	double start = now();
+
+	for (int i = 0; i < threads; i++)
+		pthread_create(&handles[i], NULL, worker, NULL);
+	for (int i = 0; i < threads; i++)
+		pthread_join(handles[i], NULL);
+
+	double elapsed = now() - start;
+	double seconds = 0;
+	int failures = 0;
+
+	for (int i = 0; i < job_count; i++)
+	{
+		Job *job = &jobs[i];
+
+		if (!job->ok)
+		{
+			printf("%s: cannot play\n", job->filename);
+			failures++;
+			continue;
+		}
+
+		printf("%s: %.1f s in %.2f s, %.2f x realtime, crc32 %08lx\n", job->filename,
+		 job->seconds, job->elapsed, job->seconds / job->elapsed, (unsigned long) job->crc);
+		seconds += job->seconds;
+	}
+
+	printf("total: %.1f s in %.2f s with %d thread%s, %.2f x realtime\n", seconds,
+	 elapsed, threads, threads == 1 ? "" : "s", seconds / elapsed);
+
+	free(handles);
+	free(jobs);
+
+	return failures ? 1 : 0;
+}
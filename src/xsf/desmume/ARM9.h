@@ -28,6 +28,4 @@ typedef struct {
   u8 *blank_memory[0x20000];
 } ARM9_struct;
 
-extern ARM9_struct ARM9Mem;
-
 #endif
@@ -45,11 +45,7 @@
 #include <assert.h>
 #include "MMU.h"
 #include "GPU.h"
-
-ARM9_struct ARM9Mem;
-
-NDS_Screen MainScreen;
-NDS_Screen SubScreen;
+#include "NDSSystem.h"
 
 //#define DEBUG_TRI
 
@@ -719,15 +719,10 @@ typedef struct {
 	u16 offset;
 } NDS_Screen;
 
-extern NDS_Screen MainScreen;
-extern NDS_Screen SubScreen;
-
 int Screen_Init(int coreid);
 void Screen_Reset(void);
 void Screen_DeInit(void);
 
-extern MMU_struct MMU;
-
 
 
 #define GFXCORE_DEFAULT		 -1
@@ -119,33 +119,37 @@ char szRomBaseName[512];
 #define DUP8(x)  x, x, x, x,  x, x, x, x
 #define DUP16(x) x, x, x, x,  x, x, x, x,  x, x, x, x,  x, x, x, x
 
-MMU_struct MMU;
-
-u8 * MMU_ARM9_MEM_MAP[256]={
-/* 0X*/	DUP16(ARM9Mem.ARM9_ITCM),
-/* 1X*/	//DUP16(ARM9Mem.ARM9_ITCM)
-/* 1X*/	DUP16(ARM9Mem.ARM9_WRAM),
-/* 2X*/	DUP16(ARM9Mem.MAIN_MEM),
-/* 3X*/	DUP16(MMU.SWIRAM),
-/* 4X*/	DUP16(ARM9Mem.ARM9_REG),
-/* 5X*/	DUP16(ARM9Mem.ARM9_VMEM),
-/* 6X*/	DUP2(ARM9Mem.ARM9_ABG),
-		DUP2(ARM9Mem.ARM9_BBG),
-		DUP2(ARM9Mem.ARM9_AOBJ),
-		DUP2(ARM9Mem.ARM9_BOBJ),
-		DUP8(ARM9Mem.ARM9_LCD),
-/* 7X*/	DUP16(ARM9Mem.ARM9_OAM),
-/* 8X*/	DUP16(NULL),
-/* 9X*/	DUP16(NULL),
-/* AX*/	DUP16(MMU.CART_RAM),
-/* BX*/	DUP16(MMU.UNUSED_RAM),
-/* CX*/	DUP16(MMU.UNUSED_RAM),
-/* DX*/	DUP16(MMU.UNUSED_RAM),
-/* EX*/	DUP16(MMU.UNUSED_RAM),
-/* FX*/	DUP16(ARM9Mem.ARM9_BIOS)
+/* in the running instance, see NDS_state */
+#define MMU_ARM9_MEM_MAP (NDS_current->MMU_ARM9_MEM_MAP)
+#define MMU_ARM9_MEM_MASK (NDS_current->MMU_ARM9_MEM_MASK)
+#define MMU_ARM7_MEM_MAP (NDS_current->MMU_ARM7_MEM_MAP)
+#define MMU_ARM7_MEM_MASK (NDS_current->MMU_ARM7_MEM_MASK)
+#define SPI_CNT (NDS_current->SPI_CNT)
+#define SPI_CMD (NDS_current->SPI_CMD)
+#define AUX_SPI_CNT (NDS_current->AUX_SPI_CNT)
+#define AUX_SPI_CMD (NDS_current->AUX_SPI_CMD)
+#define rom_mask (NDS_current->rom_mask)
+#define DMASrc (NDS_current->DMASrc)
+#define DMADst (NDS_current->DMADst)
+#define partie (NDS_current->partie)
+
+u32 MMU_ARM9_WAIT16[16]={
+	1, 1, 1, 1, 1, 1, 1, 1, 5, 5, 5, 1, 1, 1, 1, 1,
+};
+
+u32 MMU_ARM9_WAIT32[16]={
+	1, 1, 1, 1, 1, 2, 2, 1, 8, 8, 5, 1, 1, 1, 1, 1,
+};
+
+u32 MMU_ARM7_WAIT16[16]={
+	1, 1, 1, 1, 1, 1, 1, 1, 5, 5, 5, 1, 1, 1, 1, 1,
+};
+
+u32 MMU_ARM7_WAIT32[16]={
+	1, 1, 1, 1, 1, 1, 1, 1, 8, 8, 5, 1, 1, 1, 1, 1,
 };
 
-u32 MMU_ARM9_MEM_MASK[256]={
+static const u32 arm9_mem_mask[256]={
 /* 0X*/	DUP16(0x00007FFF),
 /* 1X*/	//DUP16(0x00007FFF)
 /* 1X*/	DUP16(0x00FFFFFF),
@@ -169,28 +173,7 @@ u32 MMU_ARM9_MEM_MASK[256]={
 /* FX*/	DUP16(0x00007FFF)
 };
 
-u8 * MMU_ARM7_MEM_MAP[256]={
-/* 0X*/	DUP16(MMU.ARM7_BIOS),
-/* 1X*/	DUP16(MMU.UNUSED_RAM),
-/* 2X*/	DUP16(ARM9Mem.MAIN_MEM),
-/* 3X*/	DUP8(MMU.SWIRAM),
-		DUP8(MMU.ARM7_ERAM),
-/* 4X*/	DUP8(MMU.ARM7_REG),
-		DUP8(MMU.ARM7_WIRAM),
-/* 5X*/	DUP16(MMU.UNUSED_RAM),
-/* 6X*/	DUP16(ARM9Mem.ARM9_ABG),
-/* 7X*/	DUP16(MMU.UNUSED_RAM),
-/* 8X*/	DUP16(NULL),
-/* 9X*/	DUP16(NULL),
-/* AX*/	DUP16(MMU.CART_RAM),
-/* BX*/	DUP16(MMU.UNUSED_RAM),
-/* CX*/	DUP16(MMU.UNUSED_RAM),
-/* DX*/	DUP16(MMU.UNUSED_RAM),
-/* EX*/	DUP16(MMU.UNUSED_RAM),
-/* FX*/	DUP16(MMU.UNUSED_RAM)
-};
-
-u32 MMU_ARM7_MEM_MASK[256]={
+static const u32 arm7_mem_mask[256]={
 /* 0X*/	DUP16(0x00003FFF),
 /* 1X*/	DUP16(0x00000003),
 /* 2X*/	DUP16(0x003FFFFF),
@@ -211,29 +194,64 @@ u32 MMU_ARM7_MEM_MASK[256]={
 /* FX*/	DUP16(0x00000003)
 };
 
-u32 MMU_ARM9_WAIT16[16]={
-	1, 1, 1, 1, 1, 1, 1, 1, 5, 5, 5, 1, 1, 1, 1, 1,
-};
-
-u32 MMU_ARM9_WAIT32[16]={
-	1, 1, 1, 1, 1, 2, 2, 1, 8, 8, 5, 1, 1, 1, 1, 1,
-};
-
-u32 MMU_ARM7_WAIT16[16]={
-	1, 1, 1, 1, 1, 1, 1, 1, 5, 5, 5, 1, 1, 1, 1, 1,
-};
-
-u32 MMU_ARM7_WAIT32[16]={
-	1, 1, 1, 1, 1, 1, 1, 1, 8, 8, 5, 1, 1, 1, 1, 1,
-};
-
 void MMU_Init(void) {
 	int i;
 
+	/* the maps point into the memory of this instance */
+	u8 * arm9_mem_map[256]={
+	/* 0X*/	DUP16(ARM9Mem.ARM9_ITCM),
+	/* 1X*/	//DUP16(ARM9Mem.ARM9_ITCM)
+	/* 1X*/	DUP16(ARM9Mem.ARM9_WRAM),
+	/* 2X*/	DUP16(ARM9Mem.MAIN_MEM),
+	/* 3X*/	DUP16(MMU.SWIRAM),
+	/* 4X*/	DUP16(ARM9Mem.ARM9_REG),
+	/* 5X*/	DUP16(ARM9Mem.ARM9_VMEM),
+	/* 6X*/	DUP2(ARM9Mem.ARM9_ABG),
+			DUP2(ARM9Mem.ARM9_BBG),
+			DUP2(ARM9Mem.ARM9_AOBJ),
+			DUP2(ARM9Mem.ARM9_BOBJ),
+			DUP8(ARM9Mem.ARM9_LCD),
+	/* 7X*/	DUP16(ARM9Mem.ARM9_OAM),
+	/* 8X*/	DUP16(NULL),
+	/* 9X*/	DUP16(NULL),
+	/* AX*/	DUP16(MMU.CART_RAM),
+	/* BX*/	DUP16(MMU.UNUSED_RAM),
+	/* CX*/	DUP16(MMU.UNUSED_RAM),
+	/* DX*/	DUP16(MMU.UNUSED_RAM),
+	/* EX*/	DUP16(MMU.UNUSED_RAM),
+	/* FX*/	DUP16(ARM9Mem.ARM9_BIOS)
+	};
+
+	u8 * arm7_mem_map[256]={
+	/* 0X*/	DUP16(MMU.ARM7_BIOS),
+	/* 1X*/	DUP16(MMU.UNUSED_RAM),
+	/* 2X*/	DUP16(ARM9Mem.MAIN_MEM),
+	/* 3X*/	DUP8(MMU.SWIRAM),
+			DUP8(MMU.ARM7_ERAM),
+	/* 4X*/	DUP8(MMU.ARM7_REG),
+			DUP8(MMU.ARM7_WIRAM),
+	/* 5X*/	DUP16(MMU.UNUSED_RAM),
+	/* 6X*/	DUP16(ARM9Mem.ARM9_ABG),
+	/* 7X*/	DUP16(MMU.UNUSED_RAM),
+	/* 8X*/	DUP16(NULL),
+	/* 9X*/	DUP16(NULL),
+	/* AX*/	DUP16(MMU.CART_RAM),
+	/* BX*/	DUP16(MMU.UNUSED_RAM),
+	/* CX*/	DUP16(MMU.UNUSED_RAM),
+	/* DX*/	DUP16(MMU.UNUSED_RAM),
+	/* EX*/	DUP16(MMU.UNUSED_RAM),
+	/* FX*/	DUP16(MMU.UNUSED_RAM)
+	};
+
 	LOG("MMU init\n");
 
 	memset(&MMU, 0, sizeof(MMU_struct));
 
+	memcpy(MMU_ARM9_MEM_MAP, arm9_mem_map, sizeof arm9_mem_map);
+	memcpy(MMU_ARM9_MEM_MASK, arm9_mem_mask, sizeof arm9_mem_mask);
+	memcpy(MMU_ARM7_MEM_MAP, arm7_mem_map, sizeof arm7_mem_map);
+	memcpy(MMU_ARM7_MEM_MASK, arm7_mem_mask, sizeof arm7_mem_mask);
+
 	MMU.CART_ROM = MMU.UNUSED_RAM;
 
         for(i = 0x80; i<0xA0; ++i)
@@ -249,6 +267,8 @@ void MMU_Init(void) {
 
 	MMU.ITCMRegion = 0x00800000;
 
+	partie = 1;
+
 	MMU.MMU_WAIT16[0] = MMU_ARM9_WAIT16;
 	MMU.MMU_WAIT16[1] = MMU_ARM7_WAIT16;
 	MMU.MMU_WAIT32[0] = MMU_ARM9_WAIT32;
@@ -278,18 +298,6 @@ void MMU_DeInit(void) {
     mc_free(&MMU.bupmem);
 }
 
-//Card rom & ram
-
-u16 SPI_CNT = 0;
-u16 SPI_CMD = 0;
-u16 AUX_SPI_CNT = 0;
-u16 AUX_SPI_CMD = 0;
-
-u32 rom_mask = 0;
-
-u32 DMASrc[2][4] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
-u32 DMADst[2][4] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
-
 void MMU_clearMem()
 {
 	int i;
@@ -306,6 +314,7 @@ void MMU_clearMem()
 	memset(ARM9Mem.ARM9_VMEM, 0, 0x0800);
 	memset(ARM9Mem.ARM9_WRAM, 0, 0x01000000);
 	memset(ARM9Mem.MAIN_MEM,  0, 0x400000);
+	armcpu_flush_code();
 
 	memset(ARM9Mem.blank_memory,  0, 0x020000);
 
@@ -1260,10 +1269,31 @@ void FASTCALL MMU_write8(u32 proc, u32 adr, u8 val)
 			break;
 	}
 
+	if ((adr >> 24) == 2)
+		armcpu_invalidate_code(adr);
+
 	MMU.MMU_MEM[proc][(adr>>20)&0xFF][adr&MMU.MMU_MASK[proc][(adr>>20)&0xFF]]=val;
 }
 
-u16 partie = 1;
+
+/* The memory maps only change in MMU_setRom(), so everything else that changes
+ * while running is in MMU, ARM9Mem, the memory chips and the registers below. */
+void MMU_StateBlocks(state_block_func fn, void *user)
+{
+	fn(user, &MMU, sizeof MMU);
+	fn(user, &ARM9Mem, sizeof ARM9Mem);
+	fn(user, MMU.fw.data, MMU.fw.size);
+	fn(user, MMU.bupmem.data, MMU.bupmem.size);
+
+	fn(user, &SPI_CNT, sizeof SPI_CNT);
+	fn(user, &SPI_CMD, sizeof SPI_CMD);
+	fn(user, &AUX_SPI_CNT, sizeof AUX_SPI_CNT);
+	fn(user, &AUX_SPI_CMD, sizeof AUX_SPI_CMD);
+	fn(user, &rom_mask, sizeof rom_mask);
+	fn(user, DMASrc, sizeof DMASrc);
+	fn(user, DMADst, sizeof DMADst);
+	fn(user, &partie, sizeof partie);
+}
 
 void FASTCALL MMU_write16(u32 proc, u32 adr, u16 val)
 {
@@ -1884,6 +1914,10 @@ void FASTCALL MMU_write16(u32 proc, u32 adr, u16 val)
 				return;
 		}
 	}
+
+	if ((adr >> 24) == 2)
+		armcpu_invalidate_code(adr);
+
 	T1WriteWord(MMU.MMU_MEM[proc][(adr>>20)&0xFF], adr&MMU.MMU_MASK[proc][(adr>>20)&0xFF], val);
 }
 
@@ -2923,6 +2957,10 @@ void FASTCALL MMU_write32(u32 proc, u32 adr, u32 val)
 				return;
 		}
 	}
+
+	if ((adr >> 24) == 2)
+		armcpu_invalidate_code(adr);
+
 	T1WriteLong(MMU.MMU_MEM[proc][(adr>>20)&0xFF], adr&MMU.MMU_MASK[proc][(adr>>20)&0xFF], val);
 }
 
@@ -97,8 +97,6 @@ typedef struct {
 
 } MMU_struct;
 
-extern MMU_struct MMU;
-
 
 struct armcpu_memory_iface {
   /** the 32 bit instruction prefetch */
@@ -130,6 +128,8 @@ void MMU_DeInit(void);
 
 void MMU_clearMem( void);
 
+void MMU_StateBlocks(state_block_func fn, void *user);
+
 void MMU_setRom(u8 * rom, u32 mask);
 void MMU_unsetRom( void);
 
@@ -24,6 +24,7 @@
 
 #include "NDSSystem.h"
 #include "MMU.h"
+#include "cp15.h"
 //#include "cflash.h"
 
 //#include "ROMReader.h"
@@ -31,7 +32,7 @@
 /* the count of bytes copied from the firmware into memory */
 #define NDS_FW_USER_SETTINGS_MEM_BYTE_COUNT 0x70
 
-NDSSystem nds;
+THREAD_LOCAL NDS_state *NDS_current;
 
 static u32
 calc_CRC16( u32 start, const u8 *data, int count) {
@@ -186,6 +187,7 @@ void NDS_DeInit(void) {
 
 	armcpu_deinit(&NDS_ARM7);
 	armcpu_deinit(&NDS_ARM9);
+	armcpu_free_code();
 
      nds.nextHBlank = 3168;
      SPU_DeInit();
@@ -193,6 +195,20 @@ void NDS_DeInit(void) {
      MMU_DeInit();
 }
 
+void NDS_StateBlocks(state_block_func fn, void *user)
+{
+	fn(user, &nds, sizeof nds);
+	fn(user, &NDS_ARM7, sizeof NDS_ARM7);
+	fn(user, &NDS_ARM9, sizeof NDS_ARM9);
+	fn(user, NDS_ARM7.coproc[15], sizeof(armcp15_t));
+	fn(user, NDS_ARM9.coproc[15], sizeof(armcp15_t));
+	fn(user, MainScreen.gpu, sizeof(GPU));
+	fn(user, SubScreen.gpu, sizeof(GPU));
+
+	MMU_StateBlocks(fn, user);
+	SPU_StateBlocks(fn, user);
+}
+
 BOOL NDS_SetROM(u8 * rom, u32 mask)
 {
      MMU_setRom(rom, mask);
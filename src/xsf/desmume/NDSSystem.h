@@ -31,7 +31,6 @@
 #include "mem.h"
 //#include "wifi.h"
 
-extern volatile BOOL execute;
 extern BOOL click;
 
 /*
@@ -159,7 +158,97 @@ struct NDS_fw_config_data {
   struct NDS_fw_touchscreen_cal touch_cal[2];
 };
 
-extern NDSSystem nds;
+/* Everything the emulator changes as it runs, most of it emulated memory.  An
+ * instance starts out zeroed, and a thread selects the one it works on by
+ * setting NDS_current; only one thread may use an instance at a time.  The
+ * names below stand for members of the selected instance.  Members used by a
+ * single file have their names defined there. */
+typedef struct NDS_state
+{
+	NDSSystem nds;
+	volatile BOOL execute;
+
+	armcpu_t NDS_ARM7;
+	armcpu_t NDS_ARM9;
+
+	/* armcpu.cc: one bit per slot */
+	u8 code_valid[CODE_LINES];
+	decoded_t *code_lines[CODE_SLOTS][CODE_LINES];
+
+	MMU_struct MMU;
+	ARM9_struct ARM9Mem;
+
+	/* MMU.cc */
+	u8 * MMU_ARM9_MEM_MAP[256];
+	u32 MMU_ARM9_MEM_MASK[256];
+	u8 * MMU_ARM7_MEM_MAP[256];
+	u32 MMU_ARM7_MEM_MASK[256];
+	u16 SPI_CNT;
+	u16 SPI_CMD;
+	u16 AUX_SPI_CNT;
+	u16 AUX_SPI_CMD;
+	u32 rom_mask;
+	u32 DMASrc[2][4];
+	u32 DMADst[2][4];
+	u16 partie;
+
+	NDS_Screen MainScreen;
+	NDS_Screen SubScreen;
+
+	/* SPU.cc */
+	SPU_struct spu;
+	SoundInterface_struct *SNDCore;
+} NDS_state;
+
+extern THREAD_LOCAL NDS_state *NDS_current;
+
+#define nds (NDS_current->nds)
+#define execute (NDS_current->execute)
+#define NDS_ARM7 (NDS_current->NDS_ARM7)
+#define NDS_ARM9 (NDS_current->NDS_ARM9)
+#define MMU (NDS_current->MMU)
+#define ARM9Mem (NDS_current->ARM9Mem)
+#define MainScreen (NDS_current->MainScreen)
+#define SubScreen (NDS_current->SubScreen)
+
+static INLINE void NDS_makeARM9Int(u32 num)
+{
+        /* flag the interrupt request source */
+        MMU.reg_IF[0] |= (1<<num);
+
+        /* generate the interrupt if enabled */
+	if ((MMU.reg_IE[0] & (1 << num)) && MMU.reg_IME[0])
+	{
+		NDS_ARM9.wIRQ = TRUE;
+		NDS_ARM9.waitIRQ = FALSE;
+	}
+}
+
+static INLINE void NDS_makeARM7Int(u32 num)
+{
+        /* flag the interrupt request source */
+	MMU.reg_IF[1] |= (1<<num);
+
+        /* generate the interrupt if enabled */
+	if ((MMU.reg_IE[1] & (1 << num)) && MMU.reg_IME[1])
+	{
+		NDS_ARM7.wIRQ = TRUE;
+		NDS_ARM7.waitIRQ = FALSE;
+	}
+}
+
+static INLINE void NDS_makeInt(u8 proc_ID,u32 num)
+{
+	switch (proc_ID)
+	{
+		case 0:
+			NDS_makeARM9Int(num) ;
+			break ;
+		case 1:
+			NDS_makeARM7Int(num) ;
+			break ;
+	}
+}
 
 #ifdef GDB_STUB
 int NDS_Init( struct armcpu_memory_iface *arm9_mem_if,
@@ -171,6 +260,7 @@ int NDS_Init ( void);
 #endif
 
 void NDS_DeInit(void);
+void NDS_StateBlocks(state_block_func fn, void *user);
 void
 NDS_FillDefaultFirmwareConfigData( struct NDS_fw_config_data *fw_config);
 
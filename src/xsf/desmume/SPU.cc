@@ -28,6 +28,7 @@
 #include "mem.h"
 
 #include "armcpu.h"
+#include "NDSSystem.h"
 
 enum
 {
@@ -39,42 +40,9 @@ enum
 
 #define VOL_SHIFT 10
 
-typedef struct
-{
-	int id;
-	int status;
-	int format;
-	u8 *buf8; s16 *buf16;
-	double pos, inc;
-	int loopend, looppos;
-	int loop, length;
-	s32 adpcm;
-	int adpcm_pos, adpcm_index;
-	s32 adpcm_loop;
-	int adpcm_loop_pos, adpcm_loop_index;
-	int psg_duty;
-	int timer;
-	int volume;
-	int pan;
-	int shift;
-	int repeat, hold;
-	u32 addr;
-	s32 volumel;
-	s32 volumer;
-	s16 output;
-} SChannel;
-
-typedef struct
-{
-	s32 *pmixbuf;
-	s16 *pclipingbuf;
-	u32 buflen;
-	SChannel ch[16];
-} SPU_struct;
-
-static SPU_struct spu = { 0, 0, 0 };
-
-static SoundInterface_struct *SNDCore=NULL;
+/* in the running instance, see NDS_state */
+#define spu (NDS_current->spu)
+#define SNDCore (NDS_current->SNDCore)
 extern SoundInterface_struct *SNDCoreList[];
 
 int SPU_ChangeSoundCore(int coreid, int buffersize)
@@ -894,6 +862,12 @@ void SPU_EmulateSamples(u32 numsamples)
 	}
 }
 
+void SPU_StateBlocks(state_block_func fn, void *user)
+{
+	/* the mixing buffers are scratch space, refilled on every call */
+	fn(user, spu.ch, sizeof spu.ch);
+}
+
 void SPU_Emulate(void)
 {
 	SPU_EmulateSamples(SNDCore->GetAudioSpace());
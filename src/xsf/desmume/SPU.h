@@ -39,6 +39,39 @@ typedef struct
 } SoundInterface_struct;
 extern SoundInterface_struct SNDDummy;
 
+typedef struct
+{
+	int id;
+	int status;
+	int format;
+	u8 *buf8; s16 *buf16;
+	double pos, inc;
+	int loopend, looppos;
+	int loop, length;
+	s32 adpcm;
+	int adpcm_pos, adpcm_index;
+	s32 adpcm_loop;
+	int adpcm_loop_pos, adpcm_loop_index;
+	int psg_duty;
+	int timer;
+	int volume;
+	int pan;
+	int shift;
+	int repeat, hold;
+	u32 addr;
+	s32 volumel;
+	s32 volumer;
+	s16 output;
+} SChannel;
+
+typedef struct
+{
+	s32 *pmixbuf;
+	s16 *pclipingbuf;
+	u32 buflen;
+	SChannel ch[16];
+} SPU_struct;
+
 
 int SPU_ChangeSoundCore(int coreid, int buffersize);
 int SPU_Init(int coreid, int buffersize);
@@ -53,5 +86,6 @@ void SPU_WriteLong(u32 addr, u32 val);
 u32 SPU_ReadLong(u32 addr);
 void SPU_Emulate(void);
 void SPU_EmulateSamples(u32 numsamples);
+void SPU_StateBlocks(state_block_func fn, void *user);
 
 #endif
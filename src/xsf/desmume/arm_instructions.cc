@@ -25,6 +25,7 @@
 #include "cp15.h"
 #include "debug.h"
 #include "MMU.h"
+#include "NDSSystem.h"
 
 
 // Use this macros for reading/writing, so the GDB stub isn't broken
@@ -235,8 +236,6 @@
 
 #define IMM_OFF_12 ((i)&0xFFF)
 
-extern BOOL execute;
-
 static u32 FASTCALL  OP_UND(armcpu_t *cpu)
 {
 	LOG("Undefined instruction: %08X\n", cpu->instruction);
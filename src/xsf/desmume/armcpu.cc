@@ -23,8 +23,11 @@
 #include "thumb_instructions.h"
 #include "cp15.h"
 #include "bios.h"
+#include "mem.h"
+#include "NDSSystem.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 const unsigned char arm_cond_table[16*16] = {
     /* N=0, Z=0, C=0, V=0 */
@@ -77,9 +80,6 @@ const unsigned char arm_cond_table[16*16] = {
     0x00,0xFF,0xFF,0x00,0x00,0xFF,0xFF,0x20,
 };
 
-armcpu_t NDS_ARM7;
-armcpu_t NDS_ARM9;
-
 #define SWAP(a, b, c) do      \
 	              {       \
                          c=a; \
@@ -317,6 +317,112 @@ u32 armcpu_switchMode(armcpu_t *armcpu, u8 mode)
 	return oldmode;
 }
 
+/* Decoded instruction cache for main memory, where nearly all 2SF code runs.
+ * Each 256-byte line is decoded once per CPU and instruction set into the
+ * instruction words and their handlers, and stays valid until the MMU writes to
+ * it (armcpu_invalidate_code) or memory is replaced as a whole
+ * (armcpu_flush_code).  Fetches from anywhere else still go through the MMU. */
+
+#if !defined(GDB_STUB) && !defined(MMU_ENABLE_ACL)
+#define CODE_CACHE
+#endif
+
+/* in the running instance, see NDS_state */
+#define code_valid (NDS_current->code_valid)
+#define code_lines (NDS_current->code_lines)
+
+void armcpu_invalidate_code(u32 adr)
+{
+	code_valid[(adr & 0x3FFFFF) >> CODE_LINE_SHIFT] = 0;
+}
+
+void armcpu_flush_code(void)
+{
+	memset(code_valid, 0, sizeof code_valid);
+}
+
+void armcpu_free_code(void)
+{
+	int slot, line;
+	for (slot = 0; slot < CODE_SLOTS; slot++)
+	{
+		for (line = 0; line < CODE_LINES; line++)
+		{
+			free(code_lines[slot][line]);
+			code_lines[slot][line] = NULL;
+		}
+	}
+	armcpu_flush_code();
+}
+
+#ifdef CODE_CACHE
+static const decoded_t *decode_line(int slot, u32 line, BOOL thumb)
+{
+	decoded_t *d = code_lines[slot][line];
+	u32 base = line << CODE_LINE_SHIFT;
+	int i;
+
+	if (!d)
+	{
+		/* sized for thumb, which has twice the instructions per line */
+		d = (decoded_t *) malloc(sizeof(decoded_t) * (CODE_LINE_SIZE / 2));
+		if (!d)
+			return NULL;
+		code_lines[slot][line] = d;
+	}
+
+	if (!(code_valid[line] & (1 << slot)))
+	{
+		if (thumb)
+		{
+			for (i = 0; i < CODE_LINE_SIZE / 2; i++)
+			{
+				u32 instruction = T1ReadWord(ARM9Mem.MAIN_MEM, base + 2 * i);
+				d[i].instruction = instruction;
+				d[i].handler = thumb_instructions_set[instruction >> 6];
+			}
+		}
+		else
+		{
+			for (i = 0; i < CODE_LINE_SIZE / 4; i++)
+			{
+				u32 instruction = T1ReadLong(ARM9Mem.MAIN_MEM, base + 4 * i);
+				d[i].instruction = instruction;
+				d[i].handler = arm_instructions_set[INSTRUCTION_INDEX(instruction)];
+			}
+		}
+
+		code_valid[line] |= 1 << slot;
+	}
+
+	return d;
+}
+#endif
+
+/* Returns the decoded instruction at adr, or NULL if it has to be fetched
+ * through the MMU. */
+static INLINE const decoded_t *code_fetch(armcpu_t *armcpu, u32 adr, BOOL thumb)
+{
+#ifdef CODE_CACHE
+	const decoded_t *d;
+	u32 line;
+
+	if (((adr >> 24) & 0xF) != 0x2 || (adr & (thumb ? 1 : 3)))
+		return NULL;
+	if (armcpu->proc_ID == ARMCPU_ARM9 && (adr & ~0x3FFF) == MMU.DTCMRegion)
+		return NULL;
+
+	line = (adr & 0x3FFFFF) >> CODE_LINE_SHIFT;
+	d = decode_line(armcpu->proc_ID * 2 + thumb, line, thumb);
+	if (!d)
+		return NULL;
+
+	return d + ((adr & (CODE_LINE_SIZE - 1)) >> (thumb ? 1 : 2));
+#else
+	return NULL;
+#endif
+}
+
 u32 armcpu_prefetch(armcpu_t *armcpu)
 {
 #ifdef GDB_STUB
@@ -332,12 +438,23 @@ u32 armcpu_prefetch(armcpu_t *armcpu)
 
 		if ( !armcpu->stalled) {
 			armcpu->instruction = temp_instruction;
+			armcpu->handler = arm_instructions_set[INSTRUCTION_INDEX(temp_instruction)];
 			armcpu->instruct_adr = armcpu->next_instruction;
 			armcpu->next_instruction += 4;
 			armcpu->R[15] = armcpu->next_instruction + 4;
 		}
 #else
-		armcpu->instruction = MMU_read32_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
+		const decoded_t *d = code_fetch(armcpu, armcpu->next_instruction, FALSE);
+		if (d)
+		{
+			armcpu->instruction = d->instruction;
+			armcpu->handler = d->handler;
+		}
+		else
+		{
+			armcpu->instruction = MMU_read32_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
+			armcpu->handler = arm_instructions_set[INSTRUCTION_INDEX(armcpu->instruction)];
+		}
 
 		armcpu->instruct_adr = armcpu->next_instruction;
 		armcpu->next_instruction += 4;
@@ -354,12 +471,23 @@ u32 armcpu_prefetch(armcpu_t *armcpu)
 
 	if ( !armcpu->stalled) {
 		armcpu->instruction = temp_instruction;
+		armcpu->handler = thumb_instructions_set[temp_instruction >> 6];
 		armcpu->instruct_adr = armcpu->next_instruction;
 		armcpu->next_instruction = armcpu->next_instruction + 2;
 		armcpu->R[15] = armcpu->next_instruction + 2;
 	}
 #else
-	armcpu->instruction = MMU_read16_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
+	const decoded_t *d = code_fetch(armcpu, armcpu->next_instruction, TRUE);
+	if (d)
+	{
+		armcpu->instruction = d->instruction;
+		armcpu->handler = d->handler;
+	}
+	else
+	{
+		armcpu->instruction = MMU_read16_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
+		armcpu->handler = thumb_instructions_set[armcpu->instruction >> 6];
+	}
 
 	armcpu->instruct_adr = armcpu->next_instruction;
 	armcpu->next_instruction += 2;
@@ -458,7 +586,7 @@ u32 armcpu_exec(armcpu_t *armcpu)
 /*        if((TEST_COND(CONDITION(armcpu->instruction), armcpu->CPSR)) || ((CONDITION(armcpu->instruction)==0xF)&&(CODE(armcpu->instruction)==0x5)))*/
         if((TEST_COND(CONDITION(armcpu->instruction), CODE(armcpu->instruction), armcpu->CPSR)))
 		{
-			c += arm_instructions_set[INSTRUCTION_INDEX(armcpu->instruction)](armcpu);
+			c += armcpu->handler(armcpu);
 		}
 #ifdef GDB_STUB
         if ( armcpu->post_ex_fn != NULL) {
@@ -472,7 +600,7 @@ u32 armcpu_exec(armcpu_t *armcpu)
 		return c;
 	}
 
-	c += thumb_instructions_set[armcpu->instruction>>6](armcpu);
+	c += armcpu->handler(armcpu);
 
 #ifdef GDB_STUB
     if ( armcpu->post_ex_fn != NULL) {
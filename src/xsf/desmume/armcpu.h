@@ -197,6 +197,9 @@ typedef struct armcpu_t
 
         u32 (* *swi_tab)(struct armcpu_t * cpu);
 
+        /* handler for instruction, looked up when it was fetched */
+        u32 (FASTCALL *handler)(struct armcpu_t * cpu);
+
 #ifdef GDB_STUB
   /** there is a pending irq for the cpu */
   int irq_flag;
@@ -219,6 +222,18 @@ typedef struct armcpu_t
 #endif
 } armcpu_t;
 
+/* Decoded instruction cache for main memory, see armcpu.cc */
+#define CODE_LINE_SHIFT 8
+#define CODE_LINE_SIZE (1 << CODE_LINE_SHIFT)
+#define CODE_LINES (0x400000 >> CODE_LINE_SHIFT)
+#define CODE_SLOTS 4 /* ARM9, ARM9 thumb, ARM7, ARM7 thumb */
+
+typedef struct
+{
+	u32 instruction;
+	u32 (FASTCALL *handler)(armcpu_t * cpu);
+} decoded_t;
+
 #ifdef GDB_STUB
 int armcpu_new( armcpu_t *armcpu, u32 id, struct armcpu_memory_iface *mem_if,
                 struct armcpu_ctrl_iface **ctrl_iface_ret);
@@ -229,51 +244,12 @@ void armcpu_init(armcpu_t *armcpu, u32 adr);
 u32 armcpu_switchMode(armcpu_t *armcpu, u8 mode);
 u32 armcpu_prefetch(armcpu_t *armcpu);
 u32 armcpu_exec(armcpu_t *armcpu);
+void armcpu_invalidate_code(u32 adr);
+void armcpu_flush_code(void);
+void armcpu_free_code(void);
 BOOL armcpu_irqExeption(armcpu_t *armcpu);
 //BOOL armcpu_prefetchExeption(armcpu_t *armcpu);
 BOOL
 armcpu_flagIrq( armcpu_t *armcpu);
 
-extern armcpu_t NDS_ARM7;
-extern armcpu_t NDS_ARM9;
-
-static INLINE void NDS_makeARM9Int(u32 num)
-{
-        /* flag the interrupt request source */
-        MMU.reg_IF[0] |= (1<<num);
-
-        /* generate the interrupt if enabled */
-	if ((MMU.reg_IE[0] & (1 << num)) && MMU.reg_IME[0])
-	{
-		NDS_ARM9.wIRQ = TRUE;
-		NDS_ARM9.waitIRQ = FALSE;
-	}
-}
-
-static INLINE void NDS_makeARM7Int(u32 num)
-{
-        /* flag the interrupt request source */
-	MMU.reg_IF[1] |= (1<<num);
-
-        /* generate the interrupt if enabled */
-	if ((MMU.reg_IE[1] & (1 << num)) && MMU.reg_IME[1])
-	{
-		NDS_ARM7.wIRQ = TRUE;
-		NDS_ARM7.waitIRQ = FALSE;
-	}
-}
-
-static INLINE void NDS_makeInt(u8 proc_ID,u32 num)
-{
-	switch (proc_ID)
-	{
-		case 0:
-			NDS_makeARM9Int(num) ;
-			break ;
-		case 1:
-			NDS_makeARM7Int(num) ;
-			break ;
-	}
-}
-
 #endif
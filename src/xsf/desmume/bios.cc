@@ -24,8 +24,7 @@
 #include "MMU.h"
 #include "SPU.h"
 #include "debug.h"
-
-extern BOOL execute;
+#include "NDSSystem.h"
 
 static u16 getsinetbl[] = {
 0x0000, 0x0324, 0x0648, 0x096A, 0x0C8C, 0x0FAB, 0x12C8, 0x15E2, 
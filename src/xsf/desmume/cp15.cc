@@ -24,6 +24,7 @@
 #include "cp15.h"
 #include "debug.h"
 #include "MMU.h"
+#include "NDSSystem.h"
 
 armcp15_t *armcp15_new(armcpu_t * c)
 {
@@ -27,11 +27,10 @@
 #include "bios.h"
 #include "debug.h"
 #include "MMU.h"
+#include "NDSSystem.h"
 
 #define REG_NUM(i, n) (((i)>>n)&0x7)
 
-extern BOOL execute;
-
 // Use this macros for reading/writing, so the GDB stub isn't broken
 #ifdef GDB_STUB
 	#define READ32(a,b)		cpu->mem_if->read32(a,b)
@@ -38,6 +38,16 @@
 #endif
 #endif
 
+/* initial-exec keeps each access a single load, where the default model for a
+ * shared object calls into the dynamic linker */
+#ifndef THREAD_LOCAL
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#endif
+#endif
+
 #ifdef DESMUME_COCOA
 #ifdef __BIG_ENDIAN__
 #define WORDS_BIGENDIAN
@@ -85,6 +95,9 @@ typedef u32 uint32;
 #define uint32 u32 //uint32 is defined in Leopard somewhere, avoid conflicts
 #endif
 
+/* Called once for each block of memory making up the emulator state */
+typedef void (*state_block_func)(void *user, void *ptr, u32 size);
+
 /*---------- GPU3D fixed-points types -----------*/
 
 typedef s32 f32;
@@ -29,6 +29,7 @@
 #include <string.h>
 
 #include <libaudcore/i18n.h>
+#include <libaudcore/index.h>
 #include <libaudcore/input.h>
 #include <libaudcore/plugin.h>
 #include <libaudcore/audstrings.h>
@@ -38,14 +39,12 @@
 #include "vio2sf.h"
 
 /* xsf_get_lib: called to load secondary files */
-static String dirpath;
-
-int xsf_get_lib(char *filename, void **buffer, unsigned int *length)
+int xsf_get_lib(const char *libdir, char *filename, void **buffer, unsigned int *length)
 {
 	void *filebuf;
 	int64_t size;
 
-	StringBuf path = filename_build ({dirpath, filename});
+	StringBuf path = filename_build ({libdir, filename});
 	vfs_file_get_contents(path, &filebuf, &size);
 
 	*buffer = filebuf;
@@ -110,37 +109,117 @@ static int xsf_get_length(const char *filename)
 	return length;
 }
 
+/* Playback advances in whole steps of SEGMENT samples (16.666 ms).  Positions
+ * are counted in steps, and seek targets converted to steps, so that rounding
+ * errors cannot accumulate over a long track. */
+#define RATE 44100
+#define SEGMENT (RATE / 60)
+
+/* first step at or after the given time */
+static int ms_to_steps(int ms)
+{
+	return ((int64_t) ms * RATE + SEGMENT * 1000 - 1) / (SEGMENT * 1000);
+}
+
+/* Emulator snapshots taken during playback, so that a seek can resume from the
+ * closest earlier one instead of emulating from the beginning.  When the memory
+ * limit is reached, every other snapshot is dropped and the interval between
+ * them doubles. */
+#define SNAPSHOT_INTERVAL 300 /* steps, i.e. 5 seconds */
+#define SNAPSHOT_MEMORY (64 << 20) /* bytes */
+
+typedef struct {
+	int step;
+	xsf_state *state;
+} Snapshot;
+
+static Index<Snapshot> snapshots;
+static unsigned snapshot_bytes;
+static int snapshot_interval;
+
+static void snapshots_clear(void)
+{
+	for (Snapshot & s : snapshots)
+		xsf_free_state(s.state);
+
+	snapshots.clear();
+	snapshot_bytes = 0;
+	snapshot_interval = SNAPSHOT_INTERVAL;
+}
+
+static void snapshots_thin_out(void)
+{
+	int keep = (snapshots.len() + 1) / 2;
+
+	for (int i = 1; i < snapshots.len(); i++)
+	{
+		if (i % 2)
+		{
+			snapshot_bytes -= xsf_state_bytes(snapshots[i].state);
+			xsf_free_state(snapshots[i].state);
+		}
+		else
+			snapshots[i / 2] = snapshots[i];
+	}
+
+	snapshots.remove(keep, snapshots.len() - keep);
+	snapshot_interval *= 2;
+}
+
+static void snapshots_update(xsf_emu *emu, int step)
+{
+	int count = snapshots.len();
+	if (count && step < snapshots[count - 1].step + snapshot_interval)
+		return;
+
+	xsf_state *state = xsf_save_state(emu);
+	if (!state)
+		return;
+
+	Snapshot & snapshot = snapshots.append ();
+	snapshot.step = step;
+	snapshot.state = state;
+	snapshot_bytes += xsf_state_bytes(state);
+
+	if (snapshot_bytes > SNAPSHOT_MEMORY && snapshots.len() > 2)
+		snapshots_thin_out();
+}
+
 static bool_t xsf_play(const char * filename, VFSFile * file)
 {
 	void *buffer;
 	int64_t size;
 	int length = xsf_get_length(filename);
-	int16_t samples[44100*2];
-	int seglen = 44100 / 60;
-	float pos;
+	int16_t samples[SEGMENT * 2];
+	int step = 0;
 	bool_t error = FALSE;
+	xsf_emu *emu;
 
 	const char * slash = strrchr (filename, '/');
 	if (! slash)
 		return FALSE;
 
-	dirpath = String (str_copy (filename, slash + 1 - filename));
+	String dirpath = String (str_copy (filename, slash + 1 - filename));
 
 	vfs_file_get_contents (filename, & buffer, & size);
 
-	if (xsf_start(buffer, size) != AO_SUCCESS)
+	emu = xsf_start(buffer, size, dirpath);
+	if (!emu)
 	{
 		error = TRUE;
 		goto ERR_NO_CLOSE;
 	}
 
-	if (!aud_input_open_audio(FMT_S16_NE, 44100, 2))
+	if (!aud_input_open_audio(FMT_S16_NE, RATE, 2))
 	{
 		error = TRUE;
-		goto ERR_NO_CLOSE;
+		goto CLEANUP;
 	}
 
-	aud_input_set_bitrate(44100*2*2*8);
+	aud_input_set_bitrate(RATE*2*2*8);
+
+	snapshots_clear();
+	snapshots_update(emu, step);
 
 	while (! aud_input_check_stop ())
 	{
@@ -148,49 +227,55 @@ static bool_t xsf_play(const char * filename, VFSFile * file)
 
 		if (seek_value >= 0)
 		{
-			if (seek_value > aud_input_written_time ())
-			{
-				pos = aud_input_written_time ();
+			int target = ms_to_steps(seek_value);
 
-				while (pos < seek_value)
-				{
-					xsf_gen(samples, seglen);
-					pos += 16.666;
-				}
+			/* latest snapshot at or before the target */
+			int i = snapshots.len();
+			while (i > 0 && snapshots[i - 1].step > target)
+				i--;
+
+			if (i > 0 && (target < step || snapshots[i - 1].step > step))
+			{
+				xsf_load_state(emu, snapshots[i - 1].state);
+				step = snapshots[i - 1].step;
 			}
-			else if (seek_value < aud_input_written_time ())
+			else if (target < step)
 			{
-				xsf_term();
+				snapshots_clear();
+				xsf_term(emu);
 
-				if (xsf_start(buffer, size) == AO_SUCCESS)
-				{
-					pos = 0;
-					while (pos < seek_value)
-					{
-						xsf_gen(samples, seglen);
-						pos += 16.666; /* each segment is 16.666ms */
-					}
-				}
-			   	else
+				emu = xsf_start(buffer, size, dirpath);
+				if (!emu)
 				{
 					error = TRUE;
-					goto CLEANUP;
+					goto ERR_NO_CLOSE;
 				}
+
+				step = 0;
+			}
+
+			while (step < target)
+			{
+				xsf_gen(emu, samples, SEGMENT);
+				step++;
+				snapshots_update(emu, step);
 			}
 		}
 
-		xsf_gen(samples, seglen);
-		aud_input_write_audio((uint8_t *)samples, seglen * 4);
+		xsf_gen(emu, samples, SEGMENT);
+		aud_input_write_audio((uint8_t *)samples, SEGMENT * 4);
+		step++;
+		snapshots_update(emu, step);
 
 		if (aud_input_written_time() >= length)
 			goto CLEANUP;
 	}
 
 CLEANUP:
-	xsf_term();
+	snapshots_clear();
+	xsf_term(emu);
 
 ERR_NO_CLOSE:
-	dirpath = String ();
 	free(buffer);
 
 	return !error;
@@ -14,16 +14,58 @@
 #include "tagget.h"
 #include "vio2sf.h"
 
-volatile BOOL execute = FALSE;
-
-static struct
+typedef struct
 {
+	const char *libdir;
 	unsigned char *rom;
 	unsigned char *state;
 	unsigned romsize;
 	unsigned statesize;
 	unsigned stateptr;
-} loaderwork = {0, 0, 0, 0, 0};
+} loaderwork_t;
+
+typedef struct
+{
+	unsigned char *pcmbufalloc;
+	unsigned char *pcmbuftop;
+	unsigned filled;
+	unsigned used;
+	u32 bufferbytes;
+	u32 cycles;
+	int xfs_load;
+	int sync_type;
+	int arm7_clockdown_level;
+	int arm9_clockdown_level;
+} sndifwork_t;
+
+typedef struct
+{
+	u8 *ptr;
+	unsigned size;
+} state_page;
+
+typedef struct
+{
+	state_page *pages;
+	unsigned count;
+	unsigned alloc;
+	xsf_state *base;
+} statework_t;
+
+struct xsf_emu
+{
+	/* first, so that the sound interface can reach the rest from NDS_current */
+	NDS_state core;
+	loaderwork_t loaderwork;
+	sndifwork_t sndifwork;
+	statework_t statework;
+};
+
+/* in the running track; the public functions select it */
+#define EMU ((xsf_emu *) NDS_current)
+#define loaderwork (EMU->loaderwork)
+#define sndifwork (EMU->sndifwork)
+#define statework (EMU->statework)
 
 static void load_term(void)
 {
@@ -241,7 +283,7 @@ static int load_psfcb(void *pWork, const char *pNameTop, const char *pNameEnd, c
 			unsigned libsize;
 			memcpy(lib, pValueTop, l);
 			lib[l] = '\0';
-			if (!xsf_get_lib(lib, &libbuf, &libsize))
+			if (!xsf_get_lib(loaderwork.libdir, lib, &libbuf, &libsize))
 			{
 				ret = xsf_tagenum_callback_returnvaluebreak;
 			}
@@ -403,20 +445,7 @@ void gdb_stub_fix(armcpu_t *armcpu)
 {
 	/* armcpu->R[15] = armcpu->instruct_adr; */
 	armcpu->next_instruction = armcpu->instruct_adr;
-	if(armcpu->CPSR.bits.T == 0)
-	{
-		armcpu->instruction = MMU_read32_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
-		armcpu->instruct_adr = armcpu->next_instruction;
-		armcpu->next_instruction += 4;
-		armcpu->R[15] = armcpu->next_instruction + 4;
-	}
-	else
-	{
-		armcpu->instruction = MMU_read16_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
-		armcpu->instruct_adr = armcpu->next_instruction;
-		armcpu->next_instruction += 2;
-		armcpu->R[15] = armcpu->next_instruction + 2;
-	}
+	armcpu_prefetch(armcpu);
 }
 
 static void load_setstate(void)
@@ -537,6 +566,8 @@ static void load_setstate(void)
 	/* Read in shared memory */
 	load_getu8 (MMU.SWIRAM, 0x8000);
 
+	armcpu_flush_code();
+
 #ifdef GDB_STUB
 #else
 	gdb_stub_fix(&NDS_ARM9);
@@ -544,20 +575,6 @@ static void load_setstate(void)
 #endif
 }
 
-static struct
-{
-	unsigned char *pcmbufalloc;
-	unsigned char *pcmbuftop;
-	unsigned filled;
-	unsigned used;
-	u32 bufferbytes;
-	u32 cycles;
-	int xfs_load;
-	int sync_type;
-	int arm7_clockdown_level;
-	int arm9_clockdown_level;
-} sndifwork = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
 static void SNDIFDeInit(void)
 {
 	if (sndifwork.pcmbufalloc)
@@ -628,10 +645,150 @@ static struct armcpu_ctrl_iface *arm9_ctrl_iface = 0;
 static struct armcpu_ctrl_iface *arm7_ctrl_iface = 0;
 #endif
 
-int xsf_start(void *pfile, unsigned bytes)
+/* The emulator state is split into pages covering every block reported by
+ * NDS_StateBlocks().  Most of the emulated memory is either unused or holds
+ * sample data that never changes after loading, so a snapshot keeps only the
+ * pages that are not all zero and differ from the base snapshot taken when the
+ * track starts; the others point into the base or are NULL. */
+
+#define STATE_PAGE_SIZE 4096
+
+struct xsf_state
+{
+	u8 **pages;
+	u8 *data;
+	unsigned bytes;
+};
+
+static const u8 zero_page[STATE_PAGE_SIZE] = {0};
+
+static void state_add_block(void *user, void *ptr, u32 size)
+{
+	u8 *p = (u8 *) ptr;
+	while (size)
+	{
+		unsigned n = MIN(size, STATE_PAGE_SIZE);
+		if (statework.count == statework.alloc)
+		{
+			statework.alloc = statework.alloc ? statework.alloc * 2 : 1024;
+			statework.pages = (state_page *) realloc(statework.pages, statework.alloc * sizeof(state_page));
+		}
+		statework.pages[statework.count].ptr = p;
+		statework.pages[statework.count].size = n;
+		statework.count++;
+		p += n;
+		size -= n;
+	}
+}
+
+static xsf_state *state_save(const xsf_state *base)
+{
+	/* page is stored in the snapshot itself; fixed up after allocation */
+	u8 *const own = (u8 *) zero_page;
+	unsigned own_bytes = 0;
+	unsigned i;
+
+	xsf_state *state = (xsf_state *) malloc(sizeof(xsf_state));
+	state->pages = (u8 **) malloc(statework.count * sizeof(u8 *));
+
+	for (i = 0; i < statework.count; i++)
+	{
+		state_page *page = &statework.pages[i];
+		if (base && base->pages[i] && !memcmp(page->ptr, base->pages[i], page->size))
+			state->pages[i] = base->pages[i];
+		else if (!memcmp(page->ptr, zero_page, page->size))
+			state->pages[i] = 0;
+		else
+		{
+			state->pages[i] = own;
+			own_bytes += page->size;
+		}
+	}
+
+	state->data = (u8 *) malloc(own_bytes);
+	state->bytes = sizeof(xsf_state) + statework.count * sizeof(u8 *) + own_bytes;
+
+	u8 *p = state->data;
+	for (i = 0; i < statework.count; i++)
+	{
+		if (state->pages[i] == own)
+		{
+			memcpy(p, statework.pages[i].ptr, statework.pages[i].size);
+			state->pages[i] = p;
+			p += statework.pages[i].size;
+		}
+	}
+
+	return state;
+}
+
+static void state_init(void)
+{
+	NDS_StateBlocks(state_add_block, 0);
+	state_add_block(0, &sndifwork, sizeof sndifwork);
+	state_add_block(0, sndifwork.pcmbuftop, sndifwork.bufferbytes);
+	statework.base = state_save(0);
+}
+
+static void state_term(void)
+{
+	xsf_free_state(statework.base);
+	free(statework.pages);
+	statework.pages = 0;
+	statework.count = statework.alloc = 0;
+	statework.base = 0;
+}
+
+xsf_state *xsf_save_state(xsf_emu *emu)
+{
+	NDS_current = &emu->core;
+	if (!statework.base)
+		return 0;
+	return state_save(statework.base);
+}
+
+void xsf_load_state(xsf_emu *emu, const xsf_state *state)
+{
+	unsigned i;
+	NDS_current = &emu->core;
+	for (i = 0; i < statework.count; i++)
+	{
+		state_page *page = &statework.pages[i];
+		if (state->pages[i])
+			memcpy(page->ptr, state->pages[i], page->size);
+		else
+			memset(page->ptr, 0, page->size);
+	}
+
+	armcpu_flush_code();
+}
+
+void xsf_free_state(xsf_state *state)
+{
+	if (!state)
+		return;
+	free(state->pages);
+	free(state->data);
+	free(state);
+}
+
+unsigned xsf_state_bytes(const xsf_state *state)
+{
+	return state->bytes;
+}
+
+xsf_emu *xsf_start(void *pfile, unsigned bytes, const char *libdir)
 {
 	int frames = xsf_tagget_int("_frames", (unsigned char *) pfile, bytes, -1);
 	int clockdown = xsf_tagget_int("_clockdown", (unsigned char *) pfile, bytes, 0);
+
+	/* mostly emulated memory, which is only touched where it gets used */
+	xsf_emu *emu = (xsf_emu *) calloc(1, sizeof(xsf_emu));
+	if (!emu)
+		return 0;
+
+	NDS_current = &emu->core;
+	loaderwork.libdir = libdir;
 	sndifwork.sync_type = xsf_tagget_int("_vio2sf_sync_type", (unsigned char *) pfile, bytes, 0);
 	sndifwork.arm9_clockdown_level = xsf_tagget_int("_vio2sf_arm9_clockdown_level", (unsigned char *) pfile, bytes, clockdown);
 	sndifwork.arm7_clockdown_level = xsf_tagget_int("_vio2sf_arm7_clockdown_level", (unsigned char *) pfile, bytes, clockdown);
@@ -639,7 +796,10 @@ int xsf_start(void *pfile, unsigned bytes)
 	sndifwork.xfs_load = 0;
 	printf("load_psf... ");
 	if (!load_psf(pfile, bytes))
-		return XSF_FALSE;
+	{
+		xsf_term(emu);
+		return 0;
+	}
 	printf("ok!\n");
 
 #ifdef GDB_STUB
@@ -647,7 +807,10 @@ int xsf_start(void *pfile, unsigned bytes)
 #else
 	if (NDS_Init())
 #endif
-		return XSF_FALSE;
+	{
+		xsf_term(emu);
+		return 0;
+	}
 
 	SPU_ChangeSoundCore(VIO2SFSNDIFID, 737);
 
@@ -755,13 +918,16 @@ int xsf_start(void *pfile, unsigned bytes)
 	}
 	execute = TRUE;
 	sndifwork.xfs_load = 1;
-	return XSF_TRUE;
+	loaderwork.libdir = 0;
+	state_init();
+	return emu;
 }
 
-int xsf_gen(void *pbuffer, unsigned samples)
+int xsf_gen(xsf_emu *emu, void *pbuffer, unsigned samples)
 {
 	unsigned char *ptr = (unsigned char *) pbuffer;
 	unsigned bytes = samples <<= 2;
+	NDS_current = &emu->core;
 	if (!sndifwork.xfs_load) return 0;
 	while (bytes)
 	{
@@ -833,9 +999,13 @@ int xsf_gen(void *pbuffer, unsigned samples)
 	return ptr - (unsigned char *)pbuffer;
 }
 
-void xsf_term(void)
+void xsf_term(xsf_emu *emu)
 {
+	NDS_current = &emu->core;
+	state_term();
 	MMU_unsetRom();
 	NDS_DeInit();
 	load_term();
+	NDS_current = 0;
+	free(emu);
 }
@@ -1,7 +1,23 @@
 #define XSF_FALSE (0)
 #define XSF_TRUE (!XSF_FALSE)
 
-int xsf_start(void *pfile, unsigned bytes);
-int xsf_gen(void *pbuffer, unsigned samples);
-int xsf_get_lib(char *pfilename, void **ppbuffer, unsigned int *plength);
-void xsf_term(void);
+/* Each running track has an emulator of its own, between xsf_start() and
+ * xsf_term().  Any number of them can run at once, but each one in only one
+ * thread at a time. */
+typedef struct xsf_emu xsf_emu;
+
+xsf_emu *xsf_start(void *pfile, unsigned bytes, const char *libdir);
+int xsf_gen(xsf_emu *emu, void *pbuffer, unsigned samples);
+void xsf_term(xsf_emu *emu);
+
+/* Supplied by the player: loads a library named by the track, from libdir. */
+int xsf_get_lib(const char *libdir, char *pfilename, void **ppbuffer, unsigned int *plength);
+
+/* Snapshots of the running emulator, for seeking.  They only remain valid
+ * until xsf_term(), and must all be freed before calling it. */
+typedef struct xsf_state xsf_state;
+
+xsf_state *xsf_save_state(xsf_emu *emu);
+void xsf_load_state(xsf_emu *emu, const xsf_state *state);
+void xsf_free_state(xsf_state *state);
+unsigned xsf_state_bytes(const xsf_state *state);
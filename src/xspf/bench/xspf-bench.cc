@@ -0,0 +1,263 @@
+/*
+ * Audacious: A cross-platform multimedia player
+ * Copyright (c) 2006 William Pitcock, Tony Vroon, George Averill,
+ *                    Giacomo Lozito, Derek Pomery, Yoshiki Yazawa
+ *                    and Matti Hämäläinen.
+ * Copyright (c) 2011 John Lindgren
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Benchmark for very large playlists.  A playlist of generated tracks (500,000
+ * by default) is saved with xspf_playlist_save() and loaded back with
+ * xspf_playlist_load().  Each step prints its wall time and the most heap
+ * memory it had in use at once, and every loaded track is checked against the
+ * generated one.  If a file name is given, the playlist is left there (it can
+ * be opened in Audacious); otherwise a temporary file is used.
+ *
+ * usage: xspf-bench [tracks] [file.xspf] */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <glib/gstdio.h>
+
+#include <libaudcore/runtime.h>
+
+/* the load and save functions are static */
+#include "../xspf.cc"
+
+/* heap use is tracked by wrapping the C library allocator */
+#ifdef __GLIBC__
+extern "C" {
+void * __libc_malloc (size_t size);
+void * __libc_calloc (size_t n, size_t size);
+void * __libc_realloc (void * ptr, size_t size);
+void __libc_free (void * ptr);
+}
+
+static size_t heap_used, heap_peak;
+
+static void heap_add (void * ptr)
+{
+    heap_used += malloc_usable_size (ptr);
+    heap_peak = MAX (heap_peak, heap_used);
+}
+
+extern "C" void * malloc (size_t size)
+{
+    void * ptr = __libc_malloc (size);
+    if (ptr)
+        heap_add (ptr);
+    return ptr;
+}
+
+extern "C" void * calloc (size_t n, size_t size)
+{
+    void * ptr = __libc_calloc (n, size);
+    if (ptr)
+        heap_add (ptr);
+    return ptr;
+}
+
+extern "C" void * realloc (void * ptr, size_t size)
+{
+    size_t old = ptr ? malloc_usable_size (ptr) : 0;
+    void * new_ptr = __libc_realloc (ptr, size);
+
+    if (new_ptr)
+    {
+        heap_used -= old;
+        heap_add (new_ptr);
+    }
+    else if (! size)
+        heap_used -= old;
+
+    return new_ptr;
+}
+
+extern "C" void free (void * ptr)
+{
+    if (ptr)
+        heap_used -= malloc_usable_size (ptr);
+    __libc_free (ptr);
+}
+#else
+static size_t heap_used, heap_peak;
+#endif
+
+#define MB(bytes) ((bytes) / 1048576.0)
+
+static double now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a library of 50 tracks per album and 20 albums per artist, with a few
+ * characters that have to be escaped */
+static StringBuf make_filename (int i)
+{
+    return str_printf ("file:///music/Artist%%20%d/Album%%20%d/%02d%%20Title%%20%d.flac",
+     i / 1000, i / 50, i % 50 + 1, i);
+}
+
+static Tuple make_tuple (int i)
+{
+    Tuple tuple;
+
+    tuple.set_filename (make_filename (i));
+    tuple.set_str (FIELD_ARTIST, str_printf ("Artist %d", i / 1000));
+    tuple.set_str (FIELD_ALBUM, str_printf ("Album %d", i / 50));
+    tuple.set_str (FIELD_TITLE, str_printf ("Title %d <& \"%d\">", i, i % 7));
+    tuple.set_str (FIELD_GENRE, str_printf ("Genre %d", i % 20));
+    tuple.set_int (FIELD_TRACK_NUMBER, i % 50 + 1);
+    tuple.set_int (FIELD_LENGTH, 120000 + i % 3000 * 100);
+    tuple.set_int (FIELD_YEAR, 1960 + i % 60);
+
+    return tuple;
+}
+
+static gboolean same_tuple (const Tuple & a, const Tuple & b)
+{
+    static const gint str_fields[] = {FIELD_ARTIST, FIELD_ALBUM, FIELD_TITLE, FIELD_GENRE};
+    static const gint int_fields[] = {FIELD_TRACK_NUMBER, FIELD_LENGTH, FIELD_YEAR};
+
+    for (gint field : str_fields)
+    {
+        if (g_strcmp0 (a.get_str (field), b.get_str (field)))
+            return FALSE;
+    }
+
+    for (gint field : int_fields)
+    {
+        if (a.get_int (field) != b.get_int (field))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+int main (int argc, char * * argv)
+{
+    gint tracks = (argc > 1) ? atoi (argv[1]) : 500000;
+
+    if (tracks < 1 || argc > 3)
+    {
+        fprintf (stderr, "usage: %s [tracks] [file.xspf]\n", argv[0]);
+        return 1;
+    }
+
+    gchar * path = (argc > 2) ? g_strdup (argv[2]) :
+     g_build_filename (g_get_tmp_dir (), "xspf-bench.xspf", NULL);
+    gchar * uri = g_filename_to_uri (path, NULL, NULL);
+
+    xspf_init ();
+
+    Index<PlaylistAddItem> items;
+
+    for (gint i = 0; i < tracks; i ++)
+        items.append ({String (make_filename (i)), make_tuple (i)});
+
+    /* save */
+    VFSFile * file = vfs_fopen (uri, "w");
+    if (! file)
+    {
+        fprintf (stderr, "cannot open %s\n", path);
+        return 1;
+    }
+
+    size_t start_heap = heap_used;
+    heap_peak = heap_used;
+    double start = now ();
+
+    gboolean saved = xspf_playlist_save (uri, file, "Benchmark", items);
+
+    double elapsed = now () - start;
+    vfs_fclose (file);
+
+    if (! saved)
+    {
+        fprintf (stderr, "cannot save %s\n", path);
+        return 1;
+    }
+
+    GStatBuf st;
+    g_stat (path, & st);
+
+    printf ("%d tracks, %.1f MB of XSPF\n\n", tracks, MB ((double) st.st_size));
+    printf ("save  %6.2f s  %8.0f tracks/s  peak heap +%6.1f MB\n", elapsed,
+     tracks / elapsed, MB ((double) (heap_peak - start_heap)));
+
+    /* the saved items are not needed any more */
+    items.clear ();
+
+    /* load */
+    file = vfs_fopen (uri, "r");
+    if (! file)
+    {
+        fprintf (stderr, "cannot open %s\n", path);
+        return 1;
+    }
+
+    String title;
+    Index<PlaylistAddItem> loaded;
+
+    start_heap = heap_used;
+    heap_peak = heap_used;
+    start = now ();
+
+    gboolean ok = xspf_playlist_load (uri, file, title, loaded);
+
+    elapsed = now () - start;
+    vfs_fclose (file);
+
+    printf ("load  %6.2f s  %8.0f tracks/s  peak heap +%6.1f MB  (%.1f MB kept)\n",
+     elapsed, tracks / elapsed, MB ((double) (heap_peak - start_heap)),
+     MB ((double) (heap_used - start_heap)));
+
+    /* check */
+    gint failures = 0;
+
+    if (! ok || g_strcmp0 (title, "Benchmark") || loaded.len () != tracks)
+    {
+        printf ("\nloaded %d tracks, expected %d\n", loaded.len (), tracks);
+        failures ++;
+    }
+    else
+    {
+        for (gint i = 0; i < tracks; i ++)
+        {
+            if (strcmp (loaded[i].filename, make_filename (i)) ||
+             ! same_tuple (loaded[i].tuple, make_tuple (i)))
+            {
+                if (! failures)
+                    printf ("\ntrack %d differs after loading\n", i);
+                failures ++;
+            }
+        }
+    }
+
+    if (argc < 3)
+        g_unlink (path);
+
+    g_free (uri);
+    g_free (path);
+
+    return failures ? 1 : 0;
+}
@@ -23,13 +23,8 @@
 #include <glib.h>
 #include <string.h>
 
-#include <libxml/tree.h>
-#include <libxml/parser.h>
 #include <libxml/xmlreader.h>
-#include <libxml/xmlsave.h>
-#include <libxml/xpath.h>
-#include <libxml/xpathInternals.h>
-#include <libxml/uri.h>
+#include <libxml/xmlwriter.h>
 
 #include <libaudcore/i18n.h>
 #include <libaudcore/plugin.h>
@@ -81,98 +76,145 @@ static const xspf_entry_t xspf_entries[] = {
     { FIELD_GAIN_PEAK_UNIT, "gain-peak-unit", TUPLE_INT,  TRUE},
 };
 
-static void xspf_add_file (xmlNode * track, const gchar * filename,
- const gchar * base, Index<PlaylistAddItem> & items)
+/* Field names are looked up in a perfect hash table, built at startup by
+ * picking the smallest table size at which the names do not collide. */
+#define XSPF_NO_ENTRY 0xff
+
+static guchar xspf_table[256];
+static guint xspf_table_size;
+
+static gboolean xspf_init (void)
 {
-    xmlNode *nptr;
-    String location;
-    Tuple tuple;
+    for (guint size = ARRAY_LEN (xspf_entries); size <= ARRAY_LEN (xspf_table); size ++)
+    {
+        memset (xspf_table, XSPF_NO_ENTRY, sizeof xspf_table);
 
-    for (nptr = track->children; nptr != NULL; nptr = nptr->next) {
-        if (nptr->type == XML_ELEMENT_NODE) {
-            if (!xmlStrcmp(nptr->name, (xmlChar *)"location")) {
-                /* Location is a special case */
-                gchar *str = (gchar *)xmlNodeGetContent(nptr);
-
-                if (strstr (str, "://") != NULL)
-                    location = String (str);
-                else if (str[0] == '/' && base != NULL)
-                {
-                    const gchar * colon = strstr (base, "://");
-
-                    if (colon != NULL)
-                        location = String (str_printf ("%.*s%s",
-                         (int) (colon + 3 - base), base, str));
-                }
-                else if (base != NULL)
-                {
-                    const gchar * slash = strrchr (base, '/');
-
-                    if (slash != NULL)
-                        location = String (str_printf ("%.*s%s",
-                         (int) (slash + 1 - base), base, str));
-                }
-
-                xmlFree(str);
-            } else {
-                /* Rest of the nodes are handled here */
-                gint i;
-                gboolean isMeta;
-                xmlChar *findName;
-
-                if (!xmlStrcmp(nptr->name, (xmlChar *)"meta")) {
-                    isMeta = TRUE;
-                    findName = xmlGetProp(nptr, (xmlChar *)"rel");
-                } else {
-                    isMeta = FALSE;
-                    findName = xmlStrdup(nptr->name);
-                }
-
-                for (i = 0; i < ARRAY_LEN (xspf_entries); i++)
-                if ((xspf_entries[i].isMeta == isMeta) &&
-                    !xmlStrcmp(findName, (xmlChar *)xspf_entries[i].xspfName)) {
-                    xmlChar *str = xmlNodeGetContent(nptr);
-                    switch (xspf_entries[i].type) {
-                        case TUPLE_STRING:
-                            tuple.set_str (xspf_entries[i].tupleField, (gchar *)str);
-                            break;
-
-                        case TUPLE_INT:
-                            tuple.set_int (xspf_entries[i].tupleField, atol((char *)str));
-                            break;
-
-                        default:
-                            break;
-                    }
-                    xmlFree(str);
-                    break;
-                }
+        gint i;
+        for (i = 0; i < ARRAY_LEN (xspf_entries); i ++)
+        {
+            guint hash = g_str_hash (xspf_entries[i].xspfName) % size;
+            if (xspf_table[hash] != XSPF_NO_ENTRY)
+                break;
 
-                xmlFree(findName);
-            }
+            xspf_table[hash] = i;
+        }
+
+        if (i == ARRAY_LEN (xspf_entries))
+        {
+            xspf_table_size = size;
+            return TRUE;
         }
     }
 
-    if (location != NULL)
+    /* fall back to a linear search */
+    xspf_table_size = 0;
+    return TRUE;
+}
+
+static const xspf_entry_t * xspf_find_entry (const gchar * name)
+{
+    if (! xspf_table_size)
     {
-        if (tuple)
-            tuple.set_filename (location);
+        for (gint i = 0; i < ARRAY_LEN (xspf_entries); i ++)
+        {
+            if (! strcmp (name, xspf_entries[i].xspfName))
+                return & xspf_entries[i];
+        }
 
-        items.append ({location, std::move (tuple)});
+        return NULL;
     }
+
+    gint i = xspf_table[g_str_hash (name) % xspf_table_size];
+    if (i == XSPF_NO_ENTRY || strcmp (name, xspf_entries[i].xspfName))
+        return NULL;
+
+    return & xspf_entries[i];
 }
 
+/* handles one child element of <track>; the reader is positioned on it */
+static void xspf_read_field (xmlTextReader * reader, const gchar * name,
+ const gchar * base, String & location, Tuple & tuple)
+{
+    if (! strcmp (name, "location")) {
+        /* Location is a special case */
+        gchar *str = (gchar *)xmlTextReaderReadString(reader);
+        if (! str)
+            return;
+
+        if (strstr (str, "://") != NULL)
+            location = String (str);
+        else if (str[0] == '/' && base != NULL)
+        {
+            const gchar * colon = strstr (base, "://");
 
-static void xspf_find_track (xmlNode * tracklist, const gchar * filename,
- const gchar * base, Index<PlaylistAddItem> & items)
+            if (colon != NULL)
+                location = String (str_printf ("%.*s%s",
+                 (int) (colon + 3 - base), base, str));
+        }
+        else if (base != NULL)
+        {
+            const gchar * slash = strrchr (base, '/');
+
+            if (slash != NULL)
+                location = String (str_printf ("%.*s%s",
+                 (int) (slash + 1 - base), base, str));
+        }
+
+        xmlFree(str);
+    } else {
+        /* Rest of the nodes are handled here */
+        const xspf_entry_t *entry;
+        gboolean isMeta;
+
+        if (!strcmp(name, "meta")) {
+            isMeta = TRUE;
+            xmlChar *rel = xmlTextReaderGetAttribute(reader, (xmlChar *)"rel");
+            if (! rel)
+                return;
+
+            entry = xspf_find_entry((gchar *)rel);
+            xmlFree(rel);
+        } else {
+            isMeta = FALSE;
+            entry = xspf_find_entry(name);
+        }
+
+        if (! entry || entry->isMeta != isMeta)
+            return;
+
+        xmlChar *str = xmlTextReaderReadString(reader);
+        const gchar *value = str ? (gchar *)str : "";
+
+        switch (entry->type) {
+            case TUPLE_STRING:
+                tuple.set_str (entry->tupleField, value);
+                break;
+
+            case TUPLE_INT:
+                tuple.set_int (entry->tupleField, atol(value));
+                break;
+
+            default:
+                break;
+        }
+
+        xmlFree(str);
+    }
+}
+
+static void xspf_add_file (String & location, Tuple & tuple,
+ Index<PlaylistAddItem> & items)
 {
-    xmlNode *nptr;
+    if (location != NULL)
+    {
+        if (tuple)
+            tuple.set_filename (location);
 
-    for (nptr = tracklist->children; nptr != NULL; nptr = nptr->next) {
-        if (nptr->type == XML_ELEMENT_NODE &&
-         ! xmlStrcmp (nptr->name, (xmlChar *) "track"))
-            xspf_add_file (nptr, filename, base, items);
+        items.append ({std::move (location), std::move (tuple)});
     }
+
+    location = String ();
+    tuple = Tuple ();
 }
 
 static gint read_cb (void * file, gchar * buf, gint len)
@@ -190,45 +232,84 @@ static gint close_cb (void * file)
     return 0;
 }
 
+/* The playlist is read as a stream, so that only the current element is held
+ * in memory; the structure is playlist > trackList > track > field. */
 static gboolean xspf_playlist_load (const gchar * filename, VFSFile * file,
  String & title, Index<PlaylistAddItem> & items)
 {
-    xmlDoc * doc = xmlReadIO (read_cb, close_cb, file, filename, NULL,
-     XML_PARSE_RECOVER);
-    if (! doc)
+    xmlTextReader * reader = xmlReaderForIO (read_cb, close_cb, file, filename,
+     NULL, XML_PARSE_RECOVER);
+    if (! reader)
         return FALSE;
 
-    xmlNode *nptr, *nptr2;
+    gchar * base = NULL;
+    gboolean in_playlist = FALSE, in_tracklist = FALSE, in_track = FALSE;
+    String location;
+    Tuple tuple;
+
+    while (xmlTextReaderRead (reader) == 1)
+    {
+        gint type = xmlTextReaderNodeType (reader);
+        gint depth = xmlTextReaderDepth (reader);
+
+        if (type == XML_READER_TYPE_END_ELEMENT)
+        {
+            if (depth == 2 && in_track)
+            {
+                xspf_add_file (location, tuple, items);
+                in_track = FALSE;
+            }
+
+            continue;
+        }
+
+        if (type != XML_READER_TYPE_ELEMENT)
+            continue;
+
+        const gchar * name = (const gchar *) xmlTextReaderConstLocalName (reader);
 
-    // find trackList
-    for (nptr = doc->children; nptr != NULL; nptr = nptr->next) {
-        if (nptr->type == XML_ELEMENT_NODE &&
-            !xmlStrcmp(nptr->name, (xmlChar *)"playlist")) {
-            gchar * base;
+        switch (depth)
+        {
+        case 0:
+            in_playlist = ! strcmp (name, XSPF_ROOT_NODE_NAME);
+
+            if (in_playlist && ! base)
+                base = (gchar *) xmlTextReaderBaseUri (reader);
+
+            break;
 
-            base = (gchar *)xmlNodeGetBase(doc, nptr);
+        case 1:
+            in_tracklist = in_playlist && ! strcmp (name, "trackList");
 
-            for (nptr2 = nptr->children; nptr2; nptr2 = nptr2->next)
+            if (in_playlist && ! strcmp (name, "title"))
             {
-                if (nptr2->type != XML_ELEMENT_NODE)
-                    continue;
-
-                if (! xmlStrcmp (nptr2->name, (xmlChar *) "title"))
-                {
-                    xmlChar * xml_title = xmlNodeGetContent (nptr2);
-                    if (xml_title && xml_title[0])
-                        title = String ((gchar *) xml_title);
-                    xmlFree (xml_title);
-                }
-                else if (! xmlStrcmp (nptr2->name, (xmlChar *) "trackList"))
-                    xspf_find_track (nptr2, filename, base, items);
+                xmlChar * xml_title = xmlTextReaderReadString (reader);
+                if (xml_title && xml_title[0])
+                    title = String ((gchar *) xml_title);
+                xmlFree (xml_title);
             }
 
-            xmlFree (base);
+            break;
+
+        case 2:
+            in_track = in_tracklist && ! strcmp (name, "track");
+
+            /* <track/> has no end element */
+            if (in_track && xmlTextReaderIsEmptyElement (reader))
+                in_track = FALSE;
+
+            break;
+
+        case 3:
+            if (in_track)
+                xspf_read_field (reader, name, base, location, tuple);
+
+            break;
         }
     }
 
-    xmlFreeDoc(doc);
+    xmlFree (base);
+    xmlFreeTextReader (reader);
     return TRUE;
 }
 
@@ -298,125 +379,135 @@ static gboolean is_valid_string (const gchar * s, gchar * * subst)
 }
 
 
-static void xspf_add_node(xmlNodePtr node, TupleValueType type,
-        gboolean isMeta, const gchar *xspfName, const gchar *strVal,
-        const gint intVal)
+static gboolean xspf_write_field (xmlTextWriter * writer, TupleValueType type,
+ gboolean isMeta, const gchar * xspfName, const gchar * strVal, const gint intVal)
 {
-    xmlNodePtr tmp;
-
     if (isMeta) {
-        tmp = xmlNewNode(NULL, (xmlChar *) "meta");
-        xmlSetProp(tmp, (xmlChar *) "rel", (xmlChar *) xspfName);
-    } else
-        tmp = xmlNewNode(NULL, (xmlChar *) xspfName);
+        if (xmlTextWriterStartElement (writer, (xmlChar *) "meta") < 0 ||
+         xmlTextWriterWriteAttribute (writer, (xmlChar *) "rel", (xmlChar *) xspfName) < 0)
+            return FALSE;
+    } else if (xmlTextWriterStartElement (writer, (xmlChar *) xspfName) < 0)
+        return FALSE;
+
+    gint ret = 0;
 
     switch (type) {
         case TUPLE_STRING:;
             gchar * subst;
             if (is_valid_string (strVal, & subst))
-                xmlAddChild (tmp, xmlNewText ((xmlChar *) strVal));
+                ret = xmlTextWriterWriteString (writer, (xmlChar *) strVal);
             else
             {
-                xmlAddChild (tmp, xmlNewText ((xmlChar *) subst));
+                ret = xmlTextWriterWriteString (writer, (xmlChar *) subst);
                 g_free (subst);
             }
             break;
 
         case TUPLE_INT:
-            xmlAddChild (tmp, xmlNewText ((xmlChar *) (char *) int_to_str (intVal)));
+            ret = xmlTextWriterWriteString (writer, (xmlChar *) (char *) int_to_str (intVal));
             break;
 
         default:
             break;
     }
 
-    xmlAddChild(node, tmp);
+    return ret >= 0 && xmlTextWriterEndElement (writer) >= 0;
 }
 
 
-static gboolean xspf_playlist_save (const gchar * filename, VFSFile * file,
- const gchar * title, const Index<PlaylistAddItem> & items)
+static gboolean xspf_write_track (xmlTextWriter * writer, const PlaylistAddItem & item)
 {
-    xmlDocPtr doc;
-    xmlNodePtr rootnode, tracklist;
+    const Tuple & tuple = item.tuple;
 
-    doc = xmlNewDoc((xmlChar *)"1.0");
-    doc->charset = XML_CHAR_ENCODING_UTF8;
-    doc->encoding = xmlStrdup((xmlChar *)"UTF-8");
+    if (xmlTextWriterStartElement (writer, (xmlChar *) "track") < 0 ||
+     xmlTextWriterWriteElement (writer, (xmlChar *) "location", (xmlChar *) (const char *) item.filename) < 0)
+        return FALSE;
 
-    rootnode = xmlNewNode(NULL, (xmlChar *)XSPF_ROOT_NODE_NAME);
-    xmlSetProp(rootnode, (xmlChar *)"version", (xmlChar *)"1");
-    xmlSetProp(rootnode, (xmlChar *)"xmlns", (xmlChar *)XSPF_XMLNS);
+    if (tuple)
+    {
+        for (gint i = 0; i < ARRAY_LEN (xspf_entries); i++) {
+            const xspf_entry_t *xs = &xspf_entries[i];
+            gboolean isOK = (tuple.get_value_type (xs->tupleField) == xs->type);
+            String scratch;
+            gint scratchi = 0;
+
+            switch (xs->type) {
+                case TUPLE_STRING:
+                    scratch = tuple.get_str (xs->tupleField);
+                    if (! scratch)
+                        isOK = FALSE;
+                    break;
+                case TUPLE_INT:
+                    scratchi = tuple.get_int (xs->tupleField);
+                    break;
+                default:
+                    break;
+            }
 
-    /* common */
-    xmlDocSetRootElement(doc, rootnode);
+            if (isOK && ! xspf_write_field (writer, xs->type, xs->isMeta,
+             xs->xspfName, scratch, scratchi))
+                return FALSE;
+        }
+    }
 
-    if (title)
-        xspf_add_node (rootnode, TUPLE_STRING, FALSE, "title", title, 0);
+    return xmlTextWriterEndElement (writer) >= 0;
+}
 
-    tracklist = xmlNewNode(NULL, (xmlChar *)"trackList");
-    xmlAddChild(rootnode, tracklist);
 
-    for (auto & item : items)
+/* Tracks are written out as they are formatted, without building a tree */
+static gboolean xspf_playlist_save (const gchar * filename, VFSFile * file,
+ const gchar * title, const Index<PlaylistAddItem> & items)
+{
+    xmlOutputBuffer * out = xmlOutputBufferCreateIO (write_cb, close_cb, file, NULL);
+    if (! out)
+        return FALSE;
+
+    /* the writer takes ownership of the buffer */
+    xmlTextWriter * writer = xmlNewTextWriter (out);
+    if (! writer)
     {
-        const char * filename = item.filename;
-        const Tuple & tuple = item.tuple;
-        xmlNodePtr track, location;
-        String scratch;
-        gint scratchi = 0;
+        xmlOutputBufferClose (out);
+        return FALSE;
+    }
 
-        track = xmlNewNode(NULL, (xmlChar *)"track");
-        location = xmlNewNode(NULL, (xmlChar *)"location");
+    gboolean success = FALSE;
 
-        xmlAddChild(location, xmlNewText((xmlChar *)filename));
-        xmlAddChild(track, location);
-        xmlAddChild(tracklist, track);
+    xmlTextWriterSetIndent (writer, 1);
+    xmlTextWriterSetIndentString (writer, (xmlChar *) "  ");
 
-        if (tuple)
-        {
-            gint i;
-            for (i = 0; i < ARRAY_LEN (xspf_entries); i++) {
-                const xspf_entry_t *xs = &xspf_entries[i];
-                gboolean isOK = (tuple.get_value_type (xs->tupleField) == xs->type);
-
-                switch (xs->type) {
-                    case TUPLE_STRING:
-                        scratch = tuple.get_str (xs->tupleField);
-                        if (! scratch)
-                            isOK = FALSE;
-                        break;
-                    case TUPLE_INT:
-                        scratchi = tuple.get_int (xs->tupleField);
-                        break;
-                    default:
-                        break;
-                }
-
-                if (isOK)
-                    xspf_add_node(track, xs->type, xs->isMeta, xs->xspfName, scratch, scratchi);
-            }
-        }
-    }
+    if (xmlTextWriterStartDocument (writer, "1.0", "UTF-8", NULL) < 0 ||
+     xmlTextWriterStartElement (writer, (xmlChar *) XSPF_ROOT_NODE_NAME) < 0 ||
+     xmlTextWriterWriteAttribute (writer, (xmlChar *) "version", (xmlChar *) "1") < 0 ||
+     xmlTextWriterWriteAttribute (writer, (xmlChar *) "xmlns", (xmlChar *) XSPF_XMLNS) < 0)
+        goto ERR;
 
-    xmlSaveCtxt * save = xmlSaveToIO (write_cb, close_cb, file, NULL,
-     XML_SAVE_FORMAT);
-    if (! save)
+    if (title && ! xspf_write_field (writer, TUPLE_STRING, FALSE, "title", title, 0))
         goto ERR;
 
-    if (xmlSaveDoc (save, doc) < 0 || xmlSaveClose (save) < 0)
+    if (xmlTextWriterStartElement (writer, (xmlChar *) "trackList") < 0)
         goto ERR;
 
-    xmlFreeDoc(doc);
-    return TRUE;
+    for (auto & item : items)
+    {
+        if (! xspf_write_track (writer, item))
+            goto ERR;
+    }
+
+    /* closes the open elements and flushes the output */
+    if (xmlTextWriterEndDocument (writer) < 0)
+        goto ERR;
+
+    success = TRUE;
 
 ERR:
-    xmlFreeDoc (doc);
-    return FALSE;
+    xmlFreeTextWriter (writer);
+    return success;
 }
 
 static const gchar * const xspf_exts[] = {"xspf", NULL};
 
 #define AUD_PLUGIN_NAME        N_("XML Shareable Playlists (XSPF)")
+#define AUD_PLUGIN_INIT        xspf_init
 #define AUD_PLAYLIST_EXTS      xspf_exts
 #define AUD_PLAYLIST_LOAD      xspf_playlist_load
 #define AUD_PLAYLIST_SAVE      xspf_playlist_save